@@ -0,0 +1,562 @@
+/*******************************************
+	Animation.cpp
+
+	Compressed animation clips
+********************************************/
+
+#include <cmath>
+#include <algorithm>
+#include <emmintrin.h>
+using namespace std;
+
+#include "Animation.h"
+
+
+//-----------------------------------------------------------------------------
+// Quantised rotations
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// The three smallest components of a unit quaternion lie in +-1/sqrt(2), stored in 15 bits
+	const TFloat32 kPackedRange = 0.70710678f;
+	const TUInt32  kPackedMax = 0x7fff;
+	const TFloat32 kUnpackScale = 2.0f * kPackedRange / kPackedMax;
+	const TFloat32 kUnpackBias = -kPackedRange;
+
+	// The three stored components and the index of the dropped one
+	inline void UnpackComponents( const SPackedQuaternion& packed, TFloat32* pComponents, TUInt32* pLargest )
+	{
+		pComponents[0] = (packed.bits[0] >> 1) * kUnpackScale + kUnpackBias;
+		pComponents[1] = (packed.bits[1] >> 1) * kUnpackScale + kUnpackBias;
+		pComponents[2] = (packed.bits[2] >> 1) * kUnpackScale + kUnpackBias;
+		*pLargest = (packed.bits[0] & 1) | ((packed.bits[1] & 1) << 1);
+	}
+}
+
+// Pack a quaternion, which is normalised first
+SPackedQuaternion PackQuaternion( const CQuaternion& quat )
+{
+	TFloat32 components[4] = { quat.w, quat.x, quat.y, quat.z };
+	TUInt32 largest = 0;
+	for (TUInt32 i = 1; i < 4; ++i)
+	{
+		if (fabsf( components[i] ) > fabsf( components[largest] )) largest = i;
+	}
+
+	// Negate if need be so the dropped component is positive, and normalise
+	TFloat32 scale = 1.0f / sqrtf( NormSquared( quat ) );
+	if (components[largest] < 0.0f) scale = -scale;
+
+	TUInt32 quantised[3];
+	TUInt32 stored = 0;
+	for (TUInt32 i = 0; i < 4; ++i)
+	{
+		if (i == largest) continue;
+		TFloat32 unit = (components[i] * scale / kPackedRange) * 0.5f + 0.5f;
+		unit = (unit < 0.0f) ? 0.0f : (unit > 1.0f ? 1.0f : unit);
+		quantised[stored++] = static_cast<TUInt32>(floorf( unit * kPackedMax + 0.5f ));
+	}
+
+	SPackedQuaternion packed;
+	packed.bits[0] = static_cast<TUInt16>((quantised[0] << 1) | (largest & 1));
+	packed.bits[1] = static_cast<TUInt16>((quantised[1] << 1) | (largest >> 1));
+	packed.bits[2] = static_cast<TUInt16>(quantised[2] << 1);
+	return packed;
+}
+
+// Unpack a quaternion, rebuilding the dropped component from the unit length
+CQuaternion UnpackQuaternion( const SPackedQuaternion& packed )
+{
+	TFloat32 stored[3];
+	TUInt32 largest;
+	UnpackComponents( packed, stored, &largest );
+	TFloat32 remaining = 1.0f - stored[0] * stored[0] - stored[1] * stored[1] - stored[2] * stored[2];
+
+	TFloat32 components[4];
+	TUInt32 next = 0;
+	for (TUInt32 i = 0; i < 4; ++i)
+	{
+		components[i] = (i == largest) ? sqrtf( max( remaining, 0.0f ) ) : stored[next++];
+	}
+	return CQuaternion( components );
+}
+
+
+//-----------------------------------------------------------------------------
+// Key helpers
+//-----------------------------------------------------------------------------
+// Overloaded for rotation and vector keys so key reduction and the reference sampling are written once
+
+namespace
+{
+	inline const CQuaternion& KeyValue( const SMeshRotationKey& key )
+	{
+		return key.rotation;
+	}
+
+	inline const CVector3& KeyValue( const SMeshVectorKey& key )
+	{
+		return key.value;
+	}
+
+	// Normalised lerp along the shorter arc
+	inline CQuaternion Interpolate( const CQuaternion& q0, const CQuaternion& q1, TFloat32 t )
+	{
+		CQuaternion end = (Dot( q0, q1 ) < 0.0f) ? -q1 : q1;
+		return Normalise( q0 + (end - q0) * t );
+	}
+
+	inline CVector3 Interpolate( const CVector3& v0, const CVector3& v1, TFloat32 t )
+	{
+		return v0 + (v1 - v0) * t;
+	}
+
+	// Angle in radians between the rotations of two unit quaternions. From the distance between them on the
+	// same side, 2sin(angle/4), which unlike acos of the dot product stays accurate for small angles
+	inline TFloat32 KeyError( const CQuaternion& q0, const CQuaternion& q1 )
+	{
+		CQuaternion difference = (Dot( q0, q1 ) < 0.0f) ? q0 + q1 : q0 - q1;
+		return 4.0f * asinf( min( Norm( difference ) * 0.5f, 1.0f ) );
+	}
+
+	inline TFloat32 KeyError( const CVector3& v0, const CVector3& v1 )
+	{
+		return Length( v1 - v0 );
+	}
+
+	// Interpolation parameter between two key times, 0 if the keys are at the same time
+	inline TFloat32 KeyFraction( TFloat32 time, TFloat32 time0, TFloat32 time1 )
+	{
+		if (time1 <= time0) return 0.0f;
+		TFloat32 t = (time - time0) / (time1 - time0);
+		return (t < 0.0f) ? 0.0f : (t > 1.0f ? 1.0f : t);
+	}
+
+	// Index of the last key at or before a time (0 if the time is before every key). If the time is at or
+	// past the hint then the search steps on from there, otherwise it is a binary search
+	template <class TKey> TUInt32 FindKey( const TKey* keys, TUInt32 numKeys, TFloat32 time, TUInt32 hint )
+	{
+		if (hint < numKeys && keys[hint].time <= time)
+		{
+			while (hint + 1 < numKeys && keys[hint + 1].time <= time) ++hint;
+			return hint;
+		}
+		TUInt32 low = 0, high = numKeys; // First key after the time is in [low, high]
+		while (low < high)
+		{
+			TUInt32 mid = (low + high) / 2;
+			if (keys[mid].time <= time) low = mid + 1;
+			else high = mid;
+		}
+		return (low > 0) ? low - 1 : 0;
+	}
+
+	// Value of a sorted key list at a time, holding the end keys outside them
+	template <class TKey, class TValue> void SampleKeys( const vector<TKey>& keys, TFloat32 time, TValue* pValue )
+	{
+		TUInt32 key = FindKey( &keys[0], static_cast<TUInt32>(keys.size()), time, ~0u );
+		TUInt32 next = min( key + 1, static_cast<TUInt32>(keys.size()) - 1 );
+		*pValue = Interpolate( KeyValue( keys[key] ), KeyValue( keys[next] ),
+		                       KeyFraction( time, keys[key].time, keys[next].time ) );
+	}
+
+	// Choose the keys to keep from a sorted list so that interpolating the kept keys gives every original
+	// key to within the tolerance. Greedy: each span from a kept key is extended one key at a time until a
+	// key it skips would be out of tolerance. Between keys the original is itself interpolated, so keeping
+	// the error down at the original keys keeps it down everywhere. A track that never leaves the tolerance
+	// of its first key keeps only that one
+	template <class TKey> void ReduceKeys( const vector<TKey>& keys, TFloat32 tolerance, vector<TUInt32>* pKept )
+	{
+		pKept->clear();
+		TUInt32 numKeys = static_cast<TUInt32>(keys.size());
+		if (numKeys == 0) return;
+		pKept->push_back( 0 );
+
+		bool constant = true;
+		for (TUInt32 key = 1; key < numKeys && constant; ++key)
+		{
+			constant = KeyError( KeyValue( keys[0] ), KeyValue( keys[key] ) ) <= tolerance;
+		}
+		if (constant) return;
+
+		TUInt32 start = 0;
+		for (TUInt32 end = start + 2; end < numKeys; ++end)
+		{
+			bool withinTolerance = true;
+			for (TUInt32 key = start + 1; key < end && withinTolerance; ++key)
+			{
+				TFloat32 t = KeyFraction( keys[key].time, keys[start].time, keys[end].time );
+				TFloat32 error = KeyError( Interpolate( KeyValue( keys[start] ), KeyValue( keys[end] ), t ), KeyValue( keys[key] ) );
+				withinTolerance = (error <= tolerance);
+			}
+			if (!withinTolerance)
+			{
+				start = end - 1;
+				pKept->push_back( start );
+			}
+		}
+		pKept->push_back( numKeys - 1 );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Compression
+//-----------------------------------------------------------------------------
+
+// Compress an imported animation
+void CAnimationClip::Compress( const SMeshAnimation& animation, const SMeshNode* nodes, TUInt32 numNodes,
+                               const SAnimationTolerance& tolerance /*= SAnimationTolerance()*/ )
+{
+	m_Name = animation.name;
+	m_Duration = animation.duration;
+	m_Tracks.resize( numNodes );
+	m_Rotations.clear();
+	m_Positions.clear();
+	m_Scales.clear();
+
+	// Keys of each node, if the animation has any
+	vector<const SMeshNodeAnimation*> nodeKeys( numNodes, static_cast<const SMeshNodeAnimation*>(0) );
+	for (TUInt32 anim = 0; anim < animation.nodes.size(); ++anim)
+	{
+		if (animation.nodes[anim].node < numNodes)
+		{
+			nodeKeys[animation.nodes[anim].node] = &animation.nodes[anim];
+		}
+	}
+
+	vector<TUInt32> kept;
+	for (TUInt32 node = 0; node < numNodes; ++node)
+	{
+		STrack& track = m_Tracks[node];
+		const SMeshNodeAnimation* keys = nodeKeys[node];
+		CQuatTransform defaultTransform( nodes[node].positionMatrix );
+
+		track.firstRotation = static_cast<TUInt32>(m_Rotations.size());
+		SRotationKey rotationKey;
+		if (keys && !keys->rotations.empty())
+		{
+			ReduceKeys( keys->rotations, tolerance.rotation, &kept );
+			for (TUInt32 key = 0; key < kept.size(); ++key)
+			{
+				rotationKey.time = keys->rotations[kept[key]].time;
+				rotationKey.rotation = PackQuaternion( keys->rotations[kept[key]].rotation );
+				m_Rotations.push_back( rotationKey );
+			}
+		}
+		else
+		{
+			rotationKey.time = 0.0f;
+			rotationKey.rotation = PackQuaternion( defaultTransform.quat );
+			m_Rotations.push_back( rotationKey );
+		}
+		track.numRotations = static_cast<TUInt32>(m_Rotations.size()) - track.firstRotation;
+
+		// Positions and scale are kept as floats
+		SMeshVectorKey vectorKey;
+		vectorKey.time = 0.0f;
+		track.firstPosition = static_cast<TUInt32>(m_Positions.size());
+		if (keys && !keys->positions.empty())
+		{
+			ReduceKeys( keys->positions, tolerance.position, &kept );
+			for (TUInt32 key = 0; key < kept.size(); ++key)
+			{
+				m_Positions.push_back( keys->positions[kept[key]] );
+			}
+		}
+		else
+		{
+			vectorKey.value = defaultTransform.pos;
+			m_Positions.push_back( vectorKey );
+		}
+		track.numPositions = static_cast<TUInt32>(m_Positions.size()) - track.firstPosition;
+
+		track.firstScale = static_cast<TUInt32>(m_Scales.size());
+		if (keys && !keys->scales.empty())
+		{
+			ReduceKeys( keys->scales, tolerance.scale, &kept );
+			for (TUInt32 key = 0; key < kept.size(); ++key)
+			{
+				m_Scales.push_back( keys->scales[kept[key]] );
+			}
+		}
+		else
+		{
+			vectorKey.value = defaultTransform.scale;
+			m_Scales.push_back( vectorKey );
+		}
+		track.numScales = static_cast<TUInt32>(m_Scales.size()) - track.firstScale;
+	}
+}
+
+// Bytes used by the tracks and keys
+TUInt32 CAnimationClip::GetMemoryBytes() const
+{
+	return static_cast<TUInt32>(m_Tracks.size() * sizeof(STrack) + m_Rotations.size() * sizeof(SRotationKey) +
+	                            (m_Positions.size() + m_Scales.size()) * sizeof(SMeshVectorKey));
+}
+
+
+//-----------------------------------------------------------------------------
+// Sampling
+//-----------------------------------------------------------------------------
+
+// Sample the transform of every node at a time in seconds
+void CAnimationClip::Sample( TFloat32 time, CQuatTransform* pPose, SAnimationCursor* cursor /*= 0*/,
+                             EAnimSampleMethod method /*= kAnimSampleSSE*/ ) const
+{
+	time = (time < 0.0f) ? 0.0f : (time > m_Duration ? m_Duration : time);
+
+	// Without a cursor every key is found by binary search
+	TUInt32* hints = 0;
+	if (cursor)
+	{
+		if (cursor->keys.size() != m_Tracks.size() * 3)
+		{
+			cursor->keys.assign( m_Tracks.size() * 3, 0 );
+		}
+		hints = cursor->keys.empty() ? 0 : &cursor->keys[0];
+	}
+
+	if (method == kAnimSampleScalar)
+	{
+		SampleScalar( time, pPose, hints );
+	}
+	else
+	{
+		SampleSSE( time, pPose, hints );
+	}
+}
+
+
+// Scalar sampling, the reference version
+void CAnimationClip::SampleScalar( TFloat32 time, CQuatTransform* pPose, TUInt32* cursor ) const
+{
+	for (TUInt32 node = 0; node < m_Tracks.size(); ++node)
+	{
+		const STrack& track = m_Tracks[node];
+
+		const SRotationKey* rotations = &m_Rotations[track.firstRotation];
+		TUInt32 key = FindKey( rotations, track.numRotations, time, cursor ? cursor[node * 3] : ~0u );
+		TUInt32 next = min( key + 1, track.numRotations - 1 );
+		pPose[node].quat = Interpolate( UnpackQuaternion( rotations[key].rotation ), UnpackQuaternion( rotations[next].rotation ),
+		                                KeyFraction( time, rotations[key].time, rotations[next].time ) );
+		if (cursor) cursor[node * 3] = key;
+
+		const SMeshVectorKey* positions = &m_Positions[track.firstPosition];
+		key = FindKey( positions, track.numPositions, time, cursor ? cursor[node * 3 + 1] : ~0u );
+		next = min( key + 1, track.numPositions - 1 );
+		pPose[node].pos = Interpolate( positions[key].value, positions[next].value,
+		                               KeyFraction( time, positions[key].time, positions[next].time ) );
+		if (cursor) cursor[node * 3 + 1] = key;
+
+		const SMeshVectorKey* scales = &m_Scales[track.firstScale];
+		key = FindKey( scales, track.numScales, time, cursor ? cursor[node * 3 + 2] : ~0u );
+		next = min( key + 1, track.numScales - 1 );
+		pPose[node].scale = Interpolate( scales[key].value, scales[next].value,
+		                                 KeyFraction( time, scales[key].time, scales[next].time ) );
+		if (cursor) cursor[node * 3 + 2] = key;
+	}
+}
+
+
+namespace
+{
+	// Choose between two values in each lane of an SSE register
+	inline __m128 Select( __m128 mask, __m128 ifTrue, __m128 ifFalse )
+	{
+		return _mm_or_ps( _mm_and_ps( mask, ifTrue ), _mm_andnot_ps( mask, ifFalse ) );
+	}
+
+	// Rebuild four packed quaternions, given a register for each of the three 16-bit values with a quaternion in
+	// each lane. Results are a register each for w, x, y and z
+	inline void UnpackQuaternionsSSE( __m128i packed0, __m128i packed1, __m128i packed2,
+	                                  __m128* pW, __m128* pX, __m128* pY, __m128* pZ )
+	{
+		__m128 scale = _mm_set1_ps( kUnpackScale );
+		__m128 bias = _mm_set1_ps( kUnpackBias );
+		__m128 a = _mm_add_ps( _mm_mul_ps( _mm_cvtepi32_ps( _mm_srli_epi32( packed0, 1 ) ), scale ), bias );
+		__m128 b = _mm_add_ps( _mm_mul_ps( _mm_cvtepi32_ps( _mm_srli_epi32( packed1, 1 ) ), scale ), bias );
+		__m128 c = _mm_add_ps( _mm_mul_ps( _mm_cvtepi32_ps( _mm_srli_epi32( packed2, 1 ) ), scale ), bias );
+		__m128 remaining = _mm_sub_ps( _mm_set1_ps( 1.0f ),
+		                               _mm_add_ps( _mm_add_ps( _mm_mul_ps( a, a ), _mm_mul_ps( b, b ) ), _mm_mul_ps( c, c ) ) );
+		__m128 d = _mm_sqrt_ps( _mm_max_ps( remaining, _mm_setzero_ps() ) );
+
+		// The stored components fill the other three places in order
+		__m128i one = _mm_set1_epi32( 1 );
+		__m128i largest = _mm_or_si128( _mm_and_si128( packed0, one ), _mm_slli_epi32( _mm_and_si128( packed1, one ), 1 ) );
+		__m128 is0 = _mm_castsi128_ps( _mm_cmpeq_epi32( largest, _mm_setzero_si128() ) );
+		__m128 is1 = _mm_castsi128_ps( _mm_cmpeq_epi32( largest, one ) );
+		__m128 is2 = _mm_castsi128_ps( _mm_cmpeq_epi32( largest, _mm_set1_epi32( 2 ) ) );
+		__m128 is3 = _mm_castsi128_ps( _mm_cmpeq_epi32( largest, _mm_set1_epi32( 3 ) ) );
+		*pW = Select( is0, d, a );
+		*pX = Select( is0, a, Select( is1, d, b ) );
+		*pY = Select( is2, d, Select( is3, c, b ) );
+		*pZ = Select( is3, d, c );
+	}
+
+	// Gather a value from the keys of four lanes into a register. Built from the keys in registers rather than
+	// written to an array and loaded, which would stall on store forwarding
+	template <class TKey> inline __m128 GatherTimes( const TKey* const* keys )
+	{
+		return _mm_set_ps( keys[3]->time, keys[2]->time, keys[1]->time, keys[0]->time );
+	}
+
+	inline __m128 GatherAxis( const SMeshVectorKey* const* keys, int axis )
+	{
+		return _mm_set_ps( (&keys[3]->value.x)[axis], (&keys[2]->value.x)[axis], (&keys[1]->value.x)[axis], (&keys[0]->value.x)[axis] );
+	}
+
+	// Interpolation parameters for four pairs of keys, 0 where the keys are at the same time
+	inline __m128 KeyFractionSSE( __m128 time, __m128 time0, __m128 time1 )
+	{
+		__m128 span = _mm_sub_ps( time1, time0 );
+		__m128 t = _mm_div_ps( _mm_sub_ps( time, time0 ), span );
+		t = _mm_min_ps( _mm_max_ps( t, _mm_setzero_ps() ), _mm_set1_ps( 1.0f ) );
+		return _mm_and_ps( _mm_cmpgt_ps( span, _mm_setzero_ps() ), t );
+	}
+
+	// Interpolate four pairs of values
+	inline __m128 Lerp4( __m128 v0, __m128 v1, __m128 t )
+	{
+		return _mm_add_ps( v0, _mm_mul_ps( _mm_sub_ps( v1, v0 ), t ) );
+	}
+
+	// Interpolate between the vector keys either side of a time for four lanes, result in an array per axis
+	inline void LerpVectorKeysSSE( __m128 time, const SMeshVectorKey* const* keys0, const SMeshVectorKey* const* keys1,
+	                               TFloat32 (*result)[4] )
+	{
+		__m128 t = KeyFractionSSE( time, GatherTimes( keys0 ), GatherTimes( keys1 ) );
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			_mm_storeu_ps( result[axis], Lerp4( GatherAxis( keys0, axis ), GatherAxis( keys1, axis ), t ) );
+		}
+	}
+}
+
+// SSE sampling. Keys are found node by node as in the scalar version, then the keys of four nodes are gathered
+// into registers of one component each. Unpacking, interpolation parameters and interpolation work on all four
+// nodes in each instruction. Lanes past the last node repeat it and are not written out
+void CAnimationClip::SampleSSE( TFloat32 time, CQuatTransform* pPose, TUInt32* cursor ) const
+{
+	TUInt32 numNodes = static_cast<TUInt32>(m_Tracks.size());
+	__m128 time4 = _mm_set1_ps( time );
+	for (TUInt32 first = 0; first < numNodes; first += 4)
+	{
+		// Keys either side of the time in each lane
+		const SRotationKey*   rotations[2][4];
+		const SMeshVectorKey* positions[2][4];
+		const SMeshVectorKey* scales[2][4];
+		for (TUInt32 lane = 0; lane < 4; ++lane)
+		{
+			TUInt32 node = min( first + lane, numNodes - 1 );
+			const STrack& track = m_Tracks[node];
+
+			const SRotationKey* rotationKeys = &m_Rotations[track.firstRotation];
+			TUInt32 key = FindKey( rotationKeys, track.numRotations, time, cursor ? cursor[node * 3] : ~0u );
+			rotations[0][lane] = &rotationKeys[key];
+			rotations[1][lane] = &rotationKeys[min( key + 1, track.numRotations - 1 )];
+			if (cursor) cursor[node * 3] = key;
+
+			const SMeshVectorKey* positionKeys = &m_Positions[track.firstPosition];
+			key = FindKey( positionKeys, track.numPositions, time, cursor ? cursor[node * 3 + 1] : ~0u );
+			positions[0][lane] = &positionKeys[key];
+			positions[1][lane] = &positionKeys[min( key + 1, track.numPositions - 1 )];
+			if (cursor) cursor[node * 3 + 1] = key;
+
+			const SMeshVectorKey* scaleKeys = &m_Scales[track.firstScale];
+			key = FindKey( scaleKeys, track.numScales, time, cursor ? cursor[node * 3 + 2] : ~0u );
+			scales[0][lane] = &scaleKeys[key];
+			scales[1][lane] = &scaleKeys[min( key + 1, track.numScales - 1 )];
+			if (cursor) cursor[node * 3 + 2] = key;
+		}
+
+		// Rotations - unpack both keys, flip the second onto the shorter arc, lerp and normalise
+		__m128 w[2], x[2], y[2], z[2];
+		for (int side = 0; side < 2; ++side)
+		{
+			const SRotationKey* const* keys = rotations[side];
+			UnpackQuaternionsSSE( _mm_set_epi32( keys[3]->rotation.bits[0], keys[2]->rotation.bits[0], keys[1]->rotation.bits[0], keys[0]->rotation.bits[0] ),
+			                      _mm_set_epi32( keys[3]->rotation.bits[1], keys[2]->rotation.bits[1], keys[1]->rotation.bits[1], keys[0]->rotation.bits[1] ),
+			                      _mm_set_epi32( keys[3]->rotation.bits[2], keys[2]->rotation.bits[2], keys[1]->rotation.bits[2], keys[0]->rotation.bits[2] ),
+			                      &w[side], &x[side], &y[side], &z[side] );
+		}
+		__m128 dot = _mm_add_ps( _mm_add_ps( _mm_mul_ps( w[0], w[1] ), _mm_mul_ps( x[0], x[1] ) ),
+		                         _mm_add_ps( _mm_mul_ps( y[0], y[1] ), _mm_mul_ps( z[0], z[1] ) ) );
+		__m128 flip = _mm_and_ps( _mm_cmplt_ps( dot, _mm_setzero_ps() ), _mm_set1_ps( -0.0f ) );
+		__m128 t = KeyFractionSSE( time4, GatherTimes( rotations[0] ), GatherTimes( rotations[1] ) );
+		__m128 qw = Lerp4( w[0], _mm_xor_ps( w[1], flip ), t );
+		__m128 qx = Lerp4( x[0], _mm_xor_ps( x[1], flip ), t );
+		__m128 qy = Lerp4( y[0], _mm_xor_ps( y[1], flip ), t );
+		__m128 qz = Lerp4( z[0], _mm_xor_ps( z[1], flip ), t );
+		__m128 length = _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( qw, qw ), _mm_mul_ps( qx, qx ) ),
+		                                         _mm_add_ps( _mm_mul_ps( qy, qy ), _mm_mul_ps( qz, qz ) ) ) );
+		TFloat32 quats[4][4];
+		_mm_storeu_ps( quats[0], _mm_div_ps( qw, length ) );
+		_mm_storeu_ps( quats[1], _mm_div_ps( qx, length ) );
+		_mm_storeu_ps( quats[2], _mm_div_ps( qy, length ) );
+		_mm_storeu_ps( quats[3], _mm_div_ps( qz, length ) );
+
+		TFloat32 position[3][4], scale[3][4];
+		LerpVectorKeysSSE( time4, positions[0], positions[1], position );
+		LerpVectorKeysSSE( time4, scales[0], scales[1], scale );
+
+		TUInt32 numLanes = min( 4u, numNodes - first );
+		for (TUInt32 lane = 0; lane < numLanes; ++lane)
+		{
+			CQuatTransform& transform = pPose[first + lane];
+			transform.quat = CQuaternion( quats[0][lane], quats[1][lane], quats[2][lane], quats[3][lane] );
+			transform.pos = CVector3( position[0][lane], position[1][lane], position[2][lane] );
+			transform.scale = CVector3( scale[0][lane], scale[1][lane], scale[2][lane] );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Error measurement
+//-----------------------------------------------------------------------------
+
+// Sample an uncompressed animation at a time. Nodes start from their default matrix and any keyed parts
+// are replaced
+void SampleAnimation( const SMeshAnimation& animation, const SMeshNode* nodes, TUInt32 numNodes, TFloat32 time,
+                      CQuatTransform* pPose )
+{
+	for (TUInt32 node = 0; node < numNodes; ++node)
+	{
+		pPose[node] = CQuatTransform( nodes[node].positionMatrix );
+	}
+
+	for (TUInt32 anim = 0; anim < animation.nodes.size(); ++anim)
+	{
+		const SMeshNodeAnimation& keys = animation.nodes[anim];
+		if (keys.node >= numNodes) continue;
+		if (!keys.rotations.empty()) SampleKeys( keys.rotations, time, &pPose[keys.node].quat );
+		if (!keys.positions.empty()) SampleKeys( keys.positions, time, &pPose[keys.node].pos );
+		if (!keys.scales.empty())    SampleKeys( keys.scales, time, &pPose[keys.node].scale );
+	}
+}
+
+// Compare a clip with its original animation at evenly spaced times
+SAnimationError AnimationError( const CAnimationClip& clip, const SMeshAnimation& animation, const SMeshNode* nodes,
+                                TUInt32 numSamples, EAnimSampleMethod method /*= kAnimSampleSSE*/ )
+{
+	SAnimationError error = { 0.0f, 0.0f, 0.0f };
+	TUInt32 numNodes = clip.GetNumNodes();
+	vector<CQuatTransform> original( numNodes ), compressed( numNodes );
+	SAnimationCursor cursor;
+	for (TUInt32 sample = 0; sample < numSamples; ++sample)
+	{
+		TFloat32 time = (numSamples > 1) ? clip.GetDuration() * sample / (numSamples - 1) : 0.0f;
+		SampleAnimation( animation, nodes, numNodes, time, &original[0] );
+		clip.Sample( time, &compressed[0], &cursor, method );
+		for (TUInt32 node = 0; node < numNodes; ++node)
+		{
+			error.rotation = max( error.rotation, ToDegrees( KeyError( original[node].quat, compressed[node].quat ) ) );
+			error.position = max( error.position, KeyError( original[node].pos, compressed[node].pos ) );
+			error.scale = max( error.scale, KeyError( original[node].scale, compressed[node].scale ) );
+		}
+	}
+	return error;
+}
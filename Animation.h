@@ -0,0 +1,171 @@
+/*******************************************
+	Animation.h
+
+	Compressed animation clips. The keys of an
+	imported animation are reduced to those
+	needed to stay within an error bound and
+	rotations are quantised to 48 bits. Keys
+	are stored track by track, and the pose of
+	every node is sampled in one call, four
+	nodes at a time with SSE
+********************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "Defines.h"
+#include "CQuatTransform.h"
+#include "MeshData.h"
+using namespace gen;
+
+
+//-----------------------------------------------------------------------------
+// Quantised rotations
+//-----------------------------------------------------------------------------
+
+// A unit quaternion in 48 bits, "smallest three" form. The largest component is dropped (made positive
+// by negating the quaternion, which gives the same rotation) and rebuilt from the others, which lie in
+// +-1/sqrt(2) and are stored in 15 bits each. The low bits of the first two values hold the index of the
+// dropped component. Rotation error is under 0.01 degrees
+struct SPackedQuaternion
+{
+	TUInt16 bits[3];
+};
+
+SPackedQuaternion PackQuaternion( const CQuaternion& quat );
+CQuaternion       UnpackQuaternion( const SPackedQuaternion& packed );
+
+
+//-----------------------------------------------------------------------------
+// Compression
+//-----------------------------------------------------------------------------
+
+// Error allowed when removing keys. A key is removed if interpolating the keys either side of it gives its
+// value to within these. Rotation quantisation adds its own small error on top
+struct SAnimationTolerance
+{
+	TFloat32 rotation; // Radians
+	TFloat32 position; // Model units
+	TFloat32 scale;    // Absolute, 1 is unscaled
+
+	SAnimationTolerance() : rotation( 0.001f ), position( 0.001f ), scale( 0.001f ) {}
+};
+
+// How poses are sampled. Both find the keys either side of the time for each node, then interpolate -
+// normalised lerp for rotations, lerp for position and scale
+enum EAnimSampleMethod
+{
+	kAnimSampleScalar, // One node at a time, the reference for the SSE version
+	kAnimSampleSSE,    // Keys decoded and interpolated for four nodes at once with SSE
+};
+
+// Where sampling last found the keys of each node of a clip. Sampling times that move forward a little each
+// call then find their keys in a step or two rather than a binary search. Use one for each playing instance
+struct SAnimationCursor
+{
+	vector<TUInt32> keys; // Rotation, position and scale key of each node
+};
+
+
+// An animation of a mesh hierarchy compressed for sampling. Every node has a track, with a single key
+// from the node's default matrix for anything the animation does not key. Each track's keys are together
+// in memory, rotation keys are 12 bytes (against 20 for a float quaternion and its time)
+class CAnimationClip
+{
+public:
+	CAnimationClip() : m_Duration( 0.0f ) {}
+
+	// Compress an imported animation of a hierarchy with the given nodes, replacing any current clip
+	void Compress( const SMeshAnimation& animation, const SMeshNode* nodes, TUInt32 numNodes,
+	               const SAnimationTolerance& tolerance = SAnimationTolerance() );
+
+
+	/////////////////////////////////////
+	// Data access
+
+	const string& GetName() const
+	{
+		return m_Name;
+	}
+
+	// Seconds, time of the last key
+	TFloat32 GetDuration() const
+	{
+		return m_Duration;
+	}
+
+	TUInt32 GetNumNodes() const
+	{
+		return static_cast<TUInt32>(m_Tracks.size());
+	}
+
+	// Rotation, position and scale keys kept across all tracks
+	TUInt32 GetNumKeys() const
+	{
+		return static_cast<TUInt32>(m_Rotations.size() + m_Positions.size() + m_Scales.size());
+	}
+
+	// Bytes used by the tracks and keys
+	TUInt32 GetMemoryBytes() const;
+
+
+	/////////////////////////////////////
+	// Sampling
+
+	// Sample the transform of every node at a time in seconds, clamped to the clip. Transforms are relative
+	// to the node's parent, as positionMatrix in SMeshNode. The pose must have room for GetNumNodes transforms.
+	// A cursor speeds up finding keys when sampling moves steadily through the clip - pass 0 to search afresh
+	void Sample( TFloat32 time, CQuatTransform* pPose, SAnimationCursor* cursor = 0,
+	             EAnimSampleMethod method = kAnimSampleSSE ) const;
+
+private:
+	// Rotation key with a packed quaternion
+	struct SRotationKey
+	{
+		TFloat32          time;
+		SPackedQuaternion rotation;
+	};
+
+	// Where a node's keys are in the key lists
+	struct STrack
+	{
+		TUInt32 firstRotation, numRotations;
+		TUInt32 firstPosition, numPositions;
+		TUInt32 firstScale, numScales;
+	};
+
+	void SampleScalar( TFloat32 time, CQuatTransform* pPose, TUInt32* cursor ) const;
+	void SampleSSE( TFloat32 time, CQuatTransform* pPose, TUInt32* cursor ) const;
+
+	string                 m_Name;
+	TFloat32               m_Duration;
+	vector<STrack>         m_Tracks;    // One for each node
+	vector<SRotationKey>   m_Rotations; // Keys of all tracks, in track order
+	vector<SMeshVectorKey> m_Positions;
+	vector<SMeshVectorKey> m_Scales;
+};
+
+
+//-----------------------------------------------------------------------------
+// Error measurement
+//-----------------------------------------------------------------------------
+
+// Sample an uncompressed animation at a time, interpolated in the same way as a clip. The reference for
+// measuring a clip's error. The pose must have room for numNodes transforms
+void SampleAnimation( const SMeshAnimation& animation, const SMeshNode* nodes, TUInt32 numNodes, TFloat32 time,
+                      CQuatTransform* pPose );
+
+// Largest difference between a clip and the animation it was compressed from, over every node
+struct SAnimationError
+{
+	TFloat32 rotation; // Degrees
+	TFloat32 position; // Model units
+	TFloat32 scale;
+};
+
+// Compare a clip with its original animation at numSamples evenly spaced times across the clip
+SAnimationError AnimationError( const CAnimationClip& clip, const SMeshAnimation& animation, const SMeshNode* nodes,
+                                TUInt32 numSamples, EAnimSampleMethod method = kAnimSampleSSE );
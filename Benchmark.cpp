@@ -0,0 +1,2442 @@
+/*******************************************
+	Benchmark.cpp
+
+	Automated benchmark mode
+********************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <thread>
+using namespace std;
+
+#include "Benchmark.h"
+#include "JobSystem.h"
+#include "RangeAllocator.h"
+#include "RingAllocator.h"
+#include "GBufferLayout.h"
+#include "Skinning.h"
+#include "Animation.h"
+#include "Hierarchy.h"
+#include "TextureArrays.h"
+#include "BlockCompression.h"
+#include "MipGeneration.h"
+#include "LightBaking.h"
+#include "Clock.h"
+
+
+//-----------------------------------------------------------------------------
+// Camera path
+//-----------------------------------------------------------------------------
+
+// Add a control point to the end of the path
+void CCameraPath::AddPoint( const CVector3& position, const CVector3& rotation )
+{
+	m_Positions.push_back( position );
+	m_Rotations.push_back( rotation );
+}
+
+namespace
+{
+	// Catmull-Rom interpolation between p1 and p2, using p0 and p3 to shape the curve
+	CVector3 CatmullRom( const CVector3& p0, const CVector3& p1, const CVector3& p2, const CVector3& p3, float t )
+	{
+		float t2 = t * t;
+		float t3 = t2 * t;
+		return 0.5f * (2.0f * p1 + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 +
+		               (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+	}
+}
+
+// Get the camera pose at a given point along the path, t from 0 (first point) to 1 (last point)
+void CCameraPath::Sample( float t, CVector3* pPosition, CVector3* pRotation ) const
+{
+	int numPoints = static_cast<int>(m_Positions.size());
+	if (numPoints == 0)
+	{
+		*pPosition = CVector3::kOrigin;
+		*pRotation = CVector3::kZero;
+		return;
+	}
+
+	// Find the segment containing t and the position within it
+	t = min( max( t, 0.0f ), 1.0f ) * (numPoints - 1);
+	int segment = min( static_cast<int>(t), max( numPoints - 2, 0 ) );
+	t -= segment;
+
+	// End points are repeated to give the curve something to bend towards
+	int i0 = max( segment - 1, 0 );
+	int i1 = segment;
+	int i2 = min( segment + 1, numPoints - 1 );
+	int i3 = min( segment + 2, numPoints - 1 );
+	*pPosition = CatmullRom( m_Positions[i0], m_Positions[i1], m_Positions[i2], m_Positions[i3], t );
+	*pRotation = CatmullRom( m_Rotations[i0], m_Rotations[i1], m_Rotations[i2], m_Rotations[i3], t );
+}
+
+
+//-----------------------------------------------------------------------------
+// Benchmark settings and results
+//-----------------------------------------------------------------------------
+
+SBenchmarkConfig::SBenchmarkConfig()
+{
+	paths.push_back( kBenchmarkDeferred );
+	paths.push_back( kBenchmarkForward );
+
+	// Doubling from 100 up to 25600
+	lightCounts.push_back( 1 );
+	for (int lights = 100; lights <= 25600; lights *= 2)
+	{
+		lightCounts.push_back( lights );
+	}
+
+	warmUpFrames = 60;
+	measureFrames = 600;
+	simulationStep = 1.0f / 60.0f;
+	maxCatchUpSteps = 4;
+	maxForwardLights = 0; // No limit
+	outputFile = "Benchmark.csv";
+	headless = false;
+	jobBenchmark = false;
+	selfChecks = false;
+	pinThreads = false;
+	pipelined = false;
+	targetFrameRate = 0.0f;
+	noAllocations = false;
+	updateFirst = false;
+	numInstances = 0;
+	staticBatching = true;
+	batchSize = 0.0f; // No limit
+	textureArrays = false;
+	instancing = true;
+	instanceBench = 0;
+	splitPositions = false;
+	depthPrePass = false;
+	gBufferLayout = "float";
+	skinBench = 0;
+	animBench = 0;
+	hierBench = 0;
+	compressTextures = false;
+	generateMips = false;
+	bakedLighting = false;
+}
+
+
+namespace
+{
+	// Split a comma separated list
+	vector<string> SplitList( const string& list )
+	{
+		vector<string> items;
+		stringstream stream( list );
+		string item;
+		while (getline( stream, item, ',' ))
+		{
+			if (!item.empty()) items.push_back( item );
+		}
+		return items;
+	}
+
+	// Name of the summary file written next to a results file: "Benchmark.csv" -> "Benchmark_summary.csv"
+	string SummaryFileName( const string& fileName )
+	{
+		string summaryFile = fileName;
+		size_t extension = summaryFile.find_last_of( '.' );
+		if (extension == string::npos || summaryFile.find_first_of( "/\\", extension ) != string::npos)
+		{
+			extension = summaryFile.length();
+		}
+		summaryFile.insert( extension, "_summary" );
+		return summaryFile;
+	}
+}
+
+// Parse benchmark options from the command line. Returns true if benchmark mode was requested
+bool ParseBenchmarkCommandLine( const string& commandLine, SBenchmarkConfig* pConfig )
+{
+	bool benchmark = false;
+	bool outputSet = false;
+
+	stringstream stream( commandLine );
+	string option, value;
+	while (stream >> option)
+	{
+		if (option == "-benchmark")
+		{
+			benchmark = true;
+		}
+		else if (option == "-headless")
+		{
+			pConfig->headless = true;
+		}
+		else if (option == "-jobbench")
+		{
+			pConfig->jobBenchmark = true;
+		}
+		else if (option == "-checks")
+		{
+			pConfig->selfChecks = true;
+		}
+		else if (option == "-pin")
+		{
+			pConfig->pinThreads = true;
+		}
+		else if (option == "-pipelined")
+		{
+			pConfig->pipelined = true;
+		}
+		else if (option == "-simrate" && stream >> value)
+		{
+			float rate = static_cast<float>(atof( value.c_str() ));
+			if (rate > 0.0f) pConfig->simulationStep = 1.0f / rate;
+		}
+		else if (option == "-catchup" && stream >> value)
+		{
+			pConfig->maxCatchUpSteps = max( atoi( value.c_str() ), 1 );
+		}
+		else if (option == "-noalloc")
+		{
+			pConfig->noAllocations = true;
+		}
+		else if (option == "-fps" && stream >> value)
+		{
+			pConfig->targetFrameRate = max( static_cast<float>(atof( value.c_str() )), 0.0f );
+		}
+		else if (option == "-lights" && stream >> value)
+		{
+			vector<string> items = SplitList( value );
+			pConfig->lightCounts.clear();
+			for (size_t i = 0; i < items.size(); ++i)
+			{
+				int lights = atoi( items[i].c_str() );
+				if (lights > 0) pConfig->lightCounts.push_back( lights );
+			}
+		}
+		else if (option == "-paths" && stream >> value)
+		{
+			vector<string> items = SplitList( value );
+			pConfig->paths.clear();
+			for (size_t i = 0; i < items.size(); ++i)
+			{
+				if      (items[i] == "deferred") pConfig->paths.push_back( kBenchmarkDeferred );
+				else if (items[i] == "forward")  pConfig->paths.push_back( kBenchmarkForward );
+			}
+		}
+		else if (option == "-frames" && stream >> value)
+		{
+			pConfig->measureFrames = max( atoi( value.c_str() ), 1 );
+		}
+		else if (option == "-warmup" && stream >> value)
+		{
+			pConfig->warmUpFrames = max( atoi( value.c_str() ), 0 );
+		}
+		else if (option == "-out" && stream >> value)
+		{
+			pConfig->outputFile = value;
+			outputSet = true;
+		}
+		else if (option == "-record" && stream >> value)
+		{
+			pConfig->recordFile = value;
+		}
+		else if (option == "-replay" && stream >> value)
+		{
+			pConfig->replayFile = value;
+		}
+		else if (option == "-updatefirst")
+		{
+			pConfig->updateFirst = true;
+		}
+		else if (option == "-latency" && stream >> value)
+		{
+			pConfig->latencyFile = value;
+		}
+		else if (option == "-memreport" && stream >> value)
+		{
+			pConfig->memoryReportFile = value;
+		}
+		else if (option == "-membudget" && stream >> value)
+		{
+			pConfig->memoryBudgets = value;
+		}
+		else if (option == "-instances" && stream >> value)
+		{
+			pConfig->numInstances = max( atoi( value.c_str() ), 0 );
+		}
+		else if (option == "-nobatch")
+		{
+			pConfig->staticBatching = false;
+		}
+		else if (option == "-batchsize" && stream >> value)
+		{
+			pConfig->batchSize = max( static_cast<float>(atof( value.c_str() )), 0.0f );
+		}
+		else if (option == "-batchreport" && stream >> value)
+		{
+			pConfig->batchReportFile = value;
+		}
+		else if (option == "-texarrays")
+		{
+			pConfig->textureArrays = true;
+		}
+		else if (option == "-texarrayreport" && stream >> value)
+		{
+			pConfig->texArrayReport = value;
+		}
+		else if (option == "-texarraybuild" && stream >> value)
+		{
+			pConfig->texArrayBuild = value;
+		}
+		else if (option == "-noinstancing")
+		{
+			pConfig->instancing = false;
+		}
+		else if (option == "-instancebench" && stream >> value)
+		{
+			pConfig->instanceBench = max( atoi( value.c_str() ), 0 );
+		}
+		else if (option == "-splitpositions")
+		{
+			pConfig->splitPositions = true;
+		}
+		else if (option == "-depthprepass")
+		{
+			pConfig->depthPrePass = true;
+		}
+		else if (option == "-gbuffer" && stream >> value)
+		{
+			pConfig->gBufferLayout = value;
+		}
+		else if (option == "-gbufferreport" && stream >> value)
+		{
+			pConfig->gBufferReport = value;
+		}
+		else if (option == "-skinbench" && stream >> value)
+		{
+			pConfig->skinBench = max( atoi( value.c_str() ), 0 );
+		}
+		else if (option == "-animbench" && stream >> value)
+		{
+			pConfig->animBench = max( atoi( value.c_str() ), 0 );
+		}
+		else if (option == "-hierbench" && stream >> value)
+		{
+			pConfig->hierBench = max( atoi( value.c_str() ), 0 );
+		}
+		else if (option == "-compresstextures")
+		{
+			pConfig->compressTextures = true;
+		}
+		else if (option == "-compressbench" && stream >> value)
+		{
+			pConfig->compressBench = value;
+		}
+		else if (option == "-genmips")
+		{
+			pConfig->generateMips = true;
+		}
+		else if (option == "-mipbench" && stream >> value)
+		{
+			pConfig->mipBench = value;
+		}
+		else if (option == "-bakedlighting")
+		{
+			pConfig->bakedLighting = true;
+		}
+		else if (option == "-bakelighting" && stream >> value)
+		{
+			pConfig->bakeLighting = value;
+		}
+	}
+
+	if (!pConfig->replayFile.empty() && !outputSet)
+	{
+		pConfig->outputFile = "Replay.csv";
+	}
+
+	return benchmark;
+}
+
+
+// Calculate summary statistics for a list of times (seconds in, milliseconds out). Percentiles use
+// the nearest-rank method, so every reported value is an actual frame time
+SBenchmarkSummary SummariseTimes( vector<float> times )
+{
+	SBenchmarkSummary summary = { 0, 0, 0, 0, 0 };
+	if (times.empty()) return summary;
+
+	sort( times.begin(), times.end() );
+	double sum = 0.0;
+	for (size_t i = 0; i < times.size(); ++i)
+	{
+		sum += times[i];
+	}
+
+	int count = static_cast<int>(times.size());
+	const float percentiles[3] = { 50.0f, 95.0f, 99.0f };
+	float results[3];
+	for (int p = 0; p < 3; ++p)
+	{
+		int rank = static_cast<int>(ceilf( percentiles[p] / 100.0f * count ));
+		results[p] = times[min( max( rank, 1 ), count ) - 1];
+	}
+
+	summary.mean = static_cast<float>(sum / count) * 1000.0f;
+	summary.p50  = results[0] * 1000.0f;
+	summary.p95  = results[1] * 1000.0f;
+	summary.p99  = results[2] * 1000.0f;
+	summary.max  = times.back() * 1000.0f;
+	return summary;
+}
+
+
+// Write the timings of every frame of a replay to a CSV file, with a one-line summary alongside
+bool WriteFrameTimings( const string& fileName, const vector<SBenchmarkFrame>& frames )
+{
+	FILE* file = fopen( fileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+	fprintf( file, "frame,frame_ms,update_ms,render_ms,latency_ms,allocations\n" );
+	for (size_t f = 0; f < frames.size(); ++f)
+	{
+		fprintf( file, "%d,%.4f,%.4f,%.4f,%.4f,%u\n", static_cast<int>(f), frames[f].frameTime * 1000.0f,
+		         frames[f].updateTime * 1000.0f, frames[f].renderTime * 1000.0f, frames[f].latency * 1000.0f,
+		         frames[f].allocations );
+	}
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+
+	file = fopen( SummaryFileName( fileName ).c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+	vector<float> frameTimes, updateTimes, renderTimes;
+	for (size_t f = 0; f < frames.size(); ++f)
+	{
+		frameTimes.push_back( frames[f].frameTime );
+		updateTimes.push_back( frames[f].updateTime );
+		renderTimes.push_back( frames[f].renderTime );
+	}
+	SBenchmarkSummary frame = SummariseTimes( frameTimes );
+	SBenchmarkSummary update = SummariseTimes( updateTimes );
+	SBenchmarkSummary render = SummariseTimes( renderTimes );
+	fprintf( file, "frames,frame_mean_ms,frame_p50_ms,frame_p95_ms,frame_p99_ms,frame_max_ms,"
+	               "update_p50_ms,update_p95_ms,update_p99_ms,render_p50_ms,render_p95_ms,render_p99_ms\n" );
+	fprintf( file, "%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n", static_cast<int>(frames.size()),
+	         frame.mean, frame.p50, frame.p95, frame.p99, frame.max, update.p50, update.p95, update.p99,
+	         render.p50, render.p95, render.p99 );
+	success = success && (ferror( file ) == 0);
+	fclose( file );
+
+	return success;
+}
+
+
+//-----------------------------------------------------------------------------
+// Benchmark class
+//-----------------------------------------------------------------------------
+
+CBenchmark::CBenchmark( const SBenchmarkConfig& config, const CCameraPath& cameraPath )
+	: m_Config( config ), m_CameraPath( cameraPath ), m_Run( 0 ), m_Frame( 0 )
+{
+	// Without a device there is only one thing to measure
+	if (m_Config.headless)
+	{
+		m_Config.paths.assign( 1, kBenchmarkHeadless );
+	}
+
+	// Results for each path in turn, sweeping through the light counts for each
+	m_Results.resize( NumRuns() );
+	for (int run = 0; run < NumRuns(); ++run)
+	{
+		m_Results[run].path = m_Config.paths[run / m_Config.lightCounts.size()];
+		m_Results[run].lightCount = m_Config.lightCounts[run % m_Config.lightCounts.size()];
+		m_Results[run].frames.reserve( m_Config.measureFrames );
+	}
+}
+
+
+// Settings for the current run
+EBenchmarkPath CBenchmark::RunPath() const
+{
+	return m_Results[m_Run].path;
+}
+int CBenchmark::RunLightCount() const
+{
+	return m_Results[m_Run].lightCount;
+}
+
+
+// Camera pose for the current frame. The camera waits at the start of the path during warm-up
+void CBenchmark::CameraPose( CVector3* pPosition, CVector3* pRotation ) const
+{
+	int measuredFrame = max( m_Frame - m_Config.warmUpFrames, 0 );
+	float t = (m_Config.measureFrames > 1) ? static_cast<float>(measuredFrame) / (m_Config.measureFrames - 1) : 0.0f;
+	m_CameraPath.Sample( t, pPosition, pRotation );
+}
+
+
+// Record timings for the frame just finished (seconds) and move on to the next frame
+void CBenchmark::EndFrame( const SBenchmarkFrame& timings )
+{
+	if (IsFinished()) return;
+
+	if (m_Frame >= m_Config.warmUpFrames)
+	{
+		m_Results[m_Run].frames.push_back( timings );
+	}
+
+	if (++m_Frame >= m_Config.warmUpFrames + m_Config.measureFrames)
+	{
+		m_Frame = 0;
+		++m_Run;
+	}
+}
+
+
+// Short description of progress, e.g. for the window title
+void CBenchmark::ProgressText( char* text, int size ) const
+{
+	if (IsFinished())
+	{
+		snprintf( text, size, "Benchmark complete" );
+	}
+	else
+	{
+		snprintf( text, size, "Benchmark %d/%d: %s, %d lights%s", m_Run + 1, NumRuns(), PathName( RunPath() ),
+		          RunLightCount(), m_Frame < m_Config.warmUpFrames ? " (warm-up)" : "" );
+	}
+}
+
+
+// Number of lights that actually affect shading in a run
+int CBenchmark::ShadedLights( EBenchmarkPath path, int lightCount ) const
+{
+	if (path == kBenchmarkForward && m_Config.maxForwardLights > 0)
+	{
+		return min( lightCount, m_Config.maxForwardLights );
+	}
+	return lightCount;
+}
+
+
+// Write per-frame and summary CSV files, returns false on a file error
+bool CBenchmark::WriteResults() const
+{
+	// Per-frame timings
+	FILE* file = fopen( m_Config.outputFile.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+	const char* mode = m_Config.pipelined ? "pipelined" : "serial";
+	fprintf( file, "path,mode,lights,shaded_lights,frame,frame_ms,update_ms,render_ms,latency_ms,allocations\n" );
+	for (size_t run = 0; run < m_Results.size(); ++run)
+	{
+		const SRunResults& results = m_Results[run];
+		for (size_t f = 0; f < results.frames.size(); ++f)
+		{
+			fprintf( file, "%s,%s,%d,%d,%d,%.4f,%.4f,%.4f,%.4f,%u\n", PathName( results.path ), mode, results.lightCount,
+			         ShadedLights( results.path, results.lightCount ), static_cast<int>(f),
+			         results.frames[f].frameTime * 1000.0f, results.frames[f].updateTime * 1000.0f,
+			         results.frames[f].renderTime * 1000.0f, results.frames[f].latency * 1000.0f,
+			         results.frames[f].allocations );
+		}
+	}
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+
+	// Percentiles for each run, written next to the per-frame file
+	file = fopen( SummaryFileName( m_Config.outputFile ).c_str(), "w" );
+
+	if (!file)
+	{
+		return false;
+	}
+	fprintf( file, "path,mode,lights,shaded_lights,frames,"
+	               "frame_mean_ms,frame_p50_ms,frame_p95_ms,frame_p99_ms,frame_max_ms,"
+	               "update_p50_ms,update_p95_ms,update_p99_ms,render_p50_ms,render_p95_ms,render_p99_ms,"
+	               "latency_p50_ms,latency_p95_ms,latency_p99_ms\n" );
+	for (size_t run = 0; run < m_Results.size(); ++run)
+	{
+		const SRunResults& results = m_Results[run];
+		vector<float> frameTimes, updateTimes, renderTimes, latencies;
+		for (size_t f = 0; f < results.frames.size(); ++f)
+		{
+			frameTimes.push_back( results.frames[f].frameTime );
+			updateTimes.push_back( results.frames[f].updateTime );
+			renderTimes.push_back( results.frames[f].renderTime );
+			latencies.push_back( results.frames[f].latency );
+		}
+		SBenchmarkSummary frame = SummariseTimes( frameTimes );
+		SBenchmarkSummary update = SummariseTimes( updateTimes );
+		SBenchmarkSummary render = SummariseTimes( renderTimes );
+		SBenchmarkSummary latency = SummariseTimes( latencies );
+
+		fprintf( file, "%s,%s,%d,%d,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+		         PathName( results.path ), mode, results.lightCount, ShadedLights( results.path, results.lightCount ),
+		         static_cast<int>(results.frames.size()), frame.mean, frame.p50, frame.p95, frame.p99, frame.max,
+		         update.p50, update.p95, update.p99, render.p50, render.p95, render.p99,
+		         latency.p50, latency.p95, latency.p99 );
+	}
+	success = success && (ferror( file ) == 0);
+	fclose( file );
+
+	return success;
+}
+
+
+// Name of a rendering path as written to the results
+const char* CBenchmark::PathName( EBenchmarkPath path )
+{
+	switch (path)
+	{
+		case kBenchmarkDeferred: return "deferred";
+		case kBenchmarkForward:  return "forward";
+		case kBenchmarkHeadless: return "headless";
+	}
+	return "unknown";
+}
+
+
+//-----------------------------------------------------------------------------
+// Job system benchmark
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Job that adds one to an atomic count
+	void CountJob( void* data, int, int )
+	{
+		static_cast<atomic<int>*>(data)->fetch_add( 1, memory_order_relaxed );
+	}
+
+	// Job that starts child jobs and waits for them before finishing, to a given depth. Leaf jobs
+	// add one to the count. Exercises waiting inside jobs, which is how dependencies are expressed
+	const int kTreeFanOut = 8;
+	void TreeJob( void* data, int depth, int )
+	{
+		if (depth == 0)
+		{
+			CountJob( data, 0, 0 );
+			return;
+		}
+		CJobCounter children;
+		for (int i = 0; i < kTreeFanOut; ++i)
+		{
+			JobRun( TreeJob, data, &children, depth - 1, 0, "Tree" );
+		}
+		JobWait( children );
+	}
+
+	// Some arithmetic that takes a predictable amount of time and can't be optimised away
+	float ScalingWork( int index )
+	{
+		float x = static_cast<float>(index & 1023) * 0.001f;
+		for (int i = 0; i < 64; ++i)
+		{
+			x = x * 0.999f + sqrtf( x + 1.0f ) * 0.01f;
+		}
+		return x;
+	}
+
+	// Run the stress checks with the job system already running, returns the number of failures
+	int JobSystemChecks( FILE* file )
+	{
+		int failures = 0;
+
+		// Many small jobs at once, repeatedly
+		{
+			const int kRepeats = 200;
+			const int kJobs = 2000;
+			bool passed = true;
+			for (int r = 0; r < kRepeats && passed; ++r)
+			{
+				atomic<int> count( 0 );
+				CJobCounter counter;
+				for (int j = 0; j < kJobs; ++j)
+				{
+					JobRun( CountJob, &count, &counter, 0, 0, "Count" );
+				}
+				JobWait( counter );
+				passed = (count.load() == kJobs);
+			}
+			fprintf( file, "check,small_jobs,%s\n", passed ? "pass" : "FAIL" );
+			if (!passed) ++failures;
+		}
+
+		// Nested jobs waiting for their children
+		{
+			const int kDepth = 4;
+			int expected = 1;
+			for (int d = 0; d < kDepth; ++d) expected *= kTreeFanOut;
+
+			atomic<int> count( 0 );
+			CJobCounter counter;
+			JobRun( TreeJob, &count, &counter, kDepth, 0, "Tree" );
+			JobWait( counter );
+			bool passed = (count.load() == expected);
+			fprintf( file, "check,nested_jobs,%s\n", passed ? "pass" : "FAIL" );
+			if (!passed) ++failures;
+		}
+
+		// ParallelFor visits every index exactly once, for a range of grain sizes
+		{
+			const int kSize = 100003; // Not a power of two, so ranges split unevenly
+			vector<int> visits( kSize );
+			bool passed = true;
+			for (int grain = 1; grain <= 4096 && passed; grain *= 4)
+			{
+				fill( visits.begin(), visits.end(), 0 );
+				ParallelFor( 0, kSize, grain, [&visits]( int begin, int end )
+				{
+					for (int i = begin; i < end; ++i) ++visits[i];
+				} );
+				passed = (count( visits.begin(), visits.end(), 1 ) == kSize);
+			}
+			fprintf( file, "check,parallel_for_coverage,%s\n", passed ? "pass" : "FAIL" );
+			if (!passed) ++failures;
+		}
+
+		// Chained stages, each reading the results of the one before (a small frame graph)
+		{
+			const int kSize = 50000;
+			vector<int> a( kSize ), b( kSize ), c( kSize );
+			ParallelFor( 0, kSize, 256, [&a]( int begin, int end )
+			{
+				for (int i = begin; i < end; ++i) a[i] = i;
+			} );
+			ParallelFor( 0, kSize, 256, [&a, &b]( int begin, int end )
+			{
+				for (int i = begin; i < end; ++i) b[i] = a[kSize - 1 - i] * 2;
+			} );
+			ParallelFor( 0, kSize, 256, [&b, &c]( int begin, int end )
+			{
+				for (int i = begin; i < end; ++i) c[i] = b[i] + 1;
+			} );
+			bool passed = true;
+			for (int i = 0; i < kSize && passed; ++i)
+			{
+				passed = (c[i] == (kSize - 1 - i) * 2 + 1);
+			}
+			fprintf( file, "check,chained_stages,%s\n", passed ? "pass" : "FAIL" );
+			if (!passed) ++failures;
+		}
+
+		return failures;
+	}
+}
+
+// Stress check the job system, then time a ParallelFor workload with 1 thread up to one per
+// hardware thread. Results are written to the given CSV file
+bool RunJobSystemBenchmark( const string& fileName, bool pinThreads )
+{
+	FILE* file = fopen( fileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+
+	int maxThreads = max( static_cast<int>(thread::hardware_concurrency()), 1 );
+	int failures = 0;
+
+	// Checks are run with the most threads, where races are most likely to show
+	fprintf( file, "type,name,result\n" );
+	JobSystemInit( maxThreads - 1, pinThreads );
+	failures += JobSystemChecks( file );
+	JobSystemShutdown();
+
+	// Scaling - median time of a fixed workload for each thread count
+	const int kWorkSize = 1 << 18;
+	const int kGrain = 1024;
+	const int kRepeats = 21;
+	vector<float> results( kWorkSize );
+	fprintf( file, "\nthreads,median_ms,p95_ms,speedup,efficiency\n" );
+	float singleThreadTime = 0.0f;
+	for (int threads = 1; threads <= maxThreads; ++threads)
+	{
+		JobSystemInit( threads - 1, pinThreads );
+
+		vector<float> times;
+		for (int r = 0; r < kRepeats; ++r)
+		{
+			TClockTicks start = ClockTicks();
+			ParallelFor( 0, kWorkSize, kGrain, [&results]( int begin, int end )
+			{
+				for (int i = begin; i < end; ++i) results[i] = ScalingWork( i );
+			}, "Scaling" );
+			times.push_back( static_cast<float>(ClockTicksToSeconds( ClockTicks() - start )) );
+		}
+		JobSystemShutdown();
+
+		SBenchmarkSummary summary = SummariseTimes( times );
+		if (threads == 1) singleThreadTime = summary.p50;
+		float speedup = (summary.p50 > 0.0f) ? singleThreadTime / summary.p50 : 0.0f;
+		fprintf( file, "%d,%.4f,%.4f,%.3f,%.3f\n", threads, summary.p50, summary.p95, speedup, speedup / threads );
+	}
+
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success && failures == 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Skinning benchmark
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// A skinned test mesh: a tube wrapped round a chain of bones along the y axis, one unit per bone, each vertex
+	// weighted to the four bones nearest it. Vertices have a position, weights, bone indices, normal, tangent and
+	// UV, 64 bytes as the importer would lay them out. Node 0 is the root, bones are nodes 1 to kNumBones
+	const TUInt32 kSkinTestBones = 16;
+
+	struct SSkinTestMesh
+	{
+		vector<SMeshNode> nodes;
+		vector<TUInt8>    vertices;
+		SSkinVertexLayout layout;
+		TUInt32           numVertices;
+	};
+
+	void MakeSkinTestMesh( TUInt32 numVertices, SSkinTestMesh* pMesh )
+	{
+		// Bones each one unit above their parent, the first at the origin. The bind pose is the default node matrices
+		pMesh->nodes.resize( kSkinTestBones + 1 );
+		for (TUInt32 node = 0; node <= kSkinTestBones; ++node)
+		{
+			SMeshNode& meshNode = pMesh->nodes[node];
+			meshNode.depth = node;
+			meshNode.parent = (node > 0) ? node - 1 : 0;
+			meshNode.numChildren = (node < kSkinTestBones) ? 1 : 0;
+			meshNode.positionMatrix = (node > 1) ? MatrixTranslation( CVector3( 0.0f, 1.0f, 0.0f ) ) : MatrixIdentity();
+			meshNode.invMeshOffset = MatrixTranslation( CVector3( 0.0f, -static_cast<float>(max( static_cast<int>(node) - 1, 0 )), 0.0f ) );
+		}
+
+		SSubMesh subMesh;
+		subMesh.numVertices = numVertices;
+		subMesh.vertexSize = 64;
+		subMesh.hasSkinningData = subMesh.hasNormals = subMesh.hasTangents = subMesh.hasTextureCoords = true;
+		subMesh.hasVertexColours = false;
+		SkinVertexLayout( subMesh, &pMesh->layout );
+		pMesh->numVertices = numVertices;
+		pMesh->vertices.assign( numVertices * subMesh.vertexSize, 0 );
+
+		const TUInt32 kRingVertices = 32;
+		for (TUInt32 vert = 0; vert < numVertices; ++vert)
+		{
+			TUInt8* vertex = &pMesh->vertices[vert * subMesh.vertexSize];
+			float angle = (vert % kRingVertices) * 6.2831853f / kRingVertices;
+			float height = static_cast<float>(vert / kRingVertices) * (kSkinTestBones - 1) / max( (numVertices - 1) / kRingVertices, 1u );
+			CVector3 normal( cosf( angle ), 0.0f, sinf( angle ) );
+			CVector3 tangent( -sinf( angle ), 0.0f, cosf( angle ) );
+			*reinterpret_cast<CVector3*>(vertex) = CVector3( normal.x, height, normal.z );
+			*reinterpret_cast<CVector3*>(vertex + pMesh->layout.normalOffset) = normal;
+			*reinterpret_cast<CVector3*>(vertex + pMesh->layout.tangentOffset) = tangent;
+			*reinterpret_cast<CVector2*>(vertex + pMesh->layout.tangentOffset + 12) = CVector2( angle, height );
+
+			// Weights fall off with distance from each bone, largest first as the importer sorts them
+			TFloat32* weights = reinterpret_cast<TFloat32*>(vertex + pMesh->layout.weightsOffset);
+			TUInt8* indices = vertex + pMesh->layout.indicesOffset;
+			int nearest = min( static_cast<int>(height + 0.5f), static_cast<int>(kSkinTestBones) - 1 );
+			int bones[4] = { nearest, nearest + 1, nearest - 1, nearest + 2 };
+			TFloat32 sum = 0.0f;
+			for (int influence = 0; influence < 4; ++influence)
+			{
+				int bone = min( max( bones[influence], 0 ), static_cast<int>(kSkinTestBones) - 1 );
+				indices[influence] = static_cast<TUInt8>(bone + 1);
+				weights[influence] = 1.0f / (1.0f + 4.0f * Abs( height - bone ));
+				sum += weights[influence];
+			}
+			for (int influence = 0; influence < 4; ++influence) weights[influence] /= sum;
+			sort( weights, weights + 4, greater<TFloat32>() );
+		}
+	}
+
+	// Pose for the test mesh - each bone turned a little about z and x relative to its parent, like a bending tail
+	void SkinTestPose( float time, vector<CMatrix4x4>* pNodeMatrices, const SSkinTestMesh& mesh )
+	{
+		pNodeMatrices->resize( mesh.nodes.size() );
+		for (size_t node = 0; node < mesh.nodes.size(); ++node)
+		{
+			(*pNodeMatrices)[node] = MatrixRotationZ( 0.2f * sinf( time + node * 0.5f ) ) * MatrixRotationX( 0.1f * cosf( time * 1.3f + node ) ) *
+			                         mesh.nodes[node].positionMatrix;
+		}
+	}
+}
+
+// Time skinning of a test mesh with the scalar and SSE methods on one thread, then across the job system with 1
+// thread up to one per hardware thread
+bool RunSkinningBenchmark( const string& fileName, int numVertices, bool pinThreads )
+{
+	FILE* file = fopen( fileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+
+	SSkinTestMesh mesh;
+	MakeSkinTestMesh( static_cast<TUInt32>(numVertices), &mesh );
+	vector<CMatrix4x4> nodeMatrices;
+	SkinTestPose( 1.0f, &nodeMatrices, mesh );
+	vector<CMatrix4x4> palette( mesh.nodes.size() );
+	SkinBuildPalette( &mesh.nodes[0], static_cast<TUInt32>(mesh.nodes.size()), &nodeMatrices[0], &palette[0] );
+	vector<TUInt8> skinned( mesh.vertices.size() );
+
+	const int kRepeats = 21;
+	int maxThreads = max( static_cast<int>(thread::hardware_concurrency()), 1 );
+	fprintf( file, "method,threads,vertices,median_ms,p95_ms,vertices_per_second,speedup\n" );
+	float scalarTime = 0.0f;
+	for (int run = 0; run < 2 + maxThreads; ++run)
+	{
+		// Scalar and SSE on this thread alone, then SSE in parallel batches
+		ESkinMethod method = (run == 0) ? kSkinScalar : kSkinSSE;
+		int threads = max( run - 1, 1 );
+		bool parallel = (run >= 2);
+		if (parallel) JobSystemInit( threads - 1, pinThreads );
+
+		vector<float> times;
+		for (int r = 0; r < kRepeats; ++r)
+		{
+			TClockTicks start = ClockTicks();
+			if (parallel) SkinVerticesParallel( mesh.layout, &mesh.vertices[0], &skinned[0], mesh.numVertices, &palette[0], method );
+			else          SkinVertices( mesh.layout, &mesh.vertices[0], &skinned[0], mesh.numVertices, &palette[0], method );
+			times.push_back( static_cast<float>(ClockTicksToSeconds( ClockTicks() - start )) );
+		}
+		if (parallel) JobSystemShutdown();
+
+		SBenchmarkSummary summary = SummariseTimes( times );
+		if (run == 0) scalarTime = summary.p50;
+		float verticesPerSecond = (summary.p50 > 0.0f) ? numVertices / (summary.p50 * 0.001f) : 0.0f;
+		fprintf( file, "%s%s,%d,%d,%.4f,%.4f,%.0f,%.3f\n", method == kSkinScalar ? "scalar" : "sse", parallel ? "_jobs" : "", threads,
+		         numVertices, summary.p50, summary.p95, verticesPerSecond, (summary.p50 > 0.0f) ? scalarTime / summary.p50 : 0.0f );
+	}
+
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success;
+}
+
+
+//-----------------------------------------------------------------------------
+// Animation benchmark
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// A test animation of a chain of nodes, each one unit above its parent and swinging about z and x at its own
+	// rate. Four seconds of keys at 30 a second, baked as an exporter would: odd nodes hold still for the first
+	// second, every fourth node also moves, and every node has scale keys that never change. Node 0 is the root
+	// and has no keys
+	void MakeAnimTestClip( TUInt32 numNodes, vector<SMeshNode>* pNodes, SMeshAnimation* pAnimation )
+	{
+		const TUInt32 kNumKeys = 121;
+		const float kKeyRate = 30.0f;
+
+		pNodes->resize( numNodes );
+		for (TUInt32 node = 0; node < numNodes; ++node)
+		{
+			SMeshNode& meshNode = (*pNodes)[node];
+			meshNode.depth = node;
+			meshNode.parent = (node > 0) ? node - 1 : 0;
+			meshNode.numChildren = (node + 1 < numNodes) ? 1 : 0;
+			meshNode.positionMatrix = (node > 0) ? MatrixTranslation( CVector3( 0.0f, 1.0f, 0.0f ) ) : MatrixIdentity();
+			meshNode.invMeshOffset = MatrixIdentity();
+		}
+
+		pAnimation->name = "Test";
+		pAnimation->duration = (kNumKeys - 1) / kKeyRate;
+		pAnimation->nodes.clear();
+		for (TUInt32 node = 1; node < numNodes; ++node)
+		{
+			SMeshNodeAnimation keys;
+			keys.node = node;
+			float rate = 1.0f + (node % 3);
+			for (TUInt32 key = 0; key < kNumKeys; ++key)
+			{
+				float time = key / kKeyRate;
+				float swing = (node % 2 == 1) ? max( time - 1.0f, 0.0f ) : time;
+				SMeshRotationKey rotationKey = { time, CQuaternion( MatrixRotationZ( 0.2f * sinf( swing * rate + node * 0.5f ) ) *
+				                                                    MatrixRotationX( 0.1f * cosf( swing * rate * 1.3f + node ) ) ) };
+				keys.rotations.push_back( rotationKey );
+
+				SMeshVectorKey scaleKey = { time, CVector3( 1.0f, 1.0f, 1.0f ) };
+				keys.scales.push_back( scaleKey );
+
+				if (node % 4 == 0)
+				{
+					SMeshVectorKey positionKey = { time, CVector3( 0.1f * sinf( time * 2.0f ), 1.0f, 0.0f ) };
+					keys.positions.push_back( positionKey );
+				}
+			}
+			pAnimation->nodes.push_back( keys );
+		}
+	}
+
+	// Keys in an uncompressed animation and the bytes they take
+	void AnimationKeyCount( const SMeshAnimation& animation, TUInt32* pNumKeys, TUInt32* pBytes )
+	{
+		*pNumKeys = *pBytes = 0;
+		for (size_t anim = 0; anim < animation.nodes.size(); ++anim)
+		{
+			const SMeshNodeAnimation& keys = animation.nodes[anim];
+			TUInt32 vectorKeys = static_cast<TUInt32>(keys.positions.size() + keys.scales.size());
+			*pNumKeys += static_cast<TUInt32>(keys.rotations.size()) + vectorKeys;
+			*pBytes += static_cast<TUInt32>(keys.rotations.size() * sizeof(SMeshRotationKey) + vectorKeys * sizeof(SMeshVectorKey));
+		}
+	}
+}
+
+// Compress a test animation and time sampling it, original keys first then the compressed clip
+bool RunAnimationBenchmark( const string& fileName, int numNodes )
+{
+	FILE* file = fopen( fileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+
+	vector<SMeshNode> nodes;
+	SMeshAnimation animation;
+	MakeAnimTestClip( static_cast<TUInt32>(max( numNodes, 1 )), &nodes, &animation );
+	TUInt32 numAnimNodes = static_cast<TUInt32>(nodes.size());
+	CAnimationClip clip;
+	clip.Compress( animation, &nodes[0], numAnimNodes );
+	TUInt32 originalKeys, originalBytes;
+	AnimationKeyCount( animation, &originalKeys, &originalBytes );
+
+	// Each repeat samples a pose at evenly spaced times through the clip, as a playing instance would
+	const int kRepeats = 21;
+	const int kPoses = 100;
+	const TUInt32 kErrorSamples = 481;
+	vector<CQuatTransform> pose( numAnimNodes );
+	fprintf( file, "method,nodes,keys,bytes,max_rotation_error_deg,max_position_error,max_scale_error,median_ms,p95_ms,nodes_per_second\n" );
+	for (int run = 0; run < 3; ++run)
+	{
+		EAnimSampleMethod method = (run == 2) ? kAnimSampleSSE : kAnimSampleScalar;
+		vector<float> times;
+		for (int r = 0; r < kRepeats; ++r)
+		{
+			SAnimationCursor cursor;
+			TClockTicks start = ClockTicks();
+			for (int p = 0; p < kPoses; ++p)
+			{
+				float time = clip.GetDuration() * p / (kPoses - 1);
+				if (run == 0) SampleAnimation( animation, &nodes[0], numAnimNodes, time, &pose[0] );
+				else          clip.Sample( time, &pose[0], &cursor, method );
+			}
+			times.push_back( static_cast<float>(ClockTicksToSeconds( ClockTicks() - start )) );
+		}
+
+		SBenchmarkSummary summary = SummariseTimes( times );
+		float nodesPerSecond = (summary.p50 > 0.0f) ? static_cast<float>(numAnimNodes) * kPoses / (summary.p50 * 0.001f) : 0.0f;
+		if (run == 0)
+		{
+			fprintf( file, "original,%u,%u,%u,0,0,0,%.4f,%.4f,%.0f\n", numAnimNodes, originalKeys, originalBytes, summary.p50, summary.p95, nodesPerSecond );
+		}
+		else
+		{
+			SAnimationError error = AnimationError( clip, animation, &nodes[0], kErrorSamples, method );
+			fprintf( file, "%s,%u,%u,%u,%.5f,%.6f,%.6f,%.4f,%.4f,%.0f\n", method == kAnimSampleScalar ? "scalar" : "sse", numAnimNodes,
+			         clip.GetNumKeys(), clip.GetMemoryBytes(), error.rotation, error.position, error.scale, summary.p50, summary.p95,
+			         nodesPerSecond );
+		}
+	}
+
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success;
+}
+
+
+//-----------------------------------------------------------------------------
+// Hierarchy benchmark
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Shapes of test hierarchy
+	enum EHierarchyShape
+	{
+		kHierarchyDeep,  // A single chain, each node the only child of the one before
+		kHierarchyWide,  // The root, about sqrt(n) children of it, and the rest shared out as leaves under them
+		kHierarchyMixed, // Random parents, each chosen from the ancestors of the node before (so still depth-first)
+	};
+
+	// A test hierarchy in depth-first order. Every node is turned a little and moved from its parent
+	void MakeHierarchyTestNodes( EHierarchyShape shape, TUInt32 numNodes, vector<SMeshNode>* pNodes )
+	{
+		pNodes->resize( numNodes );
+		TUInt32 numGroups = max( static_cast<TUInt32>(sqrtf( static_cast<float>(numNodes) )), 1u );
+		TUInt32 groupSize = (numNodes - 1 + numGroups - 1) / numGroups; // Group node and its leaves
+		vector<TUInt32> path; // Ancestors of the node before, for mixed hierarchies
+		for (TUInt32 node = 0; node < numNodes; ++node)
+		{
+			SMeshNode& meshNode = (*pNodes)[node];
+			meshNode.parent = 0;
+			if (node > 0)
+			{
+				if (shape == kHierarchyDeep)
+				{
+					meshNode.parent = node - 1;
+				}
+				else if (shape == kHierarchyWide)
+				{
+					meshNode.parent = ((node - 1) % groupSize == 0) ? 0 : node - (node - 1) % groupSize;
+				}
+				else
+				{
+					path.resize( rand() % path.size() + 1 );
+					meshNode.parent = path.back();
+				}
+			}
+			path.push_back( node );
+			meshNode.depth = (node > 0) ? (*pNodes)[meshNode.parent].depth + 1 : 0;
+			meshNode.numChildren = 0;
+			if (node > 0) ++(*pNodes)[meshNode.parent].numChildren;
+			meshNode.positionMatrix = MatrixRotationY( 0.01f * (node % 7) ) * MatrixRotationX( 0.02f * (node % 5) ) *
+			                          MatrixTranslation( CVector3( 0.1f * (node % 3), 1.0f, 0.05f * (node % 4) ) );
+			meshNode.invMeshOffset = MatrixIdentity();
+		}
+	}
+
+	// Local matrix of a test node moved by a given amount
+	CMatrix4x4 MovedTestMatrix( const SMeshNode& node, float amount )
+	{
+		return MatrixRotationZ( amount ) * node.positionMatrix;
+	}
+}
+
+// Time world matrix propagation of deep and wide test hierarchies
+bool RunHierarchyBenchmark( const string& fileName, int numNodes )
+{
+	FILE* file = fopen( fileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+
+	// Each repeat runs a number of updates, as frames would. For moved runs one node in a hundred is set before each
+	const int kRepeats = 21;
+	const int kUpdates = 50;
+	const TUInt32 kMoveStride = 100;
+	const char* shapeNames[] = { "deep", "wide" };
+	const char* methodNames[] = { "full_matrices", "full_scalar", "full_sse", "moved_sse" };
+	fprintf( file, "shape,method,nodes,nodes_updated,median_ms,p95_ms,nodes_per_second\n" );
+	for (int shape = kHierarchyDeep; shape <= kHierarchyWide; ++shape)
+	{
+		vector<SMeshNode> nodes;
+		MakeHierarchyTestNodes( static_cast<EHierarchyShape>(shape), static_cast<TUInt32>(max( numNodes, 1 )), &nodes );
+		TUInt32 numHierarchyNodes = static_cast<TUInt32>(nodes.size());
+		vector<CMatrix4x4> localMatrices( numHierarchyNodes ), worldMatrices( numHierarchyNodes );
+		for (TUInt32 node = 0; node < numHierarchyNodes; ++node) localMatrices[node] = nodes[node].positionMatrix;
+		CNodeHierarchy hierarchy;
+		hierarchy.Build( &nodes[0], numHierarchyNodes );
+		hierarchy.Update();
+
+		for (int method = 0; method < 4; ++method)
+		{
+			vector<float> times;
+			TUInt32 nodesUpdated = numHierarchyNodes;
+			for (int r = 0; r < kRepeats; ++r)
+			{
+				TClockTicks start = ClockTicks();
+				for (int u = 0; u < kUpdates; ++u)
+				{
+					if (method == 0)
+					{
+						ConcatenateNodeMatrices( &nodes[0], numHierarchyNodes, &localMatrices[0], &worldMatrices[0] );
+					}
+					else if (method < 3)
+					{
+						hierarchy.Invalidate();
+						hierarchy.Update( method == 1 ? kHierarchyScalar : kHierarchySSE );
+					}
+					else
+					{
+						for (TUInt32 node = (u % kMoveStride) + 1; node < numHierarchyNodes; node += kMoveStride)
+						{
+							hierarchy.SetLocalMatrix( node, MovedTestMatrix( nodes[node], 0.001f * u ) );
+						}
+						nodesUpdated = hierarchy.Update( kHierarchySSE );
+					}
+				}
+				times.push_back( static_cast<float>(ClockTicksToSeconds( ClockTicks() - start )) );
+			}
+
+			SBenchmarkSummary summary = SummariseTimes( times );
+			float nodesPerSecond = (summary.p50 > 0.0f) ? static_cast<float>(numHierarchyNodes) * kUpdates / (summary.p50 * 0.001f) : 0.0f;
+			fprintf( file, "%s,%s,%u,%u,%.4f,%.4f,%.0f\n", shapeNames[shape], methodNames[method], numHierarchyNodes, nodesUpdated,
+			         summary.p50, summary.p95, nodesPerSecond );
+		}
+	}
+
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success;
+}
+
+
+//-----------------------------------------------------------------------------
+// Compression benchmark
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Images used by "-compressbench all": every JPEG and PNG in the repository, and uncompressed DDS maps with
+	// specular in alpha and a normal map
+	const char* kCompressionImages[] = { "Flare.jpg", "StarsHi.jpg", "brick1.jpg", "tiles1.jpg", "wood2.jpg", "sky_BK.jpg", "sky_DN.jpg",
+	                                     "sky_FR.jpg", "sky_LF.jpg", "sky_RT.jpg", "sky_UP.jpg", "Lines.png", "Moogle.png",
+	                                     "CargoA.dds", "WallDiffuseSpecular.dds", "WallNormalHeight.dds" };
+
+	// Files named as normal maps (e.g. WallNormalHeight.dds) are compressed to BC5
+	bool IsNormalMapName( const string& fileName )
+	{
+		string name = fileName;
+		transform( name.begin(), name.end(), name.begin(), ::tolower );
+		return name.find( "normal" ) != string::npos;
+	}
+
+	// Channels that carry data in a block format, compared for its PSNR
+	TUInt32 BlockFormatChannels( DXGI_FORMAT format )
+	{
+		switch (format)
+		{
+			case DXGI_FORMAT_BC1_UNORM: case DXGI_FORMAT_BC1_UNORM_SRGB: return kChannelRed | kChannelGreen | kChannelBlue;
+			case DXGI_FORMAT_BC5_UNORM:                                  return kChannelRed | kChannelGreen;
+			default:                                                     return kChannelRed | kChannelGreen | kChannelBlue | kChannelAlpha;
+		}
+	}
+
+	const char* BlockFormatName( DXGI_FORMAT format )
+	{
+		switch (format)
+		{
+			case DXGI_FORMAT_BC1_UNORM: case DXGI_FORMAT_BC1_UNORM_SRGB: return "bc1";
+			case DXGI_FORMAT_BC3_UNORM: case DXGI_FORMAT_BC3_UNORM_SRGB: return "bc3";
+			case DXGI_FORMAT_BC5_UNORM:                                  return "bc5";
+			default:                                                     return "unknown";
+		}
+	}
+}
+
+// Compress each image with the scalar and SSE methods on one thread, then SSE across the job system with 1 thread up to
+// one per hardware thread
+bool RunCompressionBenchmark( const string& fileName, const string& imageList, bool pinThreads )
+{
+	FILE* file = fopen( fileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+
+	vector<string> images = SplitList( imageList );
+	if (imageList == "all")
+	{
+		images.assign( kCompressionImages, kCompressionImages + sizeof(kCompressionImages) / sizeof(kCompressionImages[0]) );
+	}
+
+	const int kRepeats = 11;
+	int maxThreads = max( static_cast<int>(thread::hardware_concurrency()), 1 );
+	bool allRead = true;
+	fprintf( file, "image,format,width,height,method,threads,median_ms,p95_ms,mpixels_per_second,speedup,psnr_db,bytes_rgba,bytes_compressed\n" );
+	for (size_t image = 0; image < images.size(); ++image)
+	{
+		STextureImage source, compressed, decompressed;
+		if (!ReadImageRGBA( images[image], &source ))
+		{
+			fprintf( file, "%s,unreadable\n", images[image].c_str() );
+			allRead = false;
+			continue;
+		}
+		DXGI_FORMAT format = ChooseBlockFormat( source, IsNormalMapName( images[image] ) );
+		float megapixels = source.width * source.height * 1e-6f;
+
+		float scalarTime = 0.0f;
+		for (int run = 0; run < 2 + maxThreads; ++run)
+		{
+			// Scalar and SSE on this thread alone, then SSE with rows of blocks spread over the job system
+			EBlockMethod method = (run == 0) ? kBlockScalar : kBlockSSE;
+			int threads = max( run - 1, 1 );
+			bool parallel = (run >= 2);
+			if (parallel) JobSystemInit( threads - 1, pinThreads );
+
+			vector<float> times;
+			for (int r = 0; r < kRepeats; ++r)
+			{
+				TClockTicks start = ClockTicks();
+				CompressTextureImage( source, format, &compressed, method, parallel );
+				times.push_back( static_cast<float>(ClockTicksToSeconds( ClockTicks() - start )) );
+			}
+			if (parallel) JobSystemShutdown();
+
+			DecompressTextureImage( compressed, &decompressed );
+			double psnr = TextureImagePSNR( source, decompressed, BlockFormatChannels( format ) );
+
+			SBenchmarkSummary summary = SummariseTimes( times );
+			if (run == 0) scalarTime = summary.p50;
+			float megapixelsPerSecond = (summary.p50 > 0.0f) ? megapixels / (summary.p50 * 0.001f) : 0.0f;
+			fprintf( file, "%s,%s,%u,%u,%s%s,%d,%.4f,%.4f,%.2f,%.3f,%.2f,%u,%u\n", images[image].c_str(), BlockFormatName( format ),
+			         source.width, source.height, method == kBlockScalar ? "scalar" : "sse", parallel ? "_jobs" : "", threads,
+			         summary.p50, summary.p95, megapixelsPerSecond, (summary.p50 > 0.0f) ? scalarTime / summary.p50 : 0.0f, psnr,
+			         static_cast<TUInt32>(source.data.size()), static_cast<TUInt32>(compressed.data.size()) );
+		}
+	}
+
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success && allRead;
+}
+
+
+//-----------------------------------------------------------------------------
+// Mip generation benchmark
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Images used by "-mipbench all": every JPEG and PNG in the repository, and the alpha tested foliage of the level
+	const char* kMipImages[] = { "Flare.jpg", "StarsHi.jpg", "brick1.jpg", "tiles1.jpg", "wood2.jpg", "sky_BK.jpg", "sky_DN.jpg",
+	                             "sky_FR.jpg", "sky_LF.jpg", "sky_RT.jpg", "sky_UP.jpg", "Lines.png", "Moogle.png",
+	                             "tree01.dds", "tree02.dds", "tree03.dds", "tree04.dds", "plant01.dds", "plant02.dds", "fence.dds" };
+
+	// Read an image as R8G8B8A8, decoding block compressed DDS files
+	bool ReadDecodedImage( const string& fileName, STextureImage* pImage )
+	{
+		STextureImage compressed;
+		return ReadImageRGBA( fileName, pImage ) ||
+		       (ReadTextureImage( fileName, &compressed ) && DecompressTextureImage( compressed, pImage ));
+	}
+
+	// Mips as they are often first written: each the average of 2x2 pixels of the 8-bit mip above, in gamma space, one
+	// channel at a time. The baseline for the mip benchmark
+	void NaiveMips( const STextureImage& source, STextureImage* pMipped )
+	{
+		pMipped->format = source.format;
+		pMipped->width = source.width;
+		pMipped->height = source.height;
+		pMipped->mipLevels = FullMipLevels( source.width, source.height );
+		pMipped->arraySize = 1;
+		pMipped->data.resize( TextureSliceBytes( *pMipped ) );
+		memcpy( &pMipped->data[0], &source.data[0], static_cast<size_t>(source.width) * source.height * 4 );
+
+		const TUInt8* above = &pMipped->data[0];
+		TUInt32 width = source.width, height = source.height;
+		for (TUInt32 level = 1; level < pMipped->mipLevels; ++level)
+		{
+			TUInt8* mip = const_cast<TUInt8*>(above) + static_cast<size_t>(width) * height * 4;
+			TUInt32 mipWidth = max( width / 2, 1u ), mipHeight = max( height / 2, 1u );
+			for (TUInt32 y = 0; y < mipHeight; ++y)
+			{
+				TUInt32 y0 = min( 2 * y, height - 1 ), y1 = min( 2 * y + 1, height - 1 );
+				for (TUInt32 x = 0; x < mipWidth; ++x)
+				{
+					TUInt32 x0 = min( 2 * x, width - 1 ), x1 = min( 2 * x + 1, width - 1 );
+					for (TUInt32 channel = 0; channel < 4; ++channel)
+					{
+						TUInt32 sum = above[(y0 * width + x0) * 4 + channel] + above[(y0 * width + x1) * 4 + channel] +
+						              above[(y1 * width + x0) * 4 + channel] + above[(y1 * width + x1) * 4 + channel];
+						mip[(y * mipWidth + x) * 4 + channel] = static_cast<TUInt8>((sum + 2) / 4);
+					}
+				}
+			}
+			above = mip;
+			width = mipWidth;
+			height = mipHeight;
+		}
+	}
+
+	// Largest change in alpha coverage from the top mip over the mips with at least 16 pixels (fewer can't match it closely)
+	float MaxCoverageError( const STextureImage& image, float alphaReference )
+	{
+		float top = MipAlphaCoverage( image, 0, 0, alphaReference );
+		float error = 0.0f;
+		for (TUInt32 mip = 1; mip < image.mipLevels && max( image.width >> mip, 1u ) * max( image.height >> mip, 1u ) >= 16; ++mip)
+		{
+			error = max( error, fabsf( MipAlphaCoverage( image, 0, mip, alphaReference ) - top ) );
+		}
+		return error;
+	}
+}
+
+// Generate mips for each image naively, then with each filter and method, then across the job system
+bool RunMipBenchmark( const string& fileName, const string& imageList, bool pinThreads )
+{
+	FILE* file = fopen( fileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+
+	vector<string> names = SplitList( imageList );
+	if (imageList == "all")
+	{
+		names.assign( kMipImages, kMipImages + sizeof(kMipImages) / sizeof(kMipImages[0]) );
+	}
+
+	const int kRepeats = 11;
+	int maxThreads = max( static_cast<int>(thread::hardware_concurrency()), 1 );
+	bool allRead = true;
+	vector<STextureImage> images;
+	vector<SMipSettings> imageSettings;
+	float totalMegapixels = 0.0f;
+	fprintf( file, "image,width,height,levels,filter,method,threads,median_ms,p95_ms,mpixels_per_second,speedup,coverage_error\n" );
+	for (size_t image = 0; image < names.size(); ++image)
+	{
+		STextureImage source, mipped;
+		if (!ReadDecodedImage( names[image], &source ))
+		{
+			fprintf( file, "%s,unreadable\n", names[image].c_str() );
+			allRead = false;
+			continue;
+		}
+		source.mipLevels = 1;
+		source.arraySize = 1;
+		SMipSettings settings = MipSettingsForFile( names[image] );
+		float megapixels = source.width * source.height * 1e-6f;
+
+		float scalarTime = 0.0f;
+		for (int run = 0; run < 5 + maxThreads; ++run)
+		{
+			// Naive, then box and Kaiser with each method on this thread alone, then Kaiser SSE in parallel
+			SMipSettings runSettings = settings;
+			runSettings.filter = (run == 1 || run == 2) ? kMipBox : kMipKaiser;
+			EMipMethod method = (run == 1 || run == 3) ? kMipScalar : kMipSSE;
+			int threads = max( run - 4, 1 );
+			bool parallel = (run >= 5);
+			if (parallel) JobSystemInit( threads - 1, pinThreads );
+
+			vector<float> times;
+			for (int r = 0; r < kRepeats; ++r)
+			{
+				TClockTicks start = ClockTicks();
+				if (run == 0) NaiveMips( source, &mipped );
+				else          GenerateMips( source, &mipped, runSettings, method, parallel );
+				times.push_back( static_cast<float>(ClockTicksToSeconds( ClockTicks() - start )) );
+			}
+			if (parallel) JobSystemShutdown();
+
+			SBenchmarkSummary summary = SummariseTimes( times );
+			if (run <= 1 || run == 3) scalarTime = summary.p50; // Speedups are over the scalar code for the same filter
+			float megapixelsPerSecond = (summary.p50 > 0.0f) ? megapixels / (summary.p50 * 0.001f) : 0.0f;
+			fprintf( file, "%s,%u,%u,%u,%s,%s%s,%d,%.4f,%.4f,%.2f,%.3f,", names[image].c_str(), source.width, source.height,
+			         mipped.mipLevels, (run == 0) ? "naive" : (runSettings.filter == kMipBox) ? "box" : "kaiser",
+			         (method == kMipScalar || run == 0) ? "scalar" : "sse", parallel ? "_jobs" : "", threads, summary.p50, summary.p95,
+			         megapixelsPerSecond, (summary.p50 > 0.0f) ? scalarTime / summary.p50 : 0.0f );
+			if (settings.alphaCoverage > 0.0f) fprintf( file, "%.4f\n", MaxCoverageError( mipped, settings.alphaCoverage ) );
+			else                               fprintf( file, "\n" );
+		}
+
+		images.push_back( source );
+		imageSettings.push_back( settings );
+		totalMegapixels += megapixels;
+	}
+
+	// Every image with all threads: one image after another with the rows of each spread over the job system, then
+	// the images themselves spread over it too
+	if (!images.empty())
+	{
+		JobSystemInit( maxThreads - 1, pinThreads );
+		vector<STextureImage> mipped( images.size() );
+		const STextureImage* sourceImages = &images[0];
+		const SMipSettings* sourceSettings = &imageSettings[0];
+		STextureImage* results = &mipped[0];
+		for (int run = 0; run < 2; ++run)
+		{
+			vector<float> times;
+			for (int r = 0; r < kRepeats; ++r)
+			{
+				TClockTicks start = ClockTicks();
+				if (run == 0)
+				{
+					for (size_t image = 0; image < images.size(); ++image)
+					{
+						GenerateMips( images[image], &mipped[image], imageSettings[image] );
+					}
+				}
+				else
+				{
+					ParallelFor( 0, static_cast<int>(images.size()), 1, [sourceImages, sourceSettings, results]( int begin, int end )
+					{
+						for (int image = begin; image < end; ++image)
+						{
+							GenerateMips( sourceImages[image], &results[image], sourceSettings[image] );
+						}
+					}, "MipBenchmark" );
+				}
+				times.push_back( static_cast<float>(ClockTicksToSeconds( ClockTicks() - start )) );
+			}
+
+			SBenchmarkSummary summary = SummariseTimes( times );
+			float megapixelsPerSecond = (summary.p50 > 0.0f) ? totalMegapixels / (summary.p50 * 0.001f) : 0.0f;
+			fprintf( file, "all,,,,kaiser,sse_jobs%s,%d,%.4f,%.4f,%.2f,,\n", (run == 0) ? "" : "_images", maxThreads, summary.p50,
+			         summary.p95, megapixelsPerSecond );
+		}
+		JobSystemShutdown();
+	}
+
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success && allRead;
+}
+
+
+//-----------------------------------------------------------------------------
+// Self-checks
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Random allocations and frees checked against a map of which units are in use, then a compaction
+	// checked by moving tagged data with the returned moves. Returns the number of failures
+	int RangeAllocatorChecks( FILE* file )
+	{
+		int failures = 0;
+		srand( 1234 );
+
+		// Random allocation and freeing never hands out overlapping ranges, and freeing everything
+		// merges back to a single range
+		const unsigned int kSize = 4096;
+		CRangeAllocator allocator( kSize );
+		vector<int> owner( kSize, -1 ); // Allocation occupying each unit
+		vector<unsigned int> offsets, sizes;
+		bool passed = true;
+		for (int i = 0; i < 5000 && passed; ++i)
+		{
+			if (offsets.empty() || rand() % 3 != 0)
+			{
+				unsigned int size = 1 + rand() % 64;
+				unsigned int offset = allocator.Allocate( size );
+				if (offset == CRangeAllocator::kInvalidOffset)
+				{
+					passed = (allocator.LargestFreeRange() < size);
+					continue;
+				}
+				for (unsigned int u = offset; u < offset + size && passed; ++u)
+				{
+					passed = (u < kSize && owner[u] == -1);
+					if (passed) owner[u] = static_cast<int>(offsets.size());
+				}
+				offsets.push_back( offset );
+				sizes.push_back( size );
+			}
+			else
+			{
+				size_t a = rand() % offsets.size();
+				allocator.Free( offsets[a] );
+				for (unsigned int u = offsets[a]; u < offsets[a] + sizes[a]; ++u) owner[u] = -1;
+				offsets[a] = offsets.back(); offsets.pop_back();
+				sizes[a] = sizes.back();     sizes.pop_back();
+				for (size_t b = 0; b < offsets.size(); ++b)
+				{
+					for (unsigned int u = offsets[b]; u < offsets[b] + sizes[b]; ++u) owner[u] = static_cast<int>(b);
+				}
+			}
+			unsigned int used = 0;
+			for (size_t a = 0; a < sizes.size(); ++a) used += sizes[a];
+			if (used != allocator.UsedSize()) passed = false;
+		}
+
+		// Compaction keeps every live range's contents and leaves one free range at the end
+		vector<int> data( owner );
+		vector<CRangeAllocator::SMove> moves;
+		allocator.Compact( &moves );
+		for (size_t m = 0; m < moves.size(); ++m)
+		{
+			for (unsigned int u = 0; u < moves[m].size; ++u) data[moves[m].to + u] = data[moves[m].from + u];
+		}
+		unsigned int compactedEnd = allocator.UsedSize();
+		for (unsigned int u = 0; u < compactedEnd && passed; ++u)
+		{
+			passed = (data[u] != -1);
+		}
+		if (allocator.NumFreeRanges() > 1 || (allocator.FreeSize() > 0 && allocator.LargestFreeRange() != kSize - compactedEnd))
+		{
+			passed = false;
+		}
+		fprintf( file, "check,range_allocator_random,%s\n", passed ? "pass" : "FAIL" );
+		if (!passed) ++failures;
+
+		// Best fit takes the smallest hole that fits, and freeing everything merges to one range
+		{
+			CRangeAllocator fit( 100 );
+			unsigned int a = fit.Allocate( 10 ), b = fit.Allocate( 30 ), c = fit.Allocate( 5 ), d = fit.Allocate( 20 );
+			fit.Allocate( 35 );
+			fit.Free( b );
+			fit.Free( d );
+			bool fitPassed = (fit.Allocate( 15 ) == d && fit.Fragmentation() > 0.0f);
+			fit.Reset( 100 );
+			a = fit.Allocate( 40 ); b = fit.Allocate( 40 ); c = fit.Allocate( 20 );
+			fit.Free( b ); fit.Free( a ); fit.Free( c );
+			fitPassed = fitPassed && fit.NumFreeRanges() == 1 && fit.LargestFreeRange() == 100 && fit.UsedSize() == 0 &&
+			            fit.Allocate( 101 ) == CRangeAllocator::kInvalidOffset;
+			fprintf( file, "check,range_allocator_best_fit,%s\n", fitPassed ? "pass" : "FAIL" );
+			if (!fitPassed) ++failures;
+		}
+
+		return failures;
+	}
+
+	// Frames of random allocations with a simulated GPU fence a few frames behind: ranges in use by
+	// frames not yet retired never overlap, offsets are aligned, and allocation never fails while the
+	// ring is empty. Then fixed sequences checking wrapping and requests larger than the ring. Returns
+	// the number of failures
+	int RingAllocatorChecks( FILE* file )
+	{
+		int failures = 0;
+		srand( 4321 );
+
+		const unsigned int kSize = 4096;
+		const unsigned long long kLag = 3; // Frames the simulated GPU is behind
+		CRingAllocator ring( kSize );
+		vector<long long> owner( kSize, -1 ); // Frame using each unit
+		bool passed = true;
+		bool wrapped = false;
+		int numFailed = 0;
+		for (unsigned long long frame = 0; frame < 2000 && passed; ++frame)
+		{
+			// The fence has passed every frame kLag or more behind this one
+			if (frame >= kLag)
+			{
+				long long completed = static_cast<long long>(frame - kLag);
+				ring.Retire( completed );
+				for (unsigned int u = 0; u < kSize; ++u)
+				{
+					if (owner[u] <= completed) owner[u] = -1;
+				}
+			}
+
+			int numAllocations = 1 + rand() % 8;
+			for (int a = 0; a < numAllocations && passed; ++a)
+			{
+				unsigned int size = 1 + rand() % 300;
+				unsigned int alignment = 1u << (rand() % 5);
+				bool empty = (ring.UsedSize() == 0);
+				bool allocationWrapped;
+				unsigned int offset = ring.Allocate( size, alignment, &allocationWrapped );
+				if (offset == CRingAllocator::kInvalidOffset)
+				{
+					passed = !empty;
+					++numFailed;
+					continue;
+				}
+				wrapped = wrapped || allocationWrapped;
+				passed = (offset % alignment == 0 && offset + size <= kSize);
+				for (unsigned int u = offset; u < offset + size && passed; ++u)
+				{
+					passed = (owner[u] == -1);
+					owner[u] = static_cast<long long>(frame);
+				}
+			}
+			ring.EndFrame( frame );
+
+			unsigned int used = 0;
+			for (unsigned int u = 0; u < kSize; ++u) used += (owner[u] != -1);
+			if (used > ring.UsedSize()) passed = false;
+		}
+		ring.Retire( ~0ull );
+		passed = passed && wrapped && numFailed > 0 && ring.UsedSize() == 0 && ring.NumFramesInFlight() == 0;
+		fprintf( file, "check,ring_allocator_random,%s\n", passed ? "pass" : "FAIL" );
+		if (!passed) ++failures;
+
+		// Wrapping waits for the frame at the start of the ring to be retired, and the end skipped counts as used
+		{
+			CRingAllocator small( 100 );
+			bool wrapPassed = (small.Allocate( 60, 1 ) == 0);
+			small.EndFrame( 1 );
+			wrapPassed = wrapPassed && small.Allocate( 30, 1 ) == 60;
+			small.EndFrame( 2 );
+			wrapPassed = wrapPassed && small.Allocate( 20, 1 ) == CRingAllocator::kInvalidOffset;
+			small.Retire( 1 );
+			bool wrapFlag = false;
+			wrapPassed = wrapPassed && small.Allocate( 20, 1, &wrapFlag ) == 0 && wrapFlag && small.UsedSize() == 60;
+			wrapPassed = wrapPassed && small.Allocate( 41, 1 ) == CRingAllocator::kInvalidOffset && small.Allocate( 40, 4 ) == 20;
+			wrapPassed = wrapPassed && small.FreeSize() == 0 && small.Allocate( 1, 1 ) == CRingAllocator::kInvalidOffset;
+			small.EndFrame( 3 );
+			small.Retire( 3 );
+			wrapPassed = wrapPassed && small.UsedSize() == 0 && small.Allocate( 100, 16 ) == 0;
+			fprintf( file, "check,ring_allocator_wrap,%s\n", wrapPassed ? "pass" : "FAIL" );
+			if (!wrapPassed) ++failures;
+		}
+
+		// A request larger than the ring fails without disturbing the frames in flight (CUploadRing::Map rejects it before
+		// touching the ring), so the next normal request still lands after the range the GPU may be reading
+		{
+			CRingAllocator small( 100 );
+			bool oversizePassed = (small.Allocate( 40, 1 ) == 0);
+			small.EndFrame( 1 );
+			oversizePassed = oversizePassed && small.Allocate( 101, 1 ) == CRingAllocator::kInvalidOffset;
+			oversizePassed = oversizePassed && small.UsedSize() == 40 && small.NumFramesInFlight() == 1;
+			oversizePassed = oversizePassed && small.Allocate( 20, 1 ) == 40 && small.UsedSize() == 60;
+			small.EndFrame( 2 );
+			oversizePassed = oversizePassed && small.Allocate( 50, 1 ) == CRingAllocator::kInvalidOffset;
+			small.Retire( 1 );
+			oversizePassed = oversizePassed && small.Allocate( 40, 1 ) == 60 && small.UsedSize() == 60;
+			fprintf( file, "check,ring_allocator_oversize,%s\n", oversizePassed ? "pass" : "FAIL" );
+			if (!oversizePassed) ++failures;
+		}
+
+		return failures;
+	}
+
+	// Angle between two unit vectors (degrees). From the sine and cosine, as acos loses the precision of small angles
+	float AngleDegrees( const CVector3& a, const CVector3& b )
+	{
+		return atan2f( Cross( a, b ).Length(), Dot( a, b ) ) * 180.0f / 3.14159265f;
+	}
+
+	// Round trips through the compact G-buffer encodings stay within the error their precision allows: normals
+	// (random directions, the axes and the octahedron's folds), diffuse/specular colours, and world positions
+	// reconstructed from depth for random points in view. Writes the worst error of each. Returns the number of
+	// failures
+	int GBufferChecks( FILE* file )
+	{
+		int failures = 0;
+		srand( 6789 );
+
+		// Normals, the first few are the awkward cases: axes, and directions on the folds and edges of the octahedron
+		const int kNumNormals = 20000;
+		const CVector3 kSpecialNormals[] =
+		{
+			CVector3( 1, 0, 0 ), CVector3( -1, 0, 0 ), CVector3( 0, 1, 0 ), CVector3( 0, -1, 0 ), CVector3( 0, 0, 1 ), CVector3( 0, 0, -1 ),
+			CVector3( 1, 1, 0 ), CVector3( -1, 1, 0 ), CVector3( 1, -1, 0 ), CVector3( -1, -1, 0 ), CVector3( 1, 1, -1 ), CVector3( -1, -1, -1 ),
+		};
+		const int kNumSpecialNormals = sizeof(kSpecialNormals) / sizeof(kSpecialNormals[0]);
+		float maxOctahedral = 0.0f, maxRG16 = 0.0f, maxRGB10A2 = 0.0f;
+		for (int n = 0; n < kNumNormals; ++n)
+		{
+			CVector3 normal;
+			if (n < kNumSpecialNormals)
+			{
+				normal = Normalise( kSpecialNormals[n] );
+			}
+			else
+			{
+				do
+				{
+					normal = CVector3( rand() * 2.0f / RAND_MAX - 1.0f, rand() * 2.0f / RAND_MAX - 1.0f, rand() * 2.0f / RAND_MAX - 1.0f );
+				} while (normal.Length() < 0.1f || normal.Length() > 1.0f);
+				normal = Normalise( normal );
+			}
+			maxOctahedral = max( maxOctahedral, AngleDegrees( normal, OctahedralDecode( OctahedralEncode( normal ) ) ) );
+			maxRG16 = max( maxRG16, AngleDegrees( normal, UnpackNormalRG16( PackNormalRG16( normal ) ) ) );
+			maxRGB10A2 = max( maxRGB10A2, AngleDegrees( normal, UnpackNormalRGB10A2( PackNormalRGB10A2( normal ) ) ) );
+		}
+		bool normalsPassed = (maxOctahedral < 0.001f && maxRG16 < 0.01f && maxRGB10A2 < 0.3f);
+		fprintf( file, "check,gbuffer_normals,%s\n", normalsPassed ? "pass" : "FAIL" );
+		fprintf( file, "error,octahedral_degrees,%.5f\nerror,rg16_degrees,%.5f\nerror,rgb10a2_degrees,%.5f\n", maxOctahedral, maxRG16, maxRGB10A2 );
+		if (!normalsPassed) ++failures;
+
+		// Diffuse and specular are quantised to the nearest of 256 steps
+		float maxColour = 0.0f;
+		for (int c = 0; c < 10000; ++c)
+		{
+			CVector3 diffuse( rand() / static_cast<float>(RAND_MAX), rand() / static_cast<float>(RAND_MAX), rand() / static_cast<float>(RAND_MAX) );
+			float specular = rand() / static_cast<float>(RAND_MAX);
+			CVector3 decodedDiffuse;
+			float decodedSpecular;
+			UnpackDiffuseSpecular( PackDiffuseSpecular( diffuse, specular ), &decodedDiffuse, &decodedSpecular );
+			maxColour = max( maxColour, max( Abs( decodedSpecular - specular ), max( Abs( decodedDiffuse.x - diffuse.x ),
+			                 max( Abs( decodedDiffuse.y - diffuse.y ), Abs( decodedDiffuse.z - diffuse.z ) ) ) ) );
+		}
+		bool colourPassed = (maxColour <= 0.5f / 255.0f + 1e-6f);
+		fprintf( file, "check,gbuffer_colour,%s\nerror,rgba8,%.6f\n", colourPassed ? "pass" : "FAIL", maxColour );
+		if (!colourPassed) ++failures;
+
+		// Positions: a camera with the default settings (45 degree FOV, clip planes 1 to 50000) at a random place and
+		// orientation, and points in view up to 2000 units away. Depth precision falls with distance, so the error is
+		// relative to it
+		const float kFOV = 3.14159265f / 4.0f, kAspect = 4.0f / 3.0f, kNear = 1.0f, kFar = 50000.0f;
+		CMatrix4x4 projMatrix = MatrixIdentity();
+		projMatrix.e11 = 1.0f / tanf( kFOV * 0.5f );
+		projMatrix.e00 = projMatrix.e11 / kAspect;
+		projMatrix.e22 = kFar / (kFar - kNear);
+		projMatrix.e23 = 1.0f;
+		projMatrix.e32 = -kNear * kFar / (kFar - kNear);
+		projMatrix.e33 = 0.0f;
+		float maxPosition = 0.0f;
+		for (int p = 0; p < 10000; ++p)
+		{
+			CMatrix4x4 cameraMatrix = MatrixRotationY( rand() * 6.28f / RAND_MAX ) * MatrixRotationX( rand() * 1.5f / RAND_MAX - 0.75f );
+			cameraMatrix.SetPosition( CVector3( rand() * 2000.0f / RAND_MAX - 1000.0f, rand() * 200.0f / RAND_MAX, rand() * 2000.0f / RAND_MAX - 1000.0f ) );
+
+			// A point in view, then its UV and depth as the rasteriser would give them
+			float viewZ = kNear + 1.0f + rand() * 2000.0f / RAND_MAX;
+			CVector2 projXY( rand() * 2.0f / RAND_MAX - 1.0f, rand() * 2.0f / RAND_MAX - 1.0f );
+			CVector3 viewPosition( projXY.x * viewZ / projMatrix.e00, projXY.y * viewZ / projMatrix.e11, viewZ );
+			CVector3 worldPosition = cameraMatrix.TransformPoint( viewPosition );
+			CVector3 viewCheck = InverseAffine( cameraMatrix ).TransformPoint( worldPosition );
+			float depth = (viewCheck.z * projMatrix.e22 + projMatrix.e32) / viewCheck.z;
+			CVector2 uv( (viewCheck.x * projMatrix.e00 / viewCheck.z) * 0.5f + 0.5f, 0.5f - (viewCheck.y * projMatrix.e11 / viewCheck.z) * 0.5f );
+
+			CVector3 reconstructed = ReconstructWorldPosition( depth, uv, projMatrix, cameraMatrix );
+			maxPosition = max( maxPosition, (reconstructed - worldPosition).Length() / viewZ );
+		}
+		bool positionPassed = (maxPosition < 1e-3f);
+		fprintf( file, "check,gbuffer_position,%s\nerror,position_relative,%.7f\n", positionPassed ? "pass" : "FAIL", maxPosition );
+		if (!positionPassed) ++failures;
+
+		// The compact layouts cut memory and write bandwidth by 6x, and reads by at least 4x with the depth buffer included
+		SGBufferBandwidth wide = GBufferBandwidth( kGBufferFloat, 1280, 960 );
+		SGBufferBandwidth compact = GBufferBandwidth( kGBufferCompact16, 1280, 960 );
+		bool bandwidthPassed = (wide.bytesPerPixel == 48 && compact.bytesPerPixel == 8 && wide.memoryBytes == 1280ull * 960 * 48 &&
+		                        compact.writeBytes * 6 == wide.writeBytes && compact.readBytes * 4 == wide.readBytes &&
+		                        GBufferBandwidth( kGBufferCompact10, 1280, 960 ).memoryBytes == compact.memoryBytes);
+		fprintf( file, "check,gbuffer_bandwidth,%s\n", bandwidthPassed ? "pass" : "FAIL" );
+		if (!bandwidthPassed) ++failures;
+
+		return failures;
+	}
+
+	// Largest difference between two sets of skinned vertices over the position, normal and tangent, and whether the
+	// rest of each vertex matches
+	float SkinMaxError( const SSkinVertexLayout& layout, const vector<TUInt8>& a, const vector<TUInt8>& b, bool* pRestSame )
+	{
+		float maxError = 0.0f;
+		*pRestSame = true;
+		for (size_t offset = 0; offset < a.size(); offset += layout.vertexSize)
+		{
+			TUInt32 offsets[3] = { 0, layout.normalOffset, layout.tangentOffset };
+			for (int e = 0; e < 3; ++e)
+			{
+				const CVector3& va = *reinterpret_cast<const CVector3*>(&a[offset + offsets[e]]);
+				const CVector3& vb = *reinterpret_cast<const CVector3*>(&b[offset + offsets[e]]);
+				maxError = max( maxError, (va - vb).Length() );
+			}
+			*pRestSame = *pRestSame && memcmp( &a[offset + layout.weightsOffset], &b[offset + layout.weightsOffset], 20 ) == 0 &&
+			             memcmp( &a[offset + layout.tangentOffset + 12], &b[offset + layout.tangentOffset + 12], layout.vertexSize - layout.tangentOffset - 12 ) == 0;
+		}
+		return maxError;
+	}
+
+	// Linear blend skinning of the test mesh: the bind pose leaves vertices where they are, turning the root turns
+	// every vertex rigidly whatever its weights, the SSE method matches the scalar one, and batches split for the job
+	// system give the same result as one call. Returns the number of failures
+	int SkinningChecks( FILE* file )
+	{
+		int failures = 0;
+		const TUInt32 kNumVertices = 5000; // Not a multiple of the batch size
+		SSkinTestMesh mesh;
+		MakeSkinTestMesh( kNumVertices, &mesh );
+		TUInt32 numNodes = static_cast<TUInt32>(mesh.nodes.size());
+		vector<CMatrix4x4> palette( numNodes );
+		vector<TUInt8> skinned( mesh.vertices.size() ), reference( mesh.vertices.size() );
+		const SSkinVertexLayout& layout = mesh.layout;
+
+		// Bind pose - every palette matrix is the identity
+		bool restSame;
+		SkinBuildPalette( &mesh.nodes[0], numNodes, 0, &palette[0] );
+		SkinVertices( layout, &mesh.vertices[0], &skinned[0], kNumVertices, &palette[0] );
+		float bindError = SkinMaxError( layout, mesh.vertices, skinned, &restSame );
+		bool bindPassed = (bindError < 1e-5f && restSame);
+		fprintf( file, "check,skinning_bind_pose,%s\nerror,skinning_bind_pose,%.7f\n", bindPassed ? "pass" : "FAIL", bindError );
+		if (!bindPassed) ++failures;
+
+		// Turning the root moves every bone with it, so blending has no effect
+		vector<CMatrix4x4> nodeMatrices( numNodes );
+		for (TUInt32 node = 0; node < numNodes; ++node) nodeMatrices[node] = mesh.nodes[node].positionMatrix;
+		CMatrix4x4 rootMatrix = MatrixRotationY( 0.7f ) * MatrixRotationX( -0.4f ) * MatrixTranslation( CVector3( 3.0f, -2.0f, 5.0f ) );
+		nodeMatrices[0] = rootMatrix;
+		SkinBuildPalette( &mesh.nodes[0], numNodes, &nodeMatrices[0], &palette[0] );
+		SkinVertices( layout, &mesh.vertices[0], &skinned[0], kNumVertices, &palette[0] );
+		for (TUInt32 vert = 0; vert < kNumVertices; ++vert)
+		{
+			TUInt8* vertex = &reference[vert * layout.vertexSize];
+			memcpy( vertex, &mesh.vertices[vert * layout.vertexSize], layout.vertexSize );
+			CVector3* position = reinterpret_cast<CVector3*>(vertex);
+			CVector3* normal = reinterpret_cast<CVector3*>(vertex + layout.normalOffset);
+			CVector3* tangent = reinterpret_cast<CVector3*>(vertex + layout.tangentOffset);
+			*position = rootMatrix.TransformPoint( *position );
+			*normal = rootMatrix.TransformVector( *normal );
+			*tangent = rootMatrix.TransformVector( *tangent );
+		}
+		float rigidError = SkinMaxError( layout, reference, skinned, &restSame );
+		bool rigidPassed = (rigidError < 1e-4f && restSame);
+		fprintf( file, "check,skinning_root_rotation,%s\nerror,skinning_root_rotation,%.7f\n", rigidPassed ? "pass" : "FAIL", rigidError );
+		if (!rigidPassed) ++failures;
+
+		// SSE against scalar, and batched against a single call, for a bent pose
+		SkinTestPose( 2.0f, &nodeMatrices, mesh );
+		SkinBuildPalette( &mesh.nodes[0], numNodes, &nodeMatrices[0], &palette[0] );
+		SkinVertices( layout, &mesh.vertices[0], &reference[0], kNumVertices, &palette[0], kSkinScalar );
+		SkinVertices( layout, &mesh.vertices[0], &skinned[0], kNumVertices, &palette[0], kSkinSSE );
+		float sseError = SkinMaxError( layout, reference, skinned, &restSame );
+		bool ssePassed = (sseError < 1e-4f && restSame);
+		fprintf( file, "check,skinning_sse,%s\nerror,skinning_sse,%.7f\n", ssePassed ? "pass" : "FAIL", sseError );
+		if (!ssePassed) ++failures;
+
+		vector<TUInt8> batched( mesh.vertices.size() );
+		SkinVerticesParallel( layout, &mesh.vertices[0], &batched[0], kNumVertices, &palette[0] );
+		bool batchedPassed = (batched == skinned);
+		fprintf( file, "check,skinning_batches,%s\n", batchedPassed ? "pass" : "FAIL" );
+		if (!batchedPassed) ++failures;
+
+		return failures;
+	}
+
+	// Angle in degrees between the rotations of two unit quaternions
+	float RotationDegrees( const CQuaternion& q0, const CQuaternion& q1 )
+	{
+		CQuaternion difference = (Dot( q0, q1 ) < 0.0f) ? q0 + q1 : q0 - q1;
+		return ToDegrees( 4.0f * asinf( min( Norm( difference ) * 0.5f, 1.0f ) ) );
+	}
+
+	// Animation compression: packed quaternions come back within their stated error, the compressed test clip stays
+	// within the tolerance (plus quantisation) of the original with fewer keys, SSE sampling matches scalar, and
+	// sampling with a cursor - forwards, then jumping back - matches sampling without. Returns the number of failures
+	int AnimationChecks( FILE* file )
+	{
+		int failures = 0;
+
+		srand( 1234 );
+		float packError = 0.0f;
+		for (int i = 0; i < 10000; ++i)
+		{
+			CQuaternion quat( rand() * 2.0f / RAND_MAX - 1.0f, rand() * 2.0f / RAND_MAX - 1.0f,
+			                  rand() * 2.0f / RAND_MAX - 1.0f, rand() * 2.0f / RAND_MAX - 1.0f );
+			if (NormSquared( quat ) < 0.01f) continue;
+			quat.Normalise();
+			packError = max( packError, RotationDegrees( quat, UnpackQuaternion( PackQuaternion( quat ) ) ) );
+		}
+		bool packPassed = (packError < 0.01f);
+		fprintf( file, "check,animation_pack,%s\nerror,animation_pack,%.6f\n", packPassed ? "pass" : "FAIL", packError );
+		if (!packPassed) ++failures;
+
+		// 37 nodes, not a multiple of the four sampled at once by SSE
+		vector<SMeshNode> nodes;
+		SMeshAnimation animation;
+		MakeAnimTestClip( 37, &nodes, &animation );
+		TUInt32 numNodes = static_cast<TUInt32>(nodes.size());
+		SAnimationTolerance tolerance;
+		CAnimationClip clip;
+		clip.Compress( animation, &nodes[0], numNodes, tolerance );
+		TUInt32 originalKeys, originalBytes;
+		AnimationKeyCount( animation, &originalKeys, &originalBytes );
+		SAnimationError error = AnimationError( clip, animation, &nodes[0], 481 );
+		bool errorPassed = (error.rotation < ToDegrees( tolerance.rotation ) + 0.01f && error.position <= tolerance.position * 1.01f &&
+		                    error.scale <= tolerance.scale * 1.01f && clip.GetNumKeys() < originalKeys);
+		fprintf( file, "check,animation_error,%s\nerror,animation_rotation_deg,%.6f\nerror,animation_position,%.6f\n"
+		               "error,animation_keys,%u/%u\n", errorPassed ? "pass" : "FAIL", error.rotation, error.position,
+		         clip.GetNumKeys(), originalKeys );
+		if (!errorPassed) ++failures;
+
+		vector<CQuatTransform> scalar( numNodes ), sse( numNodes ), searched( numNodes );
+		SAnimationCursor cursor;
+		float sseError = 0.0f;
+		bool cursorPassed = true;
+		const float times[] = { 0.0f, 0.5f, 1.01f, 1.5f, 3.99f, 10.0f, 0.2f, 2.0f, -1.0f };
+		for (size_t t = 0; t < sizeof(times) / sizeof(times[0]); ++t)
+		{
+			clip.Sample( times[t], &scalar[0], 0, kAnimSampleScalar );
+			clip.Sample( times[t], &sse[0], &cursor, kAnimSampleSSE );
+			clip.Sample( times[t], &searched[0], 0, kAnimSampleSSE );
+			for (TUInt32 node = 0; node < numNodes; ++node)
+			{
+				sseError = max( sseError, RotationDegrees( scalar[node].quat, sse[node].quat ) );
+				sseError = max( sseError, (scalar[node].pos - sse[node].pos).Length() + (scalar[node].scale - sse[node].scale).Length() );
+				cursorPassed = cursorPassed && memcmp( &sse[node], &searched[node], sizeof(CQuatTransform) ) == 0;
+			}
+		}
+		bool ssePassed = (sseError < 0.001f);
+		fprintf( file, "check,animation_sse,%s\nerror,animation_sse,%.7f\ncheck,animation_cursor,%s\n", ssePassed ? "pass" : "FAIL",
+		         sseError, cursorPassed ? "pass" : "FAIL" );
+		if (!ssePassed) ++failures;
+		if (!cursorPassed) ++failures;
+
+		return failures;
+	}
+
+
+	// Largest difference between any element of two lists of matrices
+	float MaxMatrixDifference( const CMatrix4x4* a, const CMatrix4x4* b, TUInt32 numMatrices )
+	{
+		float difference = 0.0f;
+		for (TUInt32 m = 0; m < numMatrices; ++m)
+		{
+			for (int e = 0; e < 16; ++e)
+			{
+				difference = max( difference, fabsf( (&a[m].e00)[e] - (&b[m].e00)[e] ) );
+			}
+		}
+		return difference;
+	}
+
+	// Hierarchy propagation: for deep, wide and random hierarchies (sizes not a multiple of four), a full update with
+	// the scalar and SSE methods matches the plain matrix reference, and after moving a few nodes an update recomputes
+	// exactly the nodes below them and still matches. Returns the number of failures
+	int HierarchyChecks( FILE* file )
+	{
+		int failures = 0;
+
+		srand( 4321 );
+		float fullError = 0.0f;
+		float movedError = 0.0f;
+		bool movedCountPassed = true;
+		for (int shape = kHierarchyDeep; shape <= kHierarchyMixed; ++shape)
+		{
+			vector<SMeshNode> nodes;
+			MakeHierarchyTestNodes( static_cast<EHierarchyShape>(shape), 203, &nodes );
+			TUInt32 numNodes = static_cast<TUInt32>(nodes.size());
+			vector<CMatrix4x4> localMatrices( numNodes ), reference( numNodes ), world( numNodes );
+			for (TUInt32 node = 0; node < numNodes; ++node) localMatrices[node] = nodes[node].positionMatrix;
+			ConcatenateNodeMatrices( &nodes[0], numNodes, &localMatrices[0], &reference[0] );
+
+			for (int method = kHierarchyScalar; method <= kHierarchySSE; ++method)
+			{
+				CNodeHierarchy hierarchy;
+				hierarchy.Build( &nodes[0], numNodes );
+				hierarchy.Update( static_cast<EHierarchyMethod>(method) );
+				for (TUInt32 node = 0; node < numNodes; ++node) world[node] = hierarchy.GetWorldMatrix( node );
+				fullError = max( fullError, MaxMatrixDifference( &world[0], &reference[0], numNodes ) );
+
+				// Move some nodes, marking every node at or below one of them
+				vector<bool> below( numNodes, false );
+				for (TUInt32 node = 5; node < numNodes; node += 37)
+				{
+					localMatrices[node] = MovedTestMatrix( nodes[node], 0.3f );
+					hierarchy.SetLocalMatrix( node, localMatrices[node] );
+					below[node] = true;
+				}
+				TUInt32 expected = 0;
+				for (TUInt32 node = 0; node < numNodes; ++node)
+				{
+					if (node > 0 && below[nodes[node].parent]) below[node] = true;
+					if (below[node]) ++expected;
+				}
+				TUInt32 updated = hierarchy.Update( static_cast<EHierarchyMethod>(method) );
+				movedCountPassed = movedCountPassed && updated == expected && hierarchy.Update() == 0;
+
+				ConcatenateNodeMatrices( &nodes[0], numNodes, &localMatrices[0], &reference[0] );
+				for (TUInt32 node = 0; node < numNodes; ++node) world[node] = hierarchy.GetWorldMatrix( node );
+				movedError = max( movedError, MaxMatrixDifference( &world[0], &reference[0], numNodes ) );
+
+				// Back to the default matrices for the other method
+				for (TUInt32 node = 0; node < numNodes; ++node) localMatrices[node] = nodes[node].positionMatrix;
+				ConcatenateNodeMatrices( &nodes[0], numNodes, &localMatrices[0], &reference[0] );
+			}
+		}
+
+		// Matrices are not combined in the same order as the reference, and the deep chain is 200 matrices long
+		bool fullPassed = (fullError < 0.001f);
+		bool movedPassed = (movedError < 0.001f && movedCountPassed);
+		fprintf( file, "check,hierarchy_full,%s\nerror,hierarchy_full,%.7f\ncheck,hierarchy_moved,%s\nerror,hierarchy_moved,%.7f\n",
+		         fullPassed ? "pass" : "FAIL", fullError, movedPassed ? "pass" : "FAIL", movedError );
+		if (!fullPassed) ++failures;
+		if (!movedPassed) ++failures;
+
+		return failures;
+	}
+
+
+	// Test image of random bytes - block data need not decode to anything sensible to be copied
+	STextureImage MakeTestImage( DXGI_FORMAT format, TUInt32 width, TUInt32 height, TUInt32 mipLevels )
+	{
+		STextureImage image;
+		image.format = format;
+		image.width = width;
+		image.height = height;
+		image.mipLevels = mipLevels;
+		image.arraySize = 1;
+		image.data.resize( TextureSliceBytes( image ) );
+		for (size_t i = 0; i < image.data.size(); ++i) image.data[i] = static_cast<TUInt8>(rand());
+		return image;
+	}
+
+	// Texture arrays: an image written as a DDS file and read back is unchanged, surface sizes round partial blocks up,
+	// and building arrays from a mix of textures groups only those with the same format, size and mips, each slice a
+	// byte-exact copy of its texture. Returns the number of failures
+	int TextureArrayChecks( FILE* file )
+	{
+		int failures = 0;
+
+		srand( 5678 );
+		STextureImage image = MakeTestImage( DXGI_FORMAT_BC3_UNORM, 20, 12, 3 );
+		image.arraySize = 2;
+		image.data.resize( TextureSliceBytes( image ) * 2, 0x5a );
+		vector<TUInt8> ddsFile;
+		TextureImageToDDS( image, &ddsFile );
+		STextureImage readBack;
+		bool ddsPassed = TextureImageFromDDS( &ddsFile[0], ddsFile.size(), &readBack ) && readBack.format == image.format &&
+		                 readBack.width == image.width && readBack.height == image.height && readBack.mipLevels == image.mipLevels &&
+		                 readBack.arraySize == image.arraySize && readBack.data == image.data &&
+		                 !TextureImageFromDDS( &ddsFile[0], ddsFile.size() - 1, &readBack );
+
+		// 20x12 is 5x3 blocks, then 3x2 and 2x1
+		bool sizesPassed = TextureSliceBytes( image ) == (15 + 6 + 2) * 16 &&
+		                   TextureSurfaceBytes( DXGI_FORMAT_BC1_UNORM, 1, 1 ) == 8 &&
+		                   TextureSurfaceBytes( DXGI_FORMAT_B8G8R8A8_UNORM, 3, 5 ) == 60;
+
+		// Three textures to group, apart from ones differing in format, size or mips and one added twice
+		CTextureArrayBuilder builder;
+		builder.Add( "a", MakeTestImage( DXGI_FORMAT_BC3_UNORM, 16, 16, 2 ) );
+		builder.Add( "bc1", MakeTestImage( DXGI_FORMAT_BC1_UNORM, 16, 16, 2 ) );
+		builder.Add( "b", MakeTestImage( DXGI_FORMAT_BC3_UNORM, 16, 16, 2 ) );
+		builder.Add( "small", MakeTestImage( DXGI_FORMAT_BC3_UNORM, 8, 8, 2 ) );
+		builder.Add( "mips", MakeTestImage( DXGI_FORMAT_BC3_UNORM, 16, 16, 1 ) );
+		builder.Add( "c", MakeTestImage( DXGI_FORMAT_BC3_UNORM, 16, 16, 2 ) );
+		TUInt32 again = builder.Add( "b", MakeTestImage( DXGI_FORMAT_BC3_UNORM, 16, 16, 2 ) );
+		builder.Build();
+
+		bool arraysPassed = again == 2 && builder.GetNumTextures() == 6 && builder.GetNumArrays() == 1 &&
+		                    builder.GetArray( 0 ).arraySize == 3 && builder.GetArrayTextures( 0 ).size() == 3;
+		for (TUInt32 texture = 0; arraysPassed && texture < builder.GetNumTextures(); ++texture)
+		{
+			const STextureArraySlot& slot = builder.GetSlot( texture );
+			const string& name = builder.GetTextureName( texture );
+			bool grouped = (name == "a" || name == "b" || name == "c");
+			if (!grouped)
+			{
+				arraysPassed = (slot.array == kNoTextureArray);
+				continue;
+			}
+			const STextureImage& source = builder.GetTexture( texture );
+			const STextureImage& array = builder.GetArray( slot.array );
+			size_t sliceBytes = TextureSliceBytes( source );
+			arraysPassed = slot.array == 0 && builder.GetArrayTextures( 0 )[slot.slice] == texture &&
+			               memcmp( &array.data[sliceBytes * slot.slice], &source.data[0], sliceBytes ) == 0;
+		}
+
+		fprintf( file, "check,texture_dds,%s\ncheck,texture_sizes,%s\ncheck,texture_arrays,%s\n", ddsPassed ? "pass" : "FAIL",
+		         sizesPassed ? "pass" : "FAIL", arraysPassed ? "pass" : "FAIL" );
+		if (!ddsPassed) ++failures;
+		if (!sizesPassed) ++failures;
+		if (!arraysPassed) ++failures;
+
+		return failures;
+	}
+
+
+	// Test RGBA8 image of smooth gradients in each channel with some noise, alpha a ramp if given
+	STextureImage MakeGradientImage( TUInt32 width, TUInt32 height, bool alpha )
+	{
+		STextureImage image;
+		image.format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		image.width = width;
+		image.height = height;
+		image.mipLevels = 1;
+		image.arraySize = 1;
+		image.data.resize( width * height * 4 );
+		for (TUInt32 y = 0; y < height; ++y)
+		{
+			for (TUInt32 x = 0; x < width; ++x)
+			{
+				TUInt8* pixel = &image.data[(y * width + x) * 4];
+				pixel[0] = static_cast<TUInt8>(x * 255 / width);
+				pixel[1] = static_cast<TUInt8>(y * 255 / height);
+				pixel[2] = static_cast<TUInt8>(min( 128 + 60 * sinf( x * 0.1f + y * 0.05f ) + rand() % 8, 255.0f ));
+				pixel[3] = alpha ? static_cast<TUInt8>((x + y) * 255 / (width + height)) : 255;
+			}
+		}
+		return image;
+	}
+
+	// Block compression: BC1, BC3 and BC5 round trips of gradient images (partial blocks at the edges) are close to the
+	// source, a block of two colours exact in 5:6:5 decodes exactly, the SSE method is as accurate as the scalar one,
+	// compressing across the job system gives the same bytes as on one thread, and formats are chosen by alpha. Returns
+	// the number of failures
+	int BlockCompressionChecks( FILE* file )
+	{
+		int failures = 0;
+
+		// Round trips, scalar and SSE
+		srand( 2468 );
+		STextureImage opaque = MakeGradientImage( 70, 38, false );
+		STextureImage translucent = MakeGradientImage( 70, 38, true );
+		const DXGI_FORMAT formats[] = { DXGI_FORMAT_BC1_UNORM, DXGI_FORMAT_BC3_UNORM, DXGI_FORMAT_BC5_UNORM };
+		const TUInt32 channels[] = { kChannelRed | kChannelGreen | kChannelBlue, kChannelRed | kChannelGreen | kChannelBlue | kChannelAlpha,
+		                             kChannelRed | kChannelGreen };
+		const char* names[] = { "bc1", "bc3", "bc5" };
+		bool methodsPassed = true;
+		for (int f = 0; f < 3; ++f)
+		{
+			const STextureImage& source = (f == 1) ? translucent : opaque;
+			double psnr[2];
+			STextureImage compressed, decompressed;
+			for (int method = kBlockScalar; method <= kBlockSSE; ++method)
+			{
+				bool converted = CompressTextureImage( source, formats[f], &compressed, static_cast<EBlockMethod>(method), false ) &&
+				                 DecompressTextureImage( compressed, &decompressed ) &&
+				                 compressed.data.size() == TextureSurfaceBytes( formats[f], 70, 38 );
+				psnr[method] = converted ? TextureImagePSNR( source, decompressed, channels[f] ) : 0.0;
+			}
+			methodsPassed = methodsPassed && fabs( psnr[kBlockSSE] - psnr[kBlockScalar] ) < 0.05;
+
+			bool passed = (psnr[kBlockSSE] > 35.0);
+			fprintf( file, "check,compress_%s,%s\nerror,compress_%s_psnr,%.2f\n", names[f], passed ? "pass" : "FAIL", names[f], psnr[kBlockSSE] );
+			if (!passed) ++failures;
+		}
+
+		// Two colours exact in 5:6:5, each on half the pixels
+		STextureImage twoColours = MakeGradientImage( 4, 4, false );
+		for (TUInt32 pixel = 0; pixel < 16; ++pixel)
+		{
+			TUInt8* rgba = &twoColours.data[pixel * 4];
+			bool first = ((pixel * 7) % 16) < 8;
+			rgba[0] = first ? 0xff : 0x42;
+			rgba[1] = first ? 0x82 : 0x14;
+			rgba[2] = first ? 0x08 : 0xce;
+		}
+		STextureImage compressed, decompressed;
+		bool exactPassed = CompressTextureImage( twoColours, DXGI_FORMAT_BC1_UNORM, &compressed, kBlockSSE, false ) &&
+		                   DecompressTextureImage( compressed, &decompressed ) && decompressed.data == twoColours.data;
+
+		// Rows of blocks spread over jobs, several per job, give the same bytes
+		STextureImage serial, parallel;
+		STextureImage large = MakeGradientImage( 256, 130, true );
+		JobSystemInit( 3 );
+		bool parallelPassed = CompressTextureImage( large, DXGI_FORMAT_BC3_UNORM, &serial, kBlockSSE, false ) &&
+		                      CompressTextureImage( large, DXGI_FORMAT_BC3_UNORM, &parallel, kBlockSSE, true ) && serial.data == parallel.data;
+		JobSystemShutdown();
+
+		bool formatPassed = ChooseBlockFormat( opaque ) == DXGI_FORMAT_BC1_UNORM && ChooseBlockFormat( translucent ) == DXGI_FORMAT_BC3_UNORM &&
+		                    ChooseBlockFormat( opaque, true ) == DXGI_FORMAT_BC5_UNORM;
+
+		fprintf( file, "check,compress_methods,%s\ncheck,compress_exact,%s\ncheck,compress_parallel,%s\ncheck,compress_format,%s\n",
+		         methodsPassed ? "pass" : "FAIL", exactPassed ? "pass" : "FAIL", parallelPassed ? "pass" : "FAIL", formatPassed ? "pass" : "FAIL" );
+		if (!methodsPassed) ++failures;
+		if (!exactPassed) ++failures;
+		if (!parallelPassed) ++failures;
+		if (!formatPassed) ++failures;
+
+		return failures;
+	}
+
+
+	// Mip generation: a full chain of the right sizes for an odd sized image, a black and white checker averaging to half
+	// intensity in linear light (188 in sRGB, not 128), a flat image staying flat through the Kaiser filter, the SSE method
+	// and jobs giving the same bytes as the scalar method on one thread, and alpha coverage of sparse leaves kept through
+	// the mips where it would otherwise fade. Returns the number of failures
+	int MipGenerationChecks( FILE* file )
+	{
+		int failures = 0;
+
+		SMipSettings box = { kMipBox, true, 0.0f };
+		SMipSettings kaiser = { kMipKaiser, true, 0.0f };
+
+		// 29x42 gives 14x21, 7x10, 3x5, 1x2 and 1x1
+		srand( 1357 );
+		STextureImage odd = MakeGradientImage( 29, 42, true ), mipped;
+		bool sizesPassed = GenerateMips( odd, &mipped, kaiser ) && mipped.mipLevels == 6 &&
+		                   mipped.data.size() == (29 * 42 + 14 * 21 + 7 * 10 + 3 * 5 + 1 * 2 + 1) * 4u &&
+		                   memcmp( &mipped.data[0], &odd.data[0], odd.data.size() ) == 0;
+
+		// Checker of black and white pixels, each 2x2 of the next mip down is half of each
+		STextureImage checker = MakeGradientImage( 4, 4, false );
+		for (TUInt32 pixel = 0; pixel < 16; ++pixel)
+		{
+			TUInt8 value = ((pixel + pixel / 4) % 2 == 0) ? 255 : 0;
+			memset( &checker.data[pixel * 4], value, 3 );
+		}
+		SMipSettings gammaBox = { kMipBox, false, 0.0f };
+		STextureImage gammaMipped;
+		bool linearPassed = GenerateMips( checker, &mipped, box ) && GenerateMips( checker, &gammaMipped, gammaBox ) &&
+		                    mipped.data[64] == 188 && mipped.data[64 + 2] == 188 && gammaMipped.data[64] == 128;
+
+		STextureImage flat = MakeGradientImage( 37, 16, false );
+		for (size_t i = 0; i < flat.data.size(); ++i) flat.data[i] = (i % 4 == 3) ? 255 : static_cast<TUInt8>(90 + 40 * (i % 4));
+		bool flatPassed = GenerateMips( flat, &mipped, kaiser );
+		for (size_t i = 0; flatPassed && i < mipped.data.size(); ++i)
+		{
+			flatPassed = (mipped.data[i] == flat.data[i % 4]);
+		}
+
+		// Sparse leaves: fully opaque on 30% of pixels, otherwise clear, and random colours
+		STextureImage leaves = MakeGradientImage( 128, 96, false );
+		for (size_t i = 0; i < leaves.data.size(); i += 4)
+		{
+			leaves.data[i] = static_cast<TUInt8>(rand());
+			leaves.data[i + 3] = (rand() % 10 < 3) ? 255 : 0;
+		}
+		SMipSettings foliage = { kMipKaiser, true, 0.5f };
+		STextureImage scalar, sse, parallel, faded;
+		bool methodsPassed = GenerateMips( leaves, &scalar, foliage, kMipScalar, false ) && GenerateMips( leaves, &sse, foliage, kMipSSE, false );
+		JobSystemInit( 3 );
+		methodsPassed = methodsPassed && GenerateMips( leaves, &parallel, foliage, kMipSSE, true );
+		JobSystemShutdown();
+		methodsPassed = methodsPassed && scalar.data == sse.data && sse.data == parallel.data;
+
+		GenerateMips( leaves, &faded, kaiser );
+		float coverageError = MaxCoverageError( sse, 0.5f );
+		float fadedError = MaxCoverageError( faded, 0.5f );
+		bool coveragePassed = (coverageError < 0.05f && fadedError > 0.15f);
+
+		fprintf( file, "check,mip_sizes,%s\ncheck,mip_linear,%s\ncheck,mip_flat,%s\ncheck,mip_methods,%s\ncheck,mip_coverage,%s\n"
+		         "error,mip_coverage,%.4f\nerror,mip_coverage_unpreserved,%.4f\n", sizesPassed ? "pass" : "FAIL", linearPassed ? "pass" : "FAIL",
+		         flatPassed ? "pass" : "FAIL", methodsPassed ? "pass" : "FAIL", coveragePassed ? "pass" : "FAIL", coverageError, fadedError );
+		if (!sizesPassed) ++failures;
+		if (!linearPassed) ++failures;
+		if (!flatPassed) ++failures;
+		if (!methodsPassed) ++failures;
+		if (!coveragePassed) ++failures;
+
+		return failures;
+	}
+
+
+	// Light baking: the BVH finding the same hits as testing every triangle, for random rays among random triangles, a vertex
+	// open to the sky lit by exactly the ambient light and its light, a roof shadowing the light and the sky, a vertex in a
+	// corner of two walls seeing about a quarter of the sky, the same lighting baked across jobs as on one thread, and baked
+	// lighting read back from a file only for the number of vertices and the settings it was baked with. Returns the number
+	// of failures
+	int LightBakingChecks( FILE* file )
+	{
+		int failures = 0;
+
+		srand( 8642 );
+		vector<CVector3> corners;
+		for (int triangle = 0; triangle < 500; ++triangle)
+		{
+			CVector3 centre( Random( -20.0f, 20.0f ), Random( -20.0f, 20.0f ), Random( -20.0f, 20.0f ) );
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				corners.push_back( centre + CVector3( Random( -2.0f, 2.0f ), Random( -2.0f, 2.0f ), Random( -2.0f, 2.0f ) ) );
+			}
+		}
+		CTriangleBVH bvh;
+		bvh.Build( &corners[0], 500 );
+		bool bvhPassed = (bvh.GetNumTriangles() == 500);
+		int hits = 0;
+		for (int ray = 0; ray < 2000; ++ray)
+		{
+			CVector3 origin( Random( -25.0f, 25.0f ), Random( -25.0f, 25.0f ), Random( -25.0f, 25.0f ) );
+			CVector3 direction = Normalise( CVector3( Random( -1.0f, 1.0f ), Random( -1.0f, 1.0f ), Random( -1.0f, 1.0f ) ) );
+			TFloat32 maxDistance = Random( 1.0f, 60.0f );
+			bool occluded = TrianglesOccluded( &corners[0], 500, origin, direction, maxDistance );
+			if (bvh.Occluded( origin, direction, maxDistance ) != occluded) bvhPassed = false;
+			if (occluded) ++hits;
+		}
+		bvhPassed = bvhPassed && hits > 100 && hits < 1900; // Enough of both to mean something
+
+		// A vertex facing up at the origin, with a light straight above at half its radius and one triangle well out of the way
+		SBakeSettings settings;
+		SBakeLight light = { CVector3( 0.0f, 10.0f, 0.0f ), 20.0f, CVector3( 1.0f, 0.5f, 0.25f ) };
+		settings.lights.push_back( light );
+		settings.ambientColour = CVector3( 0.1f, 0.2f, 0.3f );
+		settings.occlusionRays = 64;
+		settings.occlusionDistance = 5.0f;
+		settings.rayOffset = 0.001f;
+		CVector3 up( 0.0f, 1.0f, 0.0f );
+		CVector3 vertex( 0.0f, 0.0f, 0.0f );
+		CVector3 scene[] = { CVector3( 50.0f, 0.0f, 0.0f ), CVector3( 51.0f, 0.0f, 0.0f ), CVector3( 50.0f, 1.0f, 0.0f ),
+		                     CVector3( -10.0f, 1.0f, -10.0f ), CVector3( 10.0f, 1.0f, -10.0f ), CVector3( 0.0f, 1.0f, 20.0f ) };
+		CTriangleBVH sceneBVH;
+		sceneBVH.Build( scene, 1 );
+		CVector4 open;
+		BakeVertexLighting( sceneBVH, &vertex, &up, 1, settings, &open, false );
+		CVector3 expected = settings.ambientColour + light.colour * 0.5f;
+		bool openPassed = fabsf( open.x - expected.x ) < 1e-5f && fabsf( open.y - expected.y ) < 1e-5f &&
+		                  fabsf( open.z - expected.z ) < 1e-5f && open.w == 1.0f;
+
+		// The same with a low roof over it, hiding most of the sky within the occlusion distance
+		sceneBVH.Build( scene, 2 );
+		CVector4 roofed;
+		BakeVertexLighting( sceneBVH, &vertex, &up, 1, settings, &roofed, false );
+		bool shadowPassed = roofed.w < 0.25f && fabsf( roofed.x - settings.ambientColour.x * roofed.w ) < 1e-5f;
+
+		// Two walls meeting at a corner just by the vertex, hiding the three quarters of the sky behind them
+		CVector3 walls[] = { CVector3( 0.0f, -1.0f, -1.0f ), CVector3( 0.0f, 10.0f, -1.0f ), CVector3( 0.0f, -1.0f, 20.0f ),
+		                     CVector3( -1.0f, -1.0f, 0.0f ), CVector3( 20.0f, -1.0f, 0.0f ), CVector3( -1.0f, 10.0f, 0.0f ) };
+		CVector3 cornerVertex( 0.01f, 0.0f, 0.01f );
+		sceneBVH.Build( walls, 2 );
+		CVector4 corner;
+		BakeVertexLighting( sceneBVH, &cornerVertex, &up, 1, settings, &corner, false );
+		bool cornerPassed = corner.w > 0.15f && corner.w < 0.35f;
+
+		// Many vertices among the random triangles, on one thread and spread over jobs
+		const TUInt32 numVertices = 1000;
+		vector<CVector3> positions, normals;
+		for (TUInt32 i = 0; i < numVertices; ++i)
+		{
+			positions.push_back( CVector3( Random( -20.0f, 20.0f ), Random( -20.0f, 20.0f ), Random( -20.0f, 20.0f ) ) );
+			normals.push_back( (i % 10 == 0) ? CVector3( 0.0f, 0.0f, 0.0f ) : Normalise( CVector3( Random( -1.0f, 1.0f ), Random( 0.1f, 1.0f ), Random( -1.0f, 1.0f ) ) ) );
+		}
+		settings.lights[0].position = CVector3( 0.0f, 30.0f, 0.0f );
+		settings.lights[0].radius = 60.0f;
+		vector<CVector4> serial( numVertices ), parallel( numVertices );
+		TUInt64 serialRays = BakeVertexLighting( bvh, &positions[0], &normals[0], numVertices, settings, &serial[0], false );
+		JobSystemInit( 3 );
+		TUInt64 parallelRays = BakeVertexLighting( bvh, &positions[0], &normals[0], numVertices, settings, &parallel[0], true );
+		JobSystemShutdown();
+		bool parallelPassed = serialRays == parallelRays && memcmp( &serial[0], &parallel[0], numVertices * sizeof(CVector4) ) == 0;
+
+		// Baked lighting through a file, which must be for the same number of vertices and the same settings. Each change
+		// to the settings or root matrix changes the hash, so the file is rejected
+		const string bakeFileName = "LightBakingCheck.bake";
+		const TUInt32 settingsHash = BakeSettingsHash( settings, CMatrix4x4::kIdentity );
+		vector<CVector4> readBack;
+		bool filePassed = WriteBakedLighting( bakeFileName, settingsHash, serial ) &&
+		                  ReadBakedLighting( bakeFileName, settingsHash, numVertices, &readBack ) && readBack.size() == numVertices &&
+		                  memcmp( &readBack[0], &serial[0], numVertices * sizeof(CVector4) ) == 0 &&
+		                  !ReadBakedLighting( bakeFileName, settingsHash, numVertices + 1, &readBack );
+		const int kNumChanges = 9;
+		for (int change = 0; change < kNumChanges; ++change)
+		{
+			SBakeSettings changed = settings;
+			CMatrix4x4 changedRoot = CMatrix4x4::kIdentity;
+			switch (change)
+			{
+				case 0: changed.lights[0].position.x += 1.0f; break;
+				case 1: changed.lights[0].radius *= 2.0f;     break;
+				case 2: changed.lights[0].colour.y += 0.5f;   break;
+				case 3: changed.lights.push_back( light );    break;
+				case 4: changed.ambientColour.z += 0.1f;      break;
+				case 5: changed.occlusionRays += 1;           break;
+				case 6: changed.occlusionDistance += 1.0f;    break;
+				case 7: changed.rayOffset *= 2.0f;            break;
+				case 8: changedRoot.e31 = 2.0f;               break;
+			}
+			TUInt32 changedHash = BakeSettingsHash( changed, changedRoot );
+			filePassed = filePassed && changedHash != settingsHash && !ReadBakedLighting( bakeFileName, changedHash, numVertices, &readBack );
+		}
+		remove( bakeFileName.c_str() );
+
+		fprintf( file, "check,bake_bvh,%s\ncheck,bake_open,%s\ncheck,bake_shadow,%s\ncheck,bake_corner,%s\ncheck,bake_parallel,%s\n"
+		         "check,bake_file,%s\nerror,bake_corner_open,%.4f\n", bvhPassed ? "pass" : "FAIL", openPassed ? "pass" : "FAIL",
+		         shadowPassed ? "pass" : "FAIL", cornerPassed ? "pass" : "FAIL", parallelPassed ? "pass" : "FAIL", filePassed ? "pass" : "FAIL",
+		         corner.w );
+		if (!bvhPassed) ++failures;
+		if (!openPassed) ++failures;
+		if (!shadowPassed) ++failures;
+		if (!cornerPassed) ++failures;
+		if (!parallelPassed) ++failures;
+		if (!filePassed) ++failures;
+
+		return failures;
+	}
+}
+
+
+// Run the self-checks of the CPU-side modules
+bool RunSelfChecks( const string& fileName )
+{
+	FILE* file = fopen( fileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+
+	int failures = 0;
+	fprintf( file, "type,name,result\n" );
+	failures += RangeAllocatorChecks( file );
+	failures += RingAllocatorChecks( file );
+	failures += GBufferChecks( file );
+	failures += SkinningChecks( file );
+	failures += AnimationChecks( file );
+	failures += HierarchyChecks( file );
+	failures += TextureArrayChecks( file );
+	failures += BlockCompressionChecks( file );
+	failures += MipGenerationChecks( file );
+	failures += LightBakingChecks( file );
+
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success && failures == 0;
+}
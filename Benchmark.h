@@ -0,0 +1,289 @@
+/*******************************************
+	Benchmark.h
+
+	Automated benchmark mode - flies the camera
+	along a scripted path, sweeping the number
+	of lights for each rendering path, and
+	writes frame timings to CSV
+********************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "CVector3.h"
+using namespace gen;
+
+
+//-----------------------------------------------------------------------------
+// Camera path
+//-----------------------------------------------------------------------------
+
+// A Catmull-Rom spline through a list of camera poses. Rotations are Euler angles as used by CCamera
+// (X, Y, Z rotations in radians), they are interpolated directly so avoid wrapping angles between points
+class CCameraPath
+{
+public:
+	// Add a control point to the end of the path
+	void AddPoint( const CVector3& position, const CVector3& rotation );
+
+	// Get the camera pose at a given point along the path, t from 0 (first point) to 1 (last point)
+	void Sample( float t, CVector3* pPosition, CVector3* pRotation ) const;
+
+private:
+	vector<CVector3> m_Positions;
+	vector<CVector3> m_Rotations;
+};
+
+
+//-----------------------------------------------------------------------------
+// Benchmark settings and results
+//-----------------------------------------------------------------------------
+
+// Rendering paths that can be benchmarked
+enum EBenchmarkPath
+{
+	kBenchmarkDeferred,
+	kBenchmarkForward,
+	kBenchmarkHeadless, // CPU-side stages only, no rendering (used when there is no GPU)
+};
+
+// Benchmark settings, normally read from the command line - see ParseBenchmarkCommandLine
+struct SBenchmarkConfig
+{
+	vector<EBenchmarkPath> paths;
+	vector<int>            lightCounts;
+	int                    warmUpFrames;     // Frames discarded at the start of each run
+	int                    measureFrames;    // Frames recorded in each run, the camera covers the whole path in this many frames
+	float                  simulationStep;   // Fixed simulation step, the benchmark runs one per frame so all runs see identical scenes
+	int                    maxCatchUpSteps;  // Most simulation steps run in one frame, time beyond this is dropped
+	int                    maxForwardLights; // Lights beyond this count are not shaded by the forward path (0 for no limit)
+	string                 outputFile;       // Per-frame CSV, summary is written alongside with a "_summary" suffix
+	bool                   headless;         // Don't create a device, only run CPU-side stages
+	bool                   jobBenchmark;     // Run the job system checks and scaling benchmark instead of rendering
+	bool                   selfChecks;       // Run the self-checks of the CPU-side modules instead of rendering
+	bool                   pinThreads;       // Fix job system threads to their own cores
+	bool                   pipelined;        // Render on a separate thread, overlapping the next update
+	float                  targetFrameRate;  // Frame pacing - limit the update rate (0 for no limit)
+	bool                   noAllocations;    // Assert if any heap allocation is made in a steady-state frame
+	string                 recordFile;       // Record input and frame times to this file (see InputReplay.h)
+	string                 replayFile;       // Replay a recording instead of taking live input, timings go to outputFile
+	bool                   updateFirst;      // Serial mode: update then render each frame, rather than render the last update first
+	string                 latencyFile;      // Write input-to-present latency histograms here on exit (see InputLatency.h)
+	string                 memoryReportFile; // Write a memory report (.json and .csv) here once the scene is loaded (see MemoryAccounting.h)
+	string                 memoryBudgets;    // Memory budgets, e.g. "textures=256,gpu=512" (megabytes, see MemorySetBudgets)
+	int                    numInstances;     // Cargo containers placed around the level as instances of one mesh (see MeshInstances.h)
+	bool                   staticBatching;   // Merge the level's sub-meshes into static batches (see CMesh::BuildStaticBatches)
+	float                  batchSize;        // Largest spatial size of a static batch (world units, 0 for no limit)
+	string                 batchReportFile;  // Write the draw counts before and after static batching here once the scene is loaded
+	bool                   textureArrays;    // Share the level's diffuse maps as texture arrays (see CMesh::BuildTextureArrays)
+	string                 texArrayReport;   // Write the level's texture changes with and without texture arrays here once the scene is loaded
+	string                 texArrayBuild;    // Build texture array files from the diffuse maps of this X-file instead of rendering
+	bool                   instancing;       // Draw visible instances of the same mesh with hardware instancing (see CMeshInstanceStore::Render)
+	int                    instanceBench;    // Time submitting this many instances with and without hardware instancing instead of rendering (0 for off)
+	bool                   splitPositions;   // Load meshes with positions in a vertex stream of their own (see CMesh::Load)
+	bool                   depthPrePass;     // Render the level's depth before the G-buffer pass (see CMesh::RenderPositions)
+	string                 gBufferLayout;    // Name of the G-buffer layout (see GBufferLayout.h)
+	string                 gBufferReport;    // Write the memory and bandwidth of each G-buffer layout here once the device is created
+	int                    skinBench;        // Time CPU skinning of a test mesh with this many vertices instead of rendering (0 for off)
+	int                    animBench;        // Time sampling a test animation of this many nodes instead of rendering (0 for off)
+	int                    hierBench;        // Time world matrix propagation of test hierarchies of this many nodes instead of rendering (0 for off)
+	bool                   compressTextures; // Block compress uncompressed textures on the CPU as they load (see ReadProcessedTexture)
+	string                 compressBench;    // Time block compression of these images (comma separated, or "all") instead of rendering
+	bool                   generateMips;     // Generate mips on the CPU for textures without them as they load (see ReadProcessedTexture)
+	string                 mipBench;         // Time mip generation of these images (comma separated, or "all") instead of rendering
+	bool                   bakedLighting;    // Light the level with its static lighting baked into vertex colours (see LightBaking.h)
+	string                 bakeLighting;     // Bake the static lighting of this X-file instead of rendering
+
+	SBenchmarkConfig();
+};
+
+// Timings for a single measured frame (seconds)
+struct SBenchmarkFrame
+{
+	float frameTime;
+	float updateTime;
+	float renderTime;
+	float latency; // From the start of a frame's update until it is presented
+	unsigned int allocations; // Heap allocations made during the frame (all threads)
+};
+
+// Percentile summary of one run (milliseconds)
+struct SBenchmarkSummary
+{
+	float mean, p50, p95, p99, max;
+};
+
+
+// Parse benchmark options from the command line. Returns true if benchmark mode was requested
+// Options:  -benchmark                Enable benchmark mode
+//           -headless                 Run CPU-side stages only (implied if there is no GPU)
+//           -lights 1,100,1000        Light counts to sweep
+//           -paths deferred,forward   Rendering paths to benchmark
+//           -frames 600 -warmup 60    Measured and discarded frames per run
+//           -out Benchmark.csv        Output file
+//           -jobbench                 Job system stress checks and thread scaling (see RunJobSystemBenchmark)
+//           -checks                   Self-checks of the CPU-side modules (see RunSelfChecks)
+//           -pin                      Pin job system threads to cores
+//           -pipelined -fps 60        Pipelined update/render threads, and an update rate limit
+//           -simrate 60 -catchup 4    Simulation steps per second, and the most steps run to catch up in one frame
+//           -noalloc                  Assert there are no heap allocations once the frame loop is warmed up
+//           -record Session.rec       Record input and frame times for later replay
+//           -replay Session.rec       Replay a recording, -out defaults to Replay.csv (not used with -benchmark)
+//           -updatefirst              Render each frame straight after its update instead of at the start of the next frame
+//           -latency Latency.csv      Measure input-to-present latency and write histograms on exit
+//           -memreport Memory         Write Memory.json and Memory.csv, memory used by each asset, once the scene is loaded
+//           -membudget gpu=512        Memory budgets in megabytes by category name, cpu, gpu or heap, checked in memory reports
+//           -instances 500            Place this many cargo containers, all instances of one mesh
+//           -nobatch                  Draw the level's sub-meshes one by one rather than in static batches
+//           -batchsize 200            Largest spatial size of a static batch, to keep batches small enough to cull
+//           -batchreport Batching.csv Write the level's draw counts with and without static batching once the scene is loaded
+//           -texarrays                Share the level's diffuse maps of the same format and size as texture arrays
+//           -texarrayreport Tex.csv   Write the level's texture changes with and without texture arrays once the scene is loaded
+//           -texarraybuild Level2.x   Write texture arrays of an X-file's diffuse maps beside it, report to -out (see TextureArrays.h)
+//           -noinstancing             Draw mesh instances one at a time rather than with hardware instancing
+//           -instancebench 10000      Time the CPU submission of this many instances with and without instancing, results to -out
+//           -splitpositions           Keep vertex positions in a separate stream from the other vertex data
+//           -depthprepass             Lay down the level's depth before the G-buffer pass, reading positions only
+//           -gbuffer compact16        G-buffer layout: float (default), compact16 or compact10 (see GBufferLayout.h)
+//           -gbufferreport GBuf.csv   Write the memory and bandwidth of each G-buffer layout at the window size
+//           -skinbench 100000         Time CPU skinning of this many vertices, scalar, SSE and SSE across threads, results to -out
+//           -animbench 256            Compress a test animation of this many nodes, report its error and sampling speed to -out
+//           -hierbench 4096           Time world matrix propagation of deep and wide hierarchies of this many nodes, results to -out
+//           -compresstextures         Block compress the sky, container and light textures to BC1/BC3 on the CPU as they load
+//           -compressbench all        Time BC1/BC3/BC5 compression of these images (or all the repository's), results to -out
+//           -genmips                  Generate mips for textures loaded without them (JPEGs, PNGs and the level's DDS files)
+//           -mipbench all             Time mip generation of these images (or the repository's) against naive filtering, results to -out
+//           -bakedlighting            Light the level with static lighting and ambient occlusion baked into its vertex colours
+//           -bakelighting Level2.x    Bake an X-file's static lighting beside it, placed as the level, timings to -out (see LightBaking.h)
+bool ParseBenchmarkCommandLine( const string& commandLine, SBenchmarkConfig* pConfig );
+
+// Calculate summary statistics for a list of times (seconds in, milliseconds out)
+SBenchmarkSummary SummariseTimes( vector<float> times );
+
+// Write the timings of every frame of a replay to a CSV file, with a one-line summary written
+// alongside with a "_summary" suffix. Returns false on a file error
+bool WriteFrameTimings( const string& fileName, const vector<SBenchmarkFrame>& frames );
+
+// Stress check the job system (many small jobs, nested jobs waiting on their children, ParallelFor
+// coverage and chained stages), then time a ParallelFor workload with 1 thread up to one per
+// hardware thread. Results are written to the given CSV file. Returns false if any check fails
+// or the file cannot be written. The job system must not be running when this is called
+bool RunJobSystemBenchmark( const string& fileName, bool pinThreads );
+
+// Time linear blend skinning (see Skinning.h) of a test mesh with the given number of vertices: the
+// scalar and SSE methods on one thread, then SSE batches across the job system with 1 thread up to
+// one per hardware thread, in vertices per second. Results are written to the given CSV file.
+// Returns false if the file cannot be written. The job system must not be running
+bool RunSkinningBenchmark( const string& fileName, int numVertices, bool pinThreads );
+
+// Compress a test animation of the given number of nodes (see Animation.h), then time sampling poses
+// from the original keys and from the compressed clip with the scalar and SSE methods. Results are
+// written to the given CSV file with the key counts, memory and largest error of the clip against the
+// original. Returns false if the file cannot be written
+bool RunAnimationBenchmark( const string& fileName, int numNodes );
+
+// Time world matrix propagation (see Hierarchy.h) of a deep and a wide test hierarchy of the given number
+// of nodes: a full recompute with plain matrices, then with CNodeHierarchy scalar and SSE, and finally
+// with only a few nodes moved each update. Results are written to the given CSV file. Returns false if
+// the file cannot be written
+bool RunHierarchyBenchmark( const string& fileName, int numNodes );
+
+// Compress each of a comma separated list of image files (or "all" for the repository's JPEG and PNG images and some
+// uncompressed DDS maps) with the block format ChooseBlockFormat picks - BC5 for files named as normal maps - using the
+// scalar and SSE methods on one thread, then SSE across the job system with 1 thread up to one per hardware thread, in
+// megapixels per second. The PSNR of each result decoded against the source is written too. Results are written to the
+// given CSV file. Returns false if an image can't be read or the file cannot be written. The job system must not be running
+bool RunCompressionBenchmark( const string& fileName, const string& imageList, bool pinThreads );
+
+// Generate mips for each of a comma separated list of image files (or "all" for the repository's JPEG and PNG images and
+// the alpha tested foliage) with the settings MipSettingsForFile gives: a naive 8-bit box filter in gamma space first,
+// then the box and Kaiser filters with the scalar and SSE methods on one thread, then Kaiser across the job system with 1
+// thread up to one per hardware thread, and finally every image at once with the job system running over images as well
+// as rows. Speedups are over the scalar method with the same filter (the naive filter is cheaper but mixes colours in
+// gamma space and loses alpha coverage). The largest change in alpha coverage over the mips is written for alpha tested
+// images. Results are written to the given CSV file. Returns false if an image can't be read or the file cannot be
+// written. The job system must not be running
+bool RunMipBenchmark( const string& fileName, const string& imageList, bool pinThreads );
+
+// Check the CPU-side modules that can be tested without a device (currently the range allocator
+// used by the geometry pool). Results are written to the given CSV file. Returns false if any
+// check fails or the file cannot be written
+bool RunSelfChecks( const string& fileName );
+
+
+//-----------------------------------------------------------------------------
+// Benchmark class
+//-----------------------------------------------------------------------------
+
+// Steps through every combination of rendering path and light count. The main loop queries the
+// current run settings and camera pose each frame, then reports the frame timings back
+class CBenchmark
+{
+public:
+	CBenchmark( const SBenchmarkConfig& config, const CCameraPath& cameraPath );
+
+	// Has every run completed
+	bool IsFinished() const
+	{
+		return m_Run >= NumRuns();
+	}
+
+	// Is this the first frame of a new run - the scene should be reset to the run settings
+	bool IsNewRun() const
+	{
+		return m_Frame == 0;
+	}
+
+	// Settings for the current run
+	EBenchmarkPath RunPath() const;
+	int            RunLightCount() const;
+
+	// Fixed simulation step to use instead of the real frame time
+	float SimulationStep() const
+	{
+		return m_Config.simulationStep;
+	}
+
+	// Camera pose for the current frame
+	void CameraPose( CVector3* pPosition, CVector3* pRotation ) const;
+
+	// Record timings for the frame just finished (seconds) and move on to the next frame
+	void EndFrame( const SBenchmarkFrame& timings );
+
+	// Short description of progress, e.g. for the window title. Written into the given buffer so it
+	// can be called every frame without allocating
+	void ProgressText( char* text, int size ) const;
+
+	// Write per-frame and summary CSV files, returns false on a file error
+	bool WriteResults() const;
+
+	// Name of a rendering path as written to the results
+	static const char* PathName( EBenchmarkPath path );
+
+private:
+	int NumRuns() const
+	{
+		return static_cast<int>(m_Config.paths.size() * m_Config.lightCounts.size());
+	}
+
+	// Results of a single run (path & light count)
+	struct SRunResults
+	{
+		EBenchmarkPath          path;
+		int                     lightCount;
+		vector<SBenchmarkFrame> frames;
+	};
+
+	// Number of lights that actually affect shading in a run
+	int ShadedLights( EBenchmarkPath path, int lightCount ) const;
+
+	SBenchmarkConfig    m_Config;
+	CCameraPath         m_CameraPath;
+
+	int                 m_Run;   // Current run index
+	int                 m_Frame; // Frame within current run, including warm-up frames
+	vector<SRunResults> m_Results;
+};
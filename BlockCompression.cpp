@@ -0,0 +1,954 @@
+/*******************************************
+	BlockCompression.cpp
+
+	BC1/BC3/BC5 encoding and decoding
+********************************************/
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <emmintrin.h>
+#include <wincodec.h>
+using namespace std;
+
+#include "BlockCompression.h"
+#include "JobSystem.h"
+
+#pragma comment(lib, "windowscodecs.lib")
+
+
+//-----------------------------------------------------------------------------
+// Blocks
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// The channels of a 4x4 block's pixels as floats, pixels in rows
+	struct SBlock
+	{
+		float r[16];
+		float g[16];
+		float b[16];
+		float a[16];
+	};
+
+	// What is encoded in each block of a format
+	enum EBlockKind
+	{
+		kBlockBC1, // Colour
+		kBlockBC3, // Alpha as BC4, then colour
+		kBlockBC5, // Red as BC4, then green as BC4
+		kBlockNone,
+	};
+
+	EBlockKind BlockKind( DXGI_FORMAT format )
+	{
+		switch (format)
+		{
+			case DXGI_FORMAT_BC1_UNORM: case DXGI_FORMAT_BC1_UNORM_SRGB: return kBlockBC1;
+			case DXGI_FORMAT_BC3_UNORM: case DXGI_FORMAT_BC3_UNORM_SRGB: return kBlockBC3;
+			case DXGI_FORMAT_BC5_UNORM:                                  return kBlockBC5;
+			default:                                                     return kBlockNone;
+		}
+	}
+
+	// Copy the pixels of the block at (blockX, blockY) of an RGBA8 mip, repeating the last row and column for
+	// partial blocks at the edges
+	void GatherBlock( const TUInt8* pixels, TUInt32 width, TUInt32 height, TUInt32 blockX, TUInt32 blockY, TUInt32* block )
+	{
+		for (TUInt32 y = 0; y < 4; ++y)
+		{
+			const TUInt8* row = pixels + static_cast<size_t>(min( blockY * 4 + y, height - 1 )) * width * 4;
+			if (blockX * 4 + 4 <= width)
+			{
+				memcpy( block + y * 4, row + blockX * 16, 16 );
+				continue;
+			}
+			for (TUInt32 x = 0; x < 4; ++x)
+			{
+				memcpy( block + y * 4 + x, row + min( blockX * 4 + x, width - 1 ) * 4, 4 );
+			}
+		}
+	}
+
+	// 5:6:5 colour from 8-bit channels, rounded to nearest
+	TUInt32 Pack565( float r, float g, float b )
+	{
+		int r5 = static_cast<int>(max( min( r, 255.0f ), 0.0f ) * (31.0f / 255.0f) + 0.5f);
+		int g6 = static_cast<int>(max( min( g, 255.0f ), 0.0f ) * (63.0f / 255.0f) + 0.5f);
+		int b5 = static_cast<int>(max( min( b, 255.0f ), 0.0f ) * (31.0f / 255.0f) + 0.5f);
+		return (r5 << 11) | (g6 << 5) | b5;
+	}
+
+	// 8-bit channels of a 5:6:5 colour, bits replicated as decoders do
+	void Unpack565( TUInt32 colour, int* rgb )
+	{
+		int r5 = (colour >> 11) & 31;
+		int g6 = (colour >> 5) & 63;
+		int b5 = colour & 31;
+		rgb[0] = (r5 << 3) | (r5 >> 2);
+		rgb[1] = (g6 << 2) | (g6 >> 4);
+		rgb[2] = (b5 << 3) | (b5 >> 2);
+	}
+
+	// Colours of a BC1 block in four colour mode: the endpoints, then two thirds and one third of the way from the first
+	void ColourPalette( TUInt32 colour0, TUInt32 colour1, int palette[4][3] )
+	{
+		Unpack565( colour0, palette[0] );
+		Unpack565( colour1, palette[1] );
+		for (int c = 0; c < 3; ++c)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+	}
+
+	// BC4 index of each step from the lower endpoint (0) to the upper (7), in eight value mode
+	const TUInt32 kChannelIndices[8] = { 1, 7, 6, 5, 4, 3, 2, 0 };
+}
+
+
+//-----------------------------------------------------------------------------
+// Scalar kernels
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	void SplitChannelsScalar( const TUInt32* pixels, SBlock* block )
+	{
+		for (int i = 0; i < 16; ++i)
+		{
+			block->r[i] = static_cast<float>(pixels[i] & 0xff);
+			block->g[i] = static_cast<float>((pixels[i] >> 8) & 0xff);
+			block->b[i] = static_cast<float>((pixels[i] >> 16) & 0xff);
+			block->a[i] = static_cast<float>(pixels[i] >> 24);
+		}
+	}
+
+	// Mean colour and the covariance of the colours about it (rr, rg, rb, gg, gb, bb)
+	void ColourStatsScalar( const SBlock& block, float* mean, float* covariance )
+	{
+		mean[0] = mean[1] = mean[2] = 0.0f;
+		for (int i = 0; i < 16; ++i)
+		{
+			mean[0] += block.r[i];
+			mean[1] += block.g[i];
+			mean[2] += block.b[i];
+		}
+		mean[0] /= 16.0f;
+		mean[1] /= 16.0f;
+		mean[2] /= 16.0f;
+
+		for (int c = 0; c < 6; ++c) covariance[c] = 0.0f;
+		for (int i = 0; i < 16; ++i)
+		{
+			float r = block.r[i] - mean[0];
+			float g = block.g[i] - mean[1];
+			float b = block.b[i] - mean[2];
+			covariance[0] += r * r;
+			covariance[1] += r * g;
+			covariance[2] += r * b;
+			covariance[3] += g * g;
+			covariance[4] += g * b;
+			covariance[5] += b * b;
+		}
+	}
+
+	// Smallest and largest distance of the colours along an axis through the mean
+	void ProjectColoursScalar( const SBlock& block, const float* mean, const float* axis, float* pMin, float* pMax )
+	{
+		float minT = 1e30f, maxT = -1e30f;
+		for (int i = 0; i < 16; ++i)
+		{
+			float t = (block.r[i] - mean[0]) * axis[0] + (block.g[i] - mean[1]) * axis[1] + (block.b[i] - mean[2]) * axis[2];
+			minT = min( minT, t );
+			maxT = max( maxT, t );
+		}
+		*pMin = minT;
+		*pMax = maxT;
+	}
+
+	// Nearest palette colour to each pixel, returns the total squared error
+	float SelectColourIndicesScalar( const SBlock& block, const int palette[4][3], TUInt32* indices )
+	{
+		float error = 0.0f;
+		for (int i = 0; i < 16; ++i)
+		{
+			float best = 0.0f;
+			for (TUInt32 p = 0; p < 4; ++p)
+			{
+				float r = block.r[i] - palette[p][0];
+				float g = block.g[i] - palette[p][1];
+				float b = block.b[i] - palette[p][2];
+				float distance = r * r + g * g + b * b;
+				if (p == 0 || distance < best)
+				{
+					best = distance;
+					indices[i] = p;
+				}
+			}
+			error += best;
+		}
+		return error;
+	}
+
+	void ChannelRangeScalar( const float* values, float* pMin, float* pMax )
+	{
+		float minV = values[0], maxV = values[0];
+		for (int i = 1; i < 16; ++i)
+		{
+			minV = min( minV, values[i] );
+			maxV = max( maxV, values[i] );
+		}
+		*pMin = minV;
+		*pMax = maxV;
+	}
+
+	// Step from the lower endpoint of the nearest of the eight evenly spaced values to each value
+	void ChannelStepsScalar( const float* values, float lower, float scale, TUInt32* steps )
+	{
+		for (int i = 0; i < 16; ++i)
+		{
+			steps[i] = static_cast<TUInt32>((values[i] - lower) * scale + 0.5f);
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// SSE kernels
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	float HorizontalSum( __m128 v )
+	{
+		__m128 sum = _mm_add_ps( v, _mm_movehl_ps( v, v ) );
+		sum = _mm_add_ss( sum, _mm_shuffle_ps( sum, sum, _MM_SHUFFLE(1, 1, 1, 1) ) );
+		return _mm_cvtss_f32( sum );
+	}
+
+	float HorizontalMin( __m128 v )
+	{
+		__m128 result = _mm_min_ps( v, _mm_movehl_ps( v, v ) );
+		result = _mm_min_ss( result, _mm_shuffle_ps( result, result, _MM_SHUFFLE(1, 1, 1, 1) ) );
+		return _mm_cvtss_f32( result );
+	}
+
+	float HorizontalMax( __m128 v )
+	{
+		__m128 result = _mm_max_ps( v, _mm_movehl_ps( v, v ) );
+		result = _mm_max_ss( result, _mm_shuffle_ps( result, result, _MM_SHUFFLE(1, 1, 1, 1) ) );
+		return _mm_cvtss_f32( result );
+	}
+
+	// Four pixels at a time, each channel masked out of the packed 32-bit values
+	void SplitChannelsSSE( const TUInt32* pixels, SBlock* block )
+	{
+		const __m128i mask = _mm_set1_epi32( 0xff );
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128i packed = _mm_loadu_si128( reinterpret_cast<const __m128i*>(pixels + i) );
+			_mm_storeu_ps( block->r + i, _mm_cvtepi32_ps( _mm_and_si128( packed, mask ) ) );
+			_mm_storeu_ps( block->g + i, _mm_cvtepi32_ps( _mm_and_si128( _mm_srli_epi32( packed, 8 ), mask ) ) );
+			_mm_storeu_ps( block->b + i, _mm_cvtepi32_ps( _mm_and_si128( _mm_srli_epi32( packed, 16 ), mask ) ) );
+			_mm_storeu_ps( block->a + i, _mm_cvtepi32_ps( _mm_srli_epi32( packed, 24 ) ) );
+		}
+	}
+
+	void ColourStatsSSE( const SBlock& block, float* mean, float* covariance )
+	{
+		__m128 sumR = _mm_setzero_ps(), sumG = _mm_setzero_ps(), sumB = _mm_setzero_ps();
+		for (int i = 0; i < 16; i += 4)
+		{
+			sumR = _mm_add_ps( sumR, _mm_loadu_ps( block.r + i ) );
+			sumG = _mm_add_ps( sumG, _mm_loadu_ps( block.g + i ) );
+			sumB = _mm_add_ps( sumB, _mm_loadu_ps( block.b + i ) );
+		}
+		mean[0] = HorizontalSum( sumR ) / 16.0f;
+		mean[1] = HorizontalSum( sumG ) / 16.0f;
+		mean[2] = HorizontalSum( sumB ) / 16.0f;
+
+		__m128 meanR = _mm_set1_ps( mean[0] ), meanG = _mm_set1_ps( mean[1] ), meanB = _mm_set1_ps( mean[2] );
+		__m128 rr = _mm_setzero_ps(), rg = _mm_setzero_ps(), rb = _mm_setzero_ps();
+		__m128 gg = _mm_setzero_ps(), gb = _mm_setzero_ps(), bb = _mm_setzero_ps();
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128 r = _mm_sub_ps( _mm_loadu_ps( block.r + i ), meanR );
+			__m128 g = _mm_sub_ps( _mm_loadu_ps( block.g + i ), meanG );
+			__m128 b = _mm_sub_ps( _mm_loadu_ps( block.b + i ), meanB );
+			rr = _mm_add_ps( rr, _mm_mul_ps( r, r ) );
+			rg = _mm_add_ps( rg, _mm_mul_ps( r, g ) );
+			rb = _mm_add_ps( rb, _mm_mul_ps( r, b ) );
+			gg = _mm_add_ps( gg, _mm_mul_ps( g, g ) );
+			gb = _mm_add_ps( gb, _mm_mul_ps( g, b ) );
+			bb = _mm_add_ps( bb, _mm_mul_ps( b, b ) );
+		}
+		covariance[0] = HorizontalSum( rr );
+		covariance[1] = HorizontalSum( rg );
+		covariance[2] = HorizontalSum( rb );
+		covariance[3] = HorizontalSum( gg );
+		covariance[4] = HorizontalSum( gb );
+		covariance[5] = HorizontalSum( bb );
+	}
+
+	void ProjectColoursSSE( const SBlock& block, const float* mean, const float* axis, float* pMin, float* pMax )
+	{
+		__m128 meanR = _mm_set1_ps( mean[0] ), meanG = _mm_set1_ps( mean[1] ), meanB = _mm_set1_ps( mean[2] );
+		__m128 axisR = _mm_set1_ps( axis[0] ), axisG = _mm_set1_ps( axis[1] ), axisB = _mm_set1_ps( axis[2] );
+		__m128 minT = _mm_set1_ps( 1e30f ), maxT = _mm_set1_ps( -1e30f );
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128 t = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( block.r + i ), meanR ), axisR ),
+			                                   _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( block.g + i ), meanG ), axisG ) ),
+			                                   _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( block.b + i ), meanB ), axisB ) );
+			minT = _mm_min_ps( minT, t );
+			maxT = _mm_max_ps( maxT, t );
+		}
+		*pMin = HorizontalMin( minT );
+		*pMax = HorizontalMax( maxT );
+	}
+
+	// Distance to every palette colour for four pixels, keeping the nearest. Ties keep the lower index, as the scalar version
+	float SelectColourIndicesSSE( const SBlock& block, const int palette[4][3], TUInt32* indices )
+	{
+		__m128 paletteR[4], paletteG[4], paletteB[4];
+		for (int p = 0; p < 4; ++p)
+		{
+			paletteR[p] = _mm_set1_ps( static_cast<float>(palette[p][0]) );
+			paletteG[p] = _mm_set1_ps( static_cast<float>(palette[p][1]) );
+			paletteB[p] = _mm_set1_ps( static_cast<float>(palette[p][2]) );
+		}
+
+		__m128 error = _mm_setzero_ps();
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128 r = _mm_loadu_ps( block.r + i );
+			__m128 g = _mm_loadu_ps( block.g + i );
+			__m128 b = _mm_loadu_ps( block.b + i );
+			__m128 best = _mm_setzero_ps();
+			__m128i index = _mm_setzero_si128();
+			for (int p = 0; p < 4; ++p)
+			{
+				__m128 dr = _mm_sub_ps( r, paletteR[p] );
+				__m128 dg = _mm_sub_ps( g, paletteG[p] );
+				__m128 db = _mm_sub_ps( b, paletteB[p] );
+				__m128 distance = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dr, dr ), _mm_mul_ps( dg, dg ) ), _mm_mul_ps( db, db ) );
+				if (p == 0)
+				{
+					best = distance;
+					continue;
+				}
+				__m128i closer = _mm_castps_si128( _mm_cmplt_ps( distance, best ) );
+				best = _mm_min_ps( best, distance );
+				index = _mm_or_si128( _mm_andnot_si128( closer, index ), _mm_and_si128( closer, _mm_set1_epi32( p ) ) );
+			}
+			error = _mm_add_ps( error, best );
+			_mm_storeu_si128( reinterpret_cast<__m128i*>(indices + i), index );
+		}
+		return HorizontalSum( error );
+	}
+
+	void ChannelRangeSSE( const float* values, float* pMin, float* pMax )
+	{
+		__m128 v0 = _mm_loadu_ps( values ),     v1 = _mm_loadu_ps( values + 4 );
+		__m128 v2 = _mm_loadu_ps( values + 8 ), v3 = _mm_loadu_ps( values + 12 );
+		*pMin = HorizontalMin( _mm_min_ps( _mm_min_ps( v0, v1 ), _mm_min_ps( v2, v3 ) ) );
+		*pMax = HorizontalMax( _mm_max_ps( _mm_max_ps( v0, v1 ), _mm_max_ps( v2, v3 ) ) );
+	}
+
+	void ChannelStepsSSE( const float* values, float lower, float scale, TUInt32* steps )
+	{
+		__m128 lowerV = _mm_set1_ps( lower ), scaleV = _mm_set1_ps( scale ), half = _mm_set1_ps( 0.5f );
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128 t = _mm_add_ps( _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( values + i ), lowerV ), scaleV ), half );
+			_mm_storeu_si128( reinterpret_cast<__m128i*>(steps + i), _mm_cvttps_epi32( t ) );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Block encoding
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Principal axis of a block's colours, the eigenvector of their covariance with the largest eigenvalue, found
+	// by power iteration from the covariance row with the largest diagonal. Flat blocks get the grey axis
+	void PrincipalAxis( const float* covariance, float* axis )
+	{
+		const float matrix[3][3] = { { covariance[0], covariance[1], covariance[2] },
+		                             { covariance[1], covariance[3], covariance[4] },
+		                             { covariance[2], covariance[4], covariance[5] } };
+		int start = 0;
+		if (matrix[1][1] > matrix[start][start]) start = 1;
+		if (matrix[2][2] > matrix[start][start]) start = 2;
+		float v[3] = { matrix[start][0], matrix[start][1], matrix[start][2] };
+
+		for (int iteration = 0; iteration < 8; ++iteration)
+		{
+			float w[3];
+			for (int row = 0; row < 3; ++row)
+			{
+				w[row] = matrix[row][0] * v[0] + matrix[row][1] * v[1] + matrix[row][2] * v[2];
+			}
+			float largest = max( max( fabsf( w[0] ), fabsf( w[1] ) ), fabsf( w[2] ) );
+			if (largest < 1e-12f) break;
+			for (int c = 0; c < 3; ++c) v[c] = w[c] / largest;
+		}
+
+		float length = sqrtf( v[0] * v[0] + v[1] * v[1] + v[2] * v[2] );
+		if (length < 1e-6f)
+		{
+			axis[0] = axis[1] = axis[2] = 0.57735027f;
+			return;
+		}
+		for (int c = 0; c < 3; ++c) axis[c] = v[c] / length;
+	}
+
+	// Endpoints fitting the colours best in the least squares sense for the given indices, as 5:6:5 colours. Returns
+	// false if every pixel has the same index, leaving nothing to fit
+	bool RefineEndpoints( const SBlock& block, const TUInt32* indices, TUInt32* pColour0, TUInt32* pColour1 )
+	{
+		static const float kWeights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f }; // Of the first endpoint
+
+		float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+		float ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; ++i)
+		{
+			float a = kWeights[indices[i]];
+			float b = 1.0f - a;
+			aa += a * a;
+			bb += b * b;
+			ab += a * b;
+			ax[0] += a * block.r[i]; ax[1] += a * block.g[i]; ax[2] += a * block.b[i];
+			bx[0] += b * block.r[i]; bx[1] += b * block.g[i]; bx[2] += b * block.b[i];
+		}
+		float determinant = aa * bb - ab * ab;
+		if (fabsf( determinant ) < 1e-6f)
+		{
+			return false;
+		}
+
+		float colour0[3], colour1[3];
+		for (int c = 0; c < 3; ++c)
+		{
+			colour0[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+			colour1[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+		}
+		*pColour0 = Pack565( colour0[0], colour0[1], colour0[2] );
+		*pColour1 = Pack565( colour1[0], colour1[1], colour1[2] );
+		return true;
+	}
+
+	// Encode the colour of a block as a BC1 block (8 bytes) in four colour mode
+	void EncodeColourBlock( const SBlock& block, EBlockMethod method, TUInt8* out )
+	{
+		bool sse = (method == kBlockSSE);
+
+		// Endpoints at the ends of the colours' spread along their principal axis
+		float mean[3], covariance[6], axis[3], minT, maxT;
+		if (sse) ColourStatsSSE( block, mean, covariance );
+		else     ColourStatsScalar( block, mean, covariance );
+		PrincipalAxis( covariance, axis );
+		if (sse) ProjectColoursSSE( block, mean, axis, &minT, &maxT );
+		else     ProjectColoursScalar( block, mean, axis, &minT, &maxT );
+		TUInt32 colour0 = Pack565( mean[0] + axis[0] * maxT, mean[1] + axis[1] * maxT, mean[2] + axis[2] * maxT );
+		TUInt32 colour1 = Pack565( mean[0] + axis[0] * minT, mean[1] + axis[1] * minT, mean[2] + axis[2] * minT );
+
+		int palette[4][3];
+		TUInt32 indices[16];
+		ColourPalette( colour0, colour1, palette );
+		float error = sse ? SelectColourIndicesSSE( block, palette, indices ) : SelectColourIndicesScalar( block, palette, indices );
+
+		// One least squares refinement of the endpoints for those indices, kept if it lowers the error
+		TUInt32 refined0, refined1;
+		if (error > 0.0f && RefineEndpoints( block, indices, &refined0, &refined1 ) && (refined0 != colour0 || refined1 != colour1))
+		{
+			int refinedPalette[4][3];
+			TUInt32 refinedIndices[16];
+			ColourPalette( refined0, refined1, refinedPalette );
+			float refinedError = sse ? SelectColourIndicesSSE( block, refinedPalette, refinedIndices ) :
+			                           SelectColourIndicesScalar( block, refinedPalette, refinedIndices );
+			if (refinedError < error)
+			{
+				colour0 = refined0;
+				colour1 = refined1;
+				memcpy( indices, refinedIndices, sizeof(indices) );
+			}
+		}
+
+		// Four colour mode needs the first endpoint larger. Swapping them swaps indices 0/1 and 2/3. Equal endpoints
+		// give a single colour at index 0
+		if (colour0 < colour1)
+		{
+			swap( colour0, colour1 );
+			for (int i = 0; i < 16; ++i) indices[i] ^= 1;
+		}
+		TUInt32 indexBits = 0;
+		if (colour0 != colour1)
+		{
+			for (int i = 0; i < 16; ++i) indexBits |= indices[i] << (2 * i);
+		}
+		out[0] = static_cast<TUInt8>(colour0);
+		out[1] = static_cast<TUInt8>(colour0 >> 8);
+		out[2] = static_cast<TUInt8>(colour1);
+		out[3] = static_cast<TUInt8>(colour1 >> 8);
+		memcpy( out + 4, &indexBits, 4 );
+	}
+
+	// Encode one channel of a block as a BC4 block (8 bytes) in eight value mode, endpoints at the smallest and
+	// largest value
+	void EncodeChannelBlock( const float* values, EBlockMethod method, TUInt8* out )
+	{
+		float lower, upper;
+		if (method == kBlockSSE) ChannelRangeSSE( values, &lower, &upper );
+		else                     ChannelRangeScalar( values, &lower, &upper );
+		out[0] = static_cast<TUInt8>(upper);
+		out[1] = static_cast<TUInt8>(lower);
+		memset( out + 2, 0, 6 );
+		if (upper == lower)
+		{
+			return; // Every index 0, the first endpoint
+		}
+
+		TUInt32 steps[16];
+		float scale = 7.0f / (upper - lower);
+		if (method == kBlockSSE) ChannelStepsSSE( values, lower, scale, steps );
+		else                     ChannelStepsScalar( values, lower, scale, steps );
+
+		// Sixteen 3-bit indices in 48 bits
+		TUInt32 bits[2] = { 0, 0 };
+		for (int i = 0; i < 8; ++i)
+		{
+			bits[0] |= kChannelIndices[min( steps[i], 7u )] << (3 * i);
+			bits[1] |= kChannelIndices[min( steps[i + 8], 7u )] << (3 * i);
+		}
+		for (int i = 0; i < 3; ++i)
+		{
+			out[2 + i] = static_cast<TUInt8>(bits[0] >> (8 * i));
+			out[5 + i] = static_cast<TUInt8>(bits[1] >> (8 * i));
+		}
+	}
+
+	// Encode a block of pixels in a format, writing 8 or 16 bytes
+	void EncodeBlock( const TUInt32* pixels, EBlockKind kind, EBlockMethod method, TUInt8* out )
+	{
+		SBlock block;
+		if (method == kBlockSSE) SplitChannelsSSE( pixels, &block );
+		else                     SplitChannelsScalar( pixels, &block );
+
+		switch (kind)
+		{
+			case kBlockBC1:
+				EncodeColourBlock( block, method, out );
+				break;
+			case kBlockBC3:
+				EncodeChannelBlock( block.a, method, out );
+				EncodeColourBlock( block, method, out + 8 );
+				break;
+			case kBlockBC5:
+				EncodeChannelBlock( block.r, method, out );
+				EncodeChannelBlock( block.g, method, out + 8 );
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Image encoding
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// One mip of one slice to compress. Block rows are counted across all surfaces of the image, so jobs can be
+	// given any range of them
+	struct SBlockSurface
+	{
+		const TUInt8* source;
+		TUInt8*       dest;
+		TUInt32       width;
+		TUInt32       height;
+		TUInt32       blocksX;
+		TUInt32       firstRow;
+		TUInt32       numRows;
+	};
+
+	// Compress the block rows [begin, end) of a list of surfaces
+	void CompressBlockRows( const SBlockSurface* surfaces, TUInt32 numSurfaces, EBlockKind kind, EBlockMethod method,
+	                        TUInt32 begin, TUInt32 end )
+	{
+		TUInt32 blockBytes = (kind == kBlockBC1) ? 8 : 16;
+		TUInt32 surface = 0;
+		for (TUInt32 row = begin; row < end; ++row)
+		{
+			while (row >= surfaces[surface].firstRow + surfaces[surface].numRows && surface + 1 < numSurfaces) ++surface;
+			const SBlockSurface& current = surfaces[surface];
+			TUInt32 blockY = row - current.firstRow;
+			TUInt8* out = current.dest + static_cast<size_t>(blockY) * current.blocksX * blockBytes;
+			for (TUInt32 blockX = 0; blockX < current.blocksX; ++blockX)
+			{
+				TUInt32 pixels[16];
+				GatherBlock( current.source, current.width, current.height, blockX, blockY, pixels );
+				EncodeBlock( pixels, kind, method, out + blockX * blockBytes );
+			}
+		}
+	}
+}
+
+// Block compressed format for an 8-bit RGBA image
+DXGI_FORMAT ChooseBlockFormat( const STextureImage& image, bool normalMap /*= false*/ )
+{
+	if (normalMap)
+	{
+		return DXGI_FORMAT_BC5_UNORM;
+	}
+	bool srgb = (image.format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB);
+	for (size_t i = 3; i < image.data.size(); i += 4)
+	{
+		if (image.data[i] != 255) return srgb ? DXGI_FORMAT_BC3_UNORM_SRGB : DXGI_FORMAT_BC3_UNORM;
+	}
+	return srgb ? DXGI_FORMAT_BC1_UNORM_SRGB : DXGI_FORMAT_BC1_UNORM;
+}
+
+// Compress every mip of every slice of an R8G8B8A8 image to BC1, BC3 or BC5
+bool CompressTextureImage( const STextureImage& source, DXGI_FORMAT format, STextureImage* pCompressed,
+                           EBlockMethod method /*= kBlockSSE*/, bool parallel /*= true*/ )
+{
+	EBlockKind kind = BlockKind( format );
+	if ((source.format != DXGI_FORMAT_R8G8B8A8_UNORM && source.format != DXGI_FORMAT_R8G8B8A8_UNORM_SRGB) || kind == kBlockNone ||
+	    source.width == 0 || source.height == 0 || source.data.size() < static_cast<size_t>(TextureSliceBytes( source )) * source.arraySize)
+	{
+		return false;
+	}
+
+	STextureImage compressed;
+	compressed.format = format;
+	compressed.width = source.width;
+	compressed.height = source.height;
+	compressed.mipLevels = source.mipLevels;
+	compressed.arraySize = source.arraySize;
+	compressed.data.resize( static_cast<size_t>(TextureSliceBytes( compressed )) * compressed.arraySize );
+
+	// Surfaces in the order both images store them
+	vector<SBlockSurface> surfaces;
+	size_t sourceOffset = 0, destOffset = 0;
+	TUInt32 totalRows = 0;
+	for (TUInt32 slice = 0; slice < source.arraySize; ++slice)
+	{
+		for (TUInt32 mip = 0; mip < source.mipLevels; ++mip)
+		{
+			SBlockSurface surface;
+			surface.width = max( source.width >> mip, 1u );
+			surface.height = max( source.height >> mip, 1u );
+			surface.source = &source.data[sourceOffset];
+			surface.dest = &compressed.data[destOffset];
+			surface.blocksX = (surface.width + 3) / 4;
+			surface.firstRow = totalRows;
+			surface.numRows = (surface.height + 3) / 4;
+			surfaces.push_back( surface );
+			totalRows += surface.numRows;
+			sourceOffset += TextureSurfaceBytes( source.format, surface.width, surface.height );
+			destOffset += TextureSurfaceBytes( format, surface.width, surface.height );
+		}
+	}
+
+	const SBlockSurface* surfaceList = &surfaces[0];
+	TUInt32 numSurfaces = static_cast<TUInt32>(surfaces.size());
+	if (parallel)
+	{
+		ParallelFor( 0, static_cast<int>(totalRows), kBlockRowsPerJob, [surfaceList, numSurfaces, kind, method]( int begin, int end )
+		{
+			CompressBlockRows( surfaceList, numSurfaces, kind, method, begin, end );
+		}, "BlockCompression" );
+	}
+	else
+	{
+		CompressBlockRows( surfaceList, numSurfaces, kind, method, 0, totalRows );
+	}
+
+	pCompressed->format = compressed.format;
+	pCompressed->width = compressed.width;
+	pCompressed->height = compressed.height;
+	pCompressed->mipLevels = compressed.mipLevels;
+	pCompressed->arraySize = compressed.arraySize;
+	pCompressed->data.swap( compressed.data );
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Decoding and error
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Decode a BC1 colour block to 16 RGBA8 pixels. BC2 and BC3 colour blocks are always in four colour mode
+	void DecodeColourBlock( const TUInt8* in, bool fourColour, TUInt32* pixels )
+	{
+		TUInt32 colour0 = in[0] | (in[1] << 8);
+		TUInt32 colour1 = in[2] | (in[3] << 8);
+		TUInt32 indexBits;
+		memcpy( &indexBits, in + 4, 4 );
+
+		int palette[4][3];
+		TUInt32 alpha[4] = { 255, 255, 255, 255 };
+		ColourPalette( colour0, colour1, palette );
+		if (!fourColour && colour0 <= colour1)
+		{
+			// Three colour mode: halfway, then transparent black
+			for (int c = 0; c < 3; ++c)
+			{
+				palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+				palette[3][c] = 0;
+			}
+			alpha[3] = 0;
+		}
+		for (int i = 0; i < 16; ++i)
+		{
+			TUInt32 index = (indexBits >> (2 * i)) & 3;
+			pixels[i] = palette[index][0] | (palette[index][1] << 8) | (palette[index][2] << 16) | (alpha[index] << 24);
+		}
+	}
+
+	// Decode a BC4 block to 16 values
+	void DecodeChannelBlock( const TUInt8* in, TUInt8* values )
+	{
+		int endpoint0 = in[0], endpoint1 = in[1];
+		int palette[8] = { endpoint0, endpoint1 };
+		if (endpoint0 > endpoint1)
+		{
+			for (int i = 2; i < 8; ++i) palette[i] = ((8 - i) * endpoint0 + (i - 1) * endpoint1) / 7;
+		}
+		else
+		{
+			for (int i = 2; i < 6; ++i) palette[i] = ((6 - i) * endpoint0 + (i - 1) * endpoint1) / 5;
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+		TUInt32 bits[2] = { static_cast<TUInt32>(in[2] | (in[3] << 8) | (in[4] << 16)), static_cast<TUInt32>(in[5] | (in[6] << 8) | (in[7] << 16)) };
+		for (int i = 0; i < 16; ++i)
+		{
+			values[i] = static_cast<TUInt8>(palette[(bits[i / 8] >> (3 * (i % 8))) & 7]);
+		}
+	}
+}
+
+// Decode a BC1-BC5 image to R8G8B8A8
+bool DecompressTextureImage( const STextureImage& compressed, STextureImage* pDecompressed )
+{
+	TUInt32 blockBytes = 0;
+	switch (compressed.format)
+	{
+		case DXGI_FORMAT_BC1_UNORM: case DXGI_FORMAT_BC1_UNORM_SRGB:
+		case DXGI_FORMAT_BC4_UNORM:
+			blockBytes = 8; break;
+		case DXGI_FORMAT_BC2_UNORM: case DXGI_FORMAT_BC2_UNORM_SRGB:
+		case DXGI_FORMAT_BC3_UNORM: case DXGI_FORMAT_BC3_UNORM_SRGB:
+		case DXGI_FORMAT_BC5_UNORM:
+			blockBytes = 16; break;
+		default:
+			return false;
+	}
+	if (compressed.data.size() < static_cast<size_t>(TextureSliceBytes( compressed )) * compressed.arraySize)
+	{
+		return false;
+	}
+
+	STextureImage image;
+	image.format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	image.width = compressed.width;
+	image.height = compressed.height;
+	image.mipLevels = compressed.mipLevels;
+	image.arraySize = compressed.arraySize;
+	image.data.resize( static_cast<size_t>(TextureSliceBytes( image )) * image.arraySize );
+
+	const TUInt8* in = &compressed.data[0];
+	TUInt8* out = &image.data[0];
+	for (TUInt32 slice = 0; slice < image.arraySize; ++slice)
+	{
+		for (TUInt32 mip = 0; mip < image.mipLevels; ++mip)
+		{
+			TUInt32 width = max( image.width >> mip, 1u );
+			TUInt32 height = max( image.height >> mip, 1u );
+			for (TUInt32 blockY = 0; blockY < (height + 3) / 4; ++blockY)
+			{
+				for (TUInt32 blockX = 0; blockX < (width + 3) / 4; ++blockX, in += blockBytes)
+				{
+					TUInt32 pixels[16];
+					TUInt8 values[2][16];
+					switch (compressed.format)
+					{
+						case DXGI_FORMAT_BC1_UNORM: case DXGI_FORMAT_BC1_UNORM_SRGB:
+							DecodeColourBlock( in, false, pixels );
+							break;
+						case DXGI_FORMAT_BC2_UNORM: case DXGI_FORMAT_BC2_UNORM_SRGB:
+							DecodeColourBlock( in + 8, true, pixels );
+							for (int i = 0; i < 16; ++i) pixels[i] = (pixels[i] & 0xffffff) | (((in[i / 2] >> (4 * (i % 2))) & 15) * 17u << 24);
+							break;
+						case DXGI_FORMAT_BC3_UNORM: case DXGI_FORMAT_BC3_UNORM_SRGB:
+							DecodeChannelBlock( in, values[0] );
+							DecodeColourBlock( in + 8, true, pixels );
+							for (int i = 0; i < 16; ++i) pixels[i] = (pixels[i] & 0xffffff) | (static_cast<TUInt32>(values[0][i]) << 24);
+							break;
+						case DXGI_FORMAT_BC4_UNORM:
+							DecodeChannelBlock( in, values[0] );
+							for (int i = 0; i < 16; ++i) pixels[i] = values[0][i] * 0x010101u | 0xff000000u;
+							break;
+						default: // BC5
+							DecodeChannelBlock( in, values[0] );
+							DecodeChannelBlock( in + 8, values[1] );
+							for (int i = 0; i < 16; ++i) pixels[i] = values[0][i] | (values[1][i] << 8) | 0xff000000u;
+							break;
+					}
+
+					// Pixels of partial blocks beyond the edges are dropped
+					for (TUInt32 y = 0; y < 4 && blockY * 4 + y < height; ++y)
+					{
+						for (TUInt32 x = 0; x < 4 && blockX * 4 + x < width; ++x)
+						{
+							memcpy( out + ((blockY * 4 + y) * width + blockX * 4 + x) * 4, &pixels[y * 4 + x], 4 );
+						}
+					}
+				}
+			}
+			out += static_cast<size_t>(width) * height * 4;
+		}
+	}
+
+	pDecompressed->format = image.format;
+	pDecompressed->width = image.width;
+	pDecompressed->height = image.height;
+	pDecompressed->mipLevels = image.mipLevels;
+	pDecompressed->arraySize = image.arraySize;
+	pDecompressed->data.swap( image.data );
+	return true;
+}
+
+// Peak signal to noise ratio (dB) over some channels of two R8G8B8A8 images of the same size
+double TextureImagePSNR( const STextureImage& a, const STextureImage& b, TUInt32 channels )
+{
+	if (a.width != b.width || a.height != b.height || a.mipLevels != b.mipLevels || a.arraySize != b.arraySize ||
+	    a.data.size() != b.data.size() || TextureSurfaceBytes( a.format, 1, 1 ) != 4 || TextureSurfaceBytes( b.format, 1, 1 ) != 4)
+	{
+		return 99.0;
+	}
+
+	double squaredError = 0.0;
+	size_t count = 0;
+	for (TUInt32 channel = 0; channel < 4; ++channel)
+	{
+		if ((channels & (1u << channel)) == 0) continue;
+		for (size_t i = channel; i < a.data.size(); i += 4)
+		{
+			double difference = static_cast<double>(a.data[i]) - b.data[i];
+			squaredError += difference * difference;
+		}
+		count += a.data.size() / 4;
+	}
+	if (count == 0 || squaredError == 0.0)
+	{
+		return 99.0;
+	}
+	return 10.0 * log10( 255.0 * 255.0 / (squaredError / count) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Image files
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Decode an image file with WIC to R8G8B8A8
+	bool DecodeImageWIC( const string& fileName, STextureImage* pImage )
+	{
+		// COM may already be initialised on this thread, perhaps in another mode, which is fine
+		HRESULT comResult = CoInitializeEx( NULL, COINIT_MULTITHREADED );
+
+		IWICImagingFactory*    factory = 0;
+		IWICBitmapDecoder*     decoder = 0;
+		IWICBitmapFrameDecode* frame = 0;
+		IWICFormatConverter*   converter = 0;
+		bool success = false;
+		if (SUCCEEDED( CoCreateInstance( CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory,
+		                                 reinterpret_cast<void**>(&factory) ) ) &&
+		    SUCCEEDED( factory->CreateDecoderFromFilename( CA2W(fileName.c_str()), NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder ) ) &&
+		    SUCCEEDED( decoder->GetFrame( 0, &frame ) ) &&
+		    SUCCEEDED( factory->CreateFormatConverter( &converter ) ) &&
+		    SUCCEEDED( converter->Initialize( frame, GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeNone, NULL, 0.0, WICBitmapPaletteTypeCustom ) ))
+		{
+			UINT width, height;
+			converter->GetSize( &width, &height );
+			pImage->format = DXGI_FORMAT_R8G8B8A8_UNORM;
+			pImage->width = width;
+			pImage->height = height;
+			pImage->mipLevels = 1;
+			pImage->arraySize = 1;
+			pImage->data.resize( static_cast<size_t>(width) * height * 4 );
+			success = width > 0 && height > 0 &&
+			          SUCCEEDED( converter->CopyPixels( NULL, width * 4, static_cast<UINT>(pImage->data.size()), &pImage->data[0] ) );
+		}
+		if (converter) converter->Release();
+		if (frame) frame->Release();
+		if (decoder) decoder->Release();
+		if (factory) factory->Release();
+		if (SUCCEEDED( comResult )) CoUninitialize();
+		return success;
+	}
+
+	bool IsDDSFile( const string& fileName )
+	{
+		if (fileName.size() < 4) return false;
+		string extension = fileName.substr( fileName.size() - 4 );
+		transform( extension.begin(), extension.end(), extension.begin(), ::tolower );
+		return extension == ".dds";
+	}
+}
+
+// Read an image file as R8G8B8A8
+bool ReadImageRGBA( const string& fileName, STextureImage* pImage )
+{
+	if (!IsDDSFile( fileName ))
+	{
+		return DecodeImageWIC( fileName, pImage );
+	}
+
+	STextureImage image;
+	if (!ReadTextureImage( fileName, &image ))
+	{
+		return false;
+	}
+	switch (image.format)
+	{
+		case DXGI_FORMAT_R8G8B8A8_UNORM: case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+			break;
+		case DXGI_FORMAT_B8G8R8A8_UNORM: case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+		case DXGI_FORMAT_B8G8R8X8_UNORM: case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+		{
+			bool opaque = (image.format == DXGI_FORMAT_B8G8R8X8_UNORM || image.format == DXGI_FORMAT_B8G8R8X8_UNORM_SRGB);
+			bool srgb = (image.format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB || image.format == DXGI_FORMAT_B8G8R8X8_UNORM_SRGB);
+			for (size_t i = 0; i + 3 < image.data.size(); i += 4)
+			{
+				swap( image.data[i], image.data[i + 2] );
+				if (opaque) image.data[i + 3] = 255;
+			}
+			image.format = srgb ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : DXGI_FORMAT_R8G8B8A8_UNORM;
+			break;
+		}
+		default:
+			return false; // Already block compressed
+	}
+	pImage->format = image.format;
+	pImage->width = image.width;
+	pImage->height = image.height;
+	pImage->mipLevels = image.mipLevels;
+	pImage->arraySize = image.arraySize;
+	pImage->data.swap( image.data );
+	return true;
+}
@@ -0,0 +1,74 @@
+/*******************************************
+	BlockCompression.h
+
+	CPU block compression of 8-bit RGBA
+	images to BC1 (opaque colour), BC3 (colour
+	and alpha) and BC5 (two channel normal
+	maps). Each 4x4 block's colour endpoints
+	are fitted along its principal axis then
+	refined by least squares. Blocks are
+	encoded with SSE, rows of blocks spread
+	over the job system
+********************************************/
+
+#pragma once
+
+#include <string>
+using namespace std;
+
+#include "Defines.h"
+#include "TextureArrays.h"
+
+
+//-----------------------------------------------------------------------------
+// Encoding
+//-----------------------------------------------------------------------------
+
+// How blocks are encoded. Both fit the same endpoints and choose each pixel's index the same way
+enum EBlockMethod
+{
+	kBlockScalar, // One pixel at a time, the reference for the SSE version
+	kBlockSSE,    // Four pixels at a time with SSE
+};
+
+// Block compressed format for an 8-bit RGBA image: BC5 for normal maps (x and y in red and green, z rebuilt in the
+// shader), BC3 if any pixel is not fully opaque, otherwise BC1
+DXGI_FORMAT ChooseBlockFormat( const STextureImage& image, bool normalMap = false );
+
+// Rows of 4x4 blocks given to each job by CompressTextureImage, a few tens of microseconds of work
+const TUInt32 kBlockRowsPerJob = 4;
+
+// Compress every mip of every slice of an R8G8B8A8 image (as ReadImageRGBA gives) to BC1, BC3 or BC5 (_UNORM, or
+// _UNORM_SRGB for BC1 and BC3). Partial blocks at the edges of mips that are not a multiple of 4 repeat the edge
+// pixels. With parallel, rows of blocks are spread over the job system, returning once all are done - without the
+// job system they run on the calling thread. Returns false for formats not handled
+bool CompressTextureImage( const STextureImage& source, DXGI_FORMAT format, STextureImage* pCompressed,
+                           EBlockMethod method = kBlockSSE, bool parallel = true );
+
+
+//-----------------------------------------------------------------------------
+// Decoding and error
+//-----------------------------------------------------------------------------
+
+// Decode a BC1-BC5 image to R8G8B8A8. BC4 gives grey and BC5 red and green with no blue, both opaque
+bool DecompressTextureImage( const STextureImage& compressed, STextureImage* pDecompressed );
+
+// Channels compared by TextureImagePSNR, combined as bits
+const TUInt32 kChannelRed   = 1;
+const TUInt32 kChannelGreen = 2;
+const TUInt32 kChannelBlue  = 4;
+const TUInt32 kChannelAlpha = 8;
+
+// Peak signal to noise ratio (dB) over some channels of two R8G8B8A8 images of the same size, across all mips and
+// slices. Identical images give 99 dB, and so does a mismatch in size or format
+double TextureImagePSNR( const STextureImage& a, const STextureImage& b, TUInt32 channels );
+
+
+//-----------------------------------------------------------------------------
+// Image files
+//-----------------------------------------------------------------------------
+
+// Read an image file as R8G8B8A8: 32-bit DDS files through ReadTextureImage (BGRA reordered, no alpha made opaque),
+// anything else (JPEG, PNG, BMP...) decoded with WIC. Returns false for block compressed DDS files and files that
+// can't be read
+bool ReadImageRGBA( const string& fileName, STextureImage* pImage );
@@ -1,5 +1,5 @@
 /*******************************************
-	
+
 	CTimer.h
 
 	Timer class declarations
@@ -9,7 +9,7 @@
 #pragma once
 
 
-#include "Windows.h"
+#include "Clock.h"
 
 class CTimer
 {
@@ -20,7 +20,7 @@ public:
 
 	CTimer();
 
-	
+
 	//////////////////////////////
 	// Timer control
 
@@ -52,23 +52,10 @@ private:
 	// Is the timer running
 	bool m_Running;
 
+	// Start time and last lap start time (see Clock.h)
+	TClockTicks m_Start;
+	TClockTicks m_Lap;
 
-	// Using high resolution timer and if so its frequency
-	bool          m_HighRes;
-	LARGE_INTEGER m_HighResFreq;
-
-	// Start time and last lap start time of high-resolution timer
-	LARGE_INTEGER m_HighResStart;
-	LARGE_INTEGER m_HighResLap;
-
-	// Time when high-resolution timer was stopped (if it has been)
-	LARGE_INTEGER m_HighResStop;
-
-
-	// Start time and last lap start time of low-resolution timer
-	DWORD m_LowResStart;
-	DWORD m_LowResLap;
-
-	// Time when low-resolution timer was stopped (if it has been)
-	DWORD m_LowResStop;
+	// Time when timer was stopped (if it has been)
+	TClockTicks m_Stop;
 };
@@ -0,0 +1,41 @@
+/*******************************************
+	Clock.h
+
+	High resolution portable clock, shared by
+	the timer and the profiler
+********************************************/
+
+#pragma once
+
+#include <chrono>
+
+// Raw clock reading. Only differences between readings are meaningful
+typedef long long TClockTicks;
+
+// The steady clock never jumps backwards (unlike the system clock) and on Visual Studio 2015 or
+// later it is built on QueryPerformanceCounter, so it has the same resolution on Windows while
+// also working on other platforms
+typedef std::chrono::steady_clock TClock;
+
+
+// Get the current clock reading
+inline TClockTicks ClockTicks()
+{
+	return static_cast<TClockTicks>(TClock::now().time_since_epoch().count());
+}
+
+// Get the number of clock ticks per second
+inline TClockTicks ClockFrequency()
+{
+	return static_cast<TClockTicks>(TClock::period::den / TClock::period::num);
+}
+
+// Convert a difference in clock readings to seconds / microseconds
+inline double ClockTicksToSeconds( TClockTicks ticks )
+{
+	return static_cast<double>(ticks) * TClock::period::num / TClock::period::den;
+}
+inline double ClockTicksToMicroseconds( TClockTicks ticks )
+{
+	return ClockTicksToSeconds( ticks ) * 1000000.0;
+}
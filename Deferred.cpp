@@ -4,10 +4,15 @@
 //	Deferred rendering
 //--------------------------------------------------------------------------------------
 
+#include <cstdio>
 #include <sstream>
 #include <string>
 #include <list>
 #include <fstream>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <atomic>
 using namespace std;
 
 // General definitions used across all the project source files
@@ -15,9 +20,28 @@ using namespace std;
 
 // Declarations for supporting source files
 #include "Mesh.h" 
+#include "VertexFormat.h"
+#include "MeshInstances.h"
+#include "UploadRing.h"
+#include "GBufferLayout.h"
+#include "TextureArrays.h"
+#include "MipGeneration.h"
+#include "LightBaking.h"
 #include "Camera.h"
 #include "CTimer.h"
+#include "Profiler.h"
+#include "Benchmark.h"
+#include "JobSystem.h"
+#include "FramePipeline.h"
+#include "FrameAllocator.h"
+#include "FixedTimestep.h"
+#include "MemoryTracking.h"
+#include "MemoryAccounting.h"
+#include "FrameStats.h"
+#include "InputLatency.h"
+#include "Error.h"
 #include "Input.h"
+#include "InputReplay.h"
 #include "CVector4.h"
 #include "MathDX.h"
 
@@ -40,6 +64,98 @@ ID3D11ShaderResourceView* LightDiffuseMap = NULL;
 
 // Note: There are move & rotation speed constants in Defines.h
 
+// Profiler capture triggered with F1 - number of frames captured and the Chrome trace file written
+const unsigned int ProfileCaptureFrames = 300;
+const string ProfileCaptureFile = "ProfileCapture.json";
+
+// Frame statistics (draw calls, uploads etc., see FrameStats.h). F3 shows a summary in the window title in place of the
+// usual text, F4 writes the recent frames out
+bool ShowFrameStats = false;
+const string FrameStatsFile = "FrameStats";
+
+// Memory accounting (see MemoryAccounting.h). F5 writes a report and F6 shows a summary in the window title, -memreport on the
+// command line writes a report once the scene is loaded, and -membudget sets budgets that reports are checked against
+bool ShowMemory = false;
+const string MemoryReportFile = "MemoryReport";
+string StartupMemoryReportFile;
+
+// Cargo containers placed around the level as instances of one shared mesh (see MeshInstances.h), -instances on the command
+// line sets how many. The mesh is loaded once however many there are
+CMesh* Container = NULL;
+CMeshInstanceStore* Instances = NULL;
+int NumContainers = 0;
+const float ContainerScale = 5.0f;
+const float ContainerSpacing = 40.0f;
+
+// Hardware instancing of mesh instances (see CMeshInstanceStore::Render), on unless -noinstancing is given. -instancebench
+// times the CPU cost of submitting instances with and without it
+bool HardwareInstancing = true;
+
+// Positions in a vertex stream of their own for the level and containers (-splitpositions), and a depth pre-pass of the
+// level before the G-buffer pass (-depthprepass), which then reads only that stream
+bool SeparatePositions = false;
+bool DepthPrePass = false;
+
+// G-buffer layout (-gbuffer float|compact16|compact10, see GBufferLayout.h). -gbufferreport writes the memory and bandwidth of each
+// layout at the window size once the device is created
+EGBufferLayout GBufferLayout = kGBufferFloat;
+string GBufferReportFile;
+
+// Static batching of the level (see CMesh::BuildStaticBatches), on unless -nobatch is given. -batchreport writes the draw
+// counts with and without batching once the scene is loaded
+bool StaticBatching = true;
+float StaticBatchSize = 0.0f;
+string BatchReportFile;
+
+// Texture arrays of the level's diffuse maps (see CMesh::BuildTextureArrays), with -texarrays. -texarrayreport writes the texture
+// changes with and without them once the scene is loaded
+bool TextureArrays = false;
+string TextureArrayReportFile;
+
+// Processing of textures on the CPU as they load (see ReadProcessedTexture): -compresstextures block compresses the JPEG, PNG
+// and uncompressed DDS textures of the sky, containers and lights, -genmips generates mips for textures without them
+TUInt32 TextureOptions = 0;
+
+// Lighting of the static lights and ambient occlusion baked into the level's vertex colours (see LightBaking.h), with
+// -bakedlighting. The static lights are then left out of the light list. The bake is read from beside the level's X-file,
+// and made first if it isn't there - -bakelighting makes it offline
+bool BakedLighting = false;
+const TUInt32 BakeOcclusionRays = 64;
+const float BakeOcclusionDistance = 25.0f;
+const float BakeRayOffset = 0.05f;
+
+// The level's X-file, and the matrix its root node is given. Its world frame mirrors z (it was exported from a right-handed
+// package) but the scene is laid out in the unmirrored coordinates, so the root undoes it
+const string LevelFileName = "level2.x";
+const CMatrix4x4 LevelRootMatrix = MatrixScaling(CVector3(1.0f, 1.0f, -1.0f));
+
+// Benchmark mode, enabled from the command line (see ParseBenchmarkCommandLine for options). Flies
+// the camera along a fixed path and sweeps the number of lights for each rendering path
+CBenchmark* Benchmark = NULL;
+bool Headless = false; // No device - benchmark the CPU-side stages only
+const unsigned int BenchmarkSeed = 1234; // Same random lights in every run
+
+// Short-lived data for each frame (snapshots, text) comes from here rather than the heap. Double-buffered so
+// a snapshot stays valid while the render thread draws it during the next frame. Size is for each buffer
+const size_t FrameMemorySize = 4 * 1024 * 1024;
+CFrameAllocator FrameMemory(FrameMemorySize);
+
+// Heap allocation tracking. With -noalloc, any allocation after the warm-up frames asserts (see MemoryTracking.h)
+const unsigned int SteadyStateFrame = 120; // Frames before the loop is expected to stop allocating
+bool NoAllocations = false;
+unsigned int FrameAllocations = 0; // Allocations made in the last frame
+
+// The scene is simulated in fixed steps, independent of the frame rate. Rendering interpolates between the last two steps
+// using the state saved at the start of the latest step. Step length and catch-up limit can be set on the command line
+CFixedTimestep Simulation;
+D3DXVECTOR3 PrevCameraPosition;
+D3DXVECTOR3 PrevCameraRotation;
+
+// Input and frame times can be recorded to a file and replayed, so a session can be re-run exactly (see InputReplay.h).
+// The measured timings of each replayed frame are written out when the replay finishes
+vector<SBenchmarkFrame> ReplayTimings;
+string ReplayResultsFile;
+
 
 //--------------------------------------------------------------------------------------
 // Lights
@@ -67,20 +183,78 @@ D3D11_INPUT_ELEMENT_DESC LightVertexElts[] =
 	{ "COLOR",    0,     DXGI_FORMAT_R32G32B32_FLOAT,    0,    16,     D3D11_INPUT_PER_VERTEX_DATA,  0 },
 };
 UINT NumLightElts = sizeof(LightVertexElts) / sizeof(LightVertexElts[0]); // Length of array above
-ID3D11InputLayout* LightVertexLayout; // Layout pointer that we will get from DirectX after we give it the array above
+ID3D11InputLayout* LightVertexLayout; // Layout pointer that we will get from the layout cache after registering the array above (owned by the cache)
+
+// Lights that never move, at the start of the light list unless their lighting is baked
+const SPointLight StaticLights[] = {
+	CVector3(-18000, 4000, 6000),  25000,  CVector4(0.4f, 0.4f, 0.7f, 0),
+};
+const int NumStaticLights = sizeof(StaticLights) / sizeof(StaticLights[0]);
+int NumListedStaticLights = NumStaticLights; // Static lights in the light list, none with baked lighting
 
 									  // Lights are a particle system
-int NumPointLights = 1;              // Start with one big light
+int NumPointLights = 0;              // Start with the static lights, see ListStaticLights
 const float LightSpawnFreq = 500.0f; // How many new lights per second
-const int MaxPointLights = 128;     // Will keep adding lights until there are this many
+const int MaxSpawnedLights = 128;    // Will keep adding lights until there are this many
+const int MaxPointLights = 25600;    // Size of light list, the benchmark can use many more lights than are spawned normally
+const int MaxForwardLights = 256;    // Forward rendering shader only supports this many lights (MaxPointLights in Deferred.fx)
+const int LightAnimationGrain = 512; // Lights animated by each job
 
-									  // Array of lights, one initialised to start with
-SPointLight PointLights[MaxPointLights] = {
-	CVector3(-18000, 4000, 6000),  25000,  CVector4(0.4f, 0.4f, 0.7f, 0),
+									  // Array of lights, the static lights first
+SPointLight PointLights[MaxPointLights];
+
+// Light positions before the latest simulation step, used to interpolate. Lights added since have no previous position
+CVector3 PrevLightPositions[MaxPointLights];
+int NumPrevLights = 0;
+
+// Per-frame vertex data uploaded to the GPU - the lights each frame (a copy of the PointLights array above) and instance data
+// for hardware instancing - all share one dynamic buffer used as a ring (see UploadRing.h). Sized for a few frames of the
+// largest uploads
+CUploadRing VertexUploads("VertexUploads");
+
+
+//--------------------------------------------------------------------------------------
+// Frame Snapshots
+//--------------------------------------------------------------------------------------
+
+// Everything the renderer needs from one simulated frame. Rendering only reads from a snapshot, never from the live
+// scene, so in pipelined mode the next frame can be simulated on the main thread while this one is drawn on the render thread
+struct SFrameSnapshot
+{
+	D3DXMATRIX  viewMatrix;
+	D3DXMATRIX  cameraWorldMatrix;
+	D3DXMATRIX  projMatrix;
+	D3DXMATRIX  viewProjMatrix;
+	D3DXVECTOR3 cameraPos;
+	float       cameraNearClip;
+
+	// Arrays are in frame memory, valid until the end of the frame after the one that captured them
+	CMatrix4x4*  levelMatrices;  // Model space node matrices of each mesh
+	CMatrix4x4*  skyboxMatrices;
+	SPointLight* lights;
+	int          numLights;
+	bool         deferred;
+
+	TClockTicks simulationStart; // When the update that produced this frame started, used to measure latency
+	TClockTicks inputTime;       // Arrival of the oldest input consumed by that update, 0 if none (see InputLatency.h)
 };
 
-// Vertex buffer in GPU memory, a copy of the PointLights array above
-ID3D11Buffer* LightVertexBuffer;
+// Pipelined mode runs rendering on its own thread, toggle with F2 or start with -pipelined on the command line
+bool Pipelined = false;
+CFramePipeline<SFrameSnapshot> Pipeline; // Double-buffered snapshots passed from the main thread to the render thread
+thread RenderThread;
+SFrameSnapshot SerialSnapshot; // Snapshot used when not pipelined
+
+// Serial mode normally renders the previous frame's snapshot before updating, so input is shown a frame after it is consumed.
+// With -updatefirst each frame is updated then rendered straight away, for lower input latency but no overlap
+bool UpdateFirst = false;
+
+// Input-to-present latency histograms are written here on exit if set (-latency on the command line)
+string LatencyFile;
+
+// Timings of the most recently presented frame (seconds), written by whichever thread renders
+atomic<float> LastRenderTime(0.0f); // Time to submit and present the frame
+atomic<float> LastLatency(0.0f);    // From the start of the frame's update until it was presented
 
 
 //**| DEFERRED |**********************************************************/
@@ -94,10 +268,14 @@ ID3D11Buffer* LightVertexBuffer;
 //   2. Pixel world normal in RGB, Alpha unused
 //   3. Pixel world position in RGB, Alpha unused
 // In the first rendering pass, all the scene geometry is rendered to these three textures, *simultaneously*
+// The compact layouts use fewer, smaller targets and read the position back from the depth buffer (see GBufferLayout.h). Each target is
+// read in the lighting pass through the shader variable in the same slot of GBufferShaderVar
 ID3D11Texture2D*          GBuffer[3];
 ID3D11RenderTargetView*   GBufferRenderTarget[3];
 ID3D11ShaderResourceView* GBufferShaderResource[3];
 ID3DX11EffectShaderResourceVariable* GBufferShaderVar[3];
+ID3DX11EffectShaderResourceVariable* GBufferDepthVar = NULL;
+int NumGBufferTargets = 0;
 
 //************************************************************************/
 
@@ -112,8 +290,14 @@ ID3DX11Effect*          Effect = NULL;
 ID3DX11EffectTechnique* PixelLitTexTechnique = NULL;
 ID3DX11EffectTechnique* LightParticlesTechnique = NULL;
 ID3DX11EffectTechnique* GBufferTechnique = NULL;
+ID3DX11EffectTechnique* PixelLitTexInstancedTechnique = NULL;
+ID3DX11EffectTechnique* GBufferInstancedTechnique = NULL;
+ID3DX11EffectTechnique* DepthOnlyTechnique = NULL;
 ID3DX11EffectTechnique* PointLightTechnique = NULL;
 ID3DX11EffectTechnique* AmbientLightTechnique = NULL;
+ID3DX11EffectTechnique* PixelLitTexBakedTechnique = NULL;
+ID3DX11EffectTechnique* GBufferBakedTechnique = NULL;
+ID3DX11EffectTechnique* AmbientLightBakedTechnique = NULL;
 
 // Matrices
 ID3DX11EffectMatrixVariable* WorldMatrixVar = NULL;
@@ -153,6 +337,7 @@ ID3D11DeviceContext* g_pd3dContext = NULL; // ...and one pointer for the current
 IDXGISwapChain*           SwapChain = NULL;
 ID3D11Texture2D*          DepthStencil = NULL;
 ID3D11DepthStencilView*   DepthStencilView = NULL;
+ID3D11DepthStencilView*   DepthStencilReadOnlyView = NULL; // For depth testing while the depth buffer is also read as a texture
 ID3D11ShaderResourceView* DepthShaderView;
 ID3D11RenderTargetView*   BackBufferRenderTarget = NULL;
 
@@ -169,8 +354,10 @@ const float FrameTimePeriod = 1.0f;
 // Sum of recent update times and number of times in the sum - used to calculate
 // average over a given time period
 float SumFrameTimes = 0.0f;
+float SumLatencies = 0.0f;
 int NumFrameTimes = 0;
 float AverageFrameTime = -1.0f; // Invalid value at first
+float AverageLatency = -1.0f;
 
 
 //--------------------------------------------------------------------------------------
@@ -178,13 +365,28 @@ float AverageFrameTime = -1.0f; // Invalid value at first
 //--------------------------------------------------------------------------------------
 
 bool InitDevice();
+void AccountViewMemory(ID3D11View* view, EMemoryCategory category, const string& name, long long sign);
 void ReleaseResources();
 bool LoadEffectFile();
 bool InitScene();
+bool InitHeadlessScene();
+SBakeSettings LevelBakeSettings();
+bool ApplyBakedLighting();
+bool WriteBatchReport(const string& fileName);
+bool RunInstancingBenchmark(int numInstances, const string& fileName);
+void CaptureSnapshot(SFrameSnapshot* snapshot, TClockTicks simulationStart, TClockTicks inputTime, float alpha);
+void InitBenchmarkCameraPath(CCameraPath* cameraPath);
+void AddRandomLight();
+void ListStaticLights();
+void ResetLights(int numLights);
+void SimulateStep(float step);
 void UpdateScene(float frameTime);
 void RenderOpaqueModels();
 void RenderTransparentModels();
-void RenderScene();
+void RenderScene(const SFrameSnapshot& frame);
+void RenderFrame(const SFrameSnapshot& frame);
+void StartPipeline();
+void StopPipeline();
 bool InitWindow(HINSTANCE hInstance, int nCmdShow);
 LRESULT CALLBACK WndProc(HWND, UINT, WPARAM, LPARAM);
 
@@ -233,6 +435,7 @@ bool InitDevice()
 	hr = g_pd3dDevice->CreateRenderTargetView(pBackBuffer, NULL, &BackBufferRenderTarget);
 	pBackBuffer->Release();
 	if (FAILED(hr)) return false;
+	AccountViewMemory(BackBufferRenderTarget, kMemoryRenderTargets, "BackBuffer", 1);
 
 	// Create a texture for a depth buffer
 	D3D11_TEXTURE2D_DESC descDepth;
@@ -244,7 +447,7 @@ bool InitDevice()
 	descDepth.SampleDesc.Count = 1;
 	descDepth.SampleDesc.Quality = 0;
 	descDepth.Usage = D3D11_USAGE_DEFAULT;
-	descDepth.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+	descDepth.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE; // Read by lighting with compact g-buffer layouts
 	descDepth.CPUAccessFlags = 0;
 	descDepth.MiscFlags = 0;
 	hr = g_pd3dDevice->CreateTexture2D(&descDepth, NULL, &DepthStencil);
@@ -258,6 +461,19 @@ bool InitDevice()
 	descDSV.Texture2D.MipSlice = 0;
 	hr = g_pd3dDevice->CreateDepthStencilView(DepthStencil, &descDSV, &DepthStencilView);
 	if (FAILED(hr)) return false;
+	AccountViewMemory(DepthStencilView, kMemoryRenderTargets, "DepthBuffer", 1);
+
+	// Views to read the depth buffer in the lighting pass while still depth testing against it (without writes)
+	descDSV.Flags = D3D11_DSV_READ_ONLY_DEPTH;
+	hr = g_pd3dDevice->CreateDepthStencilView(DepthStencil, &descDSV, &DepthStencilReadOnlyView);
+	if (FAILED(hr)) return false;
+	D3D11_SHADER_RESOURCE_VIEW_DESC descDepthSRV;
+	descDepthSRV.Format = DXGI_FORMAT_R32_FLOAT;
+	descDepthSRV.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+	descDepthSRV.Texture2D.MostDetailedMip = 0;
+	descDepthSRV.Texture2D.MipLevels = 1;
+	hr = g_pd3dDevice->CreateShaderResourceView(DepthStencil, &descDepthSRV, &DepthShaderView);
+	if (FAILED(hr)) return false;
 
 
 	//**| DEFERRED SETUP |****************************************************/
@@ -277,22 +493,25 @@ bool InitDevice()
 	descDepth.Height = g_ViewportHeight;
 	descDepth.MipLevels = 1;
 	descDepth.ArraySize = 1;
-	descDepth.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
 	descDepth.SampleDesc.Count = 1;
 	descDepth.SampleDesc.Quality = 0;
 	descDepth.Usage = D3D11_USAGE_DEFAULT;
 	descDepth.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
 	descDepth.CPUAccessFlags = 0;
 	descDepth.MiscFlags = 0;
-	for (int b = 0; b < 3; b++)
+	const SGBufferLayout& gBufferLayout = GBufferLayoutDesc(GBufferLayout);
+	NumGBufferTargets = gBufferLayout.numTargets;
+	for (int b = 0; b < NumGBufferTargets; b++)
 	{
-		// Create the texture itself (reserve GPU memory)
+		// Create the texture itself (reserve GPU memory), in the format the layout uses for this target
+		descDepth.Format = gBufferLayout.formats[b];
 		hr = g_pd3dDevice->CreateTexture2D(&descDepth, NULL, &GBuffer[b]);
 		if (FAILED(hr)) return false;
 
 		// Create the render target view, a pointer that allows us to render to the GBuffer textures (first rendering pass)
 		hr = g_pd3dDevice->CreateRenderTargetView(GBuffer[b], NULL, &GBufferRenderTarget[b]);
 		if (FAILED(hr)) return false;
+		AccountViewMemory(GBufferRenderTarget[b], kMemoryRenderTargets, "GBuffer", 1);
 
 		// Create the shadeer resource view, a pointer that allow us to read from the GBuffer textures in a shader (second rendering pass)
 		hr = g_pd3dDevice->CreateShaderResourceView(GBuffer[b], NULL, &GBufferShaderResource[b]);
@@ -305,24 +524,60 @@ bool InitDevice()
 }
 
 
+// Add the GPU memory of the texture behind a view to the memory accounting, or remove it with a sign of -1. Does nothing for a
+// null view, so can be used for resources that may not have been created
+void AccountViewMemory(ID3D11View* view, EMemoryCategory category, const string& name, long long sign)
+{
+	if (!view) return;
+	ID3D11Resource* resource;
+	view->GetResource(&resource);
+	MemoryAccountAdd(category, name, sign * static_cast<long long>(TextureMemoryBytes(resource)));
+	resource->Release();
+}
+
+
 // Release the memory held by all objects created
 void ReleaseResources()
 {
 	if (g_pd3dContext) g_pd3dContext->ClearState();
 
-	delete Level;
-	delete Skybox;
-	delete MainCamera;
-
-	if (LightVertexBuffer)      LightVertexBuffer->Release();
-	if (LightDiffuseMap)        LightDiffuseMap->Release();
-	if (Effect)                 Effect->Release();
-	if (DepthShaderView)        DepthShaderView->Release();
-	if (DepthStencilView)       DepthStencilView->Release();
-	if (BackBufferRenderTarget) BackBufferRenderTarget->Release();
-	if (DepthStencil)           DepthStencil->Release();
-	if (SwapChain)              SwapChain->Release();
-	if (g_pd3dDevice)           g_pd3dDevice->Release();
+	// Remove device memory from the accounting while the resources still exist to be measured
+	AccountViewMemory(LightDiffuseMap, kMemoryTextures, "flare.jpg", -1);
+	AccountViewMemory(BackBufferRenderTarget, kMemoryRenderTargets, "BackBuffer", -1);
+	AccountViewMemory(DepthStencilView, kMemoryRenderTargets, "DepthBuffer", -1);
+	for (int b = 0; b < 3; b++)
+	{
+		AccountViewMemory(GBufferRenderTarget[b], kMemoryRenderTargets, "GBuffer", -1);
+	}
+	MemoryAccountRelease(kMemoryEffects, "Deferred.fx");
+
+	delete Instances;  Instances = NULL; // Before the meshes it places
+	delete Container;  Container = NULL;
+	delete Level;      Level = NULL;
+	delete Skybox;     Skybox = NULL;
+	delete MainCamera; MainCamera = NULL;
+	GeometryPool.Release(); // After the meshes using it
+	InputLayouts.Release();
+	LightVertexLayout = NULL;
+
+	// Pointers are cleared so the benchmark can carry on without a device if device setup fails
+	VertexUploads.Release(); // After the instances using it
+	if (LightDiffuseMap)        LightDiffuseMap->Release();        LightDiffuseMap = NULL;
+	if (Effect)                 Effect->Release();                 Effect = NULL;
+	if (DepthShaderView)        DepthShaderView->Release();        DepthShaderView = NULL;
+	if (DepthStencilReadOnlyView) DepthStencilReadOnlyView->Release(); DepthStencilReadOnlyView = NULL;
+	if (DepthStencilView)       DepthStencilView->Release();       DepthStencilView = NULL;
+	if (BackBufferRenderTarget) BackBufferRenderTarget->Release(); BackBufferRenderTarget = NULL;
+	if (DepthStencil)           DepthStencil->Release();           DepthStencil = NULL;
+	for (int b = 0; b < 3; b++)
+	{
+		if (GBufferShaderResource[b]) GBufferShaderResource[b]->Release(); GBufferShaderResource[b] = NULL;
+		if (GBufferRenderTarget[b])   GBufferRenderTarget[b]->Release();   GBufferRenderTarget[b] = NULL;
+		if (GBuffer[b])               GBuffer[b]->Release();               GBuffer[b] = NULL;
+	}
+	if (SwapChain)              SwapChain->Release();              SwapChain = NULL;
+	if (g_pd3dContext)          g_pd3dContext->Release();          g_pd3dContext = NULL;
+	if (g_pd3dDevice)           g_pd3dDevice->Release();           g_pd3dDevice = NULL;
 }
 
 
@@ -347,8 +602,11 @@ bool LoadEffectFile()
 	}
 
 
-	// Load and compile the effect file
-	hr = D3DX11CreateEffectFromMemory(pCompiled->GetBufferPointer(), pCompiled->GetBufferSize(), 0, g_pd3dDevice, &Effect);
+	// Load and compile the effect file. The heap it holds on to is charged to the effect in the memory accounting
+	{
+		CMemoryImportScope effectMemory("Deferred.fx", kMemoryEffects);
+		hr = D3DX11CreateEffectFromMemory(pCompiled->GetBufferPointer(), pCompiled->GetBufferSize(), 0, g_pd3dDevice, &Effect);
+	}
 	if (FAILED(hr))
 	{
 		MessageBox(NULL, L"Error creating effects", L"Error", MB_OK);
@@ -358,9 +616,18 @@ bool LoadEffectFile()
 	// Select techniques from the compiled effect file
 	PixelLitTexTechnique = Effect->GetTechniqueByName("PixelLitTex");
 	LightParticlesTechnique = Effect->GetTechniqueByName("LightParticles");
-	GBufferTechnique = Effect->GetTechniqueByName("GBuffer");
+	PixelLitTexInstancedTechnique = Effect->GetTechniqueByName("PixelLitTexInstanced");
+	DepthOnlyTechnique = Effect->GetTechniqueByName("DepthOnly");
 	AmbientLightTechnique = Effect->GetTechniqueByName("AmbientLight");
-	PointLightTechnique = Effect->GetTechniqueByName("PointLight");
+	PixelLitTexBakedTechnique = Effect->GetTechniqueByName("PixelLitTexBaked");
+	AmbientLightBakedTechnique = Effect->GetTechniqueByName("AmbientLightBaked");
+
+	// The g-buffer and point light techniques depend on the g-buffer layout, the compact layouts share shaders as both are UNORM targets
+	bool compactGBuffer = GBufferLayoutDesc(GBufferLayout).positionFromDepth;
+	GBufferTechnique = Effect->GetTechniqueByName(compactGBuffer ? "GBufferCompact" : "GBuffer");
+	GBufferInstancedTechnique = Effect->GetTechniqueByName(compactGBuffer ? "GBufferCompactInstanced" : "GBufferInstanced");
+	GBufferBakedTechnique = Effect->GetTechniqueByName(compactGBuffer ? "GBufferCompactBaked" : "GBufferBaked");
+	PointLightTechnique = Effect->GetTechniqueByName(compactGBuffer ? "PointLightCompact" : "PointLight");
 
 	// Create variables to access global variables in the shaders from C++
 	WorldMatrixVar = Effect->GetVariableByName("WorldMatrix")->AsMatrix();
@@ -374,10 +641,19 @@ bool LoadEffectFile()
 	DiffuseMapVar = Effect->GetVariableByName("DiffuseMap")->AsShaderResource();
 	NormalHeightMapVar = Effect->GetVariableByName("NormalHeightMap")->AsShaderResource();
 
-	// G-buffer used as textures in shader for lighting pass
+	// G-buffer used as textures in shader for lighting pass, in the order of the layout's targets
 	GBufferShaderVar[0] = Effect->GetVariableByName("GBuff_DiffuseSpecular")->AsShaderResource();
-	GBufferShaderVar[1] = Effect->GetVariableByName("GBuff_WorldPosition")->AsShaderResource();
-	GBufferShaderVar[2] = Effect->GetVariableByName("GBuff_WorldNormal")->AsShaderResource();
+	if (compactGBuffer)
+	{
+		GBufferShaderVar[1] = Effect->GetVariableByName("GBuff_WorldNormal")->AsShaderResource();
+		GBufferShaderVar[2] = NULL;
+	}
+	else
+	{
+		GBufferShaderVar[1] = Effect->GetVariableByName("GBuff_WorldPosition")->AsShaderResource();
+		GBufferShaderVar[2] = Effect->GetVariableByName("GBuff_WorldNormal")->AsShaderResource();
+	}
+	GBufferDepthVar = Effect->GetVariableByName("GBuff_Depth")->AsShaderResource();
 
 	// Viewport dimensions
 	ViewportWidthVar = Effect->GetVariableByName("ViewportWidth")->AsScalar();
@@ -401,6 +677,45 @@ bool LoadEffectFile()
 // Scene Setup / Update
 //--------------------------------------------------------------------------------------
 
+// What is baked into the level's vertex colours - the static lights and the ambient light
+SBakeSettings LevelBakeSettings()
+{
+	SBakeSettings settings;
+	for (int i = 0; i < NumStaticLights; i++)
+	{
+		const SPointLight& staticLight = StaticLights[i];
+		SBakeLight light = { staticLight.position, staticLight.radius,
+		                     CVector3(staticLight.colour.x, staticLight.colour.y, staticLight.colour.z) };
+		settings.lights.push_back(light);
+	}
+	settings.ambientColour = CVector3(AmbientColour.x, AmbientColour.y, AmbientColour.z);
+	settings.occlusionRays = BakeOcclusionRays;
+	settings.occlusionDistance = BakeOcclusionDistance;
+	settings.rayOffset = BakeRayOffset;
+	return settings;
+}
+
+// Give the level's vertices their baked lighting, baking it first if there is no bake for the level as it is now. Returns
+// false if it can't be baked or given to the level
+bool ApplyBakedLighting()
+{
+	PROFILE_FUNCTION();
+	string bakeFileName = BakedLightingFileName(LevelFileName);
+	SBakeSettings settings = LevelBakeSettings();
+	TUInt32 settingsHash = BakeSettingsHash(settings, LevelRootMatrix);
+	vector<CVector4> colours;
+	if (!ReadBakedLighting(bakeFileName, settingsHash, Level->GetNumVertices(), &colours))
+	{
+		if (!BakeLightingFile(LevelFileName, LevelRootMatrix, settings, "") ||
+		    !ReadBakedLighting(bakeFileName, settingsHash, Level->GetNumVertices(), &colours))
+		{
+			return false;
+		}
+	}
+	if (colours.empty()) return false; // No vertices to light
+	return Level->SetVertexColours(&colours[0], PixelLitTexBakedTechnique);
+}
+
 // Create / load the camera, models and textures for the scene
 bool InitScene()
 {
@@ -416,112 +731,489 @@ bool InitScene()
 	Level = new CMesh;
 
 	// Load .X files for each model
-	if (!Level->Load("level2.x", PixelLitTexTechnique)) return false; // Note: don't need to change the "example" technique for deferred rendering...
-	if (!Skybox->Load("Stars.x", PixelLitTexTechnique)) return false; //... technique are the same
+	if (!Level->Load(LevelFileName, PixelLitTexTechnique, false, SeparatePositions, TextureOptions)) return false; // Note: don't need to change the "example" technique for deferred rendering...
+	if (!Skybox->Load("Stars.x", PixelLitTexTechnique, false, false, TextureOptions)) return false; //... technique are the same
+
+	// Place the level's root before its matrices are combined for batching (see LevelRootMatrix)
+	Level->SetNodeMatrix(0, LevelRootMatrix);
+	Level->UpdateNodeMatrices();
+
+	// Baked lighting goes into the vertex colours before batching copies the vertices. Not fatal, the static lights are lit
+	// at runtime as usual without it
+	if (BakedLighting) BakedLighting = ApplyBakedLighting();
+	ListStaticLights();
+
+	// The level never moves, so its sub-meshes can be merged into a few large draws. Not fatal if the batches can't be made
+	if (StaticBatching) Level->BuildStaticBatches(StaticBatchSize);
+
+	// Diffuse maps of the same format and size shared as arrays, so consecutive draws change texture less often. Also not fatal
+	if (TextureArrays) Level->BuildTextureArrays();
+
+	// Cargo containers in a square grid centred on the level, each turned a little more than the last
+	if (NumContainers > 0)
+	{
+		Container = new CMesh;
+		if (!Container->Load("CargoContainer.x", PixelLitTexTechnique, false, SeparatePositions, TextureOptions)) return false;
+		if (StaticBatching) Container->BuildStaticBatches();
+
+		Instances = new CMeshInstanceStore("MeshInstances");
+		Instances->SetUploadRing(&VertexUploads);
+		int gridSize = static_cast<int>(ceilf(sqrtf(static_cast<float>(NumContainers))));
+		float gridStart = -0.5f * (gridSize - 1) * ContainerSpacing;
+		for (int i = 0; i < NumContainers; ++i)
+		{
+			CVector3 position(gridStart + (i % gridSize) * ContainerSpacing, 0.0f, gridStart + (i / gridSize) * ContainerSpacing);
+			Instances->Add(Container, MatrixScaling(ContainerScale) * MatrixRotationY(i * 0.3f) * MatrixTranslation(position));
+		}
+	}
 
 																	  // Initial positions
-	Skybox->Matrix().SetScale(10000.0f);
-	Skybox->GetNode(1).positionMatrix.SetScale(10000.0f);
-	Skybox->GetNode(2).positionMatrix.SetScale(10000.0f);
+	Skybox->SetNodeMatrix(0, MatrixScaling(10000.0f)); // Scales every node below the root too
+	Skybox->UpdateNodeMatrices();
 
 
 	//////////////////
 	// Lights
 
-	// Create a vertex buffer for the lights in GPU memory and copy over the contents just created (from CPU-memory)
-	// We are going to update this vertex buffer every frame, so it must be defined as "dynamic" and writable (D3D11_USAGE_DYNAMIC & D3D11_CPU_ACCESS_WRITE)
-	D3D11_BUFFER_DESC bufferDesc;
-	bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
-	bufferDesc.ByteWidth = MaxPointLights * sizeof(SPointLight); // Buffer size
-	bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-	bufferDesc.MiscFlags = 0;
-	D3D11_SUBRESOURCE_DATA initData; // Initial data
-	initData.pSysMem = PointLights;
-	if (FAILED(g_pd3dDevice->CreateBuffer(&bufferDesc, &initData, &LightVertexBuffer)))
+	// The lights are copied to the GPU every frame through the upload ring, a dynamic vertex buffer written without waiting for
+	// the GPU. Make room for the most lights and every container instance in each frame the CPU can be ahead
+	UINT uploadSize = CUploadRing::kMaxFramesInFlight * (MaxPointLights * sizeof(SPointLight) + NumContainers * sizeof(SInstanceData));
+	if (!VertexUploads.Init(uploadSize, D3D11_BIND_VERTEX_BUFFER))
 	{
 		return false;
 	}
 
-	// Create the vertex layout - to indicate to DirectX what data is contained in each vertex - see extended comment near LightVertexElts definition
-	D3DX11_PASS_DESC PassDesc;
-	PointLightTechnique->GetPassByIndex(0)->GetDesc(&PassDesc);
-	g_pd3dDevice->CreateInputLayout(LightVertexElts, NumLightElts, PassDesc.pIAInputSignature, PassDesc.IAInputSignatureSize, &LightVertexLayout);
+	// Get the vertex layout from the layout cache - to indicate to DirectX what data is contained in each vertex - see extended comment near LightVertexElts definition
+	LightVertexLayout = InputLayouts.Layout(VertexFormatRegister(LightVertexElts, NumLightElts, sizeof(SPointLight)), PointLightTechnique);
+	if (!LightVertexLayout)
+	{
+		return false;
+	}
 
 
 
 	//////////////////
 	// Load textures
 
-	if (FAILED(D3DX11CreateShaderResourceViewFromFile(g_pd3dDevice, L"flare.jpg", NULL, NULL, &LightDiffuseMap, NULL))) return false;
+	if (TextureOptions != 0) LightDiffuseMap = LoadProcessedTexture(g_pd3dDevice, "flare.jpg", TextureOptions);
+	if (!LightDiffuseMap && FAILED(D3DX11CreateShaderResourceViewFromFile(g_pd3dDevice, L"flare.jpg", NULL, NULL, &LightDiffuseMap, NULL))) return false;
+	AccountViewMemory(LightDiffuseMap, kMemoryTextures, "flare.jpg", 1);
 
 	return true;
 }
 
+// Create the parts of the scene needed without a device - only the CPU-side stages run (camera and lights)
+bool InitHeadlessScene()
+{
+	MainCamera = new CCamera();
+	MainCamera->SetPosition(D3DXVECTOR3(-320, 70, 100));
+	MainCamera->SetRotation(D3DXVECTOR3(ToRadians(8.0f), ToRadians(115.0f), 0.0f));
+	ListStaticLights();
+	return true;
+}
+
+// Write the level's draw counts with and without static batching to a CSV file, followed by the size and contents of each
+// batch. Returns false on a file error
+bool WriteBatchReport(const string& fileName)
+{
+	FILE* file = fopen(fileName.c_str(), "w");
+	if (!file)
+	{
+		return false;
+	}
+
+	TUInt32 drawsBefore = Level->GetNumSubMeshes();
+	TUInt32 drawsAfter = Level->GetNumDraws();
+	fprintf(file, "level,submeshes,batches,draws_unbatched,draws_batched,reduction_percent,max_batch_size\n");
+	fprintf(file, "%s,%u,%u,%u,%u,%.1f,%g\n", Level->GetFileName().c_str(), Level->GetNumSubMeshes(), Level->GetNumStaticBatches(), drawsBefore, drawsAfter,
+	        drawsBefore > 0 ? 100.0f * (drawsBefore - drawsAfter) / drawsBefore : 0.0f, StaticBatchSize);
+
+	fprintf(file, "\nbatch,material,submeshes,vertices,triangles,size_x,size_y,size_z\n");
+	for (TUInt32 b = 0; b < Level->GetNumStaticBatches(); ++b)
+	{
+		const CMesh::SStaticBatch& batch = Level->GetStaticBatch(b);
+		CVector3 size = batch.maxBounds - batch.minBounds;
+		fprintf(file, "%u,%u,%u,%u,%u,%.1f,%.1f,%.1f\n", b, batch.material, batch.numSubMeshes, batch.numVertices, batch.numIndices / 3,
+		        size.x, size.y, size.z);
+	}
+
+	bool success = (ferror(file) == 0);
+	fclose(file);
+	return success;
+}
+
+// Write the level's diffuse map changes per frame with separate textures and with texture arrays to a CSV file. Returns false on a
+// file error
+bool WriteTextureArrayReport(const string& fileName)
+{
+	FILE* file = fopen(fileName.c_str(), "w");
+	if (!file)
+	{
+		return false;
+	}
+
+	TUInt32 changesBefore = Level->GetNumTextureChanges(true);
+	TUInt32 changesAfter = Level->GetNumTextureChanges();
+	fprintf(file, "level,draws,texture_arrays,texture_changes_separate,texture_changes_arrays,reduction_percent\n");
+	fprintf(file, "%s,%u,%u,%u,%u,%.1f\n", Level->GetFileName().c_str(), Level->GetNumDraws(), Level->GetNumTextureArrays(), changesBefore,
+	        changesAfter, changesBefore > 0 ? 100.0f * (changesBefore - changesAfter) / changesBefore : 0.0f);
+
+	bool success = (ferror(file) == 0);
+	fclose(file);
+	return success;
+}
+
+// Time the CPU cost of submitting many instances of the container, drawn one at a time then with hardware instancing. Draws
+// are recorded into a deferred context's command list instead of going to the GPU, so the times are the CPU-side submission
+// alone - effect variables, state changes, draw calls and filling the instance buffer. Writes the draw calls and times of
+// each mode to a CSV file. Returns false on a file or device error
+bool RunInstancingBenchmark(int numInstances, const string& fileName)
+{
+	const int kWarmUp = 5;
+	const int kRepeats = 50;
+
+	if (!Container)
+	{
+		Container = new CMesh;
+		if (!Container->Load("CargoContainer.x", PixelLitTexTechnique, false, SeparatePositions, TextureOptions)) return false;
+		if (StaticBatching) Container->BuildStaticBatches();
+	}
+
+	// Instances all drawn whatever the view, each with its own colour
+	CMeshInstanceStore store("InstancingBenchmark");
+	int gridSize = static_cast<int>(ceilf(sqrtf(static_cast<float>(numInstances))));
+	for (int i = 0; i < numInstances; ++i)
+	{
+		CVector3 position((i % gridSize) * ContainerSpacing, 0.0f, (i / gridSize) * ContainerSpacing);
+		TMeshInstance instance = store.Add(Container, MatrixScaling(ContainerScale) * MatrixTranslation(position), kInstanceNoCull);
+		store.SetColour(instance, CVector3(Random(0.5f, 1.0f), Random(0.5f, 1.0f), Random(0.5f, 1.0f)));
+	}
+
+	FILE* file = fopen(fileName.c_str(), "w");
+	if (!file)
+	{
+		return false;
+	}
+	ID3D11DeviceContext* recorder = NULL;
+	if (FAILED(g_pd3dDevice->CreateDeferredContext(0, &recorder)))
+	{
+		fclose(file);
+		return false;
+	}
+
+	// Everything renders through g_pd3dContext, so swap in the deferred context while recording
+	ID3D11DeviceContext* immediateContext = g_pd3dContext;
+	g_pd3dContext = recorder;
+	fprintf(file, "mode,instances,draw_calls,buffer_binds,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+	for (int mode = 0; mode < 2; ++mode)
+	{
+		ID3DX11EffectTechnique* instancedTechnique = (mode == 1) ? GBufferInstancedTechnique : NULL;
+		vector<float> times;
+		unsigned long long drawCalls = 0, bufferBinds = 0;
+		for (int r = 0; r < kWarmUp + kRepeats; ++r)
+		{
+			unsigned long long drawsBefore = g_FrameCounters[kCounterDrawCalls].load();
+			unsigned long long bindsBefore = g_FrameCounters[kCounterBufferBinds].load();
+			TClockTicks start = ClockTicks();
+			store.Render(GBufferTechnique, instancedTechnique, CMatrix4x4::kIdentity);
+			ID3D11CommandList* commandList = NULL;
+			recorder->FinishCommandList(FALSE, &commandList);
+			float time = static_cast<float>(ClockTicksToSeconds(ClockTicks() - start));
+			if (commandList) commandList->Release();
+
+			drawCalls = g_FrameCounters[kCounterDrawCalls].load() - drawsBefore;
+			bufferBinds = g_FrameCounters[kCounterBufferBinds].load() - bindsBefore;
+			if (r >= kWarmUp) times.push_back(time);
+		}
+
+		SBenchmarkSummary summary = SummariseTimes(times);
+		fprintf(file, "%s,%d,%llu,%llu,%.4f,%.4f,%.4f,%.4f,%.4f\n", mode == 1 ? "instanced" : "individual", numInstances, drawCalls, bufferBinds,
+		        summary.mean, summary.p50, summary.p95, summary.p99, summary.max);
+	}
+	g_pd3dContext = immediateContext;
+	recorder->Release();
+
+	bool success = (ferror(file) == 0);
+	fclose(file);
+	return success;
+}
+
 
 //--------------------------------------------------------------------------------------
-// Scene Update
+// Benchmark Setup
 //--------------------------------------------------------------------------------------
 
-// Update the scene - move/rotate each model and the camera, then update their matrices
-void UpdateScene(float frameTime)
+// Fixed flight through the level for the benchmark, starting from the usual camera position and
+// circling the area where lights are placed while looking in towards the centre
+void InitBenchmarkCameraPath(CCameraPath* cameraPath)
+{
+	//                      Position                          Rotation (degrees, yaw keeps increasing so it interpolates smoothly)
+	cameraPath->AddPoint(CVector3(-320,  70,  100), CVector3(ToRadians( 8.0f), ToRadians(115.0f), 0.0f));
+	cameraPath->AddPoint(CVector3(-100,  60,  250), CVector3(ToRadians(10.0f), ToRadians(158.0f), 0.0f));
+	cameraPath->AddPoint(CVector3( 200,  50,  250), CVector3(ToRadians( 8.0f), ToRadians(219.0f), 0.0f));
+	cameraPath->AddPoint(CVector3( 350,  80,  -50), CVector3(ToRadians(15.0f), ToRadians(278.0f), 0.0f));
+	cameraPath->AddPoint(CVector3( 100, 120, -350), CVector3(ToRadians(20.0f), ToRadians(344.0f), 0.0f));
+	cameraPath->AddPoint(CVector3(-300, 150, -250), CVector3(ToRadians(25.0f), ToRadians(410.0f), 0.0f));
+}
+
+// Add a light at a random position near the centre of the level
+void AddRandomLight()
+{
+	if (NumPointLights >= MaxPointLights) return;
+
+	PointLights[NumPointLights].position = CVector3(Random(-600.0f, 600.0f), Random(5.0f, 40.0f), Random(-600.0f, 600.0f));
+	PointLights[NumPointLights].radius = Random(20.0f, 40.0f);
+	PointLights[NumPointLights].colour = CVector4(Random(0.4f, 1.0f), Random(0.4f, 1.0f), Random(0.4f, 1.0f), 0);
+	NumPointLights++;
+}
+
+// Start the light list with the static lights, unless their lighting is baked
+void ListStaticLights()
+{
+	NumListedStaticLights = BakedLighting ? 0 : NumStaticLights;
+	for (NumPointLights = 0; NumPointLights < NumListedStaticLights; NumPointLights++)
+	{
+		PointLights[NumPointLights] = StaticLights[NumPointLights];
+	}
+}
+
+// Replace the light list with the static lights plus a repeatable set of random lights
+void ResetLights(int numLights)
 {
-	// Control camera position and update its matrices (monoscopic version)
-	MainCamera->Control(frameTime, Key_Up, Key_Down, Key_Left, Key_Right, Key_W, Key_S, Key_A, Key_D);
+	srand(BenchmarkSeed);
+	ListStaticLights();
+	while (NumPointLights < numLights && NumPointLights < MaxPointLights)
+	{
+		AddRandomLight();
+	}
+	NumPrevLights = 0; // Nothing to interpolate from until the next step
+}
+
+
+//--------------------------------------------------------------------------------------
+// Frame Snapshots
+//--------------------------------------------------------------------------------------
+
+// Copy the current state of the scene needed for rendering. Called at the end of each update. Moving objects are placed
+// part way between the previous and latest simulation steps, alpha is the fraction of the way (see CFixedTimestep)
+void CaptureSnapshot(SFrameSnapshot* snapshot, TClockTicks simulationStart, TClockTicks inputTime, float alpha)
+{
+	PROFILE_FUNCTION();
+
+	// Temporarily move the camera to the interpolated pose to get its matrices, it must be restored for the next step
+	D3DXVECTOR3 cameraPosition = MainCamera->GetPosition();
+	D3DXVECTOR3 cameraRotation = MainCamera->GetRotation();
+	MainCamera->SetPosition(PrevCameraPosition + (cameraPosition - PrevCameraPosition) * alpha);
+	MainCamera->SetRotation(PrevCameraRotation + (cameraRotation - PrevCameraRotation) * alpha);
+	MainCamera->UpdateMatrices();
+
+	snapshot->viewMatrix = MainCamera->GetViewMatrix();
+	snapshot->cameraWorldMatrix = MainCamera->GetWorldMatrix();
+	snapshot->projMatrix = MainCamera->GetProjectionMatrix();
+	snapshot->viewProjMatrix = MainCamera->GetViewProjectionMatrix();
+	snapshot->cameraPos = MainCamera->GetPosition();
+	snapshot->cameraNearClip = MainCamera->GetNearClip();
+
+	MainCamera->SetPosition(cameraPosition);
+	MainCamera->SetRotation(cameraRotation);
 	MainCamera->UpdateMatrices();
 
-	// Gradually create lots more lights
-	static float emit = 1.0f / LightSpawnFreq;
-	emit -= frameTime;
-	while (emit < 0)
+	snapshot->levelMatrices = FrameMemory.AllocateArray<CMatrix4x4>(Level->GetNumNodes());
+	snapshot->skyboxMatrices = FrameMemory.AllocateArray<CMatrix4x4>(Skybox->GetNumNodes());
+	snapshot->lights = FrameMemory.AllocateArray<SPointLight>(max(NumPointLights, 1));
+	GEN_ASSERT(snapshot->levelMatrices && snapshot->skyboxMatrices && snapshot->lights, "Frame memory exhausted");
+
+	// Only nodes moved since the last frame are recombined with their parents
+	Level->UpdateNodeMatrices();
+	Skybox->UpdateNodeMatrices();
+	for (TUInt32 node = 0; node < Level->GetNumNodes(); ++node)
+	{
+		snapshot->levelMatrices[node] = Level->GetNodeMatrix(node);
+	}
+	for (TUInt32 node = 0; node < Skybox->GetNumNodes(); ++node)
+	{
+		snapshot->skyboxMatrices[node] = Skybox->GetNodeMatrix(node);
+	}
+
+	CopyMemory(snapshot->lights, PointLights, NumPointLights * sizeof(SPointLight));
+	SPointLight* lights = snapshot->lights;
+	ParallelFor(0, NumPrevLights, LightAnimationGrain, [lights, alpha](int begin, int end)
 	{
-		if (NumPointLights < MaxPointLights)
+		for (int i = begin; i < end; i++)
 		{
-			PointLights[NumPointLights].position = CVector3(Random(-600.0f, 600.0f), Random(5.0f, 40.0f), Random(-600.0f, 600.0f));
-			PointLights[NumPointLights].radius = Random(20.0f, 40.0f);
-			PointLights[NumPointLights].colour = CVector4(Random(0.4f, 1.0f), Random(0.4f, 1.0f), Random(0.4f, 1.0f), 0);
-			NumPointLights++;
+			lights[i].position = PrevLightPositions[i] + alpha * (lights[i].position - PrevLightPositions[i]);
 		}
-		emit += 1.0f / LightSpawnFreq;
+	}, "Interpolate Lights");
+	snapshot->numLights = NumPointLights;
+	snapshot->deferred = Deferred;
+	snapshot->simulationStart = simulationStart;
+	snapshot->inputTime = inputTime;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Scene Update
+//--------------------------------------------------------------------------------------
+
+// Advance the simulation by one fixed step - move/rotate each model and the camera, then update their matrices
+void SimulateStep(float step)
+{
+	PROFILE_FUNCTION();
+
+	// Keep the state before this step for rendering to interpolate from
+	PrevCameraPosition = MainCamera->GetPosition();
+	PrevCameraRotation = MainCamera->GetRotation();
+	NumPrevLights = NumPointLights;
+	for (int i = 0; i < NumPrevLights; i++)
+	{
+		PrevLightPositions[i] = PointLights[i].position;
 	}
 
-	// Rotate all lights (except the first) around the origin in an interesting way
-	for (int i = 1; i < NumPointLights; i++)
+	// Control camera position and update its matrices (monoscopic version). The benchmark flies the camera itself
+	if (Benchmark)
 	{
-		float dist = PointLights[i].position.Length();
-		float rotateSpeed = (fmodf(dist, 1.0f) + -0.5f) * 200.0f / (dist + 0.1f);
-		PointLights[i].position = MatrixRotationY(rotateSpeed*frameTime).TransformVector(PointLights[i].position);
+		CVector3 position, rotation;
+		Benchmark->CameraPose(&position, &rotation);
+		MainCamera->SetPosition(D3DXVECTOR3(position.x, position.y, position.z));
+		MainCamera->SetRotation(D3DXVECTOR3(rotation.x, rotation.y, rotation.z));
 	}
+	else
+	{
+		MainCamera->Control(step, Key_Up, Key_Down, Key_Left, Key_Right, Key_W, Key_S, Key_A, Key_D);
+	}
+	MainCamera->UpdateMatrices();
 
-	// Copy all light data over to GPU every frame
-	D3D11_MAPPED_SUBRESOURCE mappedData;
-	g_pd3dContext->Map(LightVertexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedData);
-	CopyMemory(mappedData.pData, PointLights, NumPointLights * sizeof(SPointLight));
-	g_pd3dContext->Unmap(LightVertexBuffer, 0);
+	{
+		PROFILE_SCOPE("Light Animation");
+
+		// Gradually create lots more lights (the benchmark sets the number of lights for each run instead)
+		static float emit = 1.0f / LightSpawnFreq;
+		emit -= step;
+		while (emit < 0)
+		{
+			if (!Benchmark && NumPointLights < MaxSpawnedLights)
+			{
+				AddRandomLight();
+			}
+			emit += 1.0f / LightSpawnFreq;
+		}
+
+		// Rotate all lights (except the static ones) around the origin in an interesting way. Lights are independent so are split across the job system
+		ParallelFor(NumListedStaticLights, NumPointLights, LightAnimationGrain, [step](int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				float dist = PointLights[i].position.Length();
+				float rotateSpeed = (fmodf(dist, 1.0f) + -0.5f) * 200.0f / (dist + 0.1f);
+				PointLights[i].position = MatrixRotationY(rotateSpeed*step).TransformVector(PointLights[i].position);
+			}
+		}, "Rotate Lights");
+	}
+}
+
+// Update the scene for a frame - run as many simulation steps as the time passed calls for, then deal with per-frame input
+void UpdateScene(float frameTime)
+{
+	PROFILE_FUNCTION();
+
+	int steps = Simulation.Advance(frameTime);
+	for (int i = 0; i < steps; ++i)
+	{
+		SimulateStep(Simulation.Step());
+	}
+	FrameStatsAdd(kCounterSimulationSteps, steps);
 
 	// Toggle deferred rendering
-	if (KeyHit(Key_Back)) Deferred = !Deferred;
+	if (KeyHit(Key_Back) && !Benchmark) Deferred = !Deferred;
+
+	// Capture a profile of the next few hundred frames. Capturing allocates, so is not a steady-state frame
+	if (KeyHit(Key_F1))
+	{
+		MemorySetAllocationsAllowed(true);
+		ProfilerBeginCapture(ProfileCaptureFrames, ProfileCaptureFile);
+	}
+
+	// Frame statistics - toggle the summary, or write out the recent frames (which allocates)
+	if (KeyHit(Key_F3)) ShowFrameStats = !ShowFrameStats;
+	if (KeyHit(Key_F4))
+	{
+		MemorySetAllocationsAllowed(true);
+		if (!FrameStatsWriteJSON(FrameStatsFile + ".json") || !FrameStatsWriteCSV(FrameStatsFile + ".csv"))
+		{
+			MessageBox(NULL, L"Error writing frame statistics", L"Error", MB_OK);
+		}
+	}
+
+	// Memory - toggle the summary, or write out the memory used by each asset (which allocates)
+	if (KeyHit(Key_F6)) ShowMemory = !ShowMemory;
+	if (KeyHit(Key_F5))
+	{
+		MemorySetAllocationsAllowed(true);
+		if (!MemoryWriteJSON(MemoryReportFile + ".json") || !MemoryWriteCSV(MemoryReportFile + ".csv"))
+		{
+			MessageBox(NULL, L"Error writing memory report", L"Error", MB_OK);
+		}
+	}
 
 
 	// Accumulate update times to calculate the average over a given period
 	SumFrameTimes += frameTime;
+	SumLatencies += LastLatency;
 	++NumFrameTimes;
 	if (SumFrameTimes >= FrameTimePeriod)
 	{
 		AverageFrameTime = SumFrameTimes / NumFrameTimes;
+		AverageLatency = SumLatencies / NumFrameTimes;
 		SumFrameTimes = 0.0f;
+		SumLatencies = 0.0f;
 		NumFrameTimes = 0;
 	}
 
-	// Write FPS text string
-	stringstream outText;
-	outText << (Deferred ? "Deferred Rendering - " : "Forward Rendering - ");
-	outText << "Lights: " << NumPointLights;
+	// Write FPS text string. Built in frame memory with a fixed size, so the title costs no heap allocations
+	PROFILE_SCOPE("Window Title");
 	if (AverageFrameTime >= 0.0f)
 	{
-		outText << ", Frame Time: " << AverageFrameTime * 1000.0f << "ms, FPS:" << 1.0f / AverageFrameTime << " ::: " << g_ViewportHeight << " : " << g_ViewportWidth;
-		SetWindowText(HWnd, CA2CT(outText.str().c_str()));
-		outText.str("");
+		const int TitleSize = 256;
+		char* title = FrameMemory.AllocateArray<char>(TitleSize);
+		char* progress = FrameMemory.AllocateArray<char>(TitleSize);
+		if (title && progress && ShowFrameStats)
+		{
+			FrameStatsText(title, TitleSize);
+			SetWindowTextA(HWnd, title);
+		}
+		else if (title && progress && ShowMemory)
+		{
+			MemoryReportText(title, TitleSize);
+			SetWindowTextA(HWnd, title);
+		}
+		else if (title && progress)
+		{
+			if (Benchmark)     Benchmark->ProgressText(progress, TitleSize);
+			else if (Headless) snprintf(progress, TitleSize, "Headless");
+			else if (InputIsReplaying()) snprintf(progress, TitleSize, "Replay %d/%u", static_cast<int>(ReplayTimings.size()), InputReplayFrameCount());
+			else               snprintf(progress, TitleSize, Deferred ? "Deferred Rendering" : "Forward Rendering");
+
+			int length = snprintf(title, TitleSize, "%s - Lights: %d%s%s%s, Frame Time: %gms, FPS:%g", progress, NumPointLights,
+			                      Pipelined ? " [Pipelined]" : "", ProfilerIsCapturing() ? " [Profiling]" : "",
+			                      InputIsRecording() ? " [Recording]" : "",
+			                      AverageFrameTime * 1000.0f, 1.0f / AverageFrameTime);
+			if (!Headless && length >= 0 && length < TitleSize)
+			{
+				length += snprintf(title + length, TitleSize - length, ", Latency: %gms", AverageLatency * 1000.0f);
+			}
+			const CLatencyHistogram& inputLatency = LatencyHistogram(kLatencyPresent);
+			if (inputLatency.Count() > 0 && length >= 0 && length < TitleSize)
+			{
+				length += snprintf(title + length, TitleSize - length, ", Input Latency p50/p95: %g/%gms",
+				                   inputLatency.Percentile(50.0f), inputLatency.Percentile(95.0f));
+			}
+			if (length >= 0 && length < TitleSize)
+			{
+				snprintf(title + length, TitleSize - length, ", Allocs/Frame: %u%s ::: %d : %d", FrameAllocations,
+				         MemoryForbiddenAllocationCount() > 0 ? " [Allocated In Steady State]" : "", g_ViewportHeight, g_ViewportWidth);
+			}
+			SetWindowTextA(HWnd, title);
+		}
 	}
 
 }
@@ -531,19 +1223,42 @@ void UpdateScene(float frameTime)
 // Scene Rendering
 //--------------------------------------------------------------------------------------
 
-// Render everything in the scene
-void RenderScene()
+// Render everything in the scene as it was when the given snapshot was taken
+void RenderScene(const SFrameSnapshot& frame)
 {
+	PROFILE_FUNCTION();
+
+	int numLights = frame.numLights;
+	VertexUploads.BeginFrame();
+
+	// Copy all light data over to GPU every frame, into the next space in the upload ring
+	ID3D11Buffer* lightBuffer = VertexUploads.Buffer();
+	UINT lightOffset = 0;
+	{
+		PROFILE_SCOPE("Light Upload");
+		void* lightData = VertexUploads.Map(numLights * sizeof(SPointLight), 16, &lightOffset);
+		if (lightData)
+		{
+			CopyMemory(lightData, frame.lights, numLights * sizeof(SPointLight));
+			VertexUploads.Unmap();
+			FrameStatsAdd(kCounterVertexBufferBytes, numLights * sizeof(SPointLight));
+		}
+		else
+		{
+			numLights = 0;
+		}
+	}
+
 	//---------------------------
 	// Common rendering settings
 
 	// Pass the camera's matrices to the vertex shader and position to the vertex shader
-	ViewMatrixVar->SetMatrix((float*)&MainCamera->GetViewMatrix());
-	InvViewMatrixVar->SetMatrix((float*)&MainCamera->GetWorldMatrix());
-	ProjMatrixVar->SetMatrix((float*)&MainCamera->GetProjectionMatrix());
-	ViewProjMatrixVar->SetMatrix((float*)&MainCamera->GetViewProjectionMatrix());
-	CameraPosVar->SetRawValue(MainCamera->GetPosition(), 0, 12);
-	CameraNearClipVar->SetFloat(MainCamera->GetNearClip());
+	ViewMatrixVar->SetMatrix((float*)&frame.viewMatrix);
+	InvViewMatrixVar->SetMatrix((float*)&frame.cameraWorldMatrix);
+	ProjMatrixVar->SetMatrix((float*)&frame.projMatrix);
+	ViewProjMatrixVar->SetMatrix((float*)&frame.viewProjMatrix);
+	CameraPosVar->SetRawValue((void*)&frame.cameraPos, 0, 12);
+	CameraNearClipVar->SetFloat(frame.cameraNearClip);
 
 	// Pass global light data to the shaders for both rendering methods
 	AmbientColourVar->SetRawValue(AmbientColour, 0, 12);
@@ -564,22 +1279,34 @@ void RenderScene()
 	//---------------------------
 	// Render scene
 
+	// Pose skinned meshes on the CPU, once for all the passes that draw them
+	if (Level->HasSkinning())
+	{
+		PROFILE_SCOPE("Skinning");
+		Level->Skin(frame.levelMatrices);
+	}
+
 	// Clear depth buffer
 	g_pd3dContext->ClearDepthStencilView(DepthStencilView, D3D11_CLEAR_DEPTH, 1.0f, 0);
 
 	// Although there are various preparations made for both forward and deferred rendering, this if statement shows the essential
 	// difference between the techniques on the C++ side. Of course the shaders are quite different too.
-	if (!Deferred)
+	if (!frame.deferred)
 	{
 		// Forward rendering - set back buffer as render target as usual
 		g_pd3dContext->OMSetRenderTargets(1, &BackBufferRenderTarget, DepthStencilView);
 
-		// Pass light list to the vertex shader
-		NumPointLightsVar->SetInt(NumPointLights);
-		PointLightsVar->SetRawValue(PointLights, 0, NumPointLights * sizeof(SPointLight));
-
-		// Render all non-transparent models using pixel lighting
-		Level->Render(PixelLitTexTechnique);
+		// Pass light list to the vertex shader, any lights beyond the shader's limit are ignored
+		int numForwardLights = min(numLights, MaxForwardLights);
+		NumPointLightsVar->SetInt(numForwardLights);
+		PointLightsVar->SetRawValue(frame.lights, 0, numForwardLights * sizeof(SPointLight));
+		FrameStatsAdd(kCounterLightsDrawn, numForwardLights);
+
+		// Render all non-transparent models using pixel lighting, the level lit by its baked lighting in place of the ambient light
+		PROFILE_SCOPE("Forward Pass");
+		Level->Render(BakedLighting ? PixelLitTexBakedTechnique : PixelLitTexTechnique, frame.levelMatrices);
+		if (Instances) Instances->Render(PixelLitTexTechnique, HardwareInstancing ? PixelLitTexInstancedTechnique : NULL,
+		                                 *reinterpret_cast<const CMatrix4x4*>(&frame.viewProjMatrix));
 	}
 	else
 	{
@@ -587,40 +1314,87 @@ void RenderScene()
 
 		//GBufferRenderTarget[2] = BackBufferRenderTarget; // Temporary line to show content of a particular g-buffer (also comment out the Draw(4,0) below)
 
-		// Deferred rendering - set the three g-buffer render targets (see comment by declaration of GBuffer)
-		g_pd3dContext->OMSetRenderTargets(3, GBufferRenderTarget, DepthStencilView);
+		// With baked lighting the level writes its lit colour to the back buffer as well, marked by alpha 1 (see GBUFFER_BAKED in
+		// Deferred.fx). Clear it to alpha 0 so the pixels without it are marked too
+		if (BakedLighting)
+		{
+			float clearColour[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			g_pd3dContext->ClearRenderTargetView(BackBufferRenderTarget, clearColour);
+		}
 
-		// Render non-transparent objects to the g-buffer. This also renders scene depths into the depth buffer (in the usual way), used by the later passes
-		Level->Render(GBufferTechnique);
+		// Deferred rendering - set the g-buffer render targets (see comment by declaration of GBuffer)
+		g_pd3dContext->OMSetRenderTargets(NumGBufferTargets, GBufferRenderTarget, DepthStencilView);
 
-		// Now select the g-buffer as texture inputs for the next rendering stages
-		g_pd3dContext->OMSetRenderTargets(1, &BackBufferRenderTarget, DepthStencilView);
-		GBufferShaderVar[0]->SetResource(GBufferShaderResource[0]);
-		GBufferShaderVar[1]->SetResource(GBufferShaderResource[1]);
-		GBufferShaderVar[2]->SetResource(GBufferShaderResource[2]);
+		// Optionally lay down the level's depth first, so the g-buffer pass only shades the nearest surface of each pixel. The g-buffer
+		// technique tests LESS_EQUAL so the same depths pass again
+		if (DepthPrePass)
+		{
+			PROFILE_SCOPE("Depth Pre-Pass");
+			Level->RenderPositions(DepthOnlyTechnique, frame.levelMatrices);
+		}
+
+		// Render non-transparent objects to the g-buffer. This also renders scene depths into the depth buffer (in the usual way), used by the later passes.
+		// A level with baked lighting is rendered last with the back buffer bound after the g-buffer, so its pixels in front of other objects replace
+		// theirs in the back buffer, and those behind leave them as they are
+		{
+			PROFILE_SCOPE("G-Buffer Pass");
+			if (!BakedLighting)
+			{
+				Level->Render(GBufferTechnique, frame.levelMatrices);
+			}
+			if (Instances) Instances->Render(GBufferTechnique, HardwareInstancing ? GBufferInstancedTechnique : NULL,
+			                                 *reinterpret_cast<const CMatrix4x4*>(&frame.viewProjMatrix));
+			if (BakedLighting)
+			{
+				ID3D11RenderTargetView* bakedTargets[SGBufferLayout::kMaxTargets + 1];
+				copy(GBufferRenderTarget, GBufferRenderTarget + NumGBufferTargets, bakedTargets);
+				bakedTargets[NumGBufferTargets] = BackBufferRenderTarget;
+				g_pd3dContext->OMSetRenderTargets(NumGBufferTargets + 1, bakedTargets, DepthStencilView);
+				Level->Render(GBufferBakedTechnique, frame.levelMatrices);
+			}
+		}
+
+		// Now select the g-buffer as texture inputs for the next rendering stages. Layouts that reconstruct position from depth also read the
+		// depth buffer, so it is bound read-only for the light quads' depth test
+		bool depthAsTexture = GBufferLayoutDesc(GBufferLayout).positionFromDepth;
+		g_pd3dContext->OMSetRenderTargets(1, &BackBufferRenderTarget, depthAsTexture ? DepthStencilReadOnlyView : DepthStencilView);
+		for (int b = 0; b < NumGBufferTargets; b++)
+		{
+			GBufferShaderVar[b]->SetResource(GBufferShaderResource[b]);
+		}
+		if (depthAsTexture) GBufferDepthVar->SetResource(DepthShaderView);
 
 		// Render ambient light as a full-screen quad. Copies the diffuse-colour part of the g-buffer, blends it 
-		// with the ambient colour and writes that out to the back buffer to gives a basic rendering of the scene
+		// with the ambient colour and writes that out to the back buffer to gives a basic rendering of the scene.
+		// With baked lighting it is only added to the pixels the level hasn't already lit
+		PROFILE_SCOPE("Lighting Pass");
 		g_pd3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP); // Special vertex shader generates a triangle strip to make a quad, no vertex data is needed
-		AmbientLightTechnique->GetPassByIndex(0)->Apply(0, g_pd3dContext);
+		(BakedLighting ? AmbientLightBakedTechnique : AmbientLightTechnique)->GetPassByIndex(0)->Apply(0, g_pd3dContext);
 		g_pd3dContext->Draw(4, 0);
 
 		// Render areas affected by the point lights. The lights are sent over as a vertex buffer, and a quad is rendered in front of each one. The quad size is calculated (in the 
 		// geometry shader) to be large enough to cover the area affected by that light. The pixel shader uses the g-buffer to calculatea the light effect from the current light
 		// and adds that effect (additive blending) into the scene. It's effectively a particle system to render the *effect* of each light
-		UINT offset = 0;
 		UINT vertexSize = sizeof(SPointLight);
-		g_pd3dContext->IASetVertexBuffers(0, 1, &LightVertexBuffer, &vertexSize, &offset);
+		g_pd3dContext->IASetVertexBuffers(0, 1, &lightBuffer, &vertexSize, &lightOffset);
 		g_pd3dContext->IASetInputLayout(LightVertexLayout);
 		g_pd3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_POINTLIST); // Vertex data is the lights, each is a point, geometry shader generates a quad from each one
 		PointLightTechnique->GetPassByIndex(0)->Apply(0, g_pd3dContext);
-		g_pd3dContext->Draw(NumPointLights, 0);
+		g_pd3dContext->Draw(numLights, 0);
+		FrameStatsAdd(kCounterBufferBinds);
+		FrameStatsAdd(kCounterInputLayoutBinds);
+		FrameStatsAdd(kCounterDrawCalls, 2);
+		FrameStatsAdd(kCounterTriangles, 2 + numLights);
+		FrameStatsAdd(kCounterLightsDrawn, numLights);
 
 		// Stop DirectX warnings about render targets still being bound
-		GBufferShaderVar[0]->SetResource(0);
-		GBufferShaderVar[1]->SetResource(0);
-		GBufferShaderVar[2]->SetResource(0);
+		for (int b = 0; b < NumGBufferTargets; b++)
+		{
+			GBufferShaderVar[b]->SetResource(0);
+		}
+		GBufferDepthVar->SetResource(0);
 		PointLightTechnique->GetPassByIndex(0)->Apply(0, g_pd3dContext);
+		if (depthAsTexture) g_pd3dContext->OMSetRenderTargets(1, &BackBufferRenderTarget, DepthStencilView); // Depth writes again for the skybox
 
 		//**| DEFERRED RENDERING |****************************************************/
 	}
@@ -628,7 +1402,10 @@ void RenderScene()
 
 	// Render skybox afterwards using forward rendering in either case (because no lights affect the skybox - no need for deferred)
 	// I really need another technique because this way the skybox is only affected by ambient light, but this is already a complex lab...!
-	Skybox->Render(PixelLitTexTechnique);
+	{
+		PROFILE_SCOPE("Skybox");
+		Skybox->Render(PixelLitTexTechnique, frame.skyboxMatrices);
+	}
 
 
 	// Finally render the point lights themselves (the little flares) as a particle system of camera-facing quads (additive blending)
@@ -636,21 +1413,84 @@ void RenderScene()
 	// last (regardless of rendering method) due to sorting issues. Transparency is hard to do with deferred rendering (see lecture), 
 	// so often transparent objects are rendered using a normal forward rendering pass after the deferred rendering part is complete. 
 	// So this part is same for forward and deferred rendering.
-	UINT offset = 0;
-	UINT vertexSize = sizeof(SPointLight);
-	vertexSize = sizeof(SPointLight);
-	g_pd3dContext->IASetVertexBuffers(0, 1, &LightVertexBuffer, &vertexSize, &offset);
-	g_pd3dContext->IASetInputLayout(LightVertexLayout);
-	g_pd3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_POINTLIST); // Vertex data is the lights, each is a point, geometry shader generates a quad from each one
-	DiffuseMapVar->SetResource(LightDiffuseMap);
-	LightParticlesTechnique->GetPassByIndex(0)->Apply(0, g_pd3dContext);
-	g_pd3dContext->Draw(NumPointLights, 0);
-
-
-	// After we've finished rendering, we "present" the back buffer to the front buffer (the screen)
+	{
+		PROFILE_SCOPE("Light Particles");
+		UINT vertexSize = sizeof(SPointLight);
+		g_pd3dContext->IASetVertexBuffers(0, 1, &lightBuffer, &vertexSize, &lightOffset);
+		g_pd3dContext->IASetInputLayout(LightVertexLayout);
+		g_pd3dContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_POINTLIST); // Vertex data is the lights, each is a point, geometry shader generates a quad from each one
+		DiffuseMapVar->SetResource(LightDiffuseMap);
+		LightParticlesTechnique->GetPassByIndex(0)->Apply(0, g_pd3dContext);
+		g_pd3dContext->Draw(numLights, 0);
+		FrameStatsAdd(kCounterBufferBinds);
+		FrameStatsAdd(kCounterInputLayoutBinds);
+		FrameStatsAdd(kCounterDrawCalls);
+		FrameStatsAdd(kCounterTriangles, numLights);
+	}
+
+	// Collect the work done by the effects framework for this frame
+	D3DX11_EFFECT_STATS effectStats;
+	D3DX11GetEffectStats(&effectStats, TRUE);
+	FrameStatsAdd(kCounterEffectApplies, effectStats.PassApplies);
+	FrameStatsAdd(kCounterConstantBufferBytes, effectStats.ConstantBufferBytes);
+	FrameStatsAdd(kCounterTextureBinds, effectStats.ShaderResourceBinds);
+
+
+	// Fence this frame's uploads, then we "present" the back buffer to the front buffer (the screen)
+	VertexUploads.EndFrame();
+	PROFILE_SCOPE("Present");
 	SwapChain->Present(0, 0);
 }
 
+// Render a frame and record how long it took and its latency
+void RenderFrame(const SFrameSnapshot& frame)
+{
+	TClockTicks renderStart = ClockTicks();
+	LatencyRecord(kLatencySubmit, frame.inputTime, renderStart);
+	RenderScene(frame);
+	TClockTicks renderEnd = ClockTicks();
+	LatencyRecord(kLatencyPresent, frame.inputTime, renderEnd);
+
+	LastRenderTime = static_cast<float>(ClockTicksToSeconds(renderEnd - renderStart));
+	LastLatency = static_cast<float>(ClockTicksToSeconds(renderEnd - frame.simulationStart));
+}
+
+
+//--------------------------------------------------------------------------------------
+// Pipelined Rendering
+//--------------------------------------------------------------------------------------
+
+// Render thread - draws each snapshot as the main thread finishes it. Only this thread uses the device context while pipelined
+void RenderThreadMain()
+{
+	ProfilerSetThreadName("Render");
+
+	const SFrameSnapshot* frame;
+	while ((frame = Pipeline.BeginRead()) != 0)
+	{
+		RenderFrame(*frame);
+		Pipeline.EndRead();
+	}
+}
+
+// Start rendering on a separate thread, overlapping with the update of the next frame
+void StartPipeline()
+{
+	if (Pipelined) return;
+	Pipeline.Reset();
+	RenderThread = thread(RenderThreadMain);
+	Pipelined = true;
+}
+
+// Return to rendering and updating one after the other on the main thread
+void StopPipeline()
+{
+	if (!Pipelined) return;
+	Pipeline.Stop();
+	RenderThread.join();
+	Pipelined = false;
+}
+
 
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -663,25 +1503,234 @@ void RenderScene()
 //--------------------------------------------------------------------------------------
 int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLine, int nCmdShow)
 {
+	// Read benchmark options from the command line, e.g. "-benchmark -lights 1,100,1000 -out Results.csv"
+	SBenchmarkConfig benchmarkConfig;
+	bool benchmarkMode = ParseBenchmarkCommandLine(string(CW2A(lpCmdLine)), &benchmarkConfig);
+	benchmarkConfig.maxForwardLights = MaxForwardLights;
+	Headless = benchmarkMode && benchmarkConfig.headless;
+	NoAllocations = benchmarkConfig.noAllocations;
+	UpdateFirst = benchmarkConfig.updateFirst;
+	LatencyFile = benchmarkConfig.latencyFile;
+	StartupMemoryReportFile = benchmarkConfig.memoryReportFile;
+	NumContainers = benchmarkConfig.numInstances;
+	StaticBatching = benchmarkConfig.staticBatching;
+	StaticBatchSize = benchmarkConfig.batchSize;
+	BatchReportFile = benchmarkConfig.batchReportFile;
+	TextureArrays = benchmarkConfig.textureArrays;
+	TextureArrayReportFile = benchmarkConfig.texArrayReport;
+	TextureOptions = (benchmarkConfig.compressTextures ? kTextureCompress : 0) | (benchmarkConfig.generateMips ? kTextureGenerateMips : 0);
+	HardwareInstancing = benchmarkConfig.instancing;
+	SeparatePositions = benchmarkConfig.splitPositions;
+	DepthPrePass = benchmarkConfig.depthPrePass;
+	BakedLighting = benchmarkConfig.bakedLighting;
+	GBufferReportFile = benchmarkConfig.gBufferReport;
+	if (!GBufferLayoutFromName(benchmarkConfig.gBufferLayout, &GBufferLayout))
+	{
+		MessageBox(NULL, L"Unknown g-buffer layout, see GBufferLayout.h for the names", L"Error", MB_OK);
+	}
+	if (!MemorySetBudgets(benchmarkConfig.memoryBudgets))
+	{
+		MessageBox(NULL, L"Unknown memory budget, see MemorySetBudget for the names", L"Error", MB_OK);
+	}
+	MemoryAccountAdd(kMemoryFrameData, "FrameMemory", 2 * FrameMemorySize); // Double-buffered
+
+	// Job system checks and thread scaling benchmark - runs on its own, no window needed
+	if (benchmarkConfig.jobBenchmark)
+	{
+		bool passed = RunJobSystemBenchmark(benchmarkConfig.outputFile, benchmarkConfig.pinThreads);
+		if (!passed) MessageBox(NULL, L"Job system benchmark failed, see results file", L"Error", MB_OK);
+		return passed ? 0 : 1;
+	}
+
+	// CPU skinning throughput - runs on its own, starting the job system for each thread count
+	if (benchmarkConfig.skinBench > 0)
+	{
+		bool success = RunSkinningBenchmark(benchmarkConfig.outputFile, benchmarkConfig.skinBench, benchmarkConfig.pinThreads);
+		if (!success) MessageBox(NULL, L"Error running skinning benchmark", L"Error", MB_OK);
+		return success ? 0 : 1;
+	}
+
+	// Animation compression error and sampling throughput - also runs on its own
+	if (benchmarkConfig.animBench > 0)
+	{
+		bool success = RunAnimationBenchmark(benchmarkConfig.outputFile, benchmarkConfig.animBench);
+		if (!success) MessageBox(NULL, L"Error running animation benchmark", L"Error", MB_OK);
+		return success ? 0 : 1;
+	}
+
+	// Hierarchy propagation throughput - also runs on its own
+	if (benchmarkConfig.hierBench > 0)
+	{
+		bool success = RunHierarchyBenchmark(benchmarkConfig.outputFile, benchmarkConfig.hierBench);
+		if (!success) MessageBox(NULL, L"Error running hierarchy benchmark", L"Error", MB_OK);
+		return success ? 0 : 1;
+	}
+
+	// Block compression throughput and error on the repository's images - runs on its own, starting the job system for each
+	// thread count
+	if (!benchmarkConfig.compressBench.empty())
+	{
+		bool success = RunCompressionBenchmark(benchmarkConfig.outputFile, benchmarkConfig.compressBench, benchmarkConfig.pinThreads);
+		if (!success) MessageBox(NULL, L"Error running compression benchmark", L"Error", MB_OK);
+		return success ? 0 : 1;
+	}
+
+	// Mip generation throughput and alpha coverage on the repository's images - also runs on its own
+	if (!benchmarkConfig.mipBench.empty())
+	{
+		bool success = RunMipBenchmark(benchmarkConfig.outputFile, benchmarkConfig.mipBench, benchmarkConfig.pinThreads);
+		if (!success) MessageBox(NULL, L"Error running mip generation benchmark", L"Error", MB_OK);
+		return success ? 0 : 1;
+	}
+
+	// Offline texture array build - reads the X-file and its textures, no device needed
+	if (!benchmarkConfig.texArrayBuild.empty())
+	{
+		bool success = BuildTextureArrayFiles(benchmarkConfig.texArrayBuild, benchmarkConfig.outputFile);
+		if (!success) MessageBox(NULL, L"Error building texture arrays", L"Error", MB_OK);
+		return success ? 0 : 1;
+	}
+
+	// Offline light baking - bakes an X-file placed as the level, with the job system but no device. The timings are written to the
+	// results file
+	if (!benchmarkConfig.bakeLighting.empty())
+	{
+		JobSystemInit(-1, benchmarkConfig.pinThreads);
+		bool success = BakeLightingFile(benchmarkConfig.bakeLighting, LevelRootMatrix, LevelBakeSettings(), benchmarkConfig.outputFile);
+		JobSystemShutdown();
+		if (!success) MessageBox(NULL, L"Error baking lighting", L"Error", MB_OK);
+		return success ? 0 : 1;
+	}
+
+	// Self-checks of the modules that don't need a device - also run on their own
+	if (benchmarkConfig.selfChecks)
+	{
+		bool passed = RunSelfChecks(benchmarkConfig.outputFile);
+		if (!passed) MessageBox(NULL, L"Self-checks failed, see results file", L"Error", MB_OK);
+		return passed ? 0 : 1;
+	}
+
+	// Start worker threads, this thread also runs jobs while waiting for them
+	ProfilerSetThreadName("Main");
+	JobSystemInit(-1, benchmarkConfig.pinThreads);
+
 	// Initialise everything in turn
 	if (!InitWindow(hInstance, nCmdShow))
 	{
+		JobSystemShutdown();
 		return 0;
 	}
-	if (!InitDevice() || !LoadEffectFile() || !InitScene())
+	if (!Headless && (!InitDevice() || !LoadEffectFile() || !InitScene()))
 	{
 		ReleaseResources();
+		if (!benchmarkMode)
+		{
+			JobSystemShutdown();
+			return 0;
+		}
+
+		// No usable GPU - the benchmark can still measure the CPU-side stages
+		Headless = true;
+	}
+	if (Headless && !InitHeadlessScene())
+	{
+		ReleaseResources();
+		JobSystemShutdown();
 		return 0;
 	}
 
+	// Memory report for the loaded scene, e.g. to compare asset memory between builds
+	if (!StartupMemoryReportFile.empty() &&
+	    (!MemoryWriteJSON(StartupMemoryReportFile + ".json") || !MemoryWriteCSV(StartupMemoryReportFile + ".csv")))
+	{
+		MessageBox(NULL, L"Error writing memory report", L"Error", MB_OK);
+	}
+	if (!Headless && !BatchReportFile.empty() && !WriteBatchReport(BatchReportFile))
+	{
+		MessageBox(NULL, L"Error writing static batching report", L"Error", MB_OK);
+	}
+	if (!Headless && !TextureArrayReportFile.empty() && !WriteTextureArrayReport(TextureArrayReportFile))
+	{
+		MessageBox(NULL, L"Error writing texture array report", L"Error", MB_OK);
+	}
+	if (!Headless && !GBufferReportFile.empty() && !GBufferWriteBandwidthReport(GBufferReportFile, g_ViewportWidth, g_ViewportHeight))
+	{
+		MessageBox(NULL, L"Error writing g-buffer report", L"Error", MB_OK);
+	}
+
+	// Instancing submission benchmark - runs on its own once the scene is loaded
+	if (benchmarkConfig.instanceBench > 0)
+	{
+		bool success = !Headless && RunInstancingBenchmark(benchmarkConfig.instanceBench, benchmarkConfig.outputFile);
+		if (!success) MessageBox(NULL, L"Error running instancing benchmark", L"Error", MB_OK);
+		ReleaseResources();
+		JobSystemShutdown();
+		return success ? 0 : 1;
+	}
+
+	// Create the benchmark, the first run is set up at the start of the first frame
+	if (benchmarkMode)
+	{
+		CCameraPath cameraPath;
+		InitBenchmarkCameraPath(&cameraPath);
+		benchmarkConfig.headless = Headless;
+		Benchmark = new CBenchmark(benchmarkConfig, cameraPath);
+	}
+
 	// Initialise simple input functions
 	InitInput();
 
+	// Record or replay the session. A replay uses the random seed and simulation settings of its recording, so every
+	// simulation step is the same as when it was recorded. The benchmark drives the scene itself so neither applies
+	if (!Benchmark && !benchmarkConfig.replayFile.empty())
+	{
+		SInputSessionInfo session;
+		if (!InputStartReplay(benchmarkConfig.replayFile, &session))
+		{
+			MessageBox(NULL, L"Error loading input recording", L"Error", MB_OK);
+			ReleaseResources();
+			JobSystemShutdown();
+			return 0;
+		}
+		srand(session.seed);
+		benchmarkConfig.simulationStep = session.simulationStep;
+		benchmarkConfig.maxCatchUpSteps = session.maxCatchUpSteps;
+		ReplayTimings.reserve(InputReplayFrameCount());
+		ReplayResultsFile = benchmarkConfig.outputFile;
+	}
+	else if (!Benchmark && !benchmarkConfig.recordFile.empty())
+	{
+		SInputSessionInfo session;
+		session.seed = static_cast<unsigned int>(ClockTicks());
+		session.simulationStep = benchmarkConfig.simulationStep;
+		session.maxCatchUpSteps = benchmarkConfig.maxCatchUpSteps;
+		srand(session.seed);
+		if (!InputStartRecording(benchmarkConfig.recordFile, session))
+		{
+			MessageBox(NULL, L"Error creating input recording", L"Error", MB_OK);
+		}
+	}
+
 	// Initialise a timer class, start it counting now
 	CTimer Timer;
 	Timer.Start();
 
+	// Fixed simulation steps, starting with nothing to interpolate between
+	Simulation = CFixedTimestep(benchmarkConfig.simulationStep, benchmarkConfig.maxCatchUpSteps);
+	PrevCameraPosition = MainCamera->GetPosition();
+	PrevCameraRotation = MainCamera->GetRotation();
+
+	// Rendering always works from a snapshot of the scene, take one before the first frame is rendered
+	if (!Headless)
+	{
+		CaptureSnapshot(&SerialSnapshot, ClockTicks(), 0, 0.0f);
+		if (benchmarkConfig.targetFrameRate > 0.0f) Pipeline.SetTargetFrameTime(1.0f / benchmarkConfig.targetFrameRate);
+		if (benchmarkConfig.pipelined) StartPipeline();
+	}
+
 	// Main message loop
+	unsigned int frameNumber = 0;
+	bool replayFinished = false;
 	MSG msg = { 0 };
 	while (WM_QUIT != msg.message)
 	{
@@ -694,11 +1743,124 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
 		}
 		else // Otherwise render & update
 		{
-			RenderScene();
+			// Set up the scene for each new benchmark run
+			if (Benchmark && !Benchmark->IsFinished() && Benchmark->IsNewRun())
+			{
+				Deferred = (Benchmark->RunPath() != kBenchmarkForward);
+				ResetLights(Benchmark->RunLightCount());
+			}
 
-			// Get the time passed since the last frame
-			float frameTime = Timer.GetLapTime();
-			UpdateScene(frameTime);
+			// Once warmed up, frames should make no heap allocations. Window messages are handled outside this, as is the
+			// occasional event (e.g. profile capture, results writing) that is allowed to allocate
+			MemorySetAllocationsAllowed(!NoAllocations || frameNumber < SteadyStateFrame || ProfilerIsCapturing());
+
+			SBenchmarkFrame frameTimings;
+			{
+				PROFILE_SCOPE("Frame");
+
+				// Serial mode renders the last updated frame here (unless updating first, see UpdateFirst). Pipelined mode renders it on
+				// the render thread while this thread gets on with the next update, but first waits for the render thread to start on the
+				// last frame (and for the target frame time, if set) - this is the frame pacing
+				SFrameSnapshot* snapshot = NULL;
+				if (!Headless && !Pipelined && !UpdateFirst)
+				{
+					RenderFrame(SerialSnapshot);
+				}
+				else if (!Headless && Pipelined)
+				{
+					PROFILE_SCOPE("Wait For Render");
+					snapshot = Pipeline.BeginWrite();
+				}
+
+				// Nothing uses frame memory from two frames ago now - serial rendering has drawn last frame's snapshot and
+				// the render thread has finished with the snapshot being overwritten
+				FrameMemory.BeginFrame();
+
+				// Get the time passed since the last frame. The benchmark passes exactly one simulation step per frame so every
+				// run animates identically regardless of how long its frames take. A replay uses the recorded frame time instead,
+				// and applies the recorded input for this frame. When the replay runs out, this frame does not advance the scene
+				float frameTime = Timer.GetLapTime();
+				float simulationTime = frameTime;
+				if (!InputBeginFrame(&simulationTime))
+				{
+					simulationTime = 0.0f;
+					replayFinished = true;
+				}
+				TClockTicks updateStart = ClockTicks();
+				TClockTicks inputTime = LatencyConsumeInput(updateStart);
+				UpdateScene(Benchmark ? Benchmark->SimulationStep() : simulationTime);
+				TClockTicks updateEnd = ClockTicks();
+
+				// Pass the updated scene to the renderer
+				if (snapshot)
+				{
+					CaptureSnapshot(snapshot, updateStart, inputTime, Simulation.Alpha());
+					Pipeline.EndWrite();
+				}
+				else if (!Headless && !Pipelined)
+				{
+					CaptureSnapshot(&SerialSnapshot, updateStart, inputTime, Simulation.Alpha());
+					if (UpdateFirst) RenderFrame(SerialSnapshot);
+				}
+
+				frameTimings.frameTime = frameTime;
+				frameTimings.updateTime = static_cast<float>(ClockTicksToSeconds(updateEnd - updateStart));
+				frameTimings.renderTime = LastRenderTime;
+				frameTimings.latency = LastLatency;
+			}
+			ProfilerEndFrame();
+			MemorySetAllocationsAllowed(true);
+			FrameAllocations = MemoryEndFrame();
+			frameTimings.allocations = FrameAllocations;
+			FrameStatsAdd(kCounterAllocations, FrameAllocations);
+			FrameStatsEndFrame();
+			++frameNumber;
+
+			// Record benchmark timings, write results and quit when all runs are done
+			if (Benchmark)
+			{
+				Benchmark->EndFrame(frameTimings);
+				if (Benchmark->IsFinished())
+				{
+					if (!Benchmark->WriteResults())
+					{
+						MessageBox(NULL, L"Error writing benchmark results", L"Error", MB_OK);
+					}
+					DestroyWindow(HWnd);
+				}
+			}
+
+			// Keep the measured timings of each replayed frame, write them out and quit at the end of the replay
+			if (replayFinished)
+			{
+				if (!WriteFrameTimings(ReplayResultsFile, ReplayTimings))
+				{
+					MessageBox(NULL, L"Error writing replay timings", L"Error", MB_OK);
+				}
+				replayFinished = false;
+				DestroyWindow(HWnd);
+			}
+			else if (InputIsReplaying())
+			{
+				ReplayTimings.push_back(frameTimings);
+			}
+
+			// Toggle pipelined rendering, the snapshot is retaken so either mode starts from the current scene. Input latency
+			// measurements start again so they are not a mix of both modes
+			if (KeyHit(Key_F2) && !Headless && !Benchmark)
+			{
+				if (Pipelined)
+				{
+					StopPipeline();
+					CaptureSnapshot(&SerialSnapshot, ClockTicks(), 0, Simulation.Alpha());
+					LatencyReset();
+				}
+				else
+				{
+					LatencyReset();
+					StartPipeline();
+				}
+			}
 
 			if (KeyHit(Key_Escape))
 			{
@@ -708,7 +1870,19 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdLi
 		}
 	}
 
+	if (!InputStopRecording())
+	{
+		MessageBox(NULL, L"Error writing input recording", L"Error", MB_OK);
+	}
+	StopPipeline(); // Render thread must finish before the device is released
+	if (!LatencyFile.empty() && !LatencyWriteCSV(LatencyFile))
+	{
+		MessageBox(NULL, L"Error writing input latency results", L"Error", MB_OK);
+	}
 	ReleaseResources();
+	JobSystemShutdown(); // Before the profiler, workers write to profiler buffers
+	ProfilerShutdown();
+	delete Benchmark;
 
 	return (int)msg.wParam;
 }
@@ -771,6 +1945,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 		// These windows messages (WM_KEYXXXX) can be used to get keyboard input to the window
 		// This application has added some simple functions (not DirectX) to process these messages (all in Input.cpp/h)
 	case WM_KEYDOWN:
+		if (!InputIsReplaying()) LatencyInputEvent(); // Timestamp as early as possible, replayed input has no real arrival time
 		KeyDownEvent(static_cast<EKeyState>(wParam));
 		break;
 
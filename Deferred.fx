@@ -10,7 +10,7 @@
 //--------------------------------------------------------------------------------------
 
 // The matrices (4x4 matrix of floats) for transforming from 3D model to 2D projection (used in vertex shader)
-float4x4 WorldMatrix;
+float4x4 WorldMatrix; // For instanced models this is the node matrix, relative to each instance's world matrix
 float4x4 ViewMatrix;
 float4x4 ProjMatrix;
 float4x4 ViewProjMatrix;
@@ -42,14 +42,23 @@ float  SpecularPower;
 float3 CameraPos;
 float  CameraNearClip;
 
+// Tint multiplying the diffuse material of a model drawn on its own. Instanced models take it from the instance data instead
+float3 InstanceColour = float3(1.0f, 1.0f, 1.0f);
+
 // Textures
 Texture2D DiffuseMap; // Diffuse texture map (with optional specular map in alpha)
 Texture2D NormalMap;  // Normal map (with optional height map in alpha)
 
+// Diffuse maps of the same format and size grouped into one array (see TextureArrays.h). Materials with a diffuse map in
+// an array set DiffuseSlice to its slice and sample this instead of DiffuseMap, others set it negative
+Texture2DArray DiffuseMapArray;
+float          DiffuseSlice = -1.0f;
+
 					  // G-Buffer when used as textures for lighting pass
 Texture2D GBuff_DiffuseSpecular; // Diffuse colour in rgb, specular strength in a
 Texture2D GBuff_WorldPosition;   // World position at pixel in rgb (xyz)
-Texture2D GBuff_WorldNormal;     // World normal at pixel in rgb (xyz)
+Texture2D GBuff_WorldNormal;     // World normal at pixel in rgb (xyz), or octahedral encoded in rg for the compact layouts
+Texture2D GBuff_Depth;           // Depth buffer, for the compact layouts which reconstruct the world position from it
 
 
 								 // Samplers to use with the above textures
@@ -90,6 +99,23 @@ struct VS_INPUT
 	float2 UV     : TEXCOORD0;
 };
 
+// Position only, for depth passes. With meshes loaded with separate positions only the position stream is read
+struct VS_POSITION_INPUT
+{
+	float3 Pos : POSITION;
+};
+
+// The same vertex data with per-instance data from another vertex buffer (slot 2) when using hardware instancing. The world matrix
+// and colour come from the instance being drawn, one draw call covers every instance (see MeshInstances.h)
+struct VS_INSTANCED_INPUT
+{
+	float3   Pos            : POSITION;
+	float3   Normal         : NORMAL;
+	float2   UV             : TEXCOORD0;
+	float4x4 InstanceWorld  : WORLD;   // Rows in WORLD0 to WORLD3
+	float4   InstanceColour : COLOR1;
+};
+
 // This stucture contains the vertex data transformed into projection space & world space, i.e. the result of the usual vertex processing
 // Used in forward rendering for the standard pixel lighting stage, but also used when building the g-buffer - the main geometry processing
 // doesn't change much for deferred rendering - it's all about how this data is used next.
@@ -99,6 +125,21 @@ struct PS_TRANSFORMED_INPUT
 	float3 WorldPosition : POSITION;
 	float3 WorldNormal   : NORMAL;
 	float2 UV            : TEXCOORD0;
+	nointerpolation float3 Colour : COLOR0; // Instance colour, multiplies the diffuse material
+};
+
+// Meshes with lighting baked into their vertex colours (see LightBaking.h) - the ambient light, already scaled by the ambient
+// occlusion, plus the diffuse light of the lights that never move. The occlusion itself is in alpha, but isn't needed here
+struct VS_BAKED_INPUT
+{
+	VS_INPUT Vertex;
+	float4   BakedLight : COLOR0;
+};
+
+struct PS_BAKED_INPUT
+{
+	PS_TRANSFORMED_INPUT Transformed;
+	float3               BakedLight : COLOR1;
 };
 
 // For both forward and deferred rendering, the light flares (sprites showing the position of the lights) are rendered as
@@ -130,6 +171,31 @@ struct GBUFFER
 	float4 WorldNormal     : SV_Target2;
 };
 
+// The compact layouts (see GBufferLayout.h) store the diffuse colour and specular in RGBA8 and the normal octahedral encoded in two
+// components (RG16 or RGB10A2), with the position reconstructed from the depth buffer - 8 bytes per pixel rather than 48
+struct GBUFFER_COMPACT
+{
+	float4 DiffuseSpecular : SV_Target0;
+	float4 WorldNormal     : SV_Target1;
+};
+
+// Meshes with baked lighting also write their diffuse colour lit by it to the back buffer, bound as an extra target after the
+// g-buffer, with 1 in alpha to mark the pixels that have it. The ambient pass then only lights the other pixels
+struct GBUFFER_BAKED
+{
+	float4 DiffuseSpecular : SV_Target0;
+	float4 WorldPosition   : SV_Target1;
+	float4 WorldNormal     : SV_Target2;
+	float4 BakedLight      : SV_Target3;
+};
+
+struct GBUFFER_COMPACT_BAKED
+{
+	float4 DiffuseSpecular : SV_Target0;
+	float4 WorldNormal     : SV_Target1;
+	float4 BakedLight      : SV_Target2;
+};
+
 
 // In deferred rendering, ambient/directional light is applied as a full screen quad. The vertex shader generates the quad vertices using a special
 // input type, the automatically generated vertex ID. It starts at 0 and increases with each vertex processed (did something similar in post-processing)
@@ -167,6 +233,47 @@ struct PS_POINTLIGHT_INPUT
 // Deferred Rendering Shaders
 //--------------------------------------------------------------------------------------
 
+// Octahedral mapping of a unit vector into [-1,1]^2 and back - project onto the octahedron |x|+|y|+|z| = 1 and fold the lower half over the
+// diagonals. The CPU reference versions in GBufferLayout.cpp follow the same steps
+float2 OctahedralEncode(float3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	float2 signNotZero = float2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+	return (n.z >= 0.0f) ? n.xy : (1.0f - abs(n.yx)) * signNotZero;
+}
+
+float3 OctahedralDecode(float2 e)
+{
+	float3 n = float3(e, 1.0f - abs(e.x) - abs(e.y));
+	if (n.z < 0.0f)
+	{
+		float2 signNotZero = float2(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+		n.xy = (1.0f - abs(e.yx)) * signNotZero;
+	}
+	return normalize(n);
+}
+
+// World position of a pixel from its depth buffer value and UV. Undoes the perspective projection (allowing for the stereo offsets in its
+// third row) to get the view space position, then transforms by the camera's world matrix (InvViewMatrix)
+float3 ReconstructWorldPosition(float depth, float2 uv)
+{
+	float2 projXY = float2(uv.x * 2.0f - 1.0f, 1.0f - uv.y * 2.0f);
+	float viewZ = ProjMatrix._43 / (depth - ProjMatrix._33);
+	float3 viewPos = float3((projXY - ProjMatrix._31_32) * viewZ / float2(ProjMatrix._11, ProjMatrix._22), viewZ);
+	return mul(float4(viewPos, 1.0f), InvViewMatrix).xyz;
+}
+
+// Diffuse map of the current material, from its own texture or its slice of the array. The slice is the same for the whole draw
+// so the branch costs little
+float4 SampleDiffuseMap(float2 uv)
+{
+	if (DiffuseSlice >= 0.0f)
+	{
+		return DiffuseMapArray.Sample(TrilinearWrap, float3(uv, DiffuseSlice));
+	}
+	return DiffuseMap.Sample(TrilinearWrap, uv);
+}
+
 // This pixel shader writes the g-buffer. First the scene is rendered through a standard vertex shader. Then this pixel shader, instead of lighting and 
 // rendering the pixels, stores the texture colour, position and normal for this pixel in the g-buffer. Later lighting passes will uses this data to
 // light the scene. G-buffer layout is for us to decide, this setup is fairly basic
@@ -174,7 +281,8 @@ GBUFFER PS_GBuffer(PS_TRANSFORMED_INPUT pIn)
 {
 	GBUFFER gBuffer;
 
-	float4 colour = DiffuseMap.Sample(TrilinearWrap, pIn.UV); // Sample texture
+	float4 colour = SampleDiffuseMap(pIn.UV); // Sample texture
+	colour.rgb *= pIn.Colour;
 															  //	clip( colour.a - 0.5f ); // Discard pixels with alpha < 0.5 - the models in this lab use a lot of alpha transparency, but this impacts performance testing
 
 	gBuffer.DiffuseSpecular = float4(colour.rgb, dot(SpecularColour.rgb, 0.333f)); // Store diffuse.rgb colour from texture, and specular intensity from average of X-File specular colour r,g & b
@@ -184,6 +292,43 @@ GBUFFER PS_GBuffer(PS_TRANSFORMED_INPUT pIn)
 	return gBuffer;
 }
 
+// The same for the compact layouts - no position, the depth buffer holds what is needed to reconstruct it
+GBUFFER_COMPACT PS_GBufferCompact(PS_TRANSFORMED_INPUT pIn)
+{
+	GBUFFER_COMPACT gBuffer;
+
+	float4 colour = SampleDiffuseMap(pIn.UV);
+	colour.rgb *= pIn.Colour;
+
+	gBuffer.DiffuseSpecular = float4(colour.rgb, dot(SpecularColour.rgb, 0.333f));
+	gBuffer.WorldNormal = float4(OctahedralEncode(normalize(pIn.WorldNormal)) * 0.5f + 0.5f, 0.0f, 0.0f); // Into 0-1 for the UNORM target
+	return gBuffer;
+}
+
+// The same for meshes with baked lighting, also writing the lit diffuse colour to the back buffer
+GBUFFER_BAKED PS_GBufferBaked(PS_BAKED_INPUT pIn)
+{
+	GBUFFER gBuffer = PS_GBuffer(pIn.Transformed);
+
+	GBUFFER_BAKED baked;
+	baked.DiffuseSpecular = gBuffer.DiffuseSpecular;
+	baked.WorldPosition = gBuffer.WorldPosition;
+	baked.WorldNormal = gBuffer.WorldNormal;
+	baked.BakedLight = float4(gBuffer.DiffuseSpecular.rgb * pIn.BakedLight, 1.0f);
+	return baked;
+}
+
+GBUFFER_COMPACT_BAKED PS_GBufferCompactBaked(PS_BAKED_INPUT pIn)
+{
+	GBUFFER_COMPACT gBuffer = PS_GBufferCompact(pIn.Transformed);
+
+	GBUFFER_COMPACT_BAKED baked;
+	baked.DiffuseSpecular = gBuffer.DiffuseSpecular;
+	baked.WorldNormal = gBuffer.WorldNormal;
+	baked.BakedLight = float4(gBuffer.DiffuseSpecular.rgb * pIn.BakedLight, 1.0f);
+	return baked;
+}
+
 
 // The vertex shader for the ambient light geometry shader below. This shader self-generates a full-screen quad without requiring vertex data (similar to post-processing)
 PS_AMBIENTLIGHT_INPUT VS_AmbientLight(VS_AMBIENT_INPUT vIn)
@@ -274,26 +419,15 @@ void GS_PointLight
 // and the depth buffer will sort that out. However, pixels that are far beyond, but behind the sphere will be lit. However, this isn't
 // a problem because the attenuation calculations will mean those distant pixels get no light anyway. Some schemes also attempt to cull
 // those distant pixels to gain performance, but this quad based method is considered the most effective on modern hardware (I think!)
-float4 PS_PointLight(PS_POINTLIGHT_INPUT pIn) : SV_Target
+// The lighting itself is shared by the pixel shaders for each g-buffer layout (see GBufferLayout.h), which differ in how they fetch the data
+float4 PointLightPixel(PS_POINTLIGHT_INPUT pIn, float3 WorldPosition, float3 WorldNormal, float4 DiffuseSpecular)
 {
-	// Get the texture coordinate into the g-buffer - this is like full-screen post-processing
-	float2 uv = pIn.ProjPos.xy;
-	uv.x /= ViewportWidth;
-	uv.y /= ViewportHeight;
-
-	// Get the position of the pixel to be lit
-	float3 WorldPosition = GBuff_WorldPosition.Sample(PointClamp, uv);
-
 	// Immediately calculate attenuation (it's a different formula here, a linear fall-off, not so attractive but guaranteed to lie within the sphere)
 	// If the intensity is 0 (because the pixel is far away) then immediately discard to save further processing (try commenting out the discard line to see the performance effect)
 	float3 LightVec = pIn.LightPosition - WorldPosition;
 	float LightIntensity = saturate(1.0f - length(LightVec) / pIn.LightRadius);
 	//if (LightIntensity == 0.0f) discard;
 
-	// Get the texture diffuse colour and normal for this pixel from the g-buffer
-	float4 DiffuseSpecular = GBuff_DiffuseSpecular.Sample(PointClamp, uv);
-	float3 WorldNormal = GBuff_WorldNormal.Sample(PointClamp, uv);
-
 	// The rest of the code is standard per-pixel lighting. We have all the usual data to do this, it just via a very different route.
 	float3 LightDir = normalize(LightVec);
 	float3 CameraDir = normalize(CameraPos - WorldPosition);
@@ -314,6 +448,35 @@ float4 PS_PointLight(PS_POINTLIGHT_INPUT pIn) : SV_Target
 	// to see the quad rendered for each light and the actual pixels that are affected by it
 }
 
+float4 PS_PointLight(PS_POINTLIGHT_INPUT pIn) : SV_Target
+{
+	// Get the texture coordinate into the g-buffer - this is like full-screen post-processing
+	float2 uv = pIn.ProjPos.xy;
+	uv.x /= ViewportWidth;
+	uv.y /= ViewportHeight;
+
+	// Get the position, texture diffuse colour and normal for this pixel from the g-buffer
+	float3 WorldPosition = GBuff_WorldPosition.Sample(PointClamp, uv);
+	float4 DiffuseSpecular = GBuff_DiffuseSpecular.Sample(PointClamp, uv);
+	float3 WorldNormal = GBuff_WorldNormal.Sample(PointClamp, uv);
+
+	return PointLightPixel(pIn, WorldPosition, WorldNormal, DiffuseSpecular);
+}
+
+// The same for the compact g-buffer layouts - the normal is decoded from two components and the position is reconstructed from the depth buffer
+float4 PS_PointLightCompact(PS_POINTLIGHT_INPUT pIn) : SV_Target
+{
+	float2 uv = pIn.ProjPos.xy;
+	uv.x /= ViewportWidth;
+	uv.y /= ViewportHeight;
+
+	float3 WorldPosition = ReconstructWorldPosition(GBuff_Depth.Sample(PointClamp, uv).r, uv);
+	float4 DiffuseSpecular = GBuff_DiffuseSpecular.Sample(PointClamp, uv);
+	float3 WorldNormal = OctahedralDecode(GBuff_WorldNormal.Sample(PointClamp, uv).rg * 2.0f - 1.0f);
+
+	return PointLightPixel(pIn, WorldPosition, WorldNormal, DiffuseSpecular);
+}
+
 
 //--------------------------------------------------------------------------------------
 // Forward rendering shaders - nothing particularly new here
@@ -339,20 +502,58 @@ PS_TRANSFORMED_INPUT VS_TransformTex(VS_INPUT vIn)
 
 	// Pass texture coordinates (UVs) on to the pixel shader, the vertex shader doesn't need them
 	vOut.UV = vIn.UV;
+	vOut.Colour = InstanceColour;
+
+	return vOut;
+}
 
+// The same for meshes with baked lighting, which is passed on to be interpolated
+PS_BAKED_INPUT VS_TransformTexBaked(VS_BAKED_INPUT vIn)
+{
+	PS_BAKED_INPUT vOut;
+	vOut.Transformed = VS_TransformTex(vIn.Vertex);
+	vOut.BakedLight = vIn.BakedLight.rgb;
 	return vOut;
 }
 
+// The same for hardware instancing - the node matrix (WorldMatrix) is combined with the world matrix of the instance
+PS_TRANSFORMED_INPUT VS_TransformTexInstanced(VS_INSTANCED_INPUT vIn)
+{
+	PS_TRANSFORMED_INPUT vOut;
+
+	float4x4 worldMatrix = mul(WorldMatrix, vIn.InstanceWorld);
+	float4 worldPos = mul(float4(vIn.Pos, 1.0f), worldMatrix);
+	vOut.WorldPosition = worldPos.xyz;
+	float4 viewPos = mul(worldPos, ViewMatrix);
+	vOut.ProjPos = mul(viewPos, ProjMatrix);
+	vOut.WorldNormal = mul(float4(vIn.Normal, 0.0f), worldMatrix).xyz;
+	vOut.UV = vIn.UV;
+	vOut.Colour = vIn.InstanceColour.rgb;
+
+	return vOut;
+}
+
+// Transform the position only, for a depth pre-pass. The same operations in the same order as VS_TransformTex so the depth
+// matches exactly when the same geometry is rendered again with depth test LESS_EQUAL
+float4 VS_DepthOnly(VS_POSITION_INPUT vIn) : SV_Position
+{
+	float4 worldPos = mul(float4(vIn.Pos, 1.0f), WorldMatrix);
+	float4 viewPos = mul(worldPos, ViewMatrix);
+	return mul(viewPos, ProjMatrix);
+}
+
 // Pixel shader that calculates per-pixel lighting and combines with diffuse and specular map
 // Basically the same as previous pixel lighting shaders except this one processes an array of lights rather than a fixed number
-// Obviously, this isn't efficient for large number of lights, which is the point of using deferred rendering instead of this
-float4 PS_PixelLitDiffuseMap(PS_TRANSFORMED_INPUT pIn) : SV_Target
+// Obviously, this isn't efficient for large number of lights, which is the point of using deferred rendering instead of this.
+// The ambient light is given, so meshes with baked lighting can use that in its place
+float4 PixelLit(PS_TRANSFORMED_INPUT pIn, float3 ambientLight)
 {
 	////////////////////
 	// Sample texture
 
 	// Extract diffuse material colour for this pixel from a texture
-	float4 DiffuseMaterial = DiffuseMap.Sample(TrilinearWrap, pIn.UV);
+	float4 DiffuseMaterial = SampleDiffuseMap(pIn.UV);
+	DiffuseMaterial.rgb *= pIn.Colour;
 	//	clip( DiffuseMaterial.a - 0.5f ); // Discard pixels with alpha < 0.5, the model in this lab uses a lot of alpha transparency, but this impacts performance
 
 	// Renormalise normals that have been interpolated from the vertex shader
@@ -365,7 +566,7 @@ float4 PS_PixelLitDiffuseMap(PS_TRANSFORMED_INPUT pIn) : SV_Target
 	float3 CameraDir = normalize(CameraPos - pIn.WorldPosition); // Position of camera - position of current vertex (or pixel) (in world space)
 
 																 // Sum the effects of each light, 
-	float3 TotalDiffuse = AmbientColour;
+	float3 TotalDiffuse = ambientLight;
 	float3 TotalSpecular = 0;
 	for (int i = 0; i < NumPointLights; i++)
 	{
@@ -390,6 +591,17 @@ float4 PS_PixelLitDiffuseMap(PS_TRANSFORMED_INPUT pIn) : SV_Target
 	return combinedColour;
 }
 
+float4 PS_PixelLitDiffuseMap(PS_TRANSFORMED_INPUT pIn) : SV_Target
+{
+	return PixelLit(pIn, AmbientColour);
+}
+
+// Meshes with baked lighting have it in place of the ambient light, the lights in the list are those that move
+float4 PS_PixelLitBaked(PS_BAKED_INPUT pIn) : SV_Target
+{
+	return PixelLit(pIn.Transformed, pIn.BakedLight);
+}
+
 
 // Dummy vertex shader for the light particle system geometry shader below. The geometry shader does all the work
 VS_POINTLIGHT_INPUT VS_LightParticles(VS_POINTLIGHT_INPUT vIn)
@@ -494,6 +706,11 @@ DepthStencilState DepthWritesOn  // Write to the depth buffer - normal behaviour
 	DepthFunc = LESS;
 	DepthWriteMask = ALL;
 };
+DepthStencilState DepthLessEqual // Write to the depth buffer, also passing equal depths - for geometry already in a depth pre-pass
+{
+	DepthFunc = LESS_EQUAL;
+	DepthWriteMask = ALL;
+};
 DepthStencilState DisableDepth   // Disable depth buffer entirely
 {
 	DepthFunc = ALWAYS;
@@ -519,6 +736,13 @@ BlendState AlphaBlending // Alpha blending is used for the particles
 	DestBlend = INV_SRC_ALPHA;
 	BlendOp = ADD;
 };
+BlendState BakedAmbientBlending // Ambient light is added only where the back buffer's alpha doesn't mark baked lighting already there
+{
+	BlendEnable[0] = TRUE;
+	SrcBlend = INV_DEST_ALPHA;
+	DestBlend = ONE;
+	BlendOp = ADD;
+};
 
 
 //--------------------------------------------------------------------------------------
@@ -539,6 +763,21 @@ technique11 GBuffer
 		// Switch off blending states
 		SetBlendState(NoBlending, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
 		SetRasterizerState(CullNone); // The level model uses lots of two-sided faces, quick fix rather than edit the model and add extra shaders
+		SetDepthStencilState(DepthLessEqual, 0); // Passes where a depth pre-pass has already written the same depth
+	}
+}
+
+// Depth pre-pass - lays down depth with no pixel shader so the G-buffer pass only shades visible pixels
+technique11 DepthOnly
+{
+	pass P0
+	{
+		SetVertexShader(CompileShader(vs_5_0, VS_DepthOnly()));
+		SetGeometryShader(NULL);
+		SetPixelShader(NULL);
+
+		SetBlendState(NoBlending, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetRasterizerState(CullNone);
 		SetDepthStencilState(DepthWritesOn, 0);
 	}
 }
@@ -560,6 +799,21 @@ technique11 AmbientLight
 	}
 }
 
+// The ambient light pass when meshes with baked lighting have written it to the back buffer, the ambient light is only added elsewhere
+technique11 AmbientLightBaked
+{
+	pass P0
+	{
+		SetVertexShader(CompileShader(vs_5_0, VS_AmbientLight()));
+		SetGeometryShader(NULL);
+		SetPixelShader(CompileShader(ps_5_0, PS_AmbientLight()));
+
+		SetBlendState(BakedAmbientBlending, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetRasterizerState(CullBack);
+		SetDepthStencilState(DepthWritesOff, 0);
+	}
+}
+
 // Render the effect of a point light when using deferred rendering
 // Renders a quad covering the extents of a light's effect, use data from the G-buffer to calculate contribution of the light within that area
 technique11 PointLight
@@ -577,6 +831,35 @@ technique11 PointLight
 	}
 }
 
+// G-buffer techniques for the compact layouts, which are the same apart from the pixel shaders
+technique11 GBufferCompact
+{
+	pass P0
+	{
+		SetVertexShader(CompileShader(vs_5_0, VS_TransformTex()));
+		SetGeometryShader(NULL);
+		SetPixelShader(CompileShader(ps_5_0, PS_GBufferCompact()));
+
+		SetBlendState(NoBlending, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetRasterizerState(CullNone);
+		SetDepthStencilState(DepthLessEqual, 0);
+	}
+}
+
+technique11 PointLightCompact
+{
+	pass P0
+	{
+		SetVertexShader(CompileShader(vs_5_0, VS_PointLight()));
+		SetGeometryShader(CompileShader(gs_5_0, GS_PointLight()));
+		SetPixelShader(CompileShader(ps_5_0, PS_PointLightCompact()));
+
+		SetBlendState(AdditiveBlending, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetRasterizerState(CullBack);
+		SetDepthStencilState(DepthWritesOff, 0);
+	}
+}
+
 // Per-pixel lighting with diffuse map
 technique11 PixelLitTex
 {
@@ -593,6 +876,93 @@ technique11 PixelLitTex
 	}
 }
 
+// Versions of the GBuffer and PixelLitTex techniques for meshes with baked lighting in their vertex colours. The g-buffer techniques
+// need the back buffer bound after the g-buffer targets
+technique11 GBufferBaked
+{
+	pass P0
+	{
+		SetVertexShader(CompileShader(vs_5_0, VS_TransformTexBaked()));
+		SetGeometryShader(NULL);
+		SetPixelShader(CompileShader(ps_5_0, PS_GBufferBaked()));
+
+		SetBlendState(NoBlending, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetRasterizerState(CullNone);
+		SetDepthStencilState(DepthLessEqual, 0);
+	}
+}
+
+technique11 GBufferCompactBaked
+{
+	pass P0
+	{
+		SetVertexShader(CompileShader(vs_5_0, VS_TransformTexBaked()));
+		SetGeometryShader(NULL);
+		SetPixelShader(CompileShader(ps_5_0, PS_GBufferCompactBaked()));
+
+		SetBlendState(NoBlending, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetRasterizerState(CullNone);
+		SetDepthStencilState(DepthLessEqual, 0);
+	}
+}
+
+technique11 PixelLitTexBaked
+{
+	pass P0
+	{
+		SetVertexShader(CompileShader(vs_5_0, VS_TransformTexBaked()));
+		SetGeometryShader(NULL);
+		SetPixelShader(CompileShader(ps_5_0, PS_PixelLitBaked()));
+
+		SetBlendState(NoBlending, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetRasterizerState(CullNone);
+		SetDepthStencilState(DepthWritesOn, 0);
+	}
+}
+
+// Hardware instanced versions of the GBuffer and PixelLitTex techniques, used for the instances of a mesh drawn with one call
+technique11 GBufferInstanced
+{
+	pass P0
+	{
+		SetVertexShader(CompileShader(vs_5_0, VS_TransformTexInstanced()));
+		SetGeometryShader(NULL);
+		SetPixelShader(CompileShader(ps_5_0, PS_GBuffer()));
+
+		SetBlendState(NoBlending, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetRasterizerState(CullNone);
+		SetDepthStencilState(DepthWritesOn, 0);
+	}
+}
+
+technique11 GBufferCompactInstanced
+{
+	pass P0
+	{
+		SetVertexShader(CompileShader(vs_5_0, VS_TransformTexInstanced()));
+		SetGeometryShader(NULL);
+		SetPixelShader(CompileShader(ps_5_0, PS_GBufferCompact()));
+
+		SetBlendState(NoBlending, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetRasterizerState(CullNone);
+		SetDepthStencilState(DepthWritesOn, 0);
+	}
+}
+
+technique11 PixelLitTexInstanced
+{
+	pass P0
+	{
+		SetVertexShader(CompileShader(vs_5_0, VS_TransformTexInstanced()));
+		SetGeometryShader(NULL);
+		SetPixelShader(CompileShader(ps_5_0, PS_PixelLitDiffuseMap()));
+
+		SetBlendState(NoBlending, float4(0.0f, 0.0f, 0.0f, 0.0f), 0xFFFFFFFF);
+		SetRasterizerState(CullNone);
+		SetDepthStencilState(DepthWritesOn, 0);
+	}
+}
+
 
 // A particle system of lights (just the sprite to show the location, not the effect of the light). Rendered as camera-facing quads with additive blending
 technique11 LightParticles
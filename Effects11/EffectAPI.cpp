@@ -11,6 +11,11 @@
 
 using namespace D3DX11Effects;
 
+namespace D3DX11Effects
+{
+extern D3DX11_EFFECT_STATS g_EffectStats;
+}
+
 HRESULT WINAPI D3DX11CreateEffectFromMemory(CONST void *pData, SIZE_T DataLength, UINT FXFlags, ID3D11Device *pDevice, ID3DX11Effect **ppEffect)
 {
     HRESULT hr = S_OK;
@@ -27,3 +32,12 @@ lExit:
     }
     return hr;
 }
+
+void WINAPI D3DX11GetEffectStats(D3DX11_EFFECT_STATS *pStats, BOOL Reset)
+{
+    *pStats = g_EffectStats;
+    if (Reset)
+    {
+        ZeroMemory(&g_EffectStats, sizeof(g_EffectStats));
+    }
+}
@@ -18,6 +18,9 @@ namespace D3DX11Effects
                                 D3D11_KEEP_UNORDERED_ACCESS_VIEWS, D3D11_KEEP_UNORDERED_ACCESS_VIEWS, D3D11_KEEP_UNORDERED_ACCESS_VIEWS,
                                 D3D11_KEEP_UNORDERED_ACCESS_VIEWS, D3D11_KEEP_UNORDERED_ACCESS_VIEWS };
 
+    // Work done applying passes, read with D3DX11GetEffectStats
+    D3DX11_EFFECT_STATS g_EffectStats = { 0 };
+
 BOOL SBaseBlock::ApplyAssignments(CEffect *pEffect)
 {
     SAssignment *pAssignment = pAssignments;
@@ -136,6 +139,8 @@ D3DX11INLINE void CheckAndUpdateCB_FX(ID3D11DeviceContext *pContext, SConstantBu
         // CB out of date; rebuild it
         pContext->UpdateSubresource(pCB->pD3DObject, 0, NULL, pCB->pBackingStore, pCB->Size, pCB->Size);
         pCB->IsDirty = FALSE;
+        g_EffectStats.ConstantBufferUpdates++;
+        g_EffectStats.ConstantBufferBytes += pCB->Size;
     }
 }
 
@@ -232,6 +237,7 @@ void CEffect::ApplyShaderBlock(SShaderBlock *pBlock)
         }
 
         (m_pContext->*(pVT->pSetShaderResources))(pResourceDep->StartIndex, pResourceDep->Count, pResourceDep->ppD3DObjects);
+        g_EffectStats.ShaderResourceBinds += pResourceDep->Count;
     }
 
     // Update Interface dependencies
@@ -502,6 +508,7 @@ BOOL CEffect::ValidatePassBlock( SPassBlock* pBlock )
 // Set all state defined in the pass
 void CEffect::ApplyPassBlock(SPassBlock *pBlock)
 {
+    g_EffectStats.PassApplies++;
     pBlock->ApplyPassAssignments();
 
     if (NULL != pBlock->BackingStore.pBlendBlock)
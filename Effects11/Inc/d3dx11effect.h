@@ -1558,6 +1558,37 @@ extern "C" {
 
 HRESULT WINAPI D3DX11CreateEffectFromMemory(CONST void *pData, SIZE_T DataLength, UINT FXFlags, ID3D11Device *pDevice, ID3DX11Effect **ppEffect);
 
+//----------------------------------------------------------------------------
+// D3DX11GetEffectStats:
+// --------------------------
+// Returns counts of the work done when applying passes, across all effects,
+// for profiling. The counts are not synchronised - read them on the thread
+// that applies passes
+//
+// Parameters:
+//
+// [in]
+//
+//  Reset
+//      Set the counts back to zero after reading them
+//
+// [out]
+//
+//  pStats
+//      Counts since the last reset
+//
+//----------------------------------------------------------------------------
+
+typedef struct _D3DX11_EFFECT_STATS
+{
+    UINT    PassApplies;            // Pass Apply calls
+    UINT    ConstantBufferUpdates;  // Constant buffers and tbuffers uploaded with UpdateSubresource
+    UINT64  ConstantBufferBytes;    // Bytes uploaded by those updates
+    UINT    ShaderResourceBinds;    // Shader resource views bound
+} D3DX11_EFFECT_STATS;
+
+void WINAPI D3DX11GetEffectStats(D3DX11_EFFECT_STATS *pStats, BOOL Reset);
+
 #ifdef __cplusplus
 }
 #endif //__cplusplus
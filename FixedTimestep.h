@@ -0,0 +1,92 @@
+/*******************************************
+	FixedTimestep.h
+
+	Accumulator that turns variable frame
+	times into a whole number of fixed-length
+	simulation steps, with a cap on how many
+	steps are run to catch up after a slow frame
+********************************************/
+
+#pragma once
+
+#include <cmath>
+
+// Real time is added each frame and consumed in fixed steps, so the simulation runs identically
+// whatever the frame rate. Time left over (less than one step) is carried to the next frame and
+// given as an interpolation factor, so rendering can blend between the last two simulated states.
+// If a frame is so slow that more than the maximum steps are due, the excess time is dropped
+// rather than running a burst of steps that would make the next frame slow too
+class CFixedTimestep
+{
+public:
+	// Step length in seconds, and the most steps that will be run for a single frame
+	CFixedTimestep( float step = 1.0f / 60.0f, int maxSteps = 4 )
+		: m_Step( step ), m_MaxSteps( maxSteps ), m_Accumulator( 0.0f ), m_DroppedTime( 0.0f ), m_TotalSteps( 0 )
+	{
+	}
+
+	// Add the real time passed since the last frame (seconds), returns the number of steps to run now
+	int Advance( float frameTime )
+	{
+		m_Accumulator += frameTime;
+
+		int steps = 0;
+		while (m_Accumulator >= m_Step && steps < m_MaxSteps)
+		{
+			m_Accumulator -= m_Step;
+			++steps;
+		}
+
+		// Over the catch-up limit, keep only the partial step so interpolation is still correct
+		if (m_Accumulator >= m_Step)
+		{
+			float excess = m_Accumulator - fmodf( m_Accumulator, m_Step );
+			m_DroppedTime += excess;
+			m_Accumulator -= excess;
+		}
+
+		m_TotalSteps += steps;
+		return steps;
+	}
+
+	// How far between the previous and the latest simulated state the current real time is (0 to 1)
+	float Alpha() const
+	{
+		return m_Accumulator / m_Step;
+	}
+
+	// Forget any accumulated time, e.g. when the scene is reset
+	void Reset()
+	{
+		m_Accumulator = 0.0f;
+	}
+
+	float Step() const
+	{
+		return m_Step;
+	}
+
+	int MaxSteps() const
+	{
+		return m_MaxSteps;
+	}
+
+	// Simulation steps run since creation
+	unsigned int TotalSteps() const
+	{
+		return m_TotalSteps;
+	}
+
+	// Real time (seconds) discarded because the catch-up limit was reached
+	float DroppedTime() const
+	{
+		return m_DroppedTime;
+	}
+
+private:
+	float        m_Step;
+	int          m_MaxSteps;
+	float        m_Accumulator;
+	float        m_DroppedTime;
+	unsigned int m_TotalSteps;
+};
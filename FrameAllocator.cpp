@@ -0,0 +1,62 @@
+/*******************************************
+	FrameAllocator.cpp
+
+	Linear and double-buffered frame allocators
+********************************************/
+
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+#include "FrameAllocator.h"
+
+
+//-----------------------------------------------------------------------------
+// Linear allocator
+//-----------------------------------------------------------------------------
+
+CLinearAllocator::CLinearAllocator( size_t capacity )
+	: m_Capacity( capacity ), m_Offset( 0 ), m_HighWater( 0 ), m_Failures( 0 )
+{
+	m_Memory = new char[capacity];
+}
+
+CLinearAllocator::~CLinearAllocator()
+{
+	delete[] m_Memory;
+}
+
+
+// Get memory, alignment must be a power of two. Returns null if the block is full
+void* CLinearAllocator::Allocate( size_t size, size_t alignment )
+{
+	// Reserve enough for the worst-case padding, then align within the reserved space. This keeps
+	// allocation to a single atomic add, at the cost of up to (alignment - 1) wasted bytes
+	size_t start = m_Offset.fetch_add( size + alignment - 1, memory_order_relaxed );
+	if (start + size + alignment - 1 > m_Capacity)
+	{
+		m_Failures.fetch_add( 1, memory_order_relaxed );
+		return 0;
+	}
+
+	size_t address = reinterpret_cast<size_t>(m_Memory + start);
+	address = (address + alignment - 1) & ~(alignment - 1);
+	return reinterpret_cast<void*>(address);
+}
+
+// Copy a string into the block, returns null if the block is full
+char* CLinearAllocator::CopyString( const char* text )
+{
+	size_t length = strlen( text ) + 1;
+	char* copy = static_cast<char*>(Allocate( length, 1 ));
+	if (copy) memcpy( copy, text, length );
+	return copy;
+}
+
+// Release all allocations. No other thread may be allocating
+void CLinearAllocator::Reset()
+{
+	size_t used = Used();
+	if (used > m_HighWater) m_HighWater = used;
+	m_Offset.store( 0, memory_order_relaxed );
+}
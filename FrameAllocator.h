@@ -0,0 +1,143 @@
+/*******************************************
+	FrameAllocator.h
+
+	Linear (bump) allocator for short-lived
+	per-frame data, and a double-buffered
+	frame allocator built from two of them so
+	data can outlive its frame by one frame
+********************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+using namespace std;
+
+
+//-----------------------------------------------------------------------------
+// Linear allocator
+//-----------------------------------------------------------------------------
+
+// Hands out memory from a single fixed block by moving an offset forward. Individual allocations
+// are never freed, the whole block is reset at once. Allocation is thread-safe (a single atomic
+// add), reset is not. No constructors or destructors are run, use for plain data only
+class CLinearAllocator
+{
+public:
+	CLinearAllocator( size_t capacity );
+	~CLinearAllocator();
+
+	// Get memory, alignment must be a power of two. Returns null if the block is full
+	void* Allocate( size_t size, size_t alignment = 16 );
+
+	// Get memory for an array of plain data, returns null if the block is full
+	template <class T>
+	T* AllocateArray( size_t count )
+	{
+		return static_cast<T*>(Allocate( count * sizeof(T), __alignof(T) ));
+	}
+
+	// Copy a string into the block, returns null if the block is full
+	char* CopyString( const char* text );
+
+	// Release all allocations. No other thread may be allocating
+	void Reset();
+
+	size_t Capacity() const
+	{
+		return m_Capacity;
+	}
+
+	// Bytes used since the last reset, including alignment padding
+	size_t Used() const
+	{
+		size_t used = m_Offset.load( memory_order_relaxed );
+		return used < m_Capacity ? used : m_Capacity;
+	}
+
+	// Most bytes used between any two resets
+	size_t HighWater() const
+	{
+		return m_HighWater;
+	}
+
+	// Allocations that failed because the block was full
+	unsigned int Failures() const
+	{
+		return m_Failures.load( memory_order_relaxed );
+	}
+
+private:
+	// Disallow use of copy constructor and assignment operator (private and not defined)
+	CLinearAllocator( const CLinearAllocator& );
+	CLinearAllocator& operator=( const CLinearAllocator& );
+
+	char*                m_Memory;
+	size_t               m_Capacity;
+	atomic<size_t>       m_Offset;
+	size_t               m_HighWater;
+	atomic<unsigned int> m_Failures;
+};
+
+
+//-----------------------------------------------------------------------------
+// Frame allocator
+//-----------------------------------------------------------------------------
+
+// Two linear allocators used on alternate frames. BeginFrame resets the one used two frames ago,
+// so anything allocated during a frame stays valid until the end of the following frame - long
+// enough for a render thread working one frame behind to use it
+class CFrameAllocator
+{
+public:
+	// Capacity is for each of the two buffers
+	CFrameAllocator( size_t capacity ) : m_Current( 0 )
+	{
+		m_Buffers[0] = new CLinearAllocator( capacity );
+		m_Buffers[1] = new CLinearAllocator( capacity );
+	}
+
+	~CFrameAllocator()
+	{
+		delete m_Buffers[0];
+		delete m_Buffers[1];
+	}
+
+	// Switch buffers and reset the new one. Call at the start of each frame, once nothing is still
+	// using data allocated two frames ago
+	void BeginFrame()
+	{
+		m_Current ^= 1;
+		m_Buffers[m_Current]->Reset();
+	}
+
+	void* Allocate( size_t size, size_t alignment = 16 )
+	{
+		return m_Buffers[m_Current]->Allocate( size, alignment );
+	}
+
+	template <class T>
+	T* AllocateArray( size_t count )
+	{
+		return m_Buffers[m_Current]->AllocateArray<T>( count );
+	}
+
+	char* CopyString( const char* text )
+	{
+		return m_Buffers[m_Current]->CopyString( text );
+	}
+
+	// Buffer used by the current frame, e.g. for statistics
+	const CLinearAllocator& Current() const
+	{
+		return *m_Buffers[m_Current];
+	}
+
+private:
+	// Disallow use of copy constructor and assignment operator (private and not defined)
+	CFrameAllocator( const CFrameAllocator& );
+	CFrameAllocator& operator=( const CFrameAllocator& );
+
+	CLinearAllocator* m_Buffers[2];
+	int               m_Current;
+};
@@ -0,0 +1,147 @@
+/*******************************************
+	FramePipeline.h
+
+	Double-buffered hand-over of frame data
+	from a simulation thread to a render
+	thread, so one frame can be simulated
+	while the previous one is drawn
+********************************************/
+
+#pragma once
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+using namespace std;
+
+
+// Two copies of the frame data are kept. The simulation thread fills one while the render thread
+// draws from the other, they swap over when both are done. A new frame is only started once the
+// renderer has picked up the previous one, so the simulation is never more than one frame ahead.
+// A target frame time can be set to hold the simulation back further
+template <class TFrame>
+class CFramePipeline
+{
+public:
+	CFramePipeline() : m_WriteIndex( 0 ), m_ReadIndex( 0 ), m_Stopped( false ), m_TargetFrameTime( 0.0f )
+	{
+		m_State[0] = m_State[1] = kFree;
+		m_NextFrameStart = chrono::steady_clock::now();
+	}
+
+	// Simulation thread should aim for this time per frame (seconds), 0 for as fast as possible
+	void SetTargetFrameTime( float frameTime )
+	{
+		m_TargetFrameTime = frameTime;
+		m_NextFrameStart = chrono::steady_clock::now();
+	}
+
+
+	/////////////////////////////////////
+	// Simulation thread
+
+	// Get the frame to fill in, call before starting the update. Waits until the render thread has
+	// started on the previous frame and finished with this one (and until the next frame is due if
+	// there is a target frame time). Returns null if the pipeline is stopped
+	TFrame* BeginWrite()
+	{
+		if (m_TargetFrameTime > 0.0f)
+		{
+			this_thread::sleep_until( m_NextFrameStart );
+			m_NextFrameStart = max( m_NextFrameStart + chrono::duration_cast<chrono::steady_clock::duration>(
+			                        chrono::duration<float>( m_TargetFrameTime ) ), chrono::steady_clock::now() );
+		}
+
+		unique_lock<mutex> lock( m_Mutex );
+		m_Condition.wait( lock, [this] { return (m_State[m_WriteIndex] == kFree && m_State[m_WriteIndex ^ 1] != kWritten) ||
+		                                        m_Stopped; } );
+		return m_Stopped ? 0 : &m_Frames[m_WriteIndex];
+	}
+
+	// Pass the frame just filled in to the render thread
+	void EndWrite()
+	{
+		{
+			lock_guard<mutex> lock( m_Mutex );
+			m_State[m_WriteIndex] = kWritten;
+			m_WriteIndex ^= 1;
+		}
+		m_Condition.notify_all();
+	}
+
+
+	/////////////////////////////////////
+	// Render thread
+
+	// Get the next frame to render, waiting for the simulation thread if necessary. Returns null
+	// if the pipeline is stopped
+	const TFrame* BeginRead()
+	{
+		unique_lock<mutex> lock( m_Mutex );
+		m_Condition.wait( lock, [this] { return m_State[m_ReadIndex] == kWritten || m_Stopped; } );
+		if (m_Stopped) return 0;
+		m_State[m_ReadIndex] = kReading;
+		return &m_Frames[m_ReadIndex];
+	}
+
+	// Finished with the frame, the simulation thread can reuse it
+	void EndRead()
+	{
+		{
+			lock_guard<mutex> lock( m_Mutex );
+			m_State[m_ReadIndex] = kFree;
+			m_ReadIndex ^= 1;
+		}
+		m_Condition.notify_all();
+	}
+
+
+	/////////////////////////////////////
+	// Control
+
+	// Release both threads from any wait, all further Begin calls return null
+	void Stop()
+	{
+		{
+			lock_guard<mutex> lock( m_Mutex );
+			m_Stopped = true;
+		}
+		m_Condition.notify_all();
+	}
+
+	// Return to the initial state (both threads must have stopped using the pipeline)
+	void Reset()
+	{
+		lock_guard<mutex> lock( m_Mutex );
+		m_State[0] = m_State[1] = kFree;
+		m_WriteIndex = m_ReadIndex = 0;
+		m_Stopped = false;
+		m_NextFrameStart = chrono::steady_clock::now();
+	}
+
+private:
+	// Disallow use of copy constructor and assignment operator (private and not defined)
+	CFramePipeline( const CFramePipeline& );
+	CFramePipeline& operator=( const CFramePipeline& );
+
+	enum EFrameState
+	{
+		kFree,    // Can be filled by the simulation
+		kWritten, // Filled, waiting to be rendered
+		kReading, // Being rendered
+	};
+
+	TFrame      m_Frames[2];
+	EFrameState m_State[2];
+	int         m_WriteIndex;
+	int         m_ReadIndex;
+	bool        m_Stopped;
+
+	mutex              m_Mutex;
+	condition_variable m_Condition;
+
+	// Frame pacing, used by the simulation thread only
+	float                            m_TargetFrameTime;
+	chrono::steady_clock::time_point m_NextFrameStart;
+};
@@ -0,0 +1,193 @@
+/*******************************************
+	FrameStats.cpp
+
+	Per-frame work counters
+********************************************/
+
+#include <cstdio>
+using namespace std;
+
+#include "FrameStats.h"
+
+
+//-----------------------------------------------------------------------------
+// Counters
+//-----------------------------------------------------------------------------
+
+// Counts for the frame in progress. Zero-initialised before any dynamic initialisation runs, so
+// counting is safe from other global constructors
+atomic<unsigned long long> g_FrameCounters[kNumFrameCounters];
+
+// Name of a counter as used in reports
+const char* FrameCounterName( EFrameCounter counter )
+{
+	switch (counter)
+	{
+		case kCounterDrawCalls:           return "draw_calls";
+		case kCounterTriangles:           return "triangles";
+		case kCounterSubMeshesDrawn:      return "submeshes_drawn";
+		case kCounterSubMeshesCulled:     return "submeshes_culled";
+		case kCounterLightsDrawn:         return "lights_drawn";
+		case kCounterEffectApplies:       return "effect_applies";
+		case kCounterConstantBufferBytes: return "cb_bytes";
+		case kCounterVertexBufferBytes:   return "vb_bytes";
+		case kCounterBufferDiscards:      return "buffer_discards";
+		case kCounterTextureBinds:        return "texture_binds";
+		case kCounterMaterialTextures:    return "material_textures";
+		case kCounterBufferBinds:         return "buffer_binds";
+		case kCounterInputLayoutBinds:    return "layout_binds";
+		case kCounterAllocations:         return "allocations";
+		case kCounterSimulationSteps:     return "simulation_steps";
+		default:                          return "unknown";
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Frames and reports
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Rolling window of completed frames, a ring buffer written by the main thread only
+	unsigned long long History[kFrameStatsWindow][kNumFrameCounters];
+	unsigned int       HistoryNext = 0;  // Slot for the next frame
+	unsigned int       HistoryCount = 0; // Frames stored, up to the window size
+	unsigned long long FrameNumber = 0;  // Frames ended since the program started
+
+	// Index into History of the i-th oldest frame in the window
+	unsigned int HistorySlot( unsigned int i )
+	{
+		return (HistoryNext + kFrameStatsWindow - HistoryCount + i) % kFrameStatsWindow;
+	}
+}
+
+
+// Call once at the end of every frame, on the main thread
+void FrameStatsEndFrame()
+{
+	for (int c = 0; c < kNumFrameCounters; ++c)
+	{
+		History[HistoryNext][c] = g_FrameCounters[c].exchange( 0, memory_order_relaxed );
+	}
+	HistoryNext = (HistoryNext + 1) % kFrameStatsWindow;
+	if (HistoryCount < kFrameStatsWindow) ++HistoryCount;
+	++FrameNumber;
+}
+
+// Frames recorded in the window so far
+unsigned int FrameStatsFrameCount()
+{
+	return HistoryCount;
+}
+
+
+// Summarise a counter over the window
+SFrameCounterSummary FrameStatsSummary( EFrameCounter counter )
+{
+	SFrameCounterSummary summary = { 0, 0.0, 0, 0 };
+	if (HistoryCount == 0) return summary;
+
+	unsigned long long sum = 0;
+	summary.min = ~0ull;
+	for (unsigned int i = 0; i < HistoryCount; ++i)
+	{
+		unsigned long long value = History[HistorySlot( i )][counter];
+		sum += value;
+		if (value < summary.min) summary.min = value;
+		if (value > summary.max) summary.max = value;
+	}
+	summary.last = History[HistorySlot( HistoryCount - 1 )][counter];
+	summary.mean = static_cast<double>(sum) / HistoryCount;
+	return summary;
+}
+
+
+// Short summary of the main counters (window means) for on-screen display
+void FrameStatsText( char* text, int size )
+{
+	snprintf( text, size, "Draws: %.0f, Tris: %.0fk, Applies: %.0f, CB: %.1fKB, VB: %.1fKB, Textures: %.0f (%.0f changed), Buffers: %.0f, Lights: %.0f, "
+	                      "Culled: %.0f/%.0f, Allocs: %.1f",
+	          FrameStatsSummary( kCounterDrawCalls ).mean,
+	          FrameStatsSummary( kCounterTriangles ).mean / 1000.0,
+	          FrameStatsSummary( kCounterEffectApplies ).mean,
+	          FrameStatsSummary( kCounterConstantBufferBytes ).mean / 1024.0,
+	          FrameStatsSummary( kCounterVertexBufferBytes ).mean / 1024.0,
+	          FrameStatsSummary( kCounterTextureBinds ).mean,
+	          FrameStatsSummary( kCounterMaterialTextures ).mean,
+	          FrameStatsSummary( kCounterBufferBinds ).mean,
+	          FrameStatsSummary( kCounterLightsDrawn ).mean,
+	          FrameStatsSummary( kCounterSubMeshesCulled ).mean,
+	          FrameStatsSummary( kCounterSubMeshesCulled ).mean + FrameStatsSummary( kCounterSubMeshesDrawn ).mean,
+	          FrameStatsSummary( kCounterAllocations ).mean );
+}
+
+
+// Write the window to a JSON file
+bool FrameStatsWriteJSON( const string& fileName )
+{
+	FILE* file = fopen( fileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+
+	unsigned long long firstFrame = FrameNumber - HistoryCount;
+	fprintf( file, "{\n  \"frames\": [\n" );
+	for (unsigned int i = 0; i < HistoryCount; ++i)
+	{
+		const unsigned long long* counters = History[HistorySlot( i )];
+		fprintf( file, "    { \"frame\": %llu", firstFrame + i );
+		for (int c = 0; c < kNumFrameCounters; ++c)
+		{
+			fprintf( file, ", \"%s\": %llu", FrameCounterName( static_cast<EFrameCounter>(c) ), counters[c] );
+		}
+		fprintf( file, " }%s\n", i + 1 < HistoryCount ? "," : "" );
+	}
+	fprintf( file, "  ],\n  \"summary\": {\n" );
+	for (int c = 0; c < kNumFrameCounters; ++c)
+	{
+		SFrameCounterSummary summary = FrameStatsSummary( static_cast<EFrameCounter>(c) );
+		fprintf( file, "    \"%s\": { \"last\": %llu, \"mean\": %.2f, \"min\": %llu, \"max\": %llu }%s\n",
+		         FrameCounterName( static_cast<EFrameCounter>(c) ), summary.last, summary.mean, summary.min, summary.max,
+		         c + 1 < kNumFrameCounters ? "," : "" );
+	}
+	fprintf( file, "  }\n}\n" );
+
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success;
+}
+
+// Write the window to a CSV file, one row per frame
+bool FrameStatsWriteCSV( const string& fileName )
+{
+	FILE* file = fopen( fileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+
+	fprintf( file, "frame" );
+	for (int c = 0; c < kNumFrameCounters; ++c)
+	{
+		fprintf( file, ",%s", FrameCounterName( static_cast<EFrameCounter>(c) ) );
+	}
+	fprintf( file, "\n" );
+
+	unsigned long long firstFrame = FrameNumber - HistoryCount;
+	for (unsigned int i = 0; i < HistoryCount; ++i)
+	{
+		const unsigned long long* counters = History[HistorySlot( i )];
+		fprintf( file, "%llu", firstFrame + i );
+		for (int c = 0; c < kNumFrameCounters; ++c)
+		{
+			fprintf( file, ",%llu", counters[c] );
+		}
+		fprintf( file, "\n" );
+	}
+
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success;
+}
@@ -0,0 +1,97 @@
+/*******************************************
+	FrameStats.h
+
+	Per-frame work counters (draw calls,
+	triangles, state changes, uploads...)
+	kept over a rolling window of frames and
+	reported as text, JSON or CSV
+********************************************/
+
+#pragma once
+
+#include <atomic>
+#include <string>
+using namespace std;
+
+
+//-----------------------------------------------------------------------------
+// Counters
+//-----------------------------------------------------------------------------
+
+// Everything counted each frame. Add new counters before kNumFrameCounters and give them a name
+// in FrameCounterName
+enum EFrameCounter
+{
+	kCounterDrawCalls,           // Draw, DrawIndexed etc. calls
+	kCounterTriangles,           // Triangles submitted in draw calls (points for point lists)
+	kCounterSubMeshesDrawn,      // Sub-meshes rendered by CMesh::Render
+	kCounterSubMeshesCulled,     // Sub-meshes skipped by culling
+	kCounterLightsDrawn,         // Point lights drawn in the lighting pass (or passed to the forward shader)
+	kCounterEffectApplies,       // Effect pass Apply calls
+	kCounterConstantBufferBytes, // Bytes uploaded to constant buffers
+	kCounterVertexBufferBytes,   // Bytes written to mapped vertex buffers
+	kCounterBufferDiscards,      // Dynamic buffers mapped with WRITE_DISCARD (each one a rename in the driver)
+	kCounterTextureBinds,        // Shader resource views bound
+	kCounterMaterialTextures,    // Material textures set by CMesh that differ from the previous draw's (see CMesh::BuildTextureArrays)
+	kCounterBufferBinds,         // Vertex and index buffers bound
+	kCounterInputLayoutBinds,    // Input layouts bound
+	kCounterAllocations,         // Heap allocations (see MemoryTracking.h)
+	kCounterSimulationSteps,     // Fixed simulation steps run
+
+	kNumFrameCounters
+};
+
+// Name of a counter as used in reports
+const char* FrameCounterName( EFrameCounter counter );
+
+
+// Add to a counter for the current frame. Can be called from any thread, the cost is one relaxed
+// atomic add. Define NO_FRAME_STATS to compile counting out
+#ifndef NO_FRAME_STATS
+	extern atomic<unsigned long long> g_FrameCounters[kNumFrameCounters];
+
+	inline void FrameStatsAdd( EFrameCounter counter, unsigned long long value = 1 )
+	{
+		g_FrameCounters[counter].fetch_add( value, memory_order_relaxed );
+	}
+#else
+	inline void FrameStatsAdd( EFrameCounter, unsigned long long = 1 ) {}
+#endif
+
+
+//-----------------------------------------------------------------------------
+// Frames and reports
+//-----------------------------------------------------------------------------
+
+// Number of most recent frames kept, summaries are over this rolling window
+const unsigned int kFrameStatsWindow = 120;
+
+// Summary of one counter over the window
+struct SFrameCounterSummary
+{
+	unsigned long long last; // Most recent frame
+	double             mean;
+	unsigned long long min;
+	unsigned long long max;
+};
+
+// Call once at the end of every frame, on the main thread. The counts since the last call are
+// stored as one frame of the rolling window and the counters start again from zero. In pipelined
+// mode the render thread's counts land in whichever frame is current when it makes them, so
+// render counters lag update counters by one frame
+void FrameStatsEndFrame();
+
+// Frames recorded in the window so far (up to kFrameStatsWindow)
+unsigned int FrameStatsFrameCount();
+
+// Summarise a counter over the window
+SFrameCounterSummary FrameStatsSummary( EFrameCounter counter );
+
+// Short summary of the main counters (window means) for on-screen display, written into the
+// given buffer so it can be called every frame without allocating
+void FrameStatsText( char* text, int size );
+
+// Write the window to a file, one entry per frame with every counter, followed by the summary.
+// Returns false on a file error
+bool FrameStatsWriteJSON( const string& fileName );
+bool FrameStatsWriteCSV( const string& fileName );
@@ -0,0 +1,217 @@
+/*******************************************
+	GBufferLayout.cpp
+
+	G-buffer layouts, bandwidth and reference
+	encoders
+********************************************/
+
+#include <cmath>
+#include <cstdio>
+using namespace std;
+
+#include "GBufferLayout.h"
+
+
+//-----------------------------------------------------------------------------
+// Layouts
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	const SGBufferLayout Layouts[kNumGBufferLayouts] =
+	{
+		{ "float",     3, { DXGI_FORMAT_R32G32B32A32_FLOAT, DXGI_FORMAT_R32G32B32A32_FLOAT, DXGI_FORMAT_R32G32B32A32_FLOAT }, false },
+		{ "compact16", 2, { DXGI_FORMAT_R8G8B8A8_UNORM, DXGI_FORMAT_R16G16_UNORM, DXGI_FORMAT_UNKNOWN }, true },
+		{ "compact10", 2, { DXGI_FORMAT_R8G8B8A8_UNORM, DXGI_FORMAT_R10G10B10A2_UNORM, DXGI_FORMAT_UNKNOWN }, true },
+	};
+
+	// Bytes per pixel of the formats used by the layouts
+	unsigned int FormatBytes( DXGI_FORMAT format )
+	{
+		switch (format)
+		{
+			case DXGI_FORMAT_R32G32B32A32_FLOAT: return 16;
+			case DXGI_FORMAT_R8G8B8A8_UNORM:
+			case DXGI_FORMAT_R16G16_UNORM:
+			case DXGI_FORMAT_R10G10B10A2_UNORM:
+			case DXGI_FORMAT_R32_FLOAT:          return 4;
+			default:                             return 0;
+		}
+	}
+}
+
+// Description of a layout
+const SGBufferLayout& GBufferLayoutDesc( EGBufferLayout layout )
+{
+	return Layouts[layout];
+}
+
+// Layout with the given name
+bool GBufferLayoutFromName( const string& name, EGBufferLayout* pLayout )
+{
+	for (int layout = 0; layout < kNumGBufferLayouts; ++layout)
+	{
+		if (name == Layouts[layout].name)
+		{
+			*pLayout = static_cast<EGBufferLayout>(layout);
+			return true;
+		}
+	}
+	return false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Memory and bandwidth
+//-----------------------------------------------------------------------------
+
+// Estimated G-buffer traffic of a layout at a given resolution
+SGBufferBandwidth GBufferBandwidth( EGBufferLayout layout, unsigned int width, unsigned int height )
+{
+	const SGBufferLayout& desc = Layouts[layout];
+	unsigned long long pixels = static_cast<unsigned long long>(width) * height;
+
+	SGBufferBandwidth bandwidth;
+	bandwidth.bytesPerPixel = 0;
+	for (int target = 0; target < desc.numTargets; ++target)
+	{
+		bandwidth.bytesPerPixel += FormatBytes( desc.formats[target] );
+	}
+	bandwidth.memoryBytes = pixels * bandwidth.bytesPerPixel;
+	bandwidth.writeBytes = bandwidth.memoryBytes;
+	bandwidth.readBytes = bandwidth.memoryBytes + (desc.positionFromDepth ? pixels * FormatBytes( DXGI_FORMAT_R32_FLOAT ) : 0);
+	return bandwidth;
+}
+
+// Write the bandwidth of every layout to a CSV file
+bool GBufferWriteBandwidthReport( const string& fileName, unsigned int width, unsigned int height )
+{
+	FILE* file = fopen( fileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+
+	SGBufferBandwidth reference = GBufferBandwidth( kGBufferFloat, width, height );
+	fprintf( file, "layout,width,height,targets,bytes_per_pixel,memory_bytes,write_bytes,read_bytes,memory_ratio\n" );
+	for (int layout = 0; layout < kNumGBufferLayouts; ++layout)
+	{
+		SGBufferBandwidth bandwidth = GBufferBandwidth( static_cast<EGBufferLayout>(layout), width, height );
+		fprintf( file, "%s,%u,%u,%d,%u,%llu,%llu,%llu,%.2f\n", Layouts[layout].name, width, height, Layouts[layout].numTargets,
+		         bandwidth.bytesPerPixel, bandwidth.memoryBytes, bandwidth.writeBytes, bandwidth.readBytes,
+		         static_cast<double>(reference.memoryBytes) / bandwidth.memoryBytes );
+	}
+
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success;
+}
+
+
+//-----------------------------------------------------------------------------
+// Reference encoders
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	TFloat32 SignNotZero( TFloat32 x )
+	{
+		return (x >= 0.0f) ? 1.0f : -1.0f;
+	}
+
+	TFloat32 Saturate( TFloat32 x )
+	{
+		return (x < 0.0f) ? 0.0f : (x > 1.0f ? 1.0f : x);
+	}
+
+	// Float in 0-1 to an unsigned normalised integer of the given number of bits and back, rounding to nearest
+	TUInt32 ToUnorm( TFloat32 x, int bits )
+	{
+		TFloat32 scale = static_cast<TFloat32>((1u << bits) - 1);
+		return static_cast<TUInt32>(floorf( Saturate( x ) * scale + 0.5f ));
+	}
+
+	TFloat32 FromUnorm( TUInt32 x, int bits )
+	{
+		TUInt32 mask = (1u << bits) - 1;
+		return static_cast<TFloat32>(x & mask) / static_cast<TFloat32>(mask);
+	}
+}
+
+
+// Octahedral mapping of a unit vector to [-1,1]^2: project onto the octahedron |x|+|y|+|z| = 1, then
+// fold the lower half over the diagonals
+CVector2 OctahedralEncode( const CVector3& normal )
+{
+	TFloat32 sum = fabsf( normal.x ) + fabsf( normal.y ) + fabsf( normal.z );
+	CVector2 encoded( normal.x / sum, normal.y / sum );
+	if (normal.z < 0.0f)
+	{
+		encoded = CVector2( (1.0f - fabsf( encoded.y )) * SignNotZero( encoded.x ),
+		                    (1.0f - fabsf( encoded.x )) * SignNotZero( encoded.y ) );
+	}
+	return encoded;
+}
+
+CVector3 OctahedralDecode( const CVector2& encoded )
+{
+	CVector3 normal( encoded.x, encoded.y, 1.0f - fabsf( encoded.x ) - fabsf( encoded.y ) );
+	if (normal.z < 0.0f)
+	{
+		normal.x = (1.0f - fabsf( encoded.y )) * SignNotZero( encoded.x );
+		normal.y = (1.0f - fabsf( encoded.x )) * SignNotZero( encoded.y );
+	}
+	return Normalise( normal );
+}
+
+
+// Normal in RG16_UNORM
+TUInt32 PackNormalRG16( const CVector3& normal )
+{
+	CVector2 encoded = OctahedralEncode( normal );
+	return ToUnorm( encoded.x * 0.5f + 0.5f, 16 ) | (ToUnorm( encoded.y * 0.5f + 0.5f, 16 ) << 16);
+}
+
+CVector3 UnpackNormalRG16( TUInt32 packed )
+{
+	return OctahedralDecode( CVector2( FromUnorm( packed, 16 ) * 2.0f - 1.0f, FromUnorm( packed >> 16, 16 ) * 2.0f - 1.0f ) );
+}
+
+// Normal in RGB10A2_UNORM
+TUInt32 PackNormalRGB10A2( const CVector3& normal )
+{
+	CVector2 encoded = OctahedralEncode( normal );
+	return ToUnorm( encoded.x * 0.5f + 0.5f, 10 ) | (ToUnorm( encoded.y * 0.5f + 0.5f, 10 ) << 10);
+}
+
+CVector3 UnpackNormalRGB10A2( TUInt32 packed )
+{
+	return OctahedralDecode( CVector2( FromUnorm( packed, 10 ) * 2.0f - 1.0f, FromUnorm( packed >> 10, 10 ) * 2.0f - 1.0f ) );
+}
+
+
+// Diffuse colour and specular strength in RGBA8_UNORM
+TUInt32 PackDiffuseSpecular( const CVector3& diffuse, TFloat32 specular )
+{
+	return ToUnorm( diffuse.x, 8 ) | (ToUnorm( diffuse.y, 8 ) << 8) | (ToUnorm( diffuse.z, 8 ) << 16) | (ToUnorm( specular, 8 ) << 24);
+}
+
+void UnpackDiffuseSpecular( TUInt32 packed, CVector3* pDiffuse, TFloat32* pSpecular )
+{
+	*pDiffuse = CVector3( FromUnorm( packed, 8 ), FromUnorm( packed >> 8, 8 ), FromUnorm( packed >> 16, 8 ) );
+	*pSpecular = FromUnorm( packed >> 24, 8 );
+}
+
+
+// World position of a pixel from its depth. For a perspective projection (row vectors) the depth buffer
+// holds e22 + e32 / z for view space depth z, and projection space x is (x * e00 + z * e20) / z
+CVector3 ReconstructWorldPosition( TFloat32 depth, const CVector2& uv, const CMatrix4x4& projMatrix,
+                                   const CMatrix4x4& invViewMatrix )
+{
+	TFloat32 projX = uv.x * 2.0f - 1.0f;
+	TFloat32 projY = 1.0f - uv.y * 2.0f;
+	TFloat32 viewZ = projMatrix.e32 / (depth - projMatrix.e22);
+	CVector3 viewPosition( (projX - projMatrix.e20) * viewZ / projMatrix.e00,
+	                       (projY - projMatrix.e21) * viewZ / projMatrix.e11, viewZ );
+	return invViewMatrix.TransformPoint( viewPosition );
+}
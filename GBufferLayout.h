@@ -0,0 +1,100 @@
+/*******************************************
+	GBufferLayout.h
+
+	G-buffer layouts, their memory and
+	bandwidth, and CPU reference versions of
+	the encodings the shaders use for the
+	compact layouts
+********************************************/
+
+#pragma once
+
+#include <string>
+using namespace std;
+
+#include "Defines.h"
+#include "CVector2.h"
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+using namespace gen;
+
+
+//-----------------------------------------------------------------------------
+// Layouts
+//-----------------------------------------------------------------------------
+
+// The data written by the G-buffer pass and read by the lighting passes
+enum EGBufferLayout
+{
+	kGBufferFloat,     // Diffuse/specular, world position and world normal each in RGBA32F - 48 bytes per pixel
+	kGBufferCompact16, // Diffuse/specular in RGBA8, octahedral normal in RG16, position from the depth buffer - 8 bytes
+	kGBufferCompact10, // The same with the normal in RGB10A2, leaving 12 bits spare for material data
+	kNumGBufferLayouts
+};
+
+// Render targets of a layout
+struct SGBufferLayout
+{
+	static const int kMaxTargets = 3;
+
+	const char* name;              // As given on the command line
+	int         numTargets;
+	DXGI_FORMAT formats[kMaxTargets];
+	bool        positionFromDepth; // World position is reconstructed from the depth buffer rather than stored
+};
+
+// Description of a layout
+const SGBufferLayout& GBufferLayoutDesc( EGBufferLayout layout );
+
+// Layout with the given name, returns false if there is none
+bool GBufferLayoutFromName( const string& name, EGBufferLayout* pLayout );
+
+
+//-----------------------------------------------------------------------------
+// Memory and bandwidth
+//-----------------------------------------------------------------------------
+
+// Estimated G-buffer traffic of a layout at a given resolution. Writes assume each pixel is written
+// once by the G-buffer pass (no overdraw), reads assume each lighting pass covering the screen reads
+// every target, plus the depth buffer when position comes from depth. The depth buffer is needed in
+// every layout, so it is not counted in the memory
+struct SGBufferBandwidth
+{
+	unsigned int       bytesPerPixel;  // All targets
+	unsigned long long memoryBytes;    // All targets
+	unsigned long long writeBytes;     // Per frame, G-buffer pass
+	unsigned long long readBytes;      // Per full-screen lighting pass
+};
+
+SGBufferBandwidth GBufferBandwidth( EGBufferLayout layout, unsigned int width, unsigned int height );
+
+// Write the bandwidth of every layout at a given resolution to a CSV file
+bool GBufferWriteBandwidthReport( const string& fileName, unsigned int width, unsigned int height );
+
+
+//-----------------------------------------------------------------------------
+// Reference encoders
+//-----------------------------------------------------------------------------
+// The same operations as the compact G-buffer shaders in Deferred.fx, for testing the error of each
+// encoding on the CPU. Targets are UNORM, so values are quantised to the nearest step as the GPU does
+
+// Octahedral mapping of a unit vector to [-1,1]^2 and back. Decoding normalises
+CVector2 OctahedralEncode( const CVector3& normal );
+CVector3 OctahedralDecode( const CVector2& encoded );
+
+// Unit normal packed into the bits of a G-buffer pixel - octahedral mapping in RG16_UNORM (16 bits
+// each in x and y), or in RGB10A2_UNORM (10 bits each in R and G, B and A left 0)
+TUInt32  PackNormalRG16( const CVector3& normal );
+CVector3 UnpackNormalRG16( TUInt32 packed );
+TUInt32  PackNormalRGB10A2( const CVector3& normal );
+CVector3 UnpackNormalRGB10A2( TUInt32 packed );
+
+// Diffuse colour (rgb, 0-1) and specular strength packed in RGBA8_UNORM
+TUInt32 PackDiffuseSpecular( const CVector3& diffuse, TFloat32 specular );
+void    UnpackDiffuseSpecular( TUInt32 packed, CVector3* pDiffuse, TFloat32* pSpecular );
+
+// World position of a pixel from its depth buffer value, UV in the viewport (0-1, top-left origin),
+// the camera's projection matrix (a perspective projection, allowing the stereo offsets in the third
+// row) and the inverse of its view matrix (the camera's world matrix)
+CVector3 ReconstructWorldPosition( TFloat32 depth, const CVector2& uv, const CMatrix4x4& projMatrix,
+                                   const CMatrix4x4& invViewMatrix );
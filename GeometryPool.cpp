@@ -0,0 +1,394 @@
+/*******************************************
+	GeometryPool.cpp
+
+	Shared vertex and index buffers for all
+	meshes
+********************************************/
+
+#include <cstring>
+#include <map>
+#include <vector>
+using namespace std;
+
+#include "GeometryPool.h"
+#include "MemoryAccounting.h"
+
+
+// Pool used by all meshes
+CGeometryPool GeometryPool;
+
+const float CGeometryPool::kDefragmentThreshold = 0.5f;
+
+
+//-----------------------------------------------------------------------------
+// Adding and removing geometry
+//-----------------------------------------------------------------------------
+
+// Copy geometry into the pool
+TGeometryHandle CGeometryPool::Add( TVertexFormat format, const void* vertices, UINT numVertices,
+                                    const WORD* indices, UINT numIndices )
+{
+	if (format == kNoVertexFormat || numVertices == 0 || numIndices == 0)
+	{
+		return kNoGeometry;
+	}
+	UINT vertexSize = VertexFormatDesc( format ).vertexSize;
+	UINT attributeSize = VertexFormatDesc( format ).attributeSize;
+
+	SAllocation allocation;
+	allocation.inUse = true;
+	int vertexPage = AllocateFromPages( m_VertexPages, true, format, vertexSize, attributeSize, numVertices, &allocation.vertexOffset );
+	if (vertexPage < 0)
+	{
+		return kNoGeometry;
+	}
+	int indexPage = AllocateFromPages( m_IndexPages, false, kNoVertexFormat, sizeof(WORD), 0, numIndices, &allocation.indexOffset );
+	if (indexPage < 0)
+	{
+		m_VertexPages[vertexPage].allocator.Free( allocation.vertexOffset );
+		return kNoGeometry;
+	}
+	allocation.vertexPage = vertexPage;
+	allocation.numVertices = numVertices;
+	allocation.indexPage = indexPage;
+
+	// Copy the data into its place in the buffers, splitting the interleaved vertices into positions and attributes for
+	// formats with separate positions
+	D3D11_BOX box = { allocation.vertexOffset * vertexSize, 0, 0, (allocation.vertexOffset + numVertices) * vertexSize, 1, 1 };
+	if (attributeSize > 0)
+	{
+		vector<unsigned char> positions( numVertices * vertexSize );
+		vector<unsigned char> attributes( numVertices * attributeSize );
+		const unsigned char* vertex = static_cast<const unsigned char*>(vertices);
+		for (UINT v = 0; v < numVertices; ++v)
+		{
+			memcpy( &positions[v * vertexSize], vertex, vertexSize );
+			memcpy( &attributes[v * attributeSize], vertex + vertexSize, attributeSize );
+			vertex += vertexSize + attributeSize;
+		}
+		g_pd3dContext->UpdateSubresource( m_VertexPages[vertexPage].buffer, 0, &box, &positions[0], 0, 0 );
+		D3D11_BOX attributeBox = { allocation.vertexOffset * attributeSize, 0, 0, (allocation.vertexOffset + numVertices) * attributeSize, 1, 1 };
+		g_pd3dContext->UpdateSubresource( m_VertexPages[vertexPage].attributeBuffer, 0, &attributeBox, &attributes[0], 0, 0 );
+	}
+	else
+	{
+		g_pd3dContext->UpdateSubresource( m_VertexPages[vertexPage].buffer, 0, &box, vertices, 0, 0 );
+	}
+	box.left = allocation.indexOffset * sizeof(WORD);
+	box.right = (allocation.indexOffset + numIndices) * sizeof(WORD);
+	g_pd3dContext->UpdateSubresource( m_IndexPages[indexPage].buffer, 0, &box, indices, 0, 0 );
+
+	// Reuse a removed handle if there is one
+	TGeometryHandle geometry;
+	if (!m_FreeHandles.empty())
+	{
+		geometry = m_FreeHandles.back();
+		m_FreeHandles.pop_back();
+	}
+	else
+	{
+		geometry = static_cast<TGeometryHandle>(m_Allocations.size());
+		m_Allocations.push_back( allocation );
+		m_Ranges.push_back( SGeometryRange() );
+	}
+	m_Allocations[geometry] = allocation;
+	m_Ranges[geometry].numIndices = numIndices;
+	UpdateRange( geometry );
+
+	AccountFreeSpace();
+	return geometry;
+}
+
+// Free the geometry for a handle
+void CGeometryPool::Remove( TGeometryHandle geometry )
+{
+	SAllocation& allocation = m_Allocations[geometry];
+	if (!allocation.inUse) return;
+	allocation.inUse = false;
+	m_FreeHandles.push_back( geometry );
+
+	// Release pages left empty, compact those left fragmented
+	SPage& vertexPage = m_VertexPages[allocation.vertexPage];
+	vertexPage.allocator.Free( allocation.vertexOffset );
+	if (vertexPage.allocator.NumAllocations() == 0)
+	{
+		ReleasePage( vertexPage );
+	}
+	else if (vertexPage.allocator.Fragmentation() > kDefragmentThreshold)
+	{
+		Defragment( m_VertexPages, true, allocation.vertexPage );
+	}
+
+	SPage& indexPage = m_IndexPages[allocation.indexPage];
+	indexPage.allocator.Free( allocation.indexOffset );
+	if (indexPage.allocator.NumAllocations() == 0)
+	{
+		ReleasePage( indexPage );
+	}
+	else if (indexPage.allocator.Fragmentation() > kDefragmentThreshold)
+	{
+		Defragment( m_IndexPages, false, allocation.indexPage );
+	}
+
+	AccountFreeSpace();
+}
+
+// Release all buffers
+void CGeometryPool::Release()
+{
+	if (m_VertexPages.empty() && m_IndexPages.empty()) return;
+
+	for (size_t page = 0; page < m_VertexPages.size(); ++page)
+	{
+		ReleasePage( m_VertexPages[page] );
+	}
+	for (size_t page = 0; page < m_IndexPages.size(); ++page)
+	{
+		ReleasePage( m_IndexPages[page] );
+	}
+	m_VertexPages.clear();
+	m_IndexPages.clear();
+	m_Allocations.clear();
+	m_Ranges.clear();
+	m_FreeHandles.clear();
+	AccountFreeSpace();
+}
+
+
+//-----------------------------------------------------------------------------
+// Pages
+//-----------------------------------------------------------------------------
+
+// Allocate from a page with room, creating a new page if none has
+int CGeometryPool::AllocateFromPages( vector<SPage>& pages, bool vertexPages, TVertexFormat format, UINT elementSize,
+                                      UINT attributeSize, UINT count, UINT* pOffset )
+{
+	int freeSlot = -1;
+	for (size_t page = 0; page < pages.size(); ++page)
+	{
+		if (!pages[page].buffer)
+		{
+			if (freeSlot < 0) freeSlot = static_cast<int>(page);
+			continue;
+		}
+		if (pages[page].format != format || pages[page].elementSize != elementSize) continue;
+
+		*pOffset = pages[page].allocator.Allocate( count );
+		if (*pOffset != CRangeAllocator::kInvalidOffset) return static_cast<int>(page);
+	}
+
+	// No room - create a new page, bigger than usual if the geometry won't fit in a normal one
+	UINT pageElements = (vertexPages ? kVertexPageBytes / (elementSize + attributeSize) : kIndexPageIndices);
+	if (pageElements < count) pageElements = count;
+
+	D3D11_BUFFER_DESC bufferDesc;
+	bufferDesc.BindFlags = vertexPages ? D3D11_BIND_VERTEX_BUFFER : D3D11_BIND_INDEX_BUFFER;
+	bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+	bufferDesc.ByteWidth = pageElements * elementSize;
+	bufferDesc.CPUAccessFlags = 0;
+	bufferDesc.MiscFlags = 0;
+	bufferDesc.StructureByteStride = 0;
+	ID3D11Buffer* buffer;
+	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, NULL, &buffer ) ))
+	{
+		return -1;
+	}
+	ID3D11Buffer* attributeBuffer = 0;
+	if (attributeSize > 0)
+	{
+		bufferDesc.ByteWidth = pageElements * attributeSize;
+		if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, NULL, &attributeBuffer ) ))
+		{
+			buffer->Release();
+			return -1;
+		}
+	}
+
+	if (freeSlot < 0)
+	{
+		freeSlot = static_cast<int>(pages.size());
+		pages.push_back( SPage() );
+	}
+	SPage& page = pages[freeSlot];
+	page.buffer = buffer;
+	page.format = format;
+	page.elementSize = elementSize;
+	page.attributeBuffer = attributeBuffer;
+	page.attributeSize = attributeSize;
+	page.allocator.Reset( pageElements );
+	*pOffset = page.allocator.Allocate( count );
+	return freeSlot;
+}
+
+
+// Move a page's contents down to remove gaps. A buffer can't be copied onto itself, so the contents
+// are copied into a new buffer of the same size, which replaces the old one
+void CGeometryPool::Defragment( vector<SPage>& pages, bool vertexPages, unsigned int pageIndex )
+{
+	SPage& page = pages[pageIndex];
+	D3D11_BUFFER_DESC bufferDesc;
+	page.buffer->GetDesc( &bufferDesc );
+	ID3D11Buffer* buffer;
+	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, NULL, &buffer ) ))
+	{
+		return; // Leave the page fragmented
+	}
+	ID3D11Buffer* attributeBuffer = 0;
+	if (page.attributeBuffer)
+	{
+		page.attributeBuffer->GetDesc( &bufferDesc );
+		if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, NULL, &attributeBuffer ) ))
+		{
+			buffer->Release();
+			return;
+		}
+	}
+
+	vector<CRangeAllocator::SMove> moves;
+	page.allocator.Compact( &moves );
+	map<UINT, UINT> newOffsets;
+	for (size_t m = 0; m < moves.size(); ++m)
+	{
+		newOffsets[moves[m].from] = moves[m].to;
+	}
+
+	// Copy every live range, including those that didn't move
+	for (size_t a = 0; a < m_Allocations.size(); ++a)
+	{
+		SAllocation& allocation = m_Allocations[a];
+		if (!allocation.inUse || (vertexPages ? allocation.vertexPage : allocation.indexPage) != pageIndex) continue;
+
+		UINT& offset = vertexPages ? allocation.vertexOffset : allocation.indexOffset;
+		UINT count = vertexPages ? allocation.numVertices : m_Ranges[a].numIndices;
+		map<UINT, UINT>::iterator moved = newOffsets.find( offset );
+		UINT newOffset = (moved != newOffsets.end()) ? moved->second : offset;
+
+		D3D11_BOX box = { offset * page.elementSize, 0, 0, (offset + count) * page.elementSize, 1, 1 };
+		g_pd3dContext->CopySubresourceRegion( buffer, 0, newOffset * page.elementSize, 0, 0, page.buffer, 0, &box );
+		if (attributeBuffer)
+		{
+			D3D11_BOX attributeBox = { offset * page.attributeSize, 0, 0, (offset + count) * page.attributeSize, 1, 1 };
+			g_pd3dContext->CopySubresourceRegion( attributeBuffer, 0, newOffset * page.attributeSize, 0, 0, page.attributeBuffer, 0, &attributeBox );
+		}
+		offset = newOffset;
+	}
+
+	page.buffer->Release();
+	page.buffer = buffer;
+	if (attributeBuffer)
+	{
+		page.attributeBuffer->Release();
+		page.attributeBuffer = attributeBuffer;
+	}
+	for (size_t a = 0; a < m_Allocations.size(); ++a)
+	{
+		if (m_Allocations[a].inUse) UpdateRange( static_cast<TGeometryHandle>(a) );
+	}
+}
+
+
+// Release the buffers of a page
+void CGeometryPool::ReleasePage( SPage& page )
+{
+	if (page.buffer) page.buffer->Release();
+	if (page.attributeBuffer) page.attributeBuffer->Release();
+	page.buffer = 0;
+	page.attributeBuffer = 0;
+}
+
+
+// Set the range of a handle from its allocation
+void CGeometryPool::UpdateRange( TGeometryHandle geometry )
+{
+	const SAllocation& allocation = m_Allocations[geometry];
+	SGeometryRange& range = m_Ranges[geometry];
+	range.vertexBuffer = m_VertexPages[allocation.vertexPage].buffer;
+	range.vertexSize = m_VertexPages[allocation.vertexPage].elementSize;
+	range.attributeBuffer = m_VertexPages[allocation.vertexPage].attributeBuffer;
+	range.attributeSize = m_VertexPages[allocation.vertexPage].attributeSize;
+	range.indexBuffer = m_IndexPages[allocation.indexPage].buffer;
+	range.baseVertex = allocation.vertexOffset;
+	range.startIndex = allocation.indexOffset;
+}
+
+
+//-----------------------------------------------------------------------------
+// Statistics
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Number of pages with a buffer
+	template <class TPage>
+	unsigned int CountPages( const vector<TPage>& pages )
+	{
+		unsigned int count = 0;
+		for (size_t page = 0; page < pages.size(); ++page)
+		{
+			if (pages[page].buffer) ++count;
+		}
+		return count;
+	}
+}
+
+// Number of vertex and index buffers in use
+unsigned int CGeometryPool::NumVertexPages() const
+{
+	return CountPages( m_VertexPages );
+}
+
+unsigned int CGeometryPool::NumIndexPages() const
+{
+	return CountPages( m_IndexPages );
+}
+
+// GPU memory of all pages
+size_t CGeometryPool::CapacityBytes() const
+{
+	size_t bytes = 0;
+	for (size_t page = 0; page < m_VertexPages.size(); ++page)
+	{
+		if (m_VertexPages[page].buffer) bytes += static_cast<size_t>(m_VertexPages[page].allocator.Size()) * (m_VertexPages[page].elementSize + m_VertexPages[page].attributeSize);
+	}
+	for (size_t page = 0; page < m_IndexPages.size(); ++page)
+	{
+		if (m_IndexPages[page].buffer) bytes += static_cast<size_t>(m_IndexPages[page].allocator.Size()) * m_IndexPages[page].elementSize;
+	}
+	return bytes;
+}
+
+// Part of the pages holding geometry
+size_t CGeometryPool::UsedBytes() const
+{
+	size_t bytes = 0;
+	for (size_t page = 0; page < m_VertexPages.size(); ++page)
+	{
+		bytes += static_cast<size_t>(m_VertexPages[page].allocator.UsedSize()) * (m_VertexPages[page].elementSize + m_VertexPages[page].attributeSize);
+	}
+	for (size_t page = 0; page < m_IndexPages.size(); ++page)
+	{
+		bytes += static_cast<size_t>(m_IndexPages[page].allocator.UsedSize()) * m_IndexPages[page].elementSize;
+	}
+	return bytes;
+}
+
+
+// Update the free space in the memory accounting
+void CGeometryPool::AccountFreeSpace()
+{
+	long long freeVertexBytes = 0;
+	for (size_t page = 0; page < m_VertexPages.size(); ++page)
+	{
+		if (m_VertexPages[page].buffer) freeVertexBytes += static_cast<long long>(m_VertexPages[page].allocator.FreeSize()) * (m_VertexPages[page].elementSize + m_VertexPages[page].attributeSize);
+	}
+	long long freeIndexBytes = 0;
+	for (size_t page = 0; page < m_IndexPages.size(); ++page)
+	{
+		if (m_IndexPages[page].buffer) freeIndexBytes += static_cast<long long>(m_IndexPages[page].allocator.FreeSize()) * m_IndexPages[page].elementSize;
+	}
+
+	MemoryAccountRelease( kMemoryVertexBuffers, "GeometryPool free space" );
+	MemoryAccountAdd( kMemoryVertexBuffers, "GeometryPool free space", freeVertexBytes );
+	MemoryAccountRelease( kMemoryIndexBuffers, "GeometryPool free space" );
+	MemoryAccountAdd( kMemoryIndexBuffers, "GeometryPool free space", freeIndexBytes );
+}
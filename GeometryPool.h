@@ -0,0 +1,148 @@
+/*******************************************
+	GeometryPool.h
+
+	Vertex and index data for all meshes,
+	sub-allocated from a few large buffers
+	shared by every mesh with the same vertex
+	format, so drawing a scene needs only a
+	handful of buffer binds
+********************************************/
+
+#pragma once
+
+#include <vector>
+using namespace std;
+
+#include "Defines.h"
+#include "RangeAllocator.h"
+#include "VertexFormat.h"
+
+
+// Identifies geometry added to the pool
+typedef unsigned int TGeometryHandle;
+const TGeometryHandle kNoGeometry = ~0u;
+
+// Where some geometry lives in the pool - everything needed to bind and draw it. Indices are
+// relative to the base vertex, so 16-bit indices still work in large buffers
+struct SGeometryRange
+{
+	ID3D11Buffer* vertexBuffer;
+	UINT          vertexSize;
+	ID3D11Buffer* attributeBuffer; // For slot 1 when positions are a separate stream, at the same vertex offsets, otherwise null
+	UINT          attributeSize;
+	ID3D11Buffer* indexBuffer; // 16-bit indices
+	UINT          baseVertex;  // Added to each index by DrawIndexed
+	UINT          startIndex;
+	UINT          numIndices;
+};
+
+
+// Pool of vertex buffers, one set for each vertex format, and index buffers shared by all formats.
+// Each buffer is a fixed-size page sub-allocated with a CRangeAllocator, new pages are created as
+// they fill. Data is copied to the GPU when added, no CPU copy is kept. Geometry is drawn through
+// the range for its handle, which can change when the pool is defragmented, so look it up at draw
+// time rather than keeping a copy. Uses the immediate context, so must not be changed while another
+// thread is rendering
+class CGeometryPool
+{
+public:
+	// Sizes of new pages. Geometry bigger than a page gets a page of its own
+	static const UINT kVertexPageBytes = 4 * 1024 * 1024;
+	static const UINT kIndexPageIndices = 1024 * 1024;
+
+	// Free space in a page that is scattered in small ranges, above which the page is compacted
+	// when geometry is removed (see CRangeAllocator::Fragmentation)
+	static const float kDefragmentThreshold;
+
+	CGeometryPool() {}
+	~CGeometryPool()
+	{
+		Release();
+	}
+
+	// Copy geometry into the pool. Geometry of the same vertex format shares buffers, the vertex size
+	// comes from the format. Vertices are interleaved even for formats with separate positions (see
+	// VertexFormatSeparatePositions), the pool splits off the positions into their own buffer. Returns
+	// kNoGeometry for empty geometry or if a buffer cannot be created
+	TGeometryHandle Add( TVertexFormat format, const void* vertices, UINT numVertices,
+	                     const WORD* indices, UINT numIndices );
+
+	// Free the geometry for a handle. Pages left empty are released, pages left fragmented are
+	// compacted, which moves the ranges of other geometry in the page
+	void Remove( TGeometryHandle geometry );
+
+	// Where the geometry for a handle is now
+	const SGeometryRange& Range( TGeometryHandle geometry ) const
+	{
+		return m_Ranges[geometry];
+	}
+
+	// Release all buffers, any handles still in use become invalid
+	void Release();
+
+
+	/////////////////////////////////////
+	// Statistics
+
+	// Number of vertex and index buffers in use
+	unsigned int NumVertexPages() const;
+	unsigned int NumIndexPages() const;
+
+	// GPU memory of all pages, and the part of it holding geometry (bytes)
+	size_t CapacityBytes() const;
+	size_t UsedBytes() const;
+
+private:
+	// Disallow use of copy constructor and assignment operator (private and not defined)
+	CGeometryPool( const CGeometryPool& );
+	CGeometryPool& operator=( const CGeometryPool& );
+
+	// A buffer and the allocator for its contents. Vertex pages allocate in vertices, index pages in indices.
+	// Vertex pages of formats with separate positions have a second buffer of attributes, allocated in step
+	struct SPage
+	{
+		ID3D11Buffer*   buffer;     // Null once released, the slot is reused for the next new page
+		TVertexFormat   format;     // Vertex format (vertex pages only)
+		UINT            elementSize;
+		ID3D11Buffer*   attributeBuffer;
+		UINT            attributeSize;
+		CRangeAllocator allocator;
+	};
+
+	// Page and offsets of each handle's geometry
+	struct SAllocation
+	{
+		bool         inUse;
+		unsigned int vertexPage;
+		UINT         vertexOffset;
+		UINT         numVertices;
+		unsigned int indexPage;
+		UINT         indexOffset;
+	};
+
+	// Allocate from a page with room, creating a new page if none has. Returns the page index or -1 if a
+	// new buffer cannot be created. The offset is returned in pOffset
+	int AllocateFromPages( vector<SPage>& pages, bool vertexPages, TVertexFormat format, UINT elementSize,
+	                       UINT attributeSize, UINT count, UINT* pOffset );
+
+	// Release the buffers of a page
+	void ReleasePage( SPage& page );
+
+	// Move a page's contents down to remove gaps, updating the ranges of the geometry in it
+	void Defragment( vector<SPage>& pages, bool vertexPages, unsigned int page );
+
+	// Set the range of a handle from its allocation
+	void UpdateRange( TGeometryHandle geometry );
+
+	// Update the free space in the memory accounting, the geometry itself is accounted by its owner
+	void AccountFreeSpace();
+
+	vector<SPage>          m_VertexPages;
+	vector<SPage>          m_IndexPages;
+	vector<SAllocation>    m_Allocations;
+	vector<SGeometryRange> m_Ranges;      // Parallel to m_Allocations, what draws read
+	vector<unsigned int>   m_FreeHandles; // Handles removed, to be reused
+};
+
+// Pool used by all meshes
+extern CGeometryPool GeometryPool;
@@ -0,0 +1,350 @@
+/*******************************************
+	Hierarchy.cpp
+
+	World matrices of a flattened node
+	hierarchy
+********************************************/
+
+#include <algorithm>
+#include <xmmintrin.h>
+using namespace std;
+
+#include "Hierarchy.h"
+
+
+//-----------------------------------------------------------------------------
+// Reference
+//-----------------------------------------------------------------------------
+
+// World matrix of every node. Nodes are in depth-first order, so a node's parent always comes before it
+void ConcatenateNodeMatrices( const SMeshNode* nodes, TUInt32 numNodes, const CMatrix4x4* localMatrices,
+                              CMatrix4x4* pWorldMatrices )
+{
+	for (TUInt32 node = 0; node < numNodes; ++node)
+	{
+		const CMatrix4x4& local = localMatrices ? localMatrices[node] : nodes[node].positionMatrix;
+		TUInt32 parent = nodes[node].parent;
+		pWorldMatrices[node] = (parent >= node) ? local : local * pWorldMatrices[parent];
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Construction
+//-----------------------------------------------------------------------------
+
+// Take the hierarchy and default local matrices of a list of nodes
+void CNodeHierarchy::Build( const SMeshNode* nodes, TUInt32 numNodes )
+{
+	m_NumNodes = numNodes;
+	m_Parents.resize( numNodes );
+	m_SubtreeEnds.resize( numNodes );
+	m_FirstChild.assign( numNodes, 0 );
+	m_NumChildren.assign( numNodes, 0 );
+	m_Children.resize( numNodes );
+	m_Flags.resize( numNodes );
+	m_Matrices.assign( ((numNodes + 3) >> 2) * kBlockFloats, 0.0f );
+	m_Updated.clear();
+	m_Updated.reserve( numNodes );
+	m_UpdateList.clear();
+	m_UpdateList.reserve( numNodes );
+
+	for (TUInt32 node = 0; node < numNodes; ++node)
+	{
+		TUInt32 parent = nodes[node].parent;
+		m_Parents[node] = (parent >= node) ? node : parent;
+		if (m_Parents[node] != node) ++m_NumChildren[parent];
+		SetLocalMatrix( node, nodes[node].positionMatrix );
+	}
+
+	// Children of each node in one run of m_Children, in list order
+	TUInt32 numChildren = 0;
+	for (TUInt32 node = 0; node < numNodes; ++node)
+	{
+		m_FirstChild[node] = numChildren;
+		numChildren += m_NumChildren[node];
+	}
+	vector<TUInt32> added( numNodes, 0 );
+	for (TUInt32 node = 0; node < numNodes; ++node)
+	{
+		TUInt32 parent = m_Parents[node];
+		if (parent != node) m_Children[m_FirstChild[parent] + added[parent]++] = node;
+	}
+	m_Children.resize( numChildren );
+
+	// A subtree ends where the last subtree of its children ends. Working back up the list sees every child before its parent
+	for (TUInt32 node = 0; node < numNodes; ++node)
+	{
+		m_SubtreeEnds[node] = node + 1;
+	}
+	for (TUInt32 node = numNodes; node-- > 0;)
+	{
+		TUInt32 parent = m_Parents[node];
+		if (parent != node) m_SubtreeEnds[parent] = max( m_SubtreeEnds[parent], m_SubtreeEnds[node] );
+	}
+
+	Invalidate();
+}
+
+// Bytes used by the matrices and node lists
+TUInt32 CNodeHierarchy::GetMemoryBytes() const
+{
+	return static_cast<TUInt32>((m_Parents.capacity() + m_SubtreeEnds.capacity() + m_FirstChild.capacity() + m_NumChildren.capacity() +
+	                             m_Children.capacity() + m_Updated.capacity() + m_UpdateList.capacity()) * sizeof(TUInt32) +
+	                            m_Flags.capacity() * sizeof(TUInt8) + m_Matrices.capacity() * sizeof(TFloat32));
+}
+
+
+//-----------------------------------------------------------------------------
+// Data access
+//-----------------------------------------------------------------------------
+
+// Set the local matrix of a node. Its ancestors are marked as having a dirty node below them, stopping at one
+// already marked as all above it will be too
+void CNodeHierarchy::SetLocalMatrix( TUInt32 node, const CMatrix4x4& matrix )
+{
+	const TFloat32* elements = &matrix.e00;
+	for (TUInt32 row = 0; row < 4; ++row)
+	{
+		for (TUInt32 col = 0; col < 3; ++col)
+		{
+			Element( kLocalMatrix, row * 3 + col, node ) = elements[row * 4 + col];
+		}
+	}
+
+	m_Flags[node] |= kDirty;
+	TUInt32 parent = m_Parents[node];
+	while (parent != node && !(m_Flags[parent] & kDirtyBelow))
+	{
+		m_Flags[parent] |= kDirtyBelow;
+		node = parent;
+		parent = m_Parents[node];
+	}
+}
+
+namespace
+{
+	// Build an affine matrix from the twelve elements of a node, each four floats apart
+	CMatrix4x4 MatrixFromElements( const TFloat32* elements )
+	{
+		CMatrix4x4 matrix = CMatrix4x4::kIdentity;
+		TFloat32* dest = &matrix.e00;
+		for (TUInt32 row = 0; row < 4; ++row)
+		{
+			for (TUInt32 col = 0; col < 3; ++col)
+			{
+				dest[row * 4 + col] = elements[(row * 3 + col) * 4];
+			}
+		}
+		return matrix;
+	}
+}
+
+CMatrix4x4 CNodeHierarchy::GetLocalMatrix( TUInt32 node ) const
+{
+	return MatrixFromElements( &Element( kLocalMatrix, 0, node ) );
+}
+
+// World matrix of a node as of the last Update
+CMatrix4x4 CNodeHierarchy::GetWorldMatrix( TUInt32 node ) const
+{
+	return MatrixFromElements( &Element( kWorldMatrix, 0, node ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Propagation
+//-----------------------------------------------------------------------------
+
+// Mark every node dirty
+void CNodeHierarchy::Invalidate()
+{
+	m_Flags.assign( m_NumNodes, static_cast<TUInt8>(kDirty | kDirtyBelow) );
+}
+
+// Recompute the world matrices of changed nodes and everything below them. Each node visited has its children
+// recomputed - all of them if its own world matrix changed, otherwise only those that are dirty. A node with no
+// flags has no changes anywhere below it, so its whole subtree is skipped
+TUInt32 CNodeHierarchy::Update( EHierarchyMethod method /*= kHierarchySSE*/ )
+{
+	m_Updated.clear();
+	TUInt32 node = 0;
+	while (node < m_NumNodes)
+	{
+		TUInt32 flags = m_Flags[node];
+		if (flags == 0)
+		{
+			node = m_SubtreeEnds[node];
+			continue;
+		}
+
+		// Roots are their own world matrix
+		if (m_Parents[node] == node && (flags & kDirty))
+		{
+			for (TUInt32 e = 0; e < kNumElements; ++e)
+			{
+				Element( kWorldMatrix, e, node ) = Element( kLocalMatrix, e, node );
+			}
+			flags |= kChanged;
+			m_Updated.push_back( node );
+		}
+
+		TUInt32 numChildren = m_NumChildren[node];
+		if (numChildren > 0 && (flags & (kChanged | kDirtyBelow)))
+		{
+			const TUInt32* children = &m_Children[m_FirstChild[node]];
+			if (!(flags & kChanged))
+			{
+				m_UpdateList.clear();
+				for (TUInt32 child = 0; child < numChildren; ++child)
+				{
+					if (m_Flags[children[child]] & kDirty) m_UpdateList.push_back( children[child] );
+				}
+				numChildren = static_cast<TUInt32>(m_UpdateList.size());
+				children = numChildren > 0 ? &m_UpdateList[0] : 0;
+			}
+
+			if (numChildren > 0)
+			{
+				if (method == kHierarchyScalar)
+				{
+					UpdateChildrenScalar( node, children, numChildren );
+				}
+				else
+				{
+					UpdateChildrenSSE( node, children, numChildren );
+				}
+				for (TUInt32 child = 0; child < numChildren; ++child)
+				{
+					m_Flags[children[child]] |= kChanged;
+					m_Updated.push_back( children[child] );
+				}
+			}
+		}
+
+		m_Flags[node] = 0;
+		++node;
+	}
+	return static_cast<TUInt32>(m_Updated.size());
+}
+
+
+// Recompute children one at a time. With row vectors a child's world matrix is its local matrix followed by its
+// parent's world matrix. Both are affine, so each row is the local row's first three elements times the parent's
+// top three rows, plus the parent's translation for the bottom row
+void CNodeHierarchy::UpdateChildrenScalar( TUInt32 parent, const TUInt32* children, TUInt32 numChildren )
+{
+	TFloat32 p[kNumElements];
+	const TFloat32* parentElements = &Element( kWorldMatrix, 0, parent );
+	for (TUInt32 e = 0; e < kNumElements; ++e)
+	{
+		p[e] = parentElements[e * 4];
+	}
+
+	for (TUInt32 child = 0; child < numChildren; ++child)
+	{
+		const TFloat32* l = &Element( kLocalMatrix, 0, children[child] );
+		TFloat32* w = &Element( kWorldMatrix, 0, children[child] );
+		for (TUInt32 row = 0; row < 4; ++row)
+		{
+			TFloat32 l0 = l[row * 12], l1 = l[row * 12 + 4], l2 = l[row * 12 + 8];
+			for (TUInt32 col = 0; col < 3; ++col)
+			{
+				TFloat32 element = l0 * p[col] + l1 * p[3 + col] + l2 * p[6 + col];
+				w[(row * 3 + col) * 4] = (row == 3) ? element + p[9 + col] : element;
+			}
+		}
+	}
+}
+
+namespace
+{
+	// The top three columns of four affine matrices, local followed by parent, one matrix in each lane
+	inline void MultiplyAffineSSE( const __m128* l, const __m128* p, __m128* w )
+	{
+		for (int row = 0; row < 4; ++row)
+		{
+			for (int col = 0; col < 3; ++col)
+			{
+				w[row * 3 + col] = _mm_add_ps( _mm_add_ps( _mm_mul_ps( l[row * 3], p[col] ), _mm_mul_ps( l[row * 3 + 1], p[3 + col] ) ),
+				                               _mm_mul_ps( l[row * 3 + 2], p[6 + col] ) );
+			}
+		}
+		for (int col = 0; col < 3; ++col)
+		{
+			w[9 + col] = _mm_add_ps( w[9 + col], p[9 + col] );
+		}
+	}
+}
+
+// Recompute children four at a time, one child in each lane, with the parent's elements broadcast to every lane.
+// Four children filling a block are loaded and stored whole. The others are gathered and scattered a float at a
+// time, four at once as they come, with the last one to three done as scalar. Fewer than four children (chains)
+// go straight to scalar
+void CNodeHierarchy::UpdateChildrenSSE( TUInt32 parent, const TUInt32* children, TUInt32 numChildren )
+{
+	if (numChildren < 4)
+	{
+		UpdateChildrenScalar( parent, children, numChildren );
+		return;
+	}
+
+	__m128 p[kNumElements];
+	for (TUInt32 e = 0; e < kNumElements; ++e)
+	{
+		p[e] = _mm_set1_ps( Element( kWorldMatrix, e, parent ) );
+	}
+
+	__m128 l[kNumElements];
+	__m128 w[kNumElements];
+	TUInt32 gathered[4];
+	TUInt32 numGathered = 0;
+	for (TUInt32 child = 0; child < numChildren;)
+	{
+		// Children are distinct and in increasing order, so four filling a block are the block's four nodes
+		TUInt32 node = children[child];
+		if ((node & 3) == 0 && child + 4 <= numChildren && children[child + 3] == node + 3)
+		{
+			const TFloat32* local = &Element( kLocalMatrix, 0, node );
+			TFloat32* world = &Element( kWorldMatrix, 0, node );
+			for (TUInt32 e = 0; e < kNumElements; ++e)
+			{
+				l[e] = _mm_loadu_ps( local + e * 4 );
+			}
+			MultiplyAffineSSE( l, p, w );
+			for (TUInt32 e = 0; e < kNumElements; ++e)
+			{
+				_mm_storeu_ps( world + e * 4, w[e] );
+			}
+			child += 4;
+			continue;
+		}
+
+		gathered[numGathered++] = node;
+		++child;
+		if (numGathered == 4)
+		{
+			for (TUInt32 e = 0; e < kNumElements; ++e)
+			{
+				l[e] = _mm_set_ps( Element( kLocalMatrix, e, gathered[3] ), Element( kLocalMatrix, e, gathered[2] ),
+				                   Element( kLocalMatrix, e, gathered[1] ), Element( kLocalMatrix, e, gathered[0] ) );
+			}
+			MultiplyAffineSSE( l, p, w );
+			for (TUInt32 e = 0; e < kNumElements; ++e)
+			{
+				TFloat32 lanes[4];
+				_mm_storeu_ps( lanes, w[e] );
+				for (int lane = 0; lane < 4; ++lane)
+				{
+					Element( kWorldMatrix, e, gathered[lane] ) = lanes[lane];
+				}
+			}
+			numGathered = 0;
+		}
+	}
+
+	if (numGathered > 0)
+	{
+		UpdateChildrenScalar( parent, gathered, numGathered );
+	}
+}
@@ -0,0 +1,142 @@
+/*******************************************
+	Hierarchy.h
+
+	World matrices of a flattened node
+	hierarchy. Local matrices are kept in
+	structure-of-arrays form and world
+	matrices are propagated down the depth-
+	first node list, recomputing only the
+	subtrees below changed nodes. Siblings are
+	transformed four at a time with SSE
+********************************************/
+
+#pragma once
+
+#include <vector>
+using namespace std;
+
+#include "Defines.h"
+#include "CMatrix4x4.h"
+#include "MeshData.h"
+using namespace gen;
+
+
+//-----------------------------------------------------------------------------
+// Reference
+//-----------------------------------------------------------------------------
+
+// World matrix of every node of a hierarchy in depth-first order (as SMeshNode lists are), from local matrices
+// relative to each node's parent. Every node is recomputed, the reference for CNodeHierarchy. A node that is its
+// own parent (or has a later parent) is a root, its world matrix is its local one
+void ConcatenateNodeMatrices( const SMeshNode* nodes, TUInt32 numNodes, const CMatrix4x4* localMatrices,
+                              CMatrix4x4* pWorldMatrices );
+
+
+//-----------------------------------------------------------------------------
+// Propagation
+//-----------------------------------------------------------------------------
+
+// How world matrices are recomputed. Both visit the nodes in depth-first order and transform the children of
+// each node by its world matrix
+enum EHierarchyMethod
+{
+	kHierarchyScalar, // One child at a time, the reference for the SSE version
+	kHierarchySSE,    // Four siblings at a time with SSE, leftover siblings as scalar
+};
+
+// World matrices of a node hierarchy, kept up to date as local matrices change. Only the top three columns of
+// each matrix are stored, in blocks of four nodes with each element of the four together, so four siblings in one
+// block (leaves under the same parent often are) are loaded and stored with a single instruction for each element.
+// A block holds both the local and world matrices of its nodes, which are always used together.
+// Matrices must be affine - the fourth column is taken to be (0,0,0,1)
+class CNodeHierarchy
+{
+public:
+	CNodeHierarchy() : m_NumNodes( 0 ) {}
+
+	// Take the hierarchy and default local matrices (positionMatrix) of a list of nodes, in depth-first order,
+	// replacing any current hierarchy. Every node is dirty until the first Update
+	void Build( const SMeshNode* nodes, TUInt32 numNodes );
+
+
+	/////////////////////////////////////
+	// Data access
+
+	TUInt32 GetNumNodes() const
+	{
+		return m_NumNodes;
+	}
+
+	// Set the local matrix of a node, relative to its parent. The node and everything below it are recomputed
+	// by the next Update
+	void SetLocalMatrix( TUInt32 node, const CMatrix4x4& matrix );
+
+	CMatrix4x4 GetLocalMatrix( TUInt32 node ) const;
+
+	// World matrix of a node as of the last Update
+	CMatrix4x4 GetWorldMatrix( TUInt32 node ) const;
+
+	// Nodes whose world matrix was recomputed by the last Update, parents before their children
+	const vector<TUInt32>& GetUpdatedNodes() const
+	{
+		return m_Updated;
+	}
+
+	// Bytes used by the matrices and node lists
+	TUInt32 GetMemoryBytes() const;
+
+
+	/////////////////////////////////////
+	// Propagation
+
+	// Mark every node dirty, so the next Update recomputes the whole hierarchy
+	void Invalidate();
+
+	// Recompute the world matrices of the nodes set since the last Update and of everything below them.
+	// Clean subtrees are skipped whole. Returns the number of nodes recomputed
+	TUInt32 Update( EHierarchyMethod method = kHierarchySSE );
+
+private:
+	// Node flags, cleared as Update passes each node
+	enum ENodeFlags
+	{
+		kDirty      = 1, // Local matrix set
+		kDirtyBelow = 2, // A node in the subtree below is dirty
+		kChanged    = 4, // World matrix recomputed in this Update, so all children must be too
+	};
+
+	// Elements kept for each matrix: the top three columns of each row
+	static const TUInt32 kNumElements = 12;
+
+	// Local and world matrices are kept in blocks of four nodes: element 0 of the four local matrices, then element 1
+	// and so on, then the same for the world matrices
+	static const TUInt32 kLocalMatrix = 0;
+	static const TUInt32 kWorldMatrix = kNumElements * 4;
+	static const TUInt32 kBlockFloats = kNumElements * 8;
+
+	// Element e of a node's local or world matrix
+	TFloat32& Element( TUInt32 matrix, TUInt32 e, TUInt32 node )
+	{
+		return m_Matrices[(node >> 2) * kBlockFloats + matrix + e * 4 + (node & 3)];
+	}
+	const TFloat32& Element( TUInt32 matrix, TUInt32 e, TUInt32 node ) const
+	{
+		return m_Matrices[(node >> 2) * kBlockFloats + matrix + e * 4 + (node & 3)];
+	}
+
+	// Recompute the world matrices of some children of a node, given in increasing order
+	void UpdateChildrenScalar( TUInt32 parent, const TUInt32* children, TUInt32 numChildren );
+	void UpdateChildrenSSE( TUInt32 parent, const TUInt32* children, TUInt32 numChildren );
+
+	TUInt32          m_NumNodes;
+	vector<TUInt32>  m_Parents;     // Parent of each node, a root is its own parent
+	vector<TUInt32>  m_SubtreeEnds; // One past the last node below each node - a subtree is a run of the list
+	vector<TUInt32>  m_FirstChild;  // Where each node's children start in m_Children
+	vector<TUInt32>  m_NumChildren;
+	vector<TUInt32>  m_Children;    // Children of each node together, in increasing order
+	vector<TUInt8>   m_Flags;
+	vector<TFloat32> m_Matrices;    // Blocks of kBlockFloats
+
+	vector<TUInt32>  m_Updated;
+	vector<TUInt32>  m_UpdateList;  // Children of the node being passed that need recomputing
+};
@@ -22,6 +22,8 @@ using namespace std;
 #include <rmxftmpl.h>
 
 #include "CImportXFile.h"
+#include "CQuatTransform.h"
+#include "Profiler.h"
 
 namespace gen
 {
@@ -77,10 +79,13 @@ EImportError CImportXFile::ImportFile
 )
 {
 	GEN_GUARD;
+	PROFILE_SCOPE( "CImportXFile::ImportFile" );
 
 	// Wipe any existing data
 	m_Frames.clear();
 	m_Meshes.clear();
+	m_AnimationSets.clear();
+	m_iTicksPerSecond = kiDefaultTicksPerSecond;
 	m_bImported = false;
 
 	// Ensure the file is an X-file
@@ -107,7 +112,10 @@ EImportError CImportXFile::ImportFile
 	}
 
 	// Parse X file to create frame hierachy and meshes
-	eError = ParseXFile( pXFileEnumer );
+	{
+		PROFILE_SCOPE( "CImportXFile::ParseXFile" );
+		eError = ParseXFile( pXFileEnumer );
+	}
 
 	// Release X-File interfaces
 	pXFileEnumer->Release();
@@ -118,11 +126,15 @@ EImportError CImportXFile::ImportFile
 	{
 		m_Frames.clear();
 		m_Meshes.clear();
+		m_AnimationSets.clear();
 		return eError;
 	}
 
 	// Split into meshes containing only one material each
-	SplitMeshes();
+	{
+		PROFILE_SCOPE( "CImportXFile::SplitMeshes" );
+		SplitMeshes();
+	}
 
 	// Mark file as loaded
 	m_bImported = true;
@@ -169,6 +181,7 @@ EImportError CImportXFile::GetSubMesh
 ) const
 {
 	GEN_GUARD;
+	PROFILE_SCOPE( "CImportXFile::GetSubMesh" );
 
 	// Set sub-mesh owner node
 	pOutSubMesh->node = m_Meshes[iSubMesh].iParentFrame;
@@ -382,6 +395,44 @@ void CImportXFile::GetMaterial
 }
 
 
+// Get the keys of a given animation, returned through a pointer. Nodes are given by their index
+// in the hierarchy and key times are converted to seconds
+void CImportXFile::GetAnimation
+(
+	const TUInt32         iAnimation,
+	SMeshAnimation* const pOutAnimation
+) const
+{
+	GEN_GUARD;
+
+	const SXFileAnimationSet& animationSet = m_AnimationSets[iAnimation];
+	pOutAnimation->name = animationSet.sName;
+	pOutAnimation->duration = 0.0f;
+	pOutAnimation->nodes.resize( animationSet.animations.size() );
+	for (TUInt32 iAnim = 0; iAnim < animationSet.animations.size(); ++iAnim)
+	{
+		const SMeshNodeAnimation& keys = animationSet.animations[iAnim].keys;
+		pOutAnimation->nodes[iAnim] = keys;
+
+		// Duration is the time of the last key in any list
+		if (!keys.rotations.empty())
+		{
+			pOutAnimation->duration = max( pOutAnimation->duration, keys.rotations.back().time );
+		}
+		if (!keys.positions.empty())
+		{
+			pOutAnimation->duration = max( pOutAnimation->duration, keys.positions.back().time );
+		}
+		if (!keys.scales.empty())
+		{
+			pOutAnimation->duration = max( pOutAnimation->duration, keys.scales.back().time );
+		}
+	}
+
+	GEN_ENDGUARD;
+}
+
+
 /*-----------------------------------------------------------------------------------------
 	X-File API support
 -----------------------------------------------------------------------------------------*/
@@ -572,6 +623,24 @@ EImportError CImportXFile::ParseXFile
 			eError = ParseXFileMesh( pChildData, 0 );
 		}
 
+		// Found rate of animation key times
+		else if (childGUID == DXFILEOBJ_AnimTicksPerSecond)
+		{
+			TUInt32 iSize = sizeof(TUInt32);
+			TUInt8* pDest = reinterpret_cast<TUInt8*>(&m_iTicksPerSecond);
+			eError = CopyXFileData( pChildData, pDest, &iSize );
+			if (eError == kSuccess && m_iTicksPerSecond == 0)
+			{
+				eError = kInvalidData;
+			}
+		}
+
+		// Found animation set
+		else if (childGUID == TID_D3DRMAnimationSet)
+		{
+			eError = ParseXFileAnimationSet( pChildData );
+		}
+
 		// Release current child data before moving to the next or quiting on error
 		pChildData->Release();
 
@@ -592,6 +661,13 @@ EImportError CImportXFile::ParseXFile
 		return eError;
 	}
 
+	// Match animations to their frames, now that all frames are known
+	eError = ProcessAnimations();
+	if (eError != kSuccess)
+	{
+		return eError;
+	}
+
 	return kSuccess;
 
 	GEN_ENDGUARD;
@@ -815,6 +891,103 @@ EImportError CImportXFile::ParseXFileMesh
 }
 
 
+// Create a new animation set and parse the animations it contains from the X-File. Each animation
+// is a reference to the frame it animates and one or more key templates
+EImportError CImportXFile::ParseXFileAnimationSet
+(
+	ID3DXFileData* pXFileData
+)
+{
+	GEN_GUARD;
+
+	// Create new animation set
+	TUInt32 iCurrSet = static_cast<TUInt32>(m_AnimationSets.size());
+	m_AnimationSets.push_back( SXFileAnimationSet() );
+
+	// Get name for animation set
+	EImportError eError = GetXFileDataName( pXFileData, m_AnimationSets[iCurrSet].sName );
+	if (eError != kSuccess)
+	{
+		return eError;
+	}
+
+	// Get number of child objects for the animation set
+	TUInt32 iNumChildren;
+	eError = GetXFileNumChildren( pXFileData, &iNumChildren );
+	if (eError != kSuccess)
+	{
+		return kInvalidData;
+	}
+
+	// For each child object
+	for (TUInt32 iChild = 0; iChild < iNumChildren; ++iChild)
+	{
+		// Get child data and ID
+		ID3DXFileData* pChildData;
+		GUID childGUID;
+		eError = GetXFileChild( pXFileData, iChild, &pChildData, &childGUID );
+		if (eError != kSuccess)
+		{
+			return kInvalidData;
+		}
+
+		// Found animation - parse its frame reference and keys
+		if (childGUID == TID_D3DRMAnimation)
+		{
+			SXFileAnimation animation;
+			animation.keys.node = 0;
+
+			TUInt32 iNumAnimChildren;
+			eError = GetXFileNumChildren( pChildData, &iNumAnimChildren );
+			for (TUInt32 iAnimChild = 0; eError == kSuccess && iAnimChild < iNumAnimChildren; ++iAnimChild)
+			{
+				ID3DXFileData* pAnimChildData;
+				GUID animChildGUID;
+				eError = GetXFileChild( pChildData, iAnimChild, &pAnimChildData, &animChildGUID );
+				if (eError != kSuccess)
+				{
+					break;
+				}
+
+				// Found reference to the frame animated
+				if (animChildGUID == TID_D3DRMFrame)
+				{
+					eError = GetXFileDataName( pAnimChildData, animation.sFrameName );
+				}
+
+				// Found keys
+				else if (animChildGUID == TID_D3DRMAnimationKey)
+				{
+					eError = ReadAnimationKeyData( pAnimChildData, &animation );
+				}
+
+				// Animation options (looping, spline positions) are ignored
+
+				pAnimChildData->Release();
+			}
+
+			if (eError == kSuccess)
+			{
+				m_AnimationSets[iCurrSet].animations.push_back( animation );
+			}
+		}
+
+		// Release current child data before moving to the next or quiting on error
+		pChildData->Release();
+
+		// Return any errors found
+		if (eError != kSuccess)
+		{
+			return eError;
+		}
+	}
+
+	return kSuccess;
+
+	GEN_ENDGUARD;
+}
+
+
 /*-----------------------------------------------------------------------------------------
 	X-File template parsing
 -----------------------------------------------------------------------------------------*/
@@ -1454,6 +1627,103 @@ EImportError CImportXFile::ReadSkinWeightsData
 	GEN_ENDGUARD;
 }
 
+// Read an animation key template - rotation, scale, position or matrix keys. Times are left in ticks
+EImportError CImportXFile::ReadAnimationKeyData
+(
+	ID3DXFileData*   pXFileData,
+	SXFileAnimation* pAnimation
+)
+{
+	GEN_GUARD;
+
+	// Number of floats in each key of each key type: rotation quaternion, scale, position, and
+	// matrix (some exporters write matrix keys as type 3, others as 4)
+	const TUInt32 kiNumKeyTypes = 5;
+	const TUInt32 aiKeyValues[kiNumKeyTypes] = { 4, 3, 3, 16, 16 };
+
+	// Get animation key data
+	const TUInt8* pKeyData;
+	TUInt32 iSize = 0;
+	EImportError eError = LockXFileData( pXFileData, &pKeyData, &iSize );
+	if (eError != kSuccess)
+	{
+		return kInvalidData;
+	}
+	const TUInt8* pKeyDataEnd = pKeyData + iSize;
+
+	// Read key type and number of keys
+	TUInt32 iKeyType, iNumKeys;
+	ReadXFileLockedUInt( pKeyData, &iKeyType );
+	ReadXFileLockedUInt( pKeyData, &iNumKeys );
+	if (iKeyType >= kiNumKeyTypes)
+	{
+		pXFileData->Unlock();
+		return kInvalidData;
+	}
+
+	// Read each key - a time and a list of floats, which must be the right length for the key type
+	for (TUInt32 iKey = 0; iKey < iNumKeys; ++iKey)
+	{
+		if (pKeyData + 2 * sizeof(TUInt32) > pKeyDataEnd)
+		{
+			pXFileData->Unlock();
+			return kInvalidData;
+		}
+		TUInt32 iTime, iNumValues;
+		ReadXFileLockedUInt( pKeyData, &iTime );
+		ReadXFileLockedUInt( pKeyData, &iNumValues );
+		if (iNumValues != aiKeyValues[iKeyType] ||
+		    pKeyData + iNumValues * sizeof(TFloat32) > pKeyDataEnd)
+		{
+			pXFileData->Unlock();
+			return kInvalidData;
+		}
+		TFloat32 afValues[16];
+		ReadXFileLockedData( pKeyData, reinterpret_cast<TUInt8*>(afValues), iNumValues * sizeof(TFloat32) );
+
+		SMeshRotationKey rotationKey;
+		SMeshVectorKey vectorKey;
+		rotationKey.time = vectorKey.time = static_cast<TFloat32>(iTime);
+		if (iKeyType == 0)
+		{
+			// Rotations are stored w, x, y, z but turn the opposite way to the D3DX convention used by
+			// CQuaternion and the matrices, so are conjugated
+			rotationKey.rotation = CQuaternion( afValues[0], -afValues[1], -afValues[2], -afValues[3] );
+			pAnimation->keys.rotations.push_back( rotationKey );
+		}
+		else if (iKeyType == 1)
+		{
+			vectorKey.value = CVector3( afValues[0], afValues[1], afValues[2] );
+			pAnimation->keys.scales.push_back( vectorKey );
+		}
+		else if (iKeyType == 2)
+		{
+			vectorKey.value = CVector3( afValues[0], afValues[1], afValues[2] );
+			pAnimation->keys.positions.push_back( vectorKey );
+		}
+		else
+		{
+			// Matrix keys are split into a rotation, position and scale key at the same time
+			CMatrix4x4 keyMatrix;
+			memcpy( &keyMatrix.e00, afValues, 16 * sizeof(TFloat32) );
+			CQuatTransform transform( keyMatrix );
+			rotationKey.rotation = transform.quat;
+			pAnimation->keys.rotations.push_back( rotationKey );
+			vectorKey.value = transform.pos;
+			pAnimation->keys.positions.push_back( vectorKey );
+			vectorKey.value = transform.scale;
+			pAnimation->keys.scales.push_back( vectorKey );
+		}
+	}
+
+	// Finished with animation key data
+	pXFileData->Unlock();
+
+	return kSuccess;
+
+	GEN_ENDGUARD;
+}
+
 
 /*-----------------------------------------------------------------------------------------
 	X-File parsing
@@ -1944,7 +2214,10 @@ EImportError CImportXFile::ProcessBones()
 			{
 				if (m_Meshes[iMesh].bones[iBone].sFrameName == m_Frames[iFrame].sName)
 				{
+					// The bone's offset (mesh space to bone space) becomes the frame's, returned as the
+					// node's invMeshOffset for building bone palettes
 					m_Meshes[iMesh].bones[iBone].iFrame = iFrame;
+					m_Frames[iFrame].offsetMatrix = m_Meshes[iMesh].bones[iBone].offsetMatrix;
 					bFoundFrame = true;
 					break;
 				}
@@ -1962,6 +2235,68 @@ EImportError CImportXFile::ProcessBones()
 }
 
 
+/////////////////////////////////////
+// Animation support functions
+
+namespace
+{
+	// Orders animation keys by time
+	template <class TKey> bool KeyTimeLess( const TKey& key1, const TKey& key2 )
+	{
+		return key1.time < key2.time;
+	}
+
+	// Convert key times from ticks to seconds and sort keys by time (exporters should already have)
+	template <class TKey> void ProcessKeyTimes( vector<TKey>& keys, const TFloat32 fSecondsPerTick )
+	{
+		for (TUInt32 iKey = 0; iKey < keys.size(); ++iKey)
+		{
+			keys[iKey].time *= fSecondsPerTick;
+		}
+		stable_sort( keys.begin(), keys.end(), KeyTimeLess<TKey> );
+	}
+}
+
+// Match the animations to their frames and convert key times to seconds
+// Possible return values:
+//		kInvalidData:		Could not find a frame matching one of the animations
+EImportError CImportXFile::ProcessAnimations()
+{
+	GEN_GUARD;
+
+	TFloat32 fSecondsPerTick = 1.0f / static_cast<TFloat32>(m_iTicksPerSecond);
+	for (TUInt32 iSet = 0; iSet < m_AnimationSets.size(); ++iSet)
+	{
+		for (TUInt32 iAnim = 0; iAnim < m_AnimationSets[iSet].animations.size(); ++iAnim)
+		{
+			SXFileAnimation& animation = m_AnimationSets[iSet].animations[iAnim];
+			bool bFoundFrame = false;
+			for (TUInt32 iFrame = 0; iFrame < m_Frames.size(); ++iFrame)
+			{
+				if (animation.sFrameName == m_Frames[iFrame].sName)
+				{
+					animation.keys.node = iFrame;
+					bFoundFrame = true;
+					break;
+				}
+			}
+			if (!bFoundFrame)
+			{
+				return kInvalidData;
+			}
+
+			ProcessKeyTimes( animation.keys.rotations, fSecondsPerTick );
+			ProcessKeyTimes( animation.keys.positions, fSecondsPerTick );
+			ProcessKeyTimes( animation.keys.scales, fSecondsPerTick );
+		}
+	}
+
+	return kSuccess;
+
+	GEN_ENDGUARD;
+}
+
+
 /*-----------------------------------------------------------------------------------------
 	Mesh processing
 -----------------------------------------------------------------------------------------*/
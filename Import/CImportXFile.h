@@ -49,6 +49,7 @@ public:
 	CImportXFile()
 	{
 		m_bImported = false;
+		m_iTicksPerSecond = kiDefaultTicksPerSecond;
 	}
 
 private:
@@ -137,6 +138,21 @@ public:
 	) const;
 
 
+	// Get the number of animations in the file (animation sets in an X-File)
+	TUInt32 GetNumAnimations() const
+	{
+		return static_cast<TUInt32>(m_AnimationSets.size());
+	}
+
+	// Get the keys of a given animation, returned through a pointer. Nodes are given by their index
+	// in the hierarchy and key times are converted to seconds
+	void GetAnimation
+	(
+		const TUInt32         iAnimation,
+		SMeshAnimation* const pAnimation
+	) const;
+
+
 	// TODO: bones
 
 
@@ -325,6 +341,27 @@ private:
 	typedef vector<SXFileMesh> TXFileMeshes;
 
 
+	// Keys for one frame in an animation set. Times are in ticks until all the frames are known,
+	// when the frame is matched by name and the times converted to seconds
+	struct SXFileAnimation
+	{
+		string             sFrameName; // Name of the frame animated
+		SMeshNodeAnimation keys;
+	};
+	typedef vector<SXFileAnimation> TXFileAnimations;
+
+	// An animation set in an X-file
+	struct SXFileAnimationSet
+	{
+		string           sName;
+		TXFileAnimations animations;
+	};
+	typedef vector<SXFileAnimationSet> TXFileAnimationSets;
+
+	// Ticks per second of the key times in a file without an AnimTicksPerSecond template
+	static const TUInt32 kiDefaultTicksPerSecond = 4800;
+
+
 	/////////////////////////////////////
 	// X-File API support
 
@@ -383,6 +420,13 @@ private:
 		const TUInt32  iCurrFrame
 	);
 
+	// X-File parsing - collect the animations in an animation set, each a frame reference and
+	// its keys
+	EImportError ParseXFileAnimationSet
+	(
+		ID3DXFileData* pXFileData
+	);
+
 
 	/////////////////////////////////////
 	// X-File template parsing
@@ -451,6 +495,13 @@ private:
 		const TUInt32  iBone
 	);
 
+	// Read an animation key template - rotation, scale, position or matrix keys
+	EImportError ReadAnimationKeyData
+	(
+		ID3DXFileData*   pXFileData,
+		SXFileAnimation* pAnimation
+	);
+
 
 	/////////////////////////////////////
 	// X-File parsing support
@@ -557,6 +608,13 @@ private:
 	EImportError ProcessBones();
 
 
+	/////////////////////////////////////
+	// Animation support functions
+
+	// Match the animations to their frames and convert key times to seconds
+	EImportError ProcessAnimations();
+
+
 	/////////////////////////////////////
 	// Mesh processing
 
@@ -587,6 +645,10 @@ private:
 
 	// Global list of materials used by all the meshes
 	TXFileMaterials m_Materials;
+
+	// Animation sets and the rate of the ticks their keys are timed in
+	TXFileAnimationSets m_AnimationSets;
+	TUInt32             m_iTicksPerSecond;
 };
 
 
@@ -13,7 +13,9 @@
 using namespace std;
 
 #include "Colour.h"
+#include "CVector3.h"
 #include "CMatrix4x4.h"
+#include "CQuaternion.h"
 
 namespace gen
 {
@@ -73,6 +75,44 @@ struct SMeshMaterial
 };
 
 
+/////////////////////////////////////
+// Animation definitions
+
+// Keys for a node's rotation, and for its position or scale, at a given time in seconds
+struct SMeshRotationKey
+{
+	TFloat32    time;
+	CQuaternion rotation;
+};
+typedef vector<SMeshRotationKey> TMeshRotationKeys;
+
+struct SMeshVectorKey
+{
+	TFloat32 time;
+	CVector3 value;
+};
+typedef vector<SMeshVectorKey> TMeshVectorKeys;
+
+// The keys animating a single node, each list sorted by time. Between keys the node's transform is
+// interpolated, before the first and after the last it holds the end key. Any list may be empty - that
+// part of the node's default matrix is not animated
+struct SMeshNodeAnimation
+{
+	TUInt32           node;      // Index in hierarchy list of the node animated
+	TMeshRotationKeys rotations; // Relative to the parent, as the node's positionMatrix
+	TMeshVectorKeys   positions;
+	TMeshVectorKeys   scales;
+};
+
+// An animation of a mesh hierarchy, keys for some or all of the nodes
+struct SMeshAnimation
+{
+	string                     name;
+	TFloat32                   duration; // Time of the last key in seconds
+	vector<SMeshNodeAnimation> nodes;
+};
+
+
 } // namespace gen
 
 #endif // GEN_MESH_H_INCLUDED
@@ -7,6 +7,7 @@
 //--------------------------------------------------------------------------------------
 
 #include "Input.h"
+#include "InputReplay.h"
 
 
 //////////////////////////////////
@@ -31,23 +32,49 @@ void InitInput()
 //////////////////////////////////
 // Events
 
-// Event called to indicate that a key has been pressed down
-void KeyDownEvent( EKeyState Key )
+namespace
 {
-	if (g_aiKeyStates[Key] == kNotPressed)
+	// Update the state of a key for a press or release, whether live or replayed
+	void ApplyKeyDown( int key )
 	{
-		g_aiKeyStates[Key] = kPressed;
+		if (g_aiKeyStates[key] == kNotPressed)
+		{
+			g_aiKeyStates[key] = kPressed;
+		}
+		else
+		{
+			g_aiKeyStates[key] = kHeld;
+		}
 	}
-	else
+
+	void ApplyKeyUp( int key )
 	{
-		g_aiKeyStates[Key] = kHeld;
+		g_aiKeyStates[key] = kNotPressed;
 	}
 }
 
+// Event called to indicate that a key has been pressed down. During a replay only Escape gets
+// through, so the replay can be abandoned
+void KeyDownEvent( EKeyState Key )
+{
+	if (InputIsReplaying() && static_cast<int>(Key) != Key_Escape) return;
+	InputRecordEvent( Key, true );
+	ApplyKeyDown( Key );
+}
+
 // Event called to indicate that a key has been lifted up
 void KeyUpEvent( EKeyState Key )
 {
-	g_aiKeyStates[Key] = kNotPressed;
+	if (InputIsReplaying() && static_cast<int>(Key) != Key_Escape) return;
+	InputRecordEvent( Key, false );
+	ApplyKeyUp( Key );
+}
+
+// Apply a recorded key event
+void KeyReplayEvent( EKeyCode eKeyCode, bool bDown )
+{
+	if (bDown) ApplyKeyDown( eKeyCode );
+	else       ApplyKeyUp( eKeyCode );
 }
 
 
@@ -178,6 +178,10 @@ void KeyDownEvent( EKeyState Key );
 // Event called to indicate that a key has been lifted up
 void KeyUpEvent( EKeyState Key );
 
+// Apply a recorded key event. Live events above are ignored during a replay (see InputReplay.h),
+// the recorded ones are applied through this instead
+void KeyReplayEvent( EKeyCode eKeyCode, bool bDown );
+
 
 //////////////////////////////////
 // Input functions
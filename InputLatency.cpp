@@ -0,0 +1,191 @@
+/*******************************************
+	InputLatency.cpp
+
+	Input-to-present latency measurement
+********************************************/
+
+#include <cstdio>
+#include <cmath>
+using namespace std;
+
+#include "InputLatency.h"
+
+
+//-----------------------------------------------------------------------------
+// Stages
+//-----------------------------------------------------------------------------
+
+// Name of a stage as used in reports
+const char* LatencyStageName( ELatencyStage stage )
+{
+	switch (stage)
+	{
+		case kLatencyUpdate:  return "update";
+		case kLatencySubmit:  return "submit";
+		case kLatencyPresent: return "present";
+		default:              return "unknown";
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Histogram
+//-----------------------------------------------------------------------------
+
+const float CLatencyHistogram::kBucketWidth = 0.5f; // 0 to 100ms in 200 buckets
+
+// Add a latency (seconds)
+void CLatencyHistogram::Add( double latency )
+{
+	double ms = latency * 1000.0;
+	int bucket = (ms > 0.0) ? static_cast<int>(ms / kBucketWidth) : 0;
+	if (bucket >= kNumBuckets) bucket = kNumBuckets - 1;
+
+	m_Buckets[bucket].fetch_add( 1, memory_order_relaxed );
+	m_Count.fetch_add( 1, memory_order_relaxed );
+	m_SumMicroseconds.fetch_add( static_cast<unsigned long long>(ms > 0.0 ? ms * 1000.0 : 0.0), memory_order_relaxed );
+}
+
+// Forget all recorded latencies
+void CLatencyHistogram::Reset()
+{
+	for (int i = 0; i < kNumBuckets; ++i)
+	{
+		m_Buckets[i].store( 0, memory_order_relaxed );
+	}
+	m_Count.store( 0, memory_order_relaxed );
+	m_SumMicroseconds.store( 0, memory_order_relaxed );
+}
+
+// Mean latency (milliseconds)
+float CLatencyHistogram::Mean() const
+{
+	unsigned int count = Count();
+	if (count == 0) return 0.0f;
+	return static_cast<float>(m_SumMicroseconds.load( memory_order_relaxed ) / 1000.0 / count);
+}
+
+// Latency that the given percentage of samples are at or below (milliseconds)
+float CLatencyHistogram::Percentile( float percent ) const
+{
+	unsigned int count = Count();
+	if (count == 0) return 0.0f;
+
+	// Nearest rank, as used for the benchmark summaries
+	unsigned int rank = static_cast<unsigned int>(ceilf( percent / 100.0f * count ));
+	if (rank < 1) rank = 1;
+	unsigned int seen = 0;
+	for (int i = 0; i < kNumBuckets; ++i)
+	{
+		seen += BucketCount( i );
+		if (seen >= rank) return (i + 1) * kBucketWidth;
+	}
+	return kNumBuckets * kBucketWidth;
+}
+
+
+//-----------------------------------------------------------------------------
+// Latency tracking
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Arrival times of input events not yet consumed. Single producer (the window procedure) and
+	// single consumer (the update), so the head and tail are each written by one side only
+	const unsigned int kInputRingSize = 256; // Must be a power of two
+	TClockTicks          InputRing[kInputRingSize];
+	atomic<unsigned int> InputHead;
+	atomic<unsigned int> InputTail;
+
+	CLatencyHistogram Histograms[kNumLatencyStages];
+}
+
+
+// Timestamp an input event as it arrives
+void LatencyInputEvent()
+{
+	TClockTicks now = ClockTicks();
+	unsigned int head = InputHead.load( memory_order_relaxed );
+	if (head - InputTail.load( memory_order_acquire ) >= kInputRingSize) return;
+
+	InputRing[head & (kInputRingSize - 1)] = now;
+	InputHead.store( head + 1, memory_order_release );
+}
+
+// Called when an update starts to consume input
+TClockTicks LatencyConsumeInput( TClockTicks updateStart )
+{
+	TClockTicks oldest = 0;
+	unsigned int tail = InputTail.load( memory_order_relaxed );
+	unsigned int head = InputHead.load( memory_order_acquire );
+	for (; tail != head; ++tail)
+	{
+		TClockTicks eventTime = InputRing[tail & (kInputRingSize - 1)];
+		if (oldest == 0) oldest = eventTime;
+		LatencyRecord( kLatencyUpdate, eventTime, updateStart );
+	}
+	InputTail.store( tail, memory_order_release );
+	return oldest;
+}
+
+// Record that a frame carrying input that arrived at inputTime has reached a stage
+void LatencyRecord( ELatencyStage stage, TClockTicks inputTime, TClockTicks stageTime )
+{
+	if (inputTime == 0) return;
+	Histograms[stage].Add( ClockTicksToSeconds( stageTime - inputTime ) );
+}
+
+// Histogram of latencies to a stage
+const CLatencyHistogram& LatencyHistogram( ELatencyStage stage )
+{
+	return Histograms[stage];
+}
+
+// Forget all measurements
+void LatencyReset()
+{
+	for (int s = 0; s < kNumLatencyStages; ++s)
+	{
+		Histograms[s].Reset();
+	}
+}
+
+
+// Write the histogram of each stage and a percentile summary to a CSV file
+bool LatencyWriteCSV( const string& fileName )
+{
+	FILE* file = fopen( fileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+
+	// Summary first, then one row per bucket with a count for each stage
+	fprintf( file, "stage,samples,mean_ms,p50_ms,p95_ms,p99_ms\n" );
+	for (int s = 0; s < kNumLatencyStages; ++s)
+	{
+		const CLatencyHistogram& histogram = Histograms[s];
+		fprintf( file, "%s,%u,%.3f,%.3f,%.3f,%.3f\n", LatencyStageName( static_cast<ELatencyStage>(s) ), histogram.Count(),
+		         histogram.Mean(), histogram.Percentile( 50.0f ), histogram.Percentile( 95.0f ), histogram.Percentile( 99.0f ) );
+	}
+
+	fprintf( file, "\nbucket_start_ms,bucket_end_ms" );
+	for (int s = 0; s < kNumLatencyStages; ++s)
+	{
+		fprintf( file, ",%s", LatencyStageName( static_cast<ELatencyStage>(s) ) );
+	}
+	fprintf( file, "\n" );
+	for (int b = 0; b < CLatencyHistogram::kNumBuckets; ++b)
+	{
+		fprintf( file, "%.2f,%.2f", b * CLatencyHistogram::kBucketWidth, (b + 1) * CLatencyHistogram::kBucketWidth );
+		for (int s = 0; s < kNumLatencyStages; ++s)
+		{
+			fprintf( file, ",%u", Histograms[s].BucketCount( b ) );
+		}
+		fprintf( file, "\n" );
+	}
+
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success;
+}
@@ -0,0 +1,115 @@
+/*******************************************
+	InputLatency.h
+
+	Input-to-present latency measurement.
+	Key events are timestamped as they arrive
+	and followed through the update, render
+	submission and present of the frame that
+	consumes them
+********************************************/
+
+#pragma once
+
+#include <atomic>
+#include <string>
+using namespace std;
+
+#include "Clock.h"
+
+
+//-----------------------------------------------------------------------------
+// Stages
+//-----------------------------------------------------------------------------
+
+// Points in a frame that latency is measured up to, each from the time the input event arrived
+enum ELatencyStage
+{
+	kLatencyUpdate,  // The update that consumes the input starts
+	kLatencySubmit,  // Rendering of the frame that shows the result starts
+	kLatencyPresent, // Present returns for that frame. The display scans out later still, how much later
+	                 // depends on the driver's queue and the refresh, neither visible from here
+
+	kNumLatencyStages
+};
+
+// Name of a stage as used in reports
+const char* LatencyStageName( ELatencyStage stage );
+
+
+//-----------------------------------------------------------------------------
+// Histogram
+//-----------------------------------------------------------------------------
+
+// Fixed-size latency histogram with even bucket widths. Adding is lock-free (relaxed atomics) so
+// the thread that reaches a stage can record it while another thread reads the results. Values
+// past the last bucket are counted in it
+class CLatencyHistogram
+{
+public:
+	static const int   kNumBuckets = 200;
+	static const float kBucketWidth; // Milliseconds
+
+	CLatencyHistogram()
+	{
+		Reset();
+	}
+
+	// Add a latency (seconds)
+	void Add( double latency );
+
+	// Forget all recorded latencies. Not safe while another thread is adding
+	void Reset();
+
+	unsigned int Count() const
+	{
+		return m_Count.load( memory_order_relaxed );
+	}
+
+	// Mean latency (milliseconds)
+	float Mean() const;
+
+	// Latency that the given percentage of samples are at or below (milliseconds). Reported as the
+	// upper edge of the bucket containing it, so accurate to one bucket width
+	float Percentile( float percent ) const;
+
+	// Number of samples in a bucket, bucket i covers i * kBucketWidth to (i + 1) * kBucketWidth
+	unsigned int BucketCount( int bucket ) const
+	{
+		return m_Buckets[bucket].load( memory_order_relaxed );
+	}
+
+private:
+	atomic<unsigned int>       m_Buckets[kNumBuckets];
+	atomic<unsigned int>       m_Count;
+	atomic<unsigned long long> m_SumMicroseconds;
+};
+
+
+//-----------------------------------------------------------------------------
+// Latency tracking
+//-----------------------------------------------------------------------------
+
+// Timestamp an input event as it arrives. Events go into a fixed-size lock-free ring until the
+// next update consumes them - if the ring is full the event is not measured
+void LatencyInputEvent();
+
+// Called when an update starts to consume input. Every event waiting in the ring is measured to
+// the update stage. Returns the arrival time of the oldest event, to be carried with the frame
+// through the later stages, or 0 if there were none. The later stages therefore measure the
+// input that has waited longest in each frame
+TClockTicks LatencyConsumeInput( TClockTicks updateStart );
+
+// Record that a frame carrying input that arrived at inputTime has reached a stage. Does nothing
+// if inputTime is 0 (no input in that frame). Can be called from any thread
+void LatencyRecord( ELatencyStage stage, TClockTicks inputTime, TClockTicks stageTime );
+
+// Histogram of latencies to a stage
+const CLatencyHistogram& LatencyHistogram( ELatencyStage stage );
+
+// Forget all measurements, e.g. after a change to the frame loop so results are not mixed. Not
+// safe while another thread is recording
+void LatencyReset();
+
+// Write the histogram of each stage and a percentile summary to a CSV file. Returns false on a
+// file error
+bool LatencyWriteCSV( const string& fileName );
@@ -0,0 +1,217 @@
+/*******************************************
+	InputReplay.cpp
+
+	Input and frame time record / replay
+********************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+#include "InputReplay.h"
+#include "Input.h"
+
+
+//-----------------------------------------------------------------------------
+// File format
+//-----------------------------------------------------------------------------
+
+// A recording is a header followed by a stream of records, each starting with a type byte:
+//   kRecordKeyUp / kRecordKeyDown  followed by the key code (1 byte)
+//   kRecordFrame                   followed by the frame time in seconds (4 byte float)
+// Key events come before the frame record of the frame they were seen in. The frame time is
+// stored as the exact float used, so the fixed timestep runs the same steps on replay.
+// Values are stored little-endian, as on all platforms this runs on
+namespace
+{
+	const char         RecordingMagic[4] = { 'D', 'R', 'I', 'R' };
+	const unsigned int RecordingVersion = 1;
+
+	enum ERecordType
+	{
+		kRecordKeyUp   = 0,
+		kRecordKeyDown = 1,
+		kRecordFrame   = 2,
+	};
+
+	struct SRecordingHeader
+	{
+		char         magic[4];
+		unsigned int version;
+		unsigned int seed;
+		float        simulationStep;
+		int          maxCatchUpSteps;
+	};
+
+
+	// Recording state. Writes go through the C runtime's file buffer, so recording a frame makes
+	// no heap allocations
+	FILE* RecordFile = NULL;
+	bool  RecordError = false;
+
+	// Replay state. The whole recording is loaded up front
+	bool                  Replaying = false;
+	vector<unsigned char> ReplayData;
+	size_t                ReplayPosition = 0;
+	unsigned int          ReplayFrames = 0;
+
+
+	void Write( const void* data, size_t size )
+	{
+		if (fwrite( data, size, 1, RecordFile ) != 1) RecordError = true;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Recording
+//-----------------------------------------------------------------------------
+
+// Start recording input to the given file
+bool InputStartRecording( const string& fileName, const SInputSessionInfo& info )
+{
+	InputStopRecording();
+
+	RecordFile = fopen( fileName.c_str(), "wb" );
+	if (!RecordFile) return false;
+	RecordError = false;
+
+	SRecordingHeader header;
+	memcpy( header.magic, RecordingMagic, sizeof(header.magic) );
+	header.version = RecordingVersion;
+	header.seed = info.seed;
+	header.simulationStep = info.simulationStep;
+	header.maxCatchUpSteps = info.maxCatchUpSteps;
+	Write( &header, sizeof(header) );
+	return !RecordError;
+}
+
+// Finish the recording and close the file
+bool InputStopRecording()
+{
+	if (!RecordFile) return true;
+
+	bool success = !RecordError && (fclose( RecordFile ) == 0);
+	RecordFile = NULL;
+	return success;
+}
+
+bool InputIsRecording()
+{
+	return RecordFile != NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+// Replay
+//-----------------------------------------------------------------------------
+
+// Load a recording to replay
+bool InputStartReplay( const string& fileName, SInputSessionInfo* pInfo )
+{
+	Replaying = false;
+
+	FILE* file = fopen( fileName.c_str(), "rb" );
+	if (!file) return false;
+	fseek( file, 0, SEEK_END );
+	long size = ftell( file );
+	fseek( file, 0, SEEK_SET );
+	if (size < static_cast<long>(sizeof(SRecordingHeader)))
+	{
+		fclose( file );
+		return false;
+	}
+	ReplayData.resize( size );
+	bool readOK = (fread( &ReplayData[0], size, 1, file ) == 1);
+	fclose( file );
+	if (!readOK) return false;
+
+	SRecordingHeader header;
+	memcpy( &header, &ReplayData[0], sizeof(header) );
+	if (memcmp( header.magic, RecordingMagic, sizeof(header.magic) ) != 0 || header.version != RecordingVersion)
+	{
+		return false;
+	}
+	pInfo->seed = header.seed;
+	pInfo->simulationStep = header.simulationStep;
+	pInfo->maxCatchUpSteps = header.maxCatchUpSteps;
+
+	// Count the frames, checking the records are well formed on the way
+	ReplayFrames = 0;
+	size_t position = sizeof(header);
+	while (position < ReplayData.size())
+	{
+		unsigned char type = ReplayData[position];
+		size_t recordSize = (type == kRecordFrame) ? 1 + sizeof(float) : 2;
+		if (type > kRecordFrame || position + recordSize > ReplayData.size()) return false;
+		if (type == kRecordFrame) ++ReplayFrames;
+		position += recordSize;
+	}
+
+	ReplayPosition = sizeof(header);
+	Replaying = true;
+	return true;
+}
+
+bool InputIsReplaying()
+{
+	return Replaying;
+}
+
+// Number of frames in the loaded recording
+unsigned int InputReplayFrameCount()
+{
+	return ReplayFrames;
+}
+
+
+//-----------------------------------------------------------------------------
+// Frames
+//-----------------------------------------------------------------------------
+
+// Call at the start of every frame, before any input is read, with the measured frame time
+bool InputBeginFrame( float* pFrameTime )
+{
+	if (RecordFile)
+	{
+		unsigned char type = kRecordFrame;
+		Write( &type, 1 );
+		Write( pFrameTime, sizeof(float) );
+	}
+
+	if (Replaying)
+	{
+		// Apply key events up to the next frame record, which gives this frame's time
+		while (ReplayPosition < ReplayData.size())
+		{
+			unsigned char type = ReplayData[ReplayPosition];
+			if (type == kRecordFrame)
+			{
+				memcpy( pFrameTime, &ReplayData[ReplayPosition + 1], sizeof(float) );
+				ReplayPosition += 1 + sizeof(float);
+				return true;
+			}
+			KeyReplayEvent( static_cast<EKeyCode>(ReplayData[ReplayPosition + 1]), type == kRecordKeyDown );
+			ReplayPosition += 2;
+		}
+		Replaying = false;
+		return false;
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Events
+//-----------------------------------------------------------------------------
+
+// Called by the input system for every live key event
+void InputRecordEvent( int key, bool down )
+{
+	if (!RecordFile || key < 0 || key >= kMaxKeyCodes) return;
+
+	unsigned char record[2] = { static_cast<unsigned char>(down ? kRecordKeyDown : kRecordKeyUp), static_cast<unsigned char>(key) };
+	Write( record, sizeof(record) );
+}
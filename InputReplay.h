@@ -0,0 +1,68 @@
+/*******************************************
+	InputReplay.h
+
+	Records key events and frame times to a
+	compact binary file and plays them back,
+	so a session can be re-run exactly for
+	profiling or regression comparison
+********************************************/
+
+#pragma once
+
+#include <string>
+using namespace std;
+
+
+// Settings that affect the simulation, stored with a recording so a replay uses the same ones
+struct SInputSessionInfo
+{
+	unsigned int seed;            // Random number seed, the replay reseeds with this
+	float        simulationStep;  // Fixed simulation step (see CFixedTimestep)
+	int          maxCatchUpSteps; // Most simulation steps run in one frame
+};
+
+
+//////////////////////////////////
+// Recording
+
+// Start recording input to the given file. Every key event from the window and every frame time
+// is written until recording stops. Returns false if the file cannot be created
+bool InputStartRecording( const string& fileName, const SInputSessionInfo& info );
+
+// Finish the recording and close the file. Returns false if any write failed
+bool InputStopRecording();
+
+bool InputIsRecording();
+
+
+//////////////////////////////////
+// Replay
+
+// Load a recording to replay, the session settings it was made with are returned. While
+// replaying, live key events from the window are ignored (except Escape, so a replay can be
+// abandoned). Returns false if the file is missing or not a recording
+bool InputStartReplay( const string& fileName, SInputSessionInfo* pInfo );
+
+bool InputIsReplaying();
+
+// Number of frames in the loaded recording
+unsigned int InputReplayFrameCount();
+
+
+//////////////////////////////////
+// Frames
+
+// Call at the start of every frame, before any input is read, with the measured frame time.
+// When recording, the frame time and the key events since the last frame are written out.
+// When replaying, the recorded key events are applied through the normal input functions and
+// the recorded frame time replaces the measured one. Returns false once a replay has run out
+// of frames, the replay is then over and live input is used again. Does nothing if neither
+// recording nor replaying
+bool InputBeginFrame( float* pFrameTime );
+
+
+//////////////////////////////////
+// Events
+
+// Called by the input system for every live key event (see Input.cpp)
+void InputRecordEvent( int key, bool down );
@@ -0,0 +1,364 @@
+/*******************************************
+	JobSystem.cpp
+
+	Work-stealing job system
+********************************************/
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <cstdio>
+using namespace std;
+
+#if defined(_WIN32)
+	#include <windows.h>
+#elif defined(__linux__)
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+
+#include "JobSystem.h"
+#include "Profiler.h"
+
+
+//-----------------------------------------------------------------------------
+// Job deque
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Chase-Lev work-stealing deque of fixed size (Le, Pop, Cohen & Zappa Nardelli, "Correct and
+	// Efficient Work-Stealing for Weak Memory Models", 2013). The owning thread pushes and pops at
+	// the bottom (newest first, good for cache use), other threads steal from the top (oldest first,
+	// which tend to be the largest pieces of work)
+	class CJobDeque
+	{
+	public:
+		static const int kCapacity = 1 << 12; // Must be a power of two
+
+		CJobDeque() : m_Top( 0 ), m_Bottom( 0 ) {}
+
+		// Add a job, owner thread only. Returns false if the deque is full
+		bool Push( const SJob& job )
+		{
+			long long bottom = m_Bottom.load( memory_order_relaxed );
+			long long top = m_Top.load( memory_order_acquire );
+			if (bottom - top >= kCapacity)
+			{
+				return false;
+			}
+			m_Jobs[bottom & (kCapacity - 1)] = job;
+			m_Bottom.store( bottom + 1, memory_order_release ); // Publishes the job to stealers
+			return true;
+		}
+
+		// Take the newest job, owner thread only. Returns false if empty
+		bool Pop( SJob* pJob )
+		{
+			long long bottom = m_Bottom.load( memory_order_relaxed ) - 1;
+			m_Bottom.store( bottom, memory_order_relaxed );
+			atomic_thread_fence( memory_order_seq_cst );
+			long long top = m_Top.load( memory_order_relaxed );
+
+			bool found = false;
+			if (top <= bottom)
+			{
+				*pJob = m_Jobs[bottom & (kCapacity - 1)];
+				found = true;
+				if (top == bottom)
+				{
+					// Last job, race against stealers for it
+					if (!m_Top.compare_exchange_strong( top, top + 1, memory_order_seq_cst, memory_order_relaxed ))
+					{
+						found = false;
+					}
+					m_Bottom.store( bottom + 1, memory_order_relaxed );
+				}
+			}
+			else
+			{
+				m_Bottom.store( bottom + 1, memory_order_relaxed );
+			}
+			return found;
+		}
+
+		// Take the oldest job, any thread. Returns false if empty or another thread got there first
+		bool Steal( SJob* pJob )
+		{
+			long long top = m_Top.load( memory_order_acquire );
+			atomic_thread_fence( memory_order_seq_cst );
+			long long bottom = m_Bottom.load( memory_order_acquire );
+			if (top >= bottom)
+			{
+				return false;
+			}
+
+			// Jobs are stored by value, so copy before claiming it - once top moves on the owner may
+			// reuse the entry. If the owner or another stealer took the job first the copy may be
+			// inconsistent, but then the exchange fails and the copy is thrown away
+			*pJob = m_Jobs[top & (kCapacity - 1)];
+			return m_Top.compare_exchange_strong( top, top + 1, memory_order_seq_cst, memory_order_relaxed );
+		}
+
+	private:
+		// Top is written by stealers and bottom by the owner, keep them on separate cache lines
+		// (padding rather than alignas, see CProfileThreadBuffer)
+		atomic<long long> m_Top;
+		char              m_Pad[64];
+		atomic<long long> m_Bottom;
+		char              m_Pad2[64];
+		SJob              m_Jobs[kCapacity];
+	};
+
+
+	// Everything owned by one thread that runs jobs
+	struct SJobThread
+	{
+		CJobDeque    deque;
+		unsigned int randomState; // For choosing threads to steal from
+		thread       worker;      // Not used for the thread that called JobSystemInit
+	};
+
+
+	//-----------------------------------------------------------------------------
+	// Job system data
+	//-----------------------------------------------------------------------------
+
+	// Thread 0 is the thread that called JobSystemInit, the others are workers
+	vector<SJobThread*> JobThreads;
+
+	// Index in JobThreads of the calling thread, -1 for threads outside the job system
+	thread_local int JobThreadIndex = -1;
+
+	// Jobs waiting in deques, used to let idle workers sleep. A job is counted from push until taken
+	atomic<int>        PendingJobs( 0 );
+	atomic<int>        SleepingWorkers( 0 );
+	atomic<bool>       Quit( false );
+	mutex              SleepMutex;
+	condition_variable SleepCondition;
+
+	// Idle workers keep looking for jobs for this many attempts before sleeping
+	const int kSpinCount = 256;
+
+
+	// Fix the calling thread to a single core (wrapping round if there are more threads than cores)
+	void PinThread( int core )
+	{
+		int numCores = static_cast<int>(thread::hardware_concurrency());
+		if (numCores > 0) core %= numCores;
+	#if defined(_WIN32)
+		SetThreadAffinityMask( GetCurrentThread(), static_cast<DWORD_PTR>(1) << core );
+	#elif defined(__linux__)
+		cpu_set_t cpuSet;
+		CPU_ZERO( &cpuSet );
+		CPU_SET( core, &cpuSet );
+		pthread_setaffinity_np( pthread_self(), sizeof(cpuSet), &cpuSet );
+	#endif
+	}
+
+	// Find a job to run: the calling thread's own newest job first, otherwise steal from another thread
+	bool GetJob( SJob* pJob )
+	{
+		if (PendingJobs.load( memory_order_relaxed ) <= 0) return false;
+
+		SJobThread* jobThread = JobThreads[JobThreadIndex];
+		bool found = jobThread->deque.Pop( pJob );
+		if (!found)
+		{
+			// Start from a random thread so stealers spread out
+			int numThreads = static_cast<int>(JobThreads.size());
+			jobThread->randomState = jobThread->randomState * 1664525u + 1013904223u;
+			int first = static_cast<int>((jobThread->randomState >> 16) % numThreads);
+			for (int i = 0; i < numThreads && !found; ++i)
+			{
+				int victim = (first + i) % numThreads;
+				if (victim != JobThreadIndex) found = JobThreads[victim]->deque.Steal( pJob );
+			}
+		}
+
+		if (found) PendingJobs.fetch_sub( 1, memory_order_relaxed );
+		return found;
+	}
+
+	void ExecuteJob( const SJob& job )
+	{
+		{
+			CProfileScope profileScope( job.name ? job.name : "Job" );
+			job.function( job.data, job.begin, job.end );
+		}
+		if (job.counter) job.counter->Decrement();
+	}
+
+	// Worker thread entry point
+	void WorkerMain( int index, bool pin )
+	{
+		JobThreadIndex = index;
+		if (pin) PinThread( index );
+
+		char name[32];
+		sprintf( name, "Worker %d", index );
+		ProfilerSetThreadName( name );
+
+		int spins = 0;
+		while (!Quit.load( memory_order_relaxed ))
+		{
+			SJob job;
+			if (GetJob( &job ))
+			{
+				ExecuteJob( job );
+				spins = 0;
+			}
+			else if (++spins < kSpinCount)
+			{
+				this_thread::yield();
+			}
+			else
+			{
+				// Sleep until a job is started. The sleeping count is raised before checking for jobs
+				// and JobRun adds the job before checking the sleeping count, so one of them always
+				// sees the other and no wake-up is lost
+				unique_lock<mutex> lock( SleepMutex );
+				SleepingWorkers.fetch_add( 1 );
+				SleepCondition.wait( lock, [] { return PendingJobs.load() > 0 || Quit.load(); } );
+				SleepingWorkers.fetch_sub( 1 );
+				spins = 0;
+			}
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Setup
+//-----------------------------------------------------------------------------
+
+// Start worker threads. Pass -1 to use one worker per remaining hardware thread (the calling
+// thread also runs jobs while waiting, so is not counted)
+void JobSystemInit( int numWorkers, bool pinThreads )
+{
+	if (!JobThreads.empty()) return;
+
+	if (numWorkers < 0)
+	{
+		int hardwareThreads = static_cast<int>(thread::hardware_concurrency());
+		numWorkers = (hardwareThreads > 1) ? hardwareThreads - 1 : 0;
+	}
+
+	Quit = false;
+	PendingJobs = 0;
+	for (int i = 0; i <= numWorkers; ++i)
+	{
+		SJobThread* jobThread = new SJobThread;
+		jobThread->randomState = 12345u + i;
+		JobThreads.push_back( jobThread );
+	}
+
+	// Calling thread joins in as thread 0
+	JobThreadIndex = 0;
+	if (pinThreads) PinThread( 0 );
+
+	for (int i = 1; i <= numWorkers; ++i)
+	{
+		JobThreads[i]->worker = thread( WorkerMain, i, pinThreads );
+	}
+}
+
+// Stop and join all worker threads. No jobs may be outstanding
+void JobSystemShutdown()
+{
+	if (JobThreads.empty()) return;
+
+	{
+		lock_guard<mutex> lock( SleepMutex );
+		Quit = true;
+	}
+	SleepCondition.notify_all();
+
+	for (size_t i = 1; i < JobThreads.size(); ++i)
+	{
+		JobThreads[i]->worker.join();
+	}
+	for (size_t i = 0; i < JobThreads.size(); ++i)
+	{
+		delete JobThreads[i];
+	}
+	JobThreads.clear();
+	JobThreadIndex = -1;
+}
+
+// Number of threads that run jobs, including the thread that called JobSystemInit
+int JobSystemNumThreads()
+{
+	return static_cast<int>(JobThreads.size());
+}
+
+
+//-----------------------------------------------------------------------------
+// Running jobs
+//-----------------------------------------------------------------------------
+
+// Start a job on the calling thread's deque, other threads may steal it. The counter (if given)
+// is incremented now and decremented when the job is complete
+void JobRun( TJobFunction function, void* data, CJobCounter* counter, int begin, int end, const char* name )
+{
+	if (counter) counter->Add( 1 );
+
+	SJob job = { function, data, begin, end, counter, name };
+
+	// Without the job system (or from a thread outside it) just run the job now
+	if (JobThreadIndex < 0)
+	{
+		ExecuteJob( job );
+		return;
+	}
+
+	// Count the job before it can be stolen, so the count never drops below zero
+	PendingJobs.fetch_add( 1 );
+	if (!JobThreads[JobThreadIndex]->deque.Push( job ))
+	{
+		// Deque is full, plenty of work for other threads already
+		PendingJobs.fetch_sub( 1 );
+		ExecuteJob( job );
+		return;
+	}
+
+	if (SleepingWorkers.load() > 0)
+	{
+		// Taking the mutex ensures a worker that has just decided to sleep is waiting before we notify
+		{ lock_guard<mutex> lock( SleepMutex ); }
+		SleepCondition.notify_one();
+	}
+}
+
+// Wait until a counter reaches zero. The calling thread runs other jobs while it waits
+void JobWait( const CJobCounter& counter )
+{
+	while (!counter.IsComplete())
+	{
+		SJob job;
+		if (JobThreadIndex >= 0 && GetJob( &job ))
+		{
+			ExecuteJob( job );
+		}
+		else
+		{
+			this_thread::yield();
+		}
+	}
+}
+
+
+// Job that runs a ParallelFor range, splitting off the top half as new jobs while it is too large
+void ParallelForJob( void* data, int begin, int end )
+{
+	SParallelFor* parallelFor = static_cast<SParallelFor*>(data);
+	while (end - begin > parallelFor->grain)
+	{
+		int middle = begin + (end - begin) / 2;
+		JobRun( ParallelForJob, data, &parallelFor->counter, middle, end, parallelFor->name );
+		end = middle;
+	}
+
+	parallelFor->invoke( parallelFor->function, begin, end );
+}
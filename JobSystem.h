@@ -0,0 +1,149 @@
+/*******************************************
+	JobSystem.h
+
+	Work-stealing job system. Each thread owns
+	a Chase-Lev deque of jobs, idle threads
+	steal from the others. Completion is
+	tracked with counters, which are also how
+	jobs are made to depend on each other
+********************************************/
+
+#pragma once
+
+#include <atomic>
+using namespace std;
+
+
+//-----------------------------------------------------------------------------
+// Types
+//-----------------------------------------------------------------------------
+
+// Job entry point. Jobs are given a data pointer and an index range, simple jobs can ignore the range
+typedef void (*TJobFunction)( void* data, int begin, int end );
+
+// Counts jobs not yet complete. A counter is incremented when a job that uses it is started and
+// decremented when the job finishes, so it reaches zero once all of its jobs are complete. Wait for
+// a counter before starting work that depends on those jobs
+class CJobCounter
+{
+public:
+	CJobCounter() : m_Count( 0 ) {}
+
+	bool IsComplete() const
+	{
+		return m_Count.load( memory_order_acquire ) == 0;
+	}
+
+	void Add( int count )
+	{
+		m_Count.fetch_add( count, memory_order_relaxed );
+	}
+
+	void Decrement()
+	{
+		m_Count.fetch_sub( 1, memory_order_release );
+	}
+
+private:
+	// Disallow use of copy constructor and assignment operator (private and not defined)
+	CJobCounter( const CJobCounter& );
+	CJobCounter& operator=( const CJobCounter& );
+
+	atomic<int> m_Count;
+};
+
+// A single job. Jobs are copied into the deque of the thread that starts them
+struct SJob
+{
+	TJobFunction function;
+	void*        data;
+	int          begin;
+	int          end;
+	CJobCounter* counter; // Decremented when the job completes, may be null
+	const char*  name;    // Profiler scope name (string literal), may be null
+};
+
+
+//-----------------------------------------------------------------------------
+// Setup
+//-----------------------------------------------------------------------------
+
+// Start worker threads. Pass -1 to use one worker per remaining hardware thread (the calling
+// thread also runs jobs while waiting, so is not counted). Pinning fixes each worker to its own
+// core, which gives steadier timings but can hurt if other processes are busy
+void JobSystemInit( int numWorkers = -1, bool pinThreads = false );
+
+// Stop and join all worker threads. No jobs may be outstanding
+void JobSystemShutdown();
+
+// Number of threads that run jobs, including the thread that called JobSystemInit
+int JobSystemNumThreads();
+
+
+//-----------------------------------------------------------------------------
+// Running jobs
+//-----------------------------------------------------------------------------
+
+// Start a job on the calling thread's deque, other threads may steal it. The counter (if given)
+// is incremented now and decremented when the job is complete
+void JobRun( TJobFunction function, void* data, CJobCounter* counter, int begin = 0, int end = 0,
+             const char* name = 0 );
+
+// Wait until a counter reaches zero. The calling thread runs other jobs while it waits, so this can
+// be used inside a job to wait for jobs it has started
+void JobWait( const CJobCounter& counter );
+
+
+// Call function( i0, i1 ) over sub-ranges of [begin, end) in parallel and wait for completion. Ranges
+// are split in half until they are no longer than grain, so idle threads steal large pieces of work
+// first. Choose a grain that gives each job several microseconds of work
+template <class TFunc>
+void ParallelFor( int begin, int end, int grain, const TFunc& function, const char* name = "ParallelFor" );
+
+
+//-----------------------------------------------------------------------------
+// Implementation details
+//-----------------------------------------------------------------------------
+
+// Shared state for the jobs of one ParallelFor
+struct SParallelFor
+{
+	void       (*invoke)( const void* function, int begin, int end );
+	const void*  function;
+	int          grain;
+	CJobCounter  counter;
+	const char*  name;
+};
+
+// Job that runs a ParallelFor range, splitting off the top half as new jobs while it is too large
+void ParallelForJob( void* data, int begin, int end );
+
+template <class TFunc>
+void ParallelForInvoke( const void* function, int begin, int end )
+{
+	(*static_cast<const TFunc*>(function))( begin, end );
+}
+
+template <class TFunc>
+void ParallelFor( int begin, int end, int grain, const TFunc& function, const char* name )
+{
+	if (end <= begin) return;
+
+	// Small ranges are not worth the overhead of a job
+	if (grain < 1) grain = 1;
+	if (end - begin <= grain)
+	{
+		function( begin, end );
+		return;
+	}
+
+	// The shared state lives on this stack frame, which is safe because we wait for all jobs below
+	SParallelFor parallelFor;
+	parallelFor.invoke = &ParallelForInvoke<TFunc>;
+	parallelFor.function = &function;
+	parallelFor.grain = grain;
+	parallelFor.name = name;
+
+	ParallelForJob( &parallelFor, begin, end );
+	JobWait( parallelFor.counter );
+}
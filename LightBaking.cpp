@@ -0,0 +1,594 @@
+/*******************************************
+	LightBaking.cpp
+
+	Triangle BVH and static lighting baked
+	into vertex colours
+********************************************/
+
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+using namespace std;
+
+#include "LightBaking.h"
+#include "Hierarchy.h"
+#include "JobSystem.h"
+#include "Clock.h"
+#include "CImportXFile.h"
+using namespace gen;
+
+
+//-----------------------------------------------------------------------------
+// Triangle BVH
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Leaves hold at most this many triangles, unless their centres are all in the same place
+	const TUInt32 kMaxLeafTriangles = 4;
+
+	// Bins of triangle centres along each axis when choosing where to split a node
+	const int kSplitBins = 12;
+
+	// Deepest node, the size of the stack of nodes still to visit when tracing. Nodes this deep are leaves
+	const TUInt32 kMaxBVHDepth = 64;
+
+	// Two-sided ray-triangle test (Moller-Trumbore), hits strictly between the origin and maxDistance
+	bool RayHitsTriangle( const CVector3& corner, const CVector3& edge1, const CVector3& edge2, const CVector3& origin,
+	                      const CVector3& direction, TFloat32 maxDistance )
+	{
+		CVector3 p = Cross( direction, edge2 );
+		TFloat32 determinant = Dot( edge1, p );
+		if (determinant == 0.0f) return false; // Ray parallel to the triangle, or a degenerate triangle
+		TFloat32 invDeterminant = 1.0f / determinant;
+
+		CVector3 s = origin - corner;
+		TFloat32 u = Dot( s, p ) * invDeterminant;
+		if (u < 0.0f || u > 1.0f) return false;
+		CVector3 q = Cross( s, edge1 );
+		TFloat32 v = Dot( direction, q ) * invDeterminant;
+		if (v < 0.0f || u + v > 1.0f) return false;
+		TFloat32 t = Dot( edge2, q ) * invDeterminant;
+		return t > 0.0f && t < maxDistance;
+	}
+
+	// Does a ray cross a box before maxDistance, given the reciprocal of its direction (huge rather than infinite for
+	// zero components, so origins on a face of the box don't give 0 * infinity)
+	bool RayHitsBox( const CVector3& minBounds, const CVector3& maxBounds, const CVector3& origin,
+	                 const CVector3& invDirection, TFloat32 maxDistance )
+	{
+		TFloat32 t1 = (minBounds.x - origin.x) * invDirection.x, t2 = (maxBounds.x - origin.x) * invDirection.x;
+		TFloat32 entry = Min( t1, t2 ), exit = Max( t1, t2 );
+		t1 = (minBounds.y - origin.y) * invDirection.y;
+		t2 = (maxBounds.y - origin.y) * invDirection.y;
+		entry = Max( entry, Min( t1, t2 ) );
+		exit = Min( exit, Max( t1, t2 ) );
+		t1 = (minBounds.z - origin.z) * invDirection.z;
+		t2 = (maxBounds.z - origin.z) * invDirection.z;
+		entry = Max( entry, Min( t1, t2 ) );
+		exit = Min( exit, Max( t1, t2 ) );
+		return exit >= Max( entry, 0.0f ) && entry < maxDistance;
+	}
+
+	TFloat32 Reciprocal( TFloat32 x )
+	{
+		return (fabsf( x ) > 1e-30f) ? 1.0f / x : ((x < 0.0f) ? -1e30f : 1e30f);
+	}
+
+	// Grow a box to include a point
+	void ExtendBounds( const CVector3& point, CVector3* pMin, CVector3* pMax )
+	{
+		*pMin = CVector3( Min( pMin->x, point.x ), Min( pMin->y, point.y ), Min( pMin->z, point.z ) );
+		*pMax = CVector3( Max( pMax->x, point.x ), Max( pMax->y, point.y ), Max( pMax->z, point.z ) );
+	}
+
+	// Half the surface area of a box, all the heuristic needs
+	TFloat32 HalfArea( const CVector3& minBounds, const CVector3& maxBounds )
+	{
+		CVector3 size = maxBounds - minBounds;
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+
+	// Triangles with centres in one bin, and their bounds
+	struct SSplitBin
+	{
+		TUInt32  numTriangles;
+		CVector3 minBounds;
+		CVector3 maxBounds;
+	};
+
+	// Bin of a triangle centre along an axis
+	int SplitBin( TFloat32 centre, TFloat32 minCentre, TFloat32 binScale )
+	{
+		return Min( static_cast<int>((centre - minCentre) * binScale), kSplitBins - 1 );
+	}
+}
+
+// Any-hit ray test against every triangle
+bool TrianglesOccluded( const CVector3* corners, TUInt32 numTriangles, const CVector3& origin, const CVector3& direction,
+                        TFloat32 maxDistance )
+{
+	for (TUInt32 triangle = 0; triangle < numTriangles; ++triangle)
+	{
+		const CVector3* corner = corners + triangle * 3;
+		if (RayHitsTriangle( corner[0], corner[1] - corner[0], corner[2] - corner[0], origin, direction, maxDistance ))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Build the hierarchy from a list of triangles
+void CTriangleBVH::Build( const CVector3* corners, TUInt32 numTriangles )
+{
+	m_Nodes.clear();
+	m_Triangles.clear();
+	m_Depth = 0;
+	if (numTriangles == 0) return;
+
+	vector<TUInt32> indices( numTriangles );
+	vector<CVector3> centres( numTriangles );
+	for (TUInt32 triangle = 0; triangle < numTriangles; ++triangle)
+	{
+		indices[triangle] = triangle;
+		centres[triangle] = (corners[triangle * 3] + corners[triangle * 3 + 1] + corners[triangle * 3 + 2]) * (1.0f / 3.0f);
+	}
+	m_Nodes.reserve( 2 * ((numTriangles + kMaxLeafTriangles - 1) / kMaxLeafTriangles) );
+	m_Triangles.reserve( numTriangles );
+	BuildNode( corners, indices, centres, 0, numTriangles, 0 );
+}
+
+// Build the node for a range of triangle indices, then its children
+TUInt32 CTriangleBVH::BuildNode( const CVector3* corners, vector<TUInt32>& indices, const vector<CVector3>& centres,
+                                 TUInt32 begin, TUInt32 end, TUInt32 depth )
+{
+	TUInt32 nodeIndex = static_cast<TUInt32>(m_Nodes.size());
+	m_Nodes.push_back( SNode() );
+	m_Depth = Max( m_Depth, depth );
+
+	CVector3 minBounds = corners[indices[begin] * 3], maxBounds = minBounds;
+	CVector3 minCentre = centres[indices[begin]], maxCentre = minCentre;
+	for (TUInt32 i = begin; i < end; ++i)
+	{
+		for (int corner = 0; corner < 3; ++corner) ExtendBounds( corners[indices[i] * 3 + corner], &minBounds, &maxBounds );
+		ExtendBounds( centres[indices[i]], &minCentre, &maxCentre );
+	}
+	m_Nodes[nodeIndex].minBounds = minBounds;
+	m_Nodes[nodeIndex].maxBounds = maxBounds;
+
+	// Split where the surface area heuristic is lowest - the area of each side times the triangles on that side - over the
+	// planes between bins of triangle centres on each axis
+	TUInt32 numTriangles = end - begin;
+	TUInt32 middle = begin;
+	if (numTriangles > kMaxLeafTriangles && depth + 1 < kMaxBVHDepth)
+	{
+		TFloat32 bestCost = 0.0f;
+		int bestAxis = -1, bestPlane = 0;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			TFloat32 minAxis = (&minCentre.x)[axis], extent = (&maxCentre.x)[axis] - minAxis;
+			if (extent <= 0.0f) continue;
+			TFloat32 binScale = kSplitBins / extent;
+
+			SSplitBin bins[kSplitBins];
+			for (int bin = 0; bin < kSplitBins; ++bin) bins[bin].numTriangles = 0;
+			for (TUInt32 i = begin; i < end; ++i)
+			{
+				SSplitBin& bin = bins[SplitBin( (&centres[indices[i]].x)[axis], minAxis, binScale )];
+				const CVector3* corner = corners + indices[i] * 3;
+				if (bin.numTriangles++ == 0) bin.minBounds = bin.maxBounds = corner[0];
+				ExtendBounds( corner[0], &bin.minBounds, &bin.maxBounds );
+				ExtendBounds( corner[1], &bin.minBounds, &bin.maxBounds );
+				ExtendBounds( corner[2], &bin.minBounds, &bin.maxBounds );
+			}
+
+			// Cost of everything right of each plane, then sweep from the left adding the cost of that side
+			TFloat32 rightCost[kSplitBins];
+			TUInt32 count = 0;
+			CVector3 sideMin, sideMax;
+			for (int plane = kSplitBins - 1; plane > 0; --plane)
+			{
+				const SSplitBin& bin = bins[plane];
+				if (bin.numTriangles > 0)
+				{
+					if (count == 0) { sideMin = bin.minBounds; sideMax = bin.maxBounds; }
+					ExtendBounds( bin.minBounds, &sideMin, &sideMax );
+					ExtendBounds( bin.maxBounds, &sideMin, &sideMax );
+					count += bin.numTriangles;
+				}
+				rightCost[plane] = (count > 0) ? count * HalfArea( sideMin, sideMax ) : 0.0f;
+			}
+			count = 0;
+			for (int plane = 1; plane < kSplitBins; ++plane)
+			{
+				const SSplitBin& bin = bins[plane - 1];
+				if (bin.numTriangles > 0)
+				{
+					if (count == 0) { sideMin = bin.minBounds; sideMax = bin.maxBounds; }
+					ExtendBounds( bin.minBounds, &sideMin, &sideMax );
+					ExtendBounds( bin.maxBounds, &sideMin, &sideMax );
+					count += bin.numTriangles;
+				}
+				if (count == 0 || count == numTriangles) continue; // Everything on one side
+				TFloat32 cost = count * HalfArea( sideMin, sideMax ) + rightCost[plane];
+				if (bestAxis < 0 || cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestPlane = plane;
+				}
+			}
+		}
+
+		if (bestAxis >= 0)
+		{
+			TFloat32 minAxis = (&minCentre.x)[bestAxis];
+			TFloat32 binScale = kSplitBins / ((&maxCentre.x)[bestAxis] - minAxis);
+			TUInt32* split = partition( &indices[0] + begin, &indices[0] + end, [&centres, bestAxis, minAxis, binScale, bestPlane]( TUInt32 triangle )
+			{
+				return SplitBin( (&centres[triangle].x)[bestAxis], minAxis, binScale ) < bestPlane;
+			} );
+			middle = static_cast<TUInt32>(split - &indices[0]);
+		}
+	}
+
+	// Leaf - too few triangles to split, too deep, or all the centres are in one place
+	if (middle == begin)
+	{
+		m_Nodes[nodeIndex].firstTriangle = static_cast<TUInt32>(m_Triangles.size());
+		m_Nodes[nodeIndex].numTriangles = numTriangles;
+		for (TUInt32 i = begin; i < end; ++i)
+		{
+			const CVector3* corner = corners + indices[i] * 3;
+			STriangle triangle;
+			triangle.corner = corner[0];
+			triangle.edge1 = corner[1] - corner[0];
+			triangle.edge2 = corner[2] - corner[0];
+			m_Triangles.push_back( triangle );
+		}
+		return nodeIndex;
+	}
+
+	// The first child follows this node, the second goes after the whole of the first's subtree
+	BuildNode( corners, indices, centres, begin, middle, depth + 1 );
+	TUInt32 secondChild = BuildNode( corners, indices, centres, middle, end, depth + 1 );
+	m_Nodes[nodeIndex].firstTriangle = secondChild;
+	m_Nodes[nodeIndex].numTriangles = 0;
+	return nodeIndex;
+}
+
+// Is anything hit by a ray - visits the nodes the ray crosses depth-first, stopping at the first triangle hit
+bool CTriangleBVH::Occluded( const CVector3& origin, const CVector3& direction, TFloat32 maxDistance ) const
+{
+	if (m_Nodes.empty()) return false;
+
+	CVector3 invDirection( Reciprocal( direction.x ), Reciprocal( direction.y ), Reciprocal( direction.z ) );
+	TUInt32 stack[kMaxBVHDepth];
+	TUInt32 stackSize = 0;
+	TUInt32 nodeIndex = 0;
+	while (true)
+	{
+		const SNode& node = m_Nodes[nodeIndex];
+		if (RayHitsBox( node.minBounds, node.maxBounds, origin, invDirection, maxDistance ))
+		{
+			if (node.numTriangles == 0)
+			{
+				stack[stackSize++] = node.firstTriangle; // Second child visited later
+				++nodeIndex;
+				continue;
+			}
+			const STriangle* triangle = &m_Triangles[node.firstTriangle];
+			for (TUInt32 i = 0; i < node.numTriangles; ++i, ++triangle)
+			{
+				if (RayHitsTriangle( triangle->corner, triangle->edge1, triangle->edge2, origin, direction, maxDistance ))
+				{
+					return true;
+				}
+			}
+		}
+		if (stackSize == 0) return false;
+		nodeIndex = stack[--stackSize];
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Baking
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Bits of an integer reversed as a fraction, 0.5 for 1, 0.25 for 2, 0.75 for 3... spreading a sequence evenly
+	TFloat32 RadicalInverse( TUInt32 bits )
+	{
+		bits = (bits << 16) | (bits >> 16);
+		bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+		bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+		bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+		bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+		return (bits >> 8) * (1.0f / 16777216.0f);
+	}
+
+	// A fraction from 0 to 1 that looks random, the same for the same vertex
+	TFloat32 VertexRotation( TUInt32 vertex )
+	{
+		vertex ^= vertex >> 16;
+		vertex *= 0x7FEB352Du;
+		vertex ^= vertex >> 15;
+		vertex *= 0x846CA68Bu;
+		vertex ^= vertex >> 16;
+		return (vertex >> 8) * (1.0f / 16777216.0f);
+	}
+
+	// Bake one vertex, returning the number of rays traced. Occlusion rays are a Hammersley set over the hemisphere,
+	// cosine weighted, turned about the normal by an angle particular to the vertex so neighbouring vertices don't all
+	// miss the same gaps
+	TUInt32 BakeVertex( const CTriangleBVH& bvh, const CVector3& position, const CVector3& normal, TUInt32 vertex,
+	                    const SBakeSettings& settings, CVector4* pColour )
+	{
+		TUInt32 rays = 0;
+		bool hasNormal = !normal.IsZero();
+		CVector3 origin = position + normal * settings.rayOffset;
+
+		TFloat32 open = 1.0f;
+		if (hasNormal && settings.occlusionRays > 0)
+		{
+			CVector3 tangent = Normalise( Cross( (fabsf( normal.x ) < 0.9f) ? CVector3( 1.0f, 0.0f, 0.0f ) : CVector3( 0.0f, 1.0f, 0.0f ), normal ) );
+			CVector3 bitangent = Cross( normal, tangent );
+			TFloat32 rotation = VertexRotation( vertex );
+			TUInt32 unoccluded = 0;
+			for (TUInt32 ray = 0; ray < settings.occlusionRays; ++ray)
+			{
+				TFloat32 u = (ray + 0.5f) / settings.occlusionRays;
+				TFloat32 angle = RadicalInverse( ray ) + rotation;
+				angle = 2.0f * kfPi * (angle - floorf( angle ));
+				TFloat32 radius = sqrtf( u );
+				CVector3 direction = tangent * (radius * cosf( angle )) + bitangent * (radius * sinf( angle )) + normal * sqrtf( 1.0f - u );
+				if (!bvh.Occluded( origin, direction, settings.occlusionDistance )) ++unoccluded;
+			}
+			rays += settings.occlusionRays;
+			open = static_cast<TFloat32>(unoccluded) / settings.occlusionRays;
+		}
+
+		// Diffuse light from each static light, as the lighting shaders, where nothing is in the way
+		CVector3 light = settings.ambientColour * open;
+		for (size_t i = 0; i < settings.lights.size(); ++i)
+		{
+			const SBakeLight& bakeLight = settings.lights[i];
+			CVector3 lightVector = bakeLight.position - position;
+			TFloat32 distance = Length( lightVector );
+			if (distance <= 0.0f || distance >= bakeLight.radius) continue;
+			CVector3 lightDirection = lightVector * (1.0f / distance);
+			TFloat32 intensity = (1.0f - distance / bakeLight.radius) * (hasNormal ? Dot( normal, lightDirection ) : 1.0f);
+			if (intensity <= 0.0f) continue;
+
+			++rays;
+			if (!bvh.Occluded( origin, lightDirection, Length( bakeLight.position - origin ) ))
+			{
+				light = light + bakeLight.colour * intensity;
+			}
+		}
+
+		*pColour = CVector4( light.x, light.y, light.z, open );
+		return rays;
+	}
+}
+
+// Bake the lighting of vertices against the triangles of a BVH
+TUInt64 BakeVertexLighting( const CTriangleBVH& bvh, const CVector3* positions, const CVector3* normals, TUInt32 numVertices,
+                            const SBakeSettings& settings, CVector4* pColours, bool parallel /*= true*/ )
+{
+	if (!parallel)
+	{
+		TUInt64 rays = 0;
+		for (TUInt32 vertex = 0; vertex < numVertices; ++vertex)
+		{
+			rays += BakeVertex( bvh, positions[vertex], normals[vertex], vertex, settings, &pColours[vertex] );
+		}
+		return rays;
+	}
+
+	atomic<TUInt64> totalRays( 0 );
+	ParallelFor( 0, static_cast<int>(numVertices), kBakeVerticesPerJob, [&bvh, positions, normals, &settings, pColours, &totalRays]( int begin, int end )
+	{
+		TUInt64 rays = 0;
+		for (int vertex = begin; vertex < end; ++vertex)
+		{
+			rays += BakeVertex( bvh, positions[vertex], normals[vertex], vertex, settings, &pColours[vertex] );
+		}
+		totalRays += rays;
+	}, "BakeLighting" );
+	return totalRays;
+}
+
+
+//-----------------------------------------------------------------------------
+// Meshes and files
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Start of a baked lighting file, followed by the hash of what was baked, the number of vertices and a colour
+	// (four floats) for each
+	const TUInt32 kBakedLightingMagic = 0x454B4142; // "BAKE"
+	const TUInt32 kBakedLightingVersion = 2;
+
+	// Add some bytes to an FNV-1a hash
+	TUInt32 HashBytes( TUInt32 hash, const void* data, size_t size )
+	{
+		const TUInt8* bytes = static_cast<const TUInt8*>(data);
+		for (size_t b = 0; b < size; ++b)
+		{
+			hash = (hash ^ bytes[b]) * 16777619u;
+		}
+		return hash;
+	}
+}
+
+// Hash of everything a bake depends on other than the mesh itself
+TUInt32 BakeSettingsHash( const SBakeSettings& settings, const CMatrix4x4& rootMatrix )
+{
+	TUInt32 hash = 2166136261u;
+	TUInt32 numLights = static_cast<TUInt32>(settings.lights.size());
+	hash = HashBytes( hash, &numLights, sizeof(numLights) );
+	for (TUInt32 light = 0; light < numLights; ++light)
+	{
+		hash = HashBytes( hash, &settings.lights[light].position, sizeof(CVector3) );
+		hash = HashBytes( hash, &settings.lights[light].radius, sizeof(TFloat32) );
+		hash = HashBytes( hash, &settings.lights[light].colour, sizeof(CVector3) );
+	}
+	hash = HashBytes( hash, &settings.ambientColour, sizeof(CVector3) );
+	hash = HashBytes( hash, &settings.occlusionRays, sizeof(TUInt32) );
+	hash = HashBytes( hash, &settings.occlusionDistance, sizeof(TFloat32) );
+	hash = HashBytes( hash, &settings.rayOffset, sizeof(TFloat32) );
+	hash = HashBytes( hash, &rootMatrix.e00, 16 * sizeof(TFloat32) );
+	return hash;
+}
+
+// Read the sub-meshes of an X-file into a scene in world space
+bool ReadBakeScene( const string& meshFileName, const CMatrix4x4& rootMatrix, SBakeScene* pScene )
+{
+	CImportXFile importFile;
+	if (!importFile.IsXFile( meshFileName ) || importFile.ImportFile( meshFileName ) != kSuccess)
+	{
+		return false;
+	}
+
+	// Node matrices in world space, with the root placed
+	vector<SMeshNode> nodes( importFile.GetNumNodes() );
+	if (nodes.empty()) return false;
+	for (TUInt32 node = 0; node < nodes.size(); ++node)
+	{
+		importFile.GetNode( node, &nodes[node] );
+	}
+	nodes[0].positionMatrix = rootMatrix;
+	vector<CMatrix4x4> worldMatrices( nodes.size() );
+	ConcatenateNodeMatrices( &nodes[0], static_cast<TUInt32>(nodes.size()), 0, &worldMatrices[0] );
+
+	pScene->corners.clear();
+	pScene->positions.clear();
+	pScene->normals.clear();
+	for (TUInt32 subMesh = 0; subMesh < importFile.GetNumSubMeshes(); ++subMesh)
+	{
+		SSubMesh importSubMesh;
+		if (importFile.GetSubMesh( subMesh, &importSubMesh ) != kSuccess) return false;
+
+		// Normals transform by the inverse transpose, as for static batches. The normal follows the skinning data if any
+		const CMatrix4x4& worldMatrix = worldMatrices[importSubMesh.node];
+		CMatrix4x4 normalMatrix = Transpose( InverseAffine( worldMatrix ) );
+		TUInt32 normalOffset = 12 + (importSubMesh.hasSkinningData ? 20 : 0);
+		TUInt32 firstVertex = static_cast<TUInt32>(pScene->positions.size());
+		const TUInt8* vertex = importSubMesh.vertices;
+		for (TUInt32 vert = 0; vert < importSubMesh.numVertices; ++vert, vertex += importSubMesh.vertexSize)
+		{
+			pScene->positions.push_back( worldMatrix.TransformPoint( *reinterpret_cast<const CVector3*>(vertex) ) );
+			pScene->normals.push_back( importSubMesh.hasNormals ?
+			                           Normalise( normalMatrix.TransformVector( *reinterpret_cast<const CVector3*>(vertex + normalOffset) ) ) :
+			                           CVector3( 0.0f, 0.0f, 0.0f ) );
+		}
+		for (TUInt32 face = 0; face < importSubMesh.numFaces; ++face)
+		{
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				pScene->corners.push_back( pScene->positions[firstVertex + importSubMesh.faces[face].aiVertex[corner]] );
+			}
+		}
+		delete[] importSubMesh.vertices;
+		delete[] importSubMesh.faces;
+	}
+	return true;
+}
+
+// Baked vertex colours are stored beside the mesh
+string BakedLightingFileName( const string& meshFileName )
+{
+	return meshFileName + ".bake";
+}
+
+// Write baked vertex colours
+bool WriteBakedLighting( const string& fileName, TUInt32 settingsHash, const vector<CVector4>& colours )
+{
+	FILE* file = fopen( fileName.c_str(), "wb" );
+	if (!file)
+	{
+		return false;
+	}
+	TUInt32 header[4] = { kBakedLightingMagic, kBakedLightingVersion, settingsHash, static_cast<TUInt32>(colours.size()) };
+	bool success = (fwrite( header, sizeof(header), 1, file ) == 1) &&
+	               (colours.empty() || fwrite( &colours[0], sizeof(CVector4), colours.size(), file ) == colours.size());
+	success = (fclose( file ) == 0) && success;
+	return success;
+}
+
+// Read baked vertex colours for a mesh with the given number of vertices, baked with the given settings
+bool ReadBakedLighting( const string& fileName, TUInt32 settingsHash, TUInt32 numVertices, vector<CVector4>* pColours )
+{
+	FILE* file = fopen( fileName.c_str(), "rb" );
+	if (!file)
+	{
+		return false;
+	}
+	TUInt32 header[4];
+	bool success = (fread( header, sizeof(header), 1, file ) == 1) && header[0] == kBakedLightingMagic &&
+	               header[1] == kBakedLightingVersion && header[2] == settingsHash && header[3] == numVertices;
+	if (success)
+	{
+		pColours->resize( numVertices );
+		success = (numVertices == 0 || fread( &(*pColours)[0], sizeof(CVector4), numVertices, file ) == numVertices);
+	}
+	fclose( file );
+	return success;
+}
+
+// Bake an X-file's lighting into a file beside it
+bool BakeLightingFile( const string& meshFileName, const CMatrix4x4& rootMatrix, const SBakeSettings& settings,
+                       const string& reportFileName )
+{
+	TClockTicks start = ClockTicks();
+	SBakeScene scene;
+	if (!ReadBakeScene( meshFileName, rootMatrix, &scene ))
+	{
+		return false;
+	}
+	TClockTicks read = ClockTicks();
+
+	CTriangleBVH bvh;
+	TUInt32 numTriangles = static_cast<TUInt32>(scene.corners.size() / 3);
+	if (numTriangles > 0) bvh.Build( &scene.corners[0], numTriangles );
+	TClockTicks built = ClockTicks();
+
+	TUInt32 numVertices = static_cast<TUInt32>(scene.positions.size());
+	vector<CVector4> colours( numVertices );
+	TUInt64 rays = 0;
+	if (numVertices > 0) rays = BakeVertexLighting( bvh, &scene.positions[0], &scene.normals[0], numVertices, settings, &colours[0] );
+	TClockTicks baked = ClockTicks();
+
+	if (!WriteBakedLighting( BakedLightingFileName( meshFileName ), BakeSettingsHash( settings, rootMatrix ), colours ))
+	{
+		return false;
+	}
+	if (reportFileName.empty())
+	{
+		return true;
+	}
+
+	FILE* file = fopen( reportFileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+	double meanOcclusion = 0.0;
+	for (TUInt32 vertex = 0; vertex < numVertices; ++vertex) meanOcclusion += colours[vertex].w;
+	if (numVertices > 0) meanOcclusion /= numVertices;
+	double bakeSeconds = ClockTicksToSeconds( baked - built );
+	fprintf( file, "mesh,vertices,triangles,bvh_nodes,bvh_depth,bvh_bytes,threads,read_ms,build_ms,bake_ms,rays,mrays_per_second,mean_open\n" );
+	fprintf( file, "%s,%u,%u,%u,%u,%u,%d,%.2f,%.2f,%.2f,%llu,%.2f,%.4f\n", meshFileName.c_str(), numVertices, numTriangles,
+	         bvh.GetNumNodes(), bvh.GetDepth(), bvh.GetMemoryBytes(), JobSystemNumThreads(),
+	         ClockTicksToSeconds( read - start ) * 1000.0, ClockTicksToSeconds( built - read ) * 1000.0, bakeSeconds * 1000.0,
+	         static_cast<unsigned long long>(rays), (bakeSeconds > 0.0) ? rays * 1e-6 / bakeSeconds : 0.0, meanOcclusion );
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success;
+}
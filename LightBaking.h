@@ -0,0 +1,170 @@
+/*******************************************
+	LightBaking.h
+
+	Offline CPU baking of static lighting into
+	vertex colours. The level's triangles are
+	placed in world space and built into a
+	bounding volume hierarchy, then rays from
+	each vertex find the static lights that
+	reach it and how much of the sky above it
+	is open (ambient occlusion). Vertices are
+	spread over the job system
+********************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "Defines.h"
+#include "CVector3.h"
+#include "CVector4.h"
+#include "CMatrix4x4.h"
+using namespace gen;
+
+
+//-----------------------------------------------------------------------------
+// Triangle BVH
+//-----------------------------------------------------------------------------
+
+// Any-hit ray test against a list of triangles (three corners each), one triangle at a time. Triangles are two-sided
+// and hits must lie strictly between the origin and maxDistance along the direction. The reference for CTriangleBVH
+bool TrianglesOccluded( const CVector3* corners, TUInt32 numTriangles, const CVector3& origin, const CVector3& direction,
+                        TFloat32 maxDistance );
+
+// A bounding volume hierarchy of triangles for ray tests. Nodes split their triangles by the surface area heuristic
+// over a few bins of triangle centres on each axis, down to leaves of a few triangles. Nodes are stored depth-first,
+// the first child of each directly after it
+class CTriangleBVH
+{
+public:
+	CTriangleBVH() : m_Depth( 0 ) {}
+
+	// Build from a list of triangles, three corners each. Replaces any triangles already built
+	void Build( const CVector3* corners, TUInt32 numTriangles );
+
+	// Is anything hit by a ray, as TrianglesOccluded. Safe to call from many threads at once
+	bool Occluded( const CVector3& origin, const CVector3& direction, TFloat32 maxDistance ) const;
+
+	TUInt32 GetNumTriangles() const
+	{
+		return static_cast<TUInt32>(m_Triangles.size());
+	}
+
+	TUInt32 GetNumNodes() const
+	{
+		return static_cast<TUInt32>(m_Nodes.size());
+	}
+
+	// Depth of the deepest leaf, the root has depth 0
+	TUInt32 GetDepth() const
+	{
+		return m_Depth;
+	}
+
+	TUInt32 GetMemoryBytes() const
+	{
+		return static_cast<TUInt32>(m_Nodes.capacity() * sizeof(SNode) + m_Triangles.capacity() * sizeof(STriangle));
+	}
+
+private:
+	// Bounds of the node's triangles. Leaves hold numTriangles triangles from firstTriangle, other nodes have two
+	// children, the first directly after the node and the second at the index in firstTriangle
+	struct SNode
+	{
+		CVector3 minBounds;
+		TUInt32  firstTriangle; // Leaves, or second child of other nodes
+		CVector3 maxBounds;
+		TUInt32  numTriangles;  // 0 for nodes that are not leaves
+	};
+
+	// Triangles in leaf order, as one corner and the edges from it to the other two
+	struct STriangle
+	{
+		CVector3 corner;
+		CVector3 edge1;
+		CVector3 edge2;
+	};
+
+	// Build the node for a range of triangle indices, returning its index
+	TUInt32 BuildNode( const CVector3* corners, vector<TUInt32>& indices, const vector<CVector3>& centres,
+	                   TUInt32 begin, TUInt32 end, TUInt32 depth );
+
+	vector<SNode>     m_Nodes;
+	vector<STriangle> m_Triangles;
+	TUInt32           m_Depth;
+};
+
+
+//-----------------------------------------------------------------------------
+// Baking
+//-----------------------------------------------------------------------------
+
+// A point light that never moves, lit as the lighting shaders do: diffuse only, falling off linearly to nothing at
+// its radius
+struct SBakeLight
+{
+	CVector3 position;
+	TFloat32 radius;
+	CVector3 colour;
+};
+
+// What to bake
+struct SBakeSettings
+{
+	vector<SBakeLight> lights;
+	CVector3           ambientColour;
+	TUInt32            occlusionRays;     // Rays from each vertex for ambient occlusion, over the hemisphere about its normal
+	TFloat32           occlusionDistance; // Rays hitting something nearer than this are occluded, further is open sky
+	TFloat32           rayOffset;         // Rays start this far off the surface along the normal, so it doesn't hit itself
+};
+
+// Vertices given to each job by BakeVertexLighting, around a millisecond of rays
+const TUInt32 kBakeVerticesPerJob = 64;
+
+// Bake the lighting of vertices in world space against the triangles of a BVH. Each colour is the ambient colour
+// scaled by the vertex's ambient occlusion, plus the diffuse light of each static light that reaches it unblocked,
+// with the ambient occlusion itself (1 for fully open) in w. Occlusion rays are cosine weighted so w is the fraction
+// of ambient light received. Vertices with no normal (zero length) are lit from every side and not occluded. Rays
+// are the same for a vertex wherever it is baked, so results don't depend on the jobs. With parallel, vertices are
+// spread over the job system, returning once all are done. Returns the number of rays traced
+TUInt64 BakeVertexLighting( const CTriangleBVH& bvh, const CVector3* positions, const CVector3* normals, TUInt32 numVertices,
+                         const SBakeSettings& settings, CVector4* pColours, bool parallel = true );
+
+
+//-----------------------------------------------------------------------------
+// Meshes and files
+//-----------------------------------------------------------------------------
+
+// The geometry of a mesh placed in world space: every triangle, and every vertex with its normal in the order of
+// the sub-meshes' vertices (as CMesh::SetVertexColours takes colours)
+struct SBakeScene
+{
+	vector<CVector3> corners;   // Three per triangle
+	vector<CVector3> positions;
+	vector<CVector3> normals;   // Zero for sub-meshes without normals
+};
+
+// Read the sub-meshes of an X-file into a scene, each placed by its node's matrix in the hierarchy. The root node's
+// matrix is replaced by rootMatrix, as a mesh is placed by setting it (see CMesh::SetNodeMatrix). Returns false if
+// the file can't be read
+bool ReadBakeScene( const string& meshFileName, const CMatrix4x4& rootMatrix, SBakeScene* pScene );
+
+// Baked vertex colours of a mesh are stored beside it in a file of this name
+string BakedLightingFileName( const string& meshFileName );
+
+// Hash of the settings and root matrix a mesh is baked with, stored in its baked lighting file
+TUInt32 BakeSettingsHash( const SBakeSettings& settings, const CMatrix4x4& rootMatrix );
+
+// Write and read baked vertex colours. Reading returns false if the file can't be read or has a different settings
+// hash or number of vertices, so a mesh that has moved, been relit or changed since it was baked is re-baked rather
+// than given stale colours
+bool WriteBakedLighting( const string& fileName, TUInt32 settingsHash, const vector<CVector4>& colours );
+bool ReadBakedLighting( const string& fileName, TUInt32 settingsHash, TUInt32 numVertices, vector<CVector4>* pColours );
+
+// Bake an X-file's lighting and write it to BakedLightingFileName, placed as ReadBakeScene. If reportFileName is not
+// empty the size of the scene and the time taken by each stage are written there. The job system should be running.
+// Returns false if the X-file can't be read or a file written
+bool BakeLightingFile( const string& meshFileName, const CMatrix4x4& rootMatrix, const SBakeSettings& settings,
+                       const string& reportFileName );
@@ -0,0 +1,417 @@
+/*******************************************
+	MemoryAccounting.cpp
+
+	Memory use tagged by category and asset
+********************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <mutex>
+using namespace std;
+
+#include "MemoryAccounting.h"
+#include "MemoryTracking.h"
+
+
+//-----------------------------------------------------------------------------
+// Categories
+//-----------------------------------------------------------------------------
+
+// Name of a category as used in reports and budgets
+const char* MemoryCategoryName( EMemoryCategory category )
+{
+	switch (category)
+	{
+		case kMemoryMeshNodes:     return "mesh_nodes";
+		case kMemoryMeshGeometry:  return "mesh_geometry";
+		case kMemoryMeshMaterials: return "mesh_materials";
+		case kMemoryEffects:       return "effects";
+		case kMemoryFrameData:     return "frame_data";
+		case kMemoryVertexBuffers: return "vertex_buffers";
+		case kMemoryIndexBuffers:  return "index_buffers";
+		case kMemoryTextures:      return "textures";
+		case kMemoryRenderTargets: return "render_targets";
+		default:                   return "unknown";
+	}
+}
+
+// Whether a category is GPU memory
+bool MemoryCategoryIsGPU( EMemoryCategory category )
+{
+	return category >= kMemoryVertexBuffers;
+}
+
+
+//-----------------------------------------------------------------------------
+// Accounting
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Budgets are indexed by category, followed by the totals
+	enum EBudget
+	{
+		kBudgetCPU = kNumMemoryCategories,
+		kBudgetGPU,
+		kBudgetHeap,
+		kNumBudgets
+	};
+
+	// Everything below is guarded by the mutex
+	mutex                       AccountMutex;
+	vector<SMemoryAccountEntry> Entries;
+	vector<SMemoryImportRecord> ImportRecords;
+	long long                   CategoryBytes[kNumMemoryCategories];
+	long long                   CategoryPeakBytes[kNumMemoryCategories];
+	unsigned long long          Budgets[kNumBudgets];
+
+
+	// Name of a budget as used in reports
+	const char* BudgetName( int budget )
+	{
+		switch (budget)
+		{
+			case kBudgetCPU:  return "cpu";
+			case kBudgetGPU:  return "gpu";
+			case kBudgetHeap: return "heap";
+			default:          return MemoryCategoryName( static_cast<EMemoryCategory>(budget) );
+		}
+	}
+
+	// Total of all CPU or all GPU categories, lock must be held
+	long long LockedTotalBytes( bool gpu )
+	{
+		long long total = 0;
+		for (int c = 0; c < kNumMemoryCategories; ++c)
+		{
+			if (MemoryCategoryIsGPU( static_cast<EMemoryCategory>(c) ) == gpu) total += CategoryBytes[c];
+		}
+		return total;
+	}
+
+	// Bytes counted against a budget, lock must be held
+	long long LockedBudgetUsedBytes( int budget )
+	{
+		switch (budget)
+		{
+			case kBudgetCPU:  return LockedTotalBytes( false );
+			case kBudgetGPU:  return LockedTotalBytes( true );
+			case kBudgetHeap: return static_cast<long long>(MemoryLiveBytes());
+			default:          return CategoryBytes[budget];
+		}
+	}
+
+	bool LockedOverBudget( int budget )
+	{
+		return Budgets[budget] > 0 && LockedBudgetUsedBytes( budget ) > static_cast<long long>(Budgets[budget]);
+	}
+}
+
+
+// Add bytes used by an asset in a category, or remove them with a negative value
+void MemoryAccountAdd( EMemoryCategory category, const string& asset, long long bytes )
+{
+	lock_guard<mutex> lock( AccountMutex );
+
+	SMemoryAccountEntry* entry = 0;
+	for (size_t e = 0; e < Entries.size(); ++e)
+	{
+		if (Entries[e].category == category && Entries[e].asset == asset)
+		{
+			entry = &Entries[e];
+			break;
+		}
+	}
+	if (!entry)
+	{
+		SMemoryAccountEntry newEntry = { category, asset, 0, 0 };
+		Entries.push_back( newEntry );
+		entry = &Entries.back();
+	}
+
+	entry->bytes += bytes;
+	if (entry->bytes > entry->peakBytes) entry->peakBytes = entry->bytes;
+	CategoryBytes[category] += bytes;
+	if (CategoryBytes[category] > CategoryPeakBytes[category]) CategoryPeakBytes[category] = CategoryBytes[category];
+}
+
+// Remove all bytes used by an asset in a category
+void MemoryAccountRelease( EMemoryCategory category, const string& asset )
+{
+	lock_guard<mutex> lock( AccountMutex );
+	for (size_t e = 0; e < Entries.size(); ++e)
+	{
+		if (Entries[e].category == category && Entries[e].asset == asset)
+		{
+			CategoryBytes[category] -= Entries[e].bytes;
+			Entries[e].bytes = 0;
+			return;
+		}
+	}
+}
+
+
+// Start measuring the import of an asset
+CMemoryImportScope::CMemoryImportScope( const string& asset, EMemoryCategory retainedCategory /*= kNumMemoryCategories*/ )
+	: m_Asset( asset ), m_RetainedCategory( retainedCategory )
+{
+	m_StartBytes = MemoryLiveBytes();
+	MemoryBeginPeakWindow();
+}
+
+// Record the import
+CMemoryImportScope::~CMemoryImportScope()
+{
+	long long retained = static_cast<long long>(MemoryLiveBytes()) - static_cast<long long>(m_StartBytes);
+	unsigned long long peak = MemoryPeakWindowBytes();
+	SMemoryImportRecord record = { m_Asset, peak > m_StartBytes ? peak - m_StartBytes : 0, retained };
+
+	if (m_RetainedCategory != kNumMemoryCategories)
+	{
+		MemoryAccountAdd( m_RetainedCategory, m_Asset, retained );
+	}
+
+	lock_guard<mutex> lock( AccountMutex );
+	ImportRecords.push_back( record );
+}
+
+
+//-----------------------------------------------------------------------------
+// Queries
+//-----------------------------------------------------------------------------
+
+// Copies of the current entries and import records
+vector<SMemoryAccountEntry> MemoryAccountEntries()
+{
+	lock_guard<mutex> lock( AccountMutex );
+	return Entries;
+}
+
+vector<SMemoryImportRecord> MemoryImportRecords()
+{
+	lock_guard<mutex> lock( AccountMutex );
+	return ImportRecords;
+}
+
+// Totals of a category
+long long MemoryCategoryBytes( EMemoryCategory category )
+{
+	lock_guard<mutex> lock( AccountMutex );
+	return CategoryBytes[category];
+}
+
+long long MemoryCategoryPeakBytes( EMemoryCategory category )
+{
+	lock_guard<mutex> lock( AccountMutex );
+	return CategoryPeakBytes[category];
+}
+
+// Totals of all CPU or all GPU categories
+long long MemoryCPUBytes()
+{
+	lock_guard<mutex> lock( AccountMutex );
+	return LockedTotalBytes( false );
+}
+
+long long MemoryGPUBytes()
+{
+	lock_guard<mutex> lock( AccountMutex );
+	return LockedTotalBytes( true );
+}
+
+
+//-----------------------------------------------------------------------------
+// Budgets
+//-----------------------------------------------------------------------------
+
+// Set a budget by name
+bool MemorySetBudget( const string& name, unsigned long long bytes )
+{
+	lock_guard<mutex> lock( AccountMutex );
+	for (int b = 0; b < kNumBudgets; ++b)
+	{
+		if (name == BudgetName( b ))
+		{
+			Budgets[b] = bytes;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Set budgets from a list such as "textures=256,gpu=512" (megabytes)
+bool MemorySetBudgets( const string& list )
+{
+	bool success = true;
+	stringstream stream( list );
+	string item;
+	while (getline( stream, item, ',' ))
+	{
+		size_t equals = item.find( '=' );
+		double megabytes = (equals != string::npos) ? atof( item.c_str() + equals + 1 ) : -1.0;
+		if (megabytes < 0.0 ||
+		    !MemorySetBudget( item.substr( 0, equals ), static_cast<unsigned long long>(megabytes * 1024.0 * 1024.0) ))
+		{
+			success = false;
+		}
+	}
+	return success;
+}
+
+// Number of budgets currently exceeded
+int MemoryOverBudgetCount()
+{
+	lock_guard<mutex> lock( AccountMutex );
+	int count = 0;
+	for (int b = 0; b < kNumBudgets; ++b)
+	{
+		if (LockedOverBudget( b )) ++count;
+	}
+	return count;
+}
+
+
+//-----------------------------------------------------------------------------
+// Reports
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	const double kMegabyte = 1024.0 * 1024.0;
+
+	// Write a string as a JSON string, escaping quotes and backslashes (file paths)
+	void WriteJSONString( FILE* file, const string& text )
+	{
+		fputc( '"', file );
+		for (size_t i = 0; i < text.length(); ++i)
+		{
+			if (text[i] == '"' || text[i] == '\\') fputc( '\\', file );
+			fputc( text[i], file );
+		}
+		fputc( '"', file );
+	}
+
+	// Write a string as a CSV field, quoted in case it contains commas
+	void WriteCSVString( FILE* file, const string& text )
+	{
+		fputc( '"', file );
+		for (size_t i = 0; i < text.length(); ++i)
+		{
+			if (text[i] == '"') fputc( '"', file );
+			fputc( text[i], file );
+		}
+		fputc( '"', file );
+	}
+}
+
+
+// Short summary for on-screen display
+void MemoryReportText( char* text, int size )
+{
+	lock_guard<mutex> lock( AccountMutex );
+	int overBudget = 0;
+	for (int b = 0; b < kNumBudgets; ++b)
+	{
+		if (LockedOverBudget( b )) ++overBudget;
+	}
+	snprintf( text, size, "CPU: %.1fMB, GPU: %.1fMB, Heap: %.1fMB (peak %.1fMB), Over budget: %d",
+	          LockedTotalBytes( false ) / kMegabyte, LockedTotalBytes( true ) / kMegabyte,
+	          MemoryLiveBytes() / kMegabyte, MemoryPeakLiveBytes() / kMegabyte, overBudget );
+}
+
+
+// Write a JSON report
+bool MemoryWriteJSON( const string& fileName )
+{
+	FILE* file = fopen( fileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+
+	lock_guard<mutex> lock( AccountMutex );
+	fprintf( file, "{\n  \"heap\": { \"bytes\": %llu, \"peak_bytes\": %llu },\n",
+	         MemoryLiveBytes(), MemoryPeakLiveBytes() );
+	fprintf( file, "  \"cpu_bytes\": %lld,\n  \"gpu_bytes\": %lld,\n", LockedTotalBytes( false ), LockedTotalBytes( true ) );
+
+	fprintf( file, "  \"categories\": {\n" );
+	for (int c = 0; c < kNumMemoryCategories; ++c)
+	{
+		EMemoryCategory category = static_cast<EMemoryCategory>(c);
+		fprintf( file, "    \"%s\": { \"gpu\": %s, \"bytes\": %lld, \"peak_bytes\": %lld }%s\n", MemoryCategoryName( category ),
+		         MemoryCategoryIsGPU( category ) ? "true" : "false", CategoryBytes[c], CategoryPeakBytes[c],
+		         c + 1 < kNumMemoryCategories ? "," : "" );
+	}
+
+	fprintf( file, "  },\n  \"entries\": [\n" );
+	for (size_t e = 0; e < Entries.size(); ++e)
+	{
+		fprintf( file, "    { \"category\": \"%s\", \"asset\": ", MemoryCategoryName( Entries[e].category ) );
+		WriteJSONString( file, Entries[e].asset );
+		fprintf( file, ", \"bytes\": %lld, \"peak_bytes\": %lld }%s\n", Entries[e].bytes, Entries[e].peakBytes,
+		         e + 1 < Entries.size() ? "," : "" );
+	}
+
+	fprintf( file, "  ],\n  \"imports\": [\n" );
+	for (size_t i = 0; i < ImportRecords.size(); ++i)
+	{
+		fprintf( file, "    { \"asset\": " );
+		WriteJSONString( file, ImportRecords[i].asset );
+		fprintf( file, ", \"peak_bytes\": %llu, \"retained_bytes\": %lld }%s\n", ImportRecords[i].peakBytes,
+		         ImportRecords[i].retainedBytes, i + 1 < ImportRecords.size() ? "," : "" );
+	}
+
+	fprintf( file, "  ],\n  \"budgets\": [\n" );
+	bool first = true;
+	for (int b = 0; b < kNumBudgets; ++b)
+	{
+		if (Budgets[b] == 0) continue;
+		fprintf( file, "%s    { \"name\": \"%s\", \"budget_bytes\": %llu, \"bytes\": %lld, \"over\": %s }", first ? "" : ",\n",
+		         BudgetName( b ), Budgets[b], LockedBudgetUsedBytes( b ), LockedOverBudget( b ) ? "true" : "false" );
+		first = false;
+	}
+	fprintf( file, "%s  ]\n}\n", first ? "" : "\n" );
+
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success;
+}
+
+// Write a CSV report
+bool MemoryWriteCSV( const string& fileName )
+{
+	FILE* file = fopen( fileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+
+	lock_guard<mutex> lock( AccountMutex );
+	fprintf( file, "category,asset,gpu,bytes,peak_bytes\n" );
+	for (size_t e = 0; e < Entries.size(); ++e)
+	{
+		fprintf( file, "%s,", MemoryCategoryName( Entries[e].category ) );
+		WriteCSVString( file, Entries[e].asset );
+		fprintf( file, ",%d,%lld,%lld\n", MemoryCategoryIsGPU( Entries[e].category ) ? 1 : 0, Entries[e].bytes, Entries[e].peakBytes );
+	}
+
+	// Category totals have an empty asset, then the import records with the import peak in place of the category
+	for (int c = 0; c < kNumMemoryCategories; ++c)
+	{
+		EMemoryCategory category = static_cast<EMemoryCategory>(c);
+		fprintf( file, "%s,,%d,%lld,%lld\n", MemoryCategoryName( category ), MemoryCategoryIsGPU( category ) ? 1 : 0,
+		         CategoryBytes[c], CategoryPeakBytes[c] );
+	}
+	fprintf( file, "heap,,0,%llu,%llu\n", MemoryLiveBytes(), MemoryPeakLiveBytes() );
+	for (size_t i = 0; i < ImportRecords.size(); ++i)
+	{
+		fprintf( file, "import," );
+		WriteCSVString( file, ImportRecords[i].asset );
+		fprintf( file, ",0,%lld,%llu\n", ImportRecords[i].retainedBytes, ImportRecords[i].peakBytes );
+	}
+
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success;
+}
@@ -0,0 +1,149 @@
+/*******************************************
+	MemoryAccounting.h
+
+	Memory use tagged by category and asset
+	(mesh file, texture path, effect...),
+	covering CPU allocations and GPU buffers
+	and textures, with peaks, import peaks
+	and budgets. Reported as text, JSON or
+	CSV so asset memory can be compared
+	between builds
+********************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+using namespace std;
+
+
+//-----------------------------------------------------------------------------
+// Categories
+//-----------------------------------------------------------------------------
+
+// What memory is used for. Add new categories before kNumMemoryCategories and give them a name in
+// MemoryCategoryName
+enum EMemoryCategory
+{
+	// CPU
+	kMemoryMeshNodes,     // Mesh node hierarchies
+	kMemoryMeshGeometry,  // Sub-mesh descriptions and the vertex / face data kept for enumeration
+	kMemoryMeshMaterials, // Mesh material descriptions (the textures themselves are GPU memory)
+	kMemoryEffects,       // Heap used by a compiled effect (Effects11 heaps, reflection data, shaders)
+	kMemoryFrameData,     // Frame allocator buffers
+
+	// GPU
+	kMemoryVertexBuffers,
+	kMemoryIndexBuffers,
+	kMemoryTextures,      // Textures loaded for materials and effects
+	kMemoryRenderTargets, // Back buffer, depth buffer and G-buffer
+
+	kNumMemoryCategories
+};
+
+// Name of a category as used in reports and budgets
+const char* MemoryCategoryName( EMemoryCategory category );
+
+// Whether a category is GPU memory. GPU sizes are calculated from the resource description so
+// don't include driver padding or alignment
+bool MemoryCategoryIsGPU( EMemoryCategory category );
+
+
+//-----------------------------------------------------------------------------
+// Accounting
+//-----------------------------------------------------------------------------
+
+// Add bytes used by an asset in a category, or remove them with a negative value when the asset
+// is released. Thread-safe, but takes a lock so is meant for loading and releasing, not for
+// every frame
+void MemoryAccountAdd( EMemoryCategory category, const string& asset, long long bytes );
+
+// Remove all bytes used by an asset in a category, for when the amount added is not known
+void MemoryAccountRelease( EMemoryCategory category, const string& asset );
+
+
+// Measures the heap used while importing an asset: records the highest heap use above the start
+// of the scope and the bytes still held at the end. Optionally charges the bytes held to a
+// category, for code whose allocations can't be counted directly (e.g. effect creation). The heap
+// is shared by all threads, so measurements are only meaningful if nothing else is allocating
+// meanwhile - true for loading in this program. Scopes cannot nest (see MemoryBeginPeakWindow)
+class CMemoryImportScope
+{
+public:
+	CMemoryImportScope( const string& asset, EMemoryCategory retainedCategory = kNumMemoryCategories );
+	~CMemoryImportScope();
+
+private:
+	// Disallow use of copy constructor and assignment operator (private and not defined)
+	CMemoryImportScope( const CMemoryImportScope& );
+	CMemoryImportScope& operator=( const CMemoryImportScope& );
+
+	string             m_Asset;
+	EMemoryCategory    m_RetainedCategory;
+	unsigned long long m_StartBytes;
+};
+
+
+//-----------------------------------------------------------------------------
+// Queries
+//-----------------------------------------------------------------------------
+
+// Memory used by one asset in one category
+struct SMemoryAccountEntry
+{
+	EMemoryCategory category;
+	string          asset;
+	long long       bytes;     // In use now
+	long long       peakBytes; // Most ever in use
+};
+
+// Heap use measured while importing one asset
+struct SMemoryImportRecord
+{
+	string             asset;
+	unsigned long long peakBytes;     // Highest heap use above the start of the import
+	long long          retainedBytes; // Heap still held once the import finished
+};
+
+// Copies of the current entries (in the order first added) and import records
+vector<SMemoryAccountEntry> MemoryAccountEntries();
+vector<SMemoryImportRecord> MemoryImportRecords();
+
+// Totals of a category, in use now and most ever in use
+long long MemoryCategoryBytes( EMemoryCategory category );
+long long MemoryCategoryPeakBytes( EMemoryCategory category );
+
+// Totals of all CPU or all GPU categories
+long long MemoryCPUBytes();
+long long MemoryGPUBytes();
+
+
+//-----------------------------------------------------------------------------
+// Budgets
+//-----------------------------------------------------------------------------
+
+// Set a budget (bytes, 0 for none) by name: a category name, "cpu" or "gpu" for the totals of
+// accounted memory, or "heap" for all memory allocated with new. Returns false for an unknown name
+bool MemorySetBudget( const string& name, unsigned long long bytes );
+
+// Set budgets from a list such as "textures=256,gpu=512" (megabytes). Returns false if any entry
+// was not understood, the valid ones are still set
+bool MemorySetBudgets( const string& list );
+
+// Number of budgets currently exceeded
+int MemoryOverBudgetCount();
+
+
+//-----------------------------------------------------------------------------
+// Reports
+//-----------------------------------------------------------------------------
+
+// Short summary (CPU, GPU and heap totals and budgets exceeded) for on-screen display, written into
+// the given buffer so it does not allocate
+void MemoryReportText( char* text, int size );
+
+// Write a report with every category, entry, import record and budget. The JSON has everything, the
+// CSV has one row per entry, then the category totals (empty asset), the heap and the import records
+// (peak in the peak column, retained in the bytes column). Returns false on a file error
+bool MemoryWriteJSON( const string& fileName );
+bool MemoryWriteCSV( const string& fileName );
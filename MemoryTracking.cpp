@@ -0,0 +1,210 @@
+/*******************************************
+	MemoryTracking.cpp
+
+	Global operator new/delete replacement
+	that counts heap allocations
+********************************************/
+
+#include <new>
+#include <atomic>
+#include <cstdlib>
+#include <cassert>
+#include <malloc.h>
+using namespace std;
+
+#include "MemoryTracking.h"
+
+
+//-----------------------------------------------------------------------------
+// Allocation counts
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Counts are plain atomics with relaxed ordering - they only need to be exact, not ordered
+	// with anything else. These are zero-initialised before any dynamic initialisation runs, so
+	// allocations made by other global constructors are counted safely
+	atomic<unsigned long long> AllocationCount;
+	atomic<unsigned long long> AllocatedBytes;
+	atomic<unsigned long long> LiveBytes;
+	atomic<unsigned long long> PeakLiveBytes;
+	atomic<unsigned long long> WindowPeakBytes;
+	atomic<unsigned int>       ForbiddenAllocations;
+	atomic<bool>               AllocationsForbidden;
+
+	// Allocation count at the end of the last frame, main thread only
+	unsigned long long FrameStartCount = 0;
+
+
+	// Usable size of a block from malloc
+	size_t BlockSize( void* p )
+	{
+	#ifdef _MSC_VER
+		return _msize( p );
+	#else
+		return malloc_usable_size( p );
+	#endif
+	}
+
+	// Raise a peak to the given value if it is higher
+	void UpdatePeak( atomic<unsigned long long>& peak, unsigned long long value )
+	{
+		unsigned long long current = peak.load( memory_order_relaxed );
+		while (value > current && !peak.compare_exchange_weak( current, value, memory_order_relaxed ));
+	}
+
+
+	// Shared by all forms of operator new
+	void* TrackedAllocate( size_t size )
+	{
+		AllocationCount.fetch_add( 1, memory_order_relaxed );
+		AllocatedBytes.fetch_add( size, memory_order_relaxed );
+
+		if (AllocationsForbidden.load( memory_order_relaxed ))
+		{
+			// Allow allocations again first, in case reporting the assert allocates memory
+			AllocationsForbidden.store( false, memory_order_relaxed );
+			ForbiddenAllocations.fetch_add( 1, memory_order_relaxed );
+			assert( !"Heap allocation while allocations are forbidden (steady-state frame)" );
+		}
+
+		void* p = malloc( size ? size : 1 );
+		if (p)
+		{
+			size_t blockSize = BlockSize( p );
+			unsigned long long live = LiveBytes.fetch_add( blockSize, memory_order_relaxed ) + blockSize;
+			UpdatePeak( PeakLiveBytes, live );
+			UpdatePeak( WindowPeakBytes, live );
+		}
+		return p;
+	}
+
+	// Shared by all forms of operator delete
+	void TrackedFree( void* p )
+	{
+		if (!p) return;
+		LiveBytes.fetch_sub( BlockSize( p ), memory_order_relaxed );
+		free( p );
+	}
+}
+
+
+// Total number of allocations made with new since the program started (all threads)
+unsigned long long MemoryAllocationCount()
+{
+	return AllocationCount.load( memory_order_relaxed );
+}
+
+// Total bytes requested from new since the program started (all threads)
+unsigned long long MemoryAllocatedBytes()
+{
+	return AllocatedBytes.load( memory_order_relaxed );
+}
+
+// Call once at the end of every frame. Returns the number of allocations since the last call
+unsigned int MemoryEndFrame()
+{
+	unsigned long long count = AllocationCount.load( memory_order_relaxed );
+	unsigned int frameCount = static_cast<unsigned int>(count - FrameStartCount);
+	FrameStartCount = count;
+	return frameCount;
+}
+
+// Bytes currently allocated with new (all threads)
+unsigned long long MemoryLiveBytes()
+{
+	return LiveBytes.load( memory_order_relaxed );
+}
+
+// Highest value of MemoryLiveBytes since the program started
+unsigned long long MemoryPeakLiveBytes()
+{
+	return PeakLiveBytes.load( memory_order_relaxed );
+}
+
+// Start a new peak window
+void MemoryBeginPeakWindow()
+{
+	WindowPeakBytes.store( LiveBytes.load( memory_order_relaxed ), memory_order_relaxed );
+}
+
+unsigned long long MemoryPeakWindowBytes()
+{
+	return WindowPeakBytes.load( memory_order_relaxed );
+}
+
+// Allow or forbid heap allocations
+void MemorySetAllocationsAllowed( bool allowed )
+{
+	AllocationsForbidden.store( !allowed, memory_order_relaxed );
+}
+
+bool MemoryAllocationsAllowed()
+{
+	return !AllocationsForbidden.load( memory_order_relaxed );
+}
+
+// Number of allocations made while allocations were forbidden
+unsigned int MemoryForbiddenAllocationCount()
+{
+	return ForbiddenAllocations.load( memory_order_relaxed );
+}
+
+
+//-----------------------------------------------------------------------------
+// Global operator new / delete replacements
+//-----------------------------------------------------------------------------
+
+void* operator new( size_t size )
+{
+	void* p = TrackedAllocate( size );
+	if (!p) throw bad_alloc();
+	return p;
+}
+
+void* operator new[]( size_t size )
+{
+	void* p = TrackedAllocate( size );
+	if (!p) throw bad_alloc();
+	return p;
+}
+
+void* operator new( size_t size, const nothrow_t& ) noexcept
+{
+	return TrackedAllocate( size );
+}
+
+void* operator new[]( size_t size, const nothrow_t& ) noexcept
+{
+	return TrackedAllocate( size );
+}
+
+void operator delete( void* p ) noexcept
+{
+	TrackedFree( p );
+}
+
+void operator delete[]( void* p ) noexcept
+{
+	TrackedFree( p );
+}
+
+void operator delete( void* p, size_t ) noexcept
+{
+	TrackedFree( p );
+}
+
+void operator delete[]( void* p, size_t ) noexcept
+{
+	TrackedFree( p );
+}
+
+void operator delete( void* p, const nothrow_t& ) noexcept
+{
+	TrackedFree( p );
+}
+
+void operator delete[]( void* p, const nothrow_t& ) noexcept
+{
+	TrackedFree( p );
+}
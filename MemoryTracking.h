@@ -0,0 +1,69 @@
+/*******************************************
+	MemoryTracking.h
+
+	Counts heap allocations made with new by
+	replacing the global operator new/delete,
+	so per-frame allocations can be reported
+	and forbidden in steady state. Also tracks
+	the bytes in use and their peak
+********************************************/
+
+#pragma once
+
+#include <cstddef>
+
+
+// Total number of allocations made with new since the program started (all threads)
+unsigned long long MemoryAllocationCount();
+
+// Total bytes requested from new since the program started (all threads)
+unsigned long long MemoryAllocatedBytes();
+
+// Call once at the end of every frame. Returns the number of allocations since the last call
+unsigned int MemoryEndFrame();
+
+
+// Bytes currently allocated with new (all threads). Measured as the usable size of each block the
+// C runtime returns, so it includes the allocator's rounding but not its bookkeeping
+unsigned long long MemoryLiveBytes();
+
+// Highest value of MemoryLiveBytes since the program started
+unsigned long long MemoryPeakLiveBytes();
+
+// Start a new peak window, e.g. around the import of an asset. The window peak is the highest
+// value of MemoryLiveBytes since the last call. There is only one window, so windows cannot nest
+void MemoryBeginPeakWindow();
+unsigned long long MemoryPeakWindowBytes();
+
+
+// Allow or forbid heap allocations. While forbidden, any allocation made with new (on any thread)
+// triggers an assert in debug builds, breaking at the allocation that caused it. Only the first is
+// asserted, after which allocations are allowed again. Use to check a steady-state frame loop
+void MemorySetAllocationsAllowed( bool allowed );
+bool MemoryAllocationsAllowed();
+
+// Allows heap allocations while in scope, then puts back whether they were allowed before. For objects
+// that are normally created at load time but are created on first use if one is missed, so a miss
+// mid-frame doesn't switch off the steady-state check for the rest of the frame
+class CMemoryAllowAllocationsScope
+{
+public:
+	CMemoryAllowAllocationsScope() : m_WasAllowed( MemoryAllocationsAllowed() )
+	{
+		MemorySetAllocationsAllowed( true );
+	}
+	~CMemoryAllowAllocationsScope()
+	{
+		MemorySetAllocationsAllowed( m_WasAllowed );
+	}
+
+private:
+	// Disallow use of copy constructor and assignment operator (private and not defined)
+	CMemoryAllowAllocationsScope( const CMemoryAllowAllocationsScope& );
+	CMemoryAllowAllocationsScope& operator=( const CMemoryAllowAllocationsScope& );
+
+	bool m_WasAllowed;
+};
+
+// Number of allocations made while allocations were forbidden (counted in release builds too)
+unsigned int MemoryForbiddenAllocationCount();
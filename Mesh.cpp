@@ -4,8 +4,19 @@
 	Mesh class implementation
 ********************************************/
 
+#include <map>
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
 #include "Mesh.h"
+#include "Skinning.h"
+#include "TextureArrays.h"
+#include "MipGeneration.h"
 #include "CImportXFile.h"
+#include "Profiler.h"
+#include "FrameStats.h"
+#include "MemoryAccounting.h"
 
 //-----------------------------------------------------------------------------
 // Constructor / destructor
@@ -23,9 +34,13 @@ CMesh::CMesh()
 	m_NumSubMeshes = 0;
 	m_SubMeshes = 0;
 	m_SubMeshesDX = 0;
+	m_SeparatePositions = false;
+	m_TextureOptions = 0;
+	m_Skinned = false;
 
 	m_NumMaterials = 0;
 	m_Materials = 0;
+	m_NumTextureArrays = 0;
 }
 
 // Model destructor
@@ -38,6 +53,11 @@ CMesh::~CMesh()
 // Release all nodes, sub-meshes and materials along with any DirectX data
 void CMesh::ReleaseResources()
 {
+	if (m_HasGeometry)
+	{
+		AccountMemory( -1 );
+	}
+
 	for (TUInt32 material = 0; material < m_NumMaterials; ++material)
 	{
 		for (TUInt32 texture = 0; texture < m_Materials[material].numTextures; ++texture)
@@ -48,19 +68,35 @@ void CMesh::ReleaseResources()
 	delete[] m_Materials;
 	m_Materials = 0;
 	m_NumMaterials = 0;
+	m_NumTextureArrays = 0;
+
+	for (TUInt32 batch = 0; batch < m_Batches.size(); ++batch)
+	{
+		GeometryPool.Remove( m_Batches[batch].geometry );
+	}
+	m_Batches.clear();
 
 	for (TUInt32 subMesh = 0; subMesh < m_NumSubMeshes; ++subMesh)
 	{
-		if (m_SubMeshesDX[subMesh].indexBuffer)	 m_SubMeshesDX[subMesh].indexBuffer->Release();
-		if (m_SubMeshesDX[subMesh].vertexBuffer) m_SubMeshesDX[subMesh].vertexBuffer->Release();
-		if (m_SubMeshesDX[subMesh].vertexLayout) m_SubMeshesDX[subMesh].vertexLayout->Release();
+		if (m_SubMeshesDX[subMesh].geometry != kNoGeometry) GeometryPool.Remove( m_SubMeshesDX[subMesh].geometry );
+		if (m_SubMeshesDX[subMesh].skinnedVertices) m_SubMeshesDX[subMesh].skinnedVertices->Release();
+
+		// Vertex and face data were allocated by the importer but are owned by the mesh
+		delete[] m_SubMeshes[subMesh].vertices;
+		delete[] m_SubMeshes[subMesh].faces;
 	}
 	delete[] m_SubMeshesDX;
 	delete[] m_SubMeshes;
 	m_SubMeshesDX = 0;
 	m_SubMeshes = 0;
 	m_NumSubMeshes = 0;
+	vector<CVector3>().swap( m_Positions );
+	vector<CMatrix4x4>().swap( m_BonePalette );
+	m_Skinned = false;
+	vector<CAnimationClip>().swap( m_Animations );
 
+	m_Hierarchy = CNodeHierarchy();
+	vector<CMatrix4x4>().swap( m_NodeMatrices );
 	delete[] m_Nodes;
 	m_Nodes = 0;
 	m_NumNodes = 0;
@@ -69,6 +105,29 @@ void CMesh::ReleaseResources()
 }
 
 
+//-----------------------------------------------------------------------------
+// Hierarchy access
+//-----------------------------------------------------------------------------
+
+// Set the matrix of a node relative to its parent
+void CMesh::SetNodeMatrix( TUInt32 node, const CMatrix4x4& matrix )
+{
+	m_Nodes[node].positionMatrix = matrix;
+	m_Hierarchy.SetLocalMatrix( node, matrix );
+}
+
+// Combine changed node matrices with their parents' and copy out the model space matrices recomputed
+void CMesh::UpdateNodeMatrices()
+{
+	m_Hierarchy.Update();
+	const vector<TUInt32>& updated = m_Hierarchy.GetUpdatedNodes();
+	for (TUInt32 i = 0; i < updated.size(); ++i)
+	{
+		m_NodeMatrices[updated[i]] = m_Hierarchy.GetWorldMatrix( updated[i] );
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Geometry access / enumeration
 //-----------------------------------------------------------------------------
@@ -122,28 +181,26 @@ bool CMesh::GetTriangle( CVector3* pVertex1, CVector3* pVertex2, CVector3* pVert
 	SMeshFace face = m_SubMeshes[m_EnumTriMesh].faces[m_EnumTri];
 
 	// Get pointer to vertex refered to by first face index - deal with flexible vertex size
-	TUInt8* pVertexData = m_SubMeshes[m_EnumTriMesh].vertices + 
-	                      face.aiVertex[0] * m_SubMeshes[m_EnumTriMesh].vertexSize;
+	TUInt32 stride;
+	const TUInt8* pPositions = reinterpret_cast<const TUInt8*>(GetPositions( m_EnumTriMesh, &stride ));
+	const TUInt8* pVertexData = pPositions + face.aiVertex[0] * stride;
 
 	// Copy vertex coordinate to output pointer
-	// Assuming first three floats are the vertex coord x,y & z. See comment in CMesh::PreProcess
-	TFloat32* pVertexCoord = reinterpret_cast<TFloat32*>(pVertexData);
+	const TFloat32* pVertexCoord = reinterpret_cast<const TFloat32*>(pVertexData);
 	pVertex1->x = *pVertexCoord++;
 	pVertex1->y = *pVertexCoord++;
 	pVertex1->z = *pVertexCoord;
 
 	// Get second vertex coordinate
-	pVertexData = m_SubMeshes[m_EnumTriMesh].vertices +
-	              face.aiVertex[1] * m_SubMeshes[m_EnumTriMesh].vertexSize;
-	pVertexCoord = reinterpret_cast<TFloat32*>(pVertexData);
+	pVertexData = pPositions + face.aiVertex[1] * stride;
+	pVertexCoord = reinterpret_cast<const TFloat32*>(pVertexData);
 	pVertex2->x = *pVertexCoord++;
 	pVertex2->y = *pVertexCoord++;
 	pVertex2->z = *pVertexCoord;
 
 	// Get third vertex coordinate
-	pVertexData = m_SubMeshes[m_EnumTriMesh].vertices +
-	              face.aiVertex[2] * m_SubMeshes[m_EnumTriMesh].vertexSize;
-	pVertexCoord = reinterpret_cast<TFloat32*>(pVertexData);
+	pVertexData = pPositions + face.aiVertex[2] * stride;
+	pVertexCoord = reinterpret_cast<const TFloat32*>(pVertexData);
 	pVertex3->x = *pVertexCoord++;
 	pVertex3->y = *pVertexCoord++;
 	pVertex3->z = *pVertexCoord;
@@ -198,12 +255,11 @@ bool CMesh::GetVertex( CVector3* pVertex )
 	}
 
 	// Get pointer to current vertex in current mesh - deal with flexible vertex size
-	TUInt8* pVertexData = m_SubMeshes[m_EnumVertMesh].vertices + 
-	                      m_EnumVert * m_SubMeshes[m_EnumVertMesh].vertexSize;
+	TUInt32 stride;
+	const TUInt8* pVertexData = reinterpret_cast<const TUInt8*>(GetPositions( m_EnumVertMesh, &stride )) + m_EnumVert * stride;
 
 	// Copy vertex coordinate to output pointer
-	// Assuming first three floats are the vertex coord x,y & z. See comment in CMesh::PreProcess
-	TFloat32* pVertexCoord = reinterpret_cast<TFloat32*>(pVertexData);
+	const TFloat32* pVertexCoord = reinterpret_cast<const TFloat32*>(pVertexData);
 	pVertex->x = *pVertexCoord++;
 	pVertex->y = *pVertexCoord++;
 	pVertex->z = *pVertexCoord;
@@ -211,14 +267,33 @@ bool CMesh::GetVertex( CVector3* pVertex )
 	return true;
 }
 
+// Vertex positions of a sub-mesh and the stride between them
+const TFloat32* CMesh::GetPositions( TUInt32 subMesh, TUInt32* pStride )
+{
+	if (m_SeparatePositions)
+	{
+		*pStride = sizeof(CVector3);
+		return &m_Positions[m_SubMeshesDX[subMesh].firstPosition].x;
+	}
+
+	// Assuming first three floats are the vertex coord x,y & z. Would be better to support a flexible data type
+	// system like DirectX vertex declarations (D3DVERTEXELEMENT9)
+	*pStride = m_SubMeshes[subMesh].vertexSize;
+	return reinterpret_cast<const TFloat32*>(m_SubMeshes[subMesh].vertices);
+}
+
 
 //-----------------------------------------------------------------------------
 // Creation
 //-----------------------------------------------------------------------------
 
 // Create the model from an X-File, returns true on success
-bool CMesh::Load( const string& fileName, ID3DX11EffectTechnique* shaderCode, bool needTangents /*= false*/)
+bool CMesh::Load( const string& fileName, ID3DX11EffectTechnique* shaderCode, bool needTangents /*= false*/,
+                  bool separatePositions /*= false*/, TUInt32 textureOptions /*= 0*/ )
 {
+	PROFILE_FUNCTION();
+	CMemoryImportScope importMemory( fileName ); // Heap used by the importer while loading
+
 	// Create a X-File import helper class
 	CImportXFile importFile;
 
@@ -248,6 +323,9 @@ bool CMesh::Load( const string& fileName, ID3DX11EffectTechnique* shaderCode, bo
 	{
 		ReleaseResources();
 	}
+	m_FileName = fileName;
+	m_SeparatePositions = separatePositions;
+	m_TextureOptions = textureOptions;
 
 	// Get node data from import class
 	m_NumNodes = importFile.GetNumNodes();
@@ -260,6 +338,18 @@ bool CMesh::Load( const string& fileName, ID3DX11EffectTechnique* shaderCode, bo
 	{
 		importFile.GetNode( node, &m_Nodes[node] );
 	}
+	m_Hierarchy.Build( m_Nodes, m_NumNodes );
+	m_NodeMatrices.resize( m_NumNodes );
+	UpdateNodeMatrices();
+
+	// Get animations from import class and compress them against the nodes
+	m_Animations.resize( importFile.GetNumAnimations() );
+	for (TUInt32 animation = 0; animation < m_Animations.size(); ++animation)
+	{
+		SMeshAnimation importAnimation;
+		importFile.GetAnimation( animation, &importAnimation );
+		m_Animations[animation].Compress( importAnimation, m_Nodes, m_NumNodes );
+	}
 
 	// Get material data from import class, also load textures
 	TUInt32 requiredMaterials = importFile.GetNumMaterials();
@@ -282,6 +372,7 @@ bool CMesh::Load( const string& fileName, ID3DX11EffectTechnique* shaderCode, bo
 
 	// Get submesh data from import class - convert to DirectX data for rendering
 	// but retain original data for easy access to vertices / faces
+	PROFILE_SCOPE("Create Sub-Meshes");
 	TUInt32 requiredSubMeshes = importFile.GetNumSubMeshes();
 	m_SubMeshes = new SSubMesh[requiredSubMeshes];
 	m_SubMeshesDX = new SSubMeshDX[requiredSubMeshes];
@@ -290,6 +381,8 @@ bool CMesh::Load( const string& fileName, ID3DX11EffectTechnique* shaderCode, bo
 		ReleaseResources();
 		return false;
 	}
+	TUInt32 totalVertices = 0;
+	bool hasSkinning = false;
 	for (m_NumSubMeshes = 0; m_NumSubMeshes < requiredSubMeshes; ++m_NumSubMeshes)
 	{
 		importFile.GetSubMesh( m_NumSubMeshes, &m_SubMeshes[m_NumSubMeshes], needTangents );
@@ -298,6 +391,29 @@ bool CMesh::Load( const string& fileName, ID3DX11EffectTechnique* shaderCode, bo
 			ReleaseResources();
 			return false;
 		}
+		m_SubMeshesDX[m_NumSubMeshes].firstPosition = totalVertices;
+		totalVertices += m_SubMeshes[m_NumSubMeshes].numVertices;
+		if (m_SubMeshesDX[m_NumSubMeshes].skinnedVertices) hasSkinning = true;
+	}
+
+	// Skinned meshes need a bone palette, filled by Skin
+	if (hasSkinning)
+	{
+		m_BonePalette.resize( m_NumNodes );
+	}
+
+	// Packed copy of the positions for CPU work, the import data stays interleaved
+	if (m_SeparatePositions)
+	{
+		m_Positions.reserve( totalVertices );
+		for (TUInt32 subMesh = 0; subMesh < m_NumSubMeshes; ++subMesh)
+		{
+			const SSubMesh& importSubMesh = m_SubMeshes[subMesh];
+			for (TUInt32 vert = 0; vert < importSubMesh.numVertices; ++vert)
+			{
+				m_Positions.push_back( *reinterpret_cast<const CVector3*>(importSubMesh.vertices + vert * importSubMesh.vertexSize) );
+			}
+		}
 	}
 
 	// Geometry pre-processing - just calculating bounding box in this example
@@ -308,6 +424,7 @@ bool CMesh::Load( const string& fileName, ID3DX11EffectTechnique* shaderCode, bo
 	}
 
 	m_HasGeometry = true;
+	AccountMemory( 1 );
 	return true;
 }
 
@@ -322,132 +439,143 @@ bool CMesh::CreateSubMeshDX
 	// Copy node and material
 	subMeshDX->node = subMesh.node;
 	subMeshDX->material = subMesh.material;
+	subMeshDX->geometry = kNoGeometry;
+	subMeshDX->vertexFormat = kNoVertexFormat;
+	subMeshDX->skinnedVertices = 0;
 
 	// Buffer sizes
 	subMeshDX->numVertices = subMesh.numVertices;
 	subMeshDX->numIndices = subMesh.numFaces * 3; // Using triangle lists, so always 3 indexes per face
 
-	// Create vertex element list & layout.
+	// Create vertex element list, registered as a vertex format below
+	D3D11_INPUT_ELEMENT_DESC vertexElts[SVertexFormat::kMaxElements];
 	unsigned int numElts = 0;
 	unsigned int offset = 0;
 
 	// Position is always required
-	subMeshDX->vertexElts[numElts].SemanticName = "POSITION";   // Semantic in HLSL (what is this data for)
-	subMeshDX->vertexElts[numElts].SemanticIndex = 0;           // Index to add to semantic (a count for this kind of data, when using multiple of the same type, e.g. TEXCOORD0, TEXCOORD1)
-	subMeshDX->vertexElts[numElts].Format = DXGI_FORMAT_R32G32B32_FLOAT; // Type of data - this one will be a float3 in the shader. Most data communicated as though it were colours
-	subMeshDX->vertexElts[numElts].AlignedByteOffset = offset;  // Offset of element from start of vertex data (e.g. if we have position (float3), uv (float2) then normal, the normal's offset is 5 floats = 5*4 = 20)
-	subMeshDX->vertexElts[numElts].InputSlot = 0;               // For when using multiple vertex buffers (e.g. instancing - an advanced topic)
-	subMeshDX->vertexElts[numElts].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA; // Use this value for most cases (only changed for instancing)
-	subMeshDX->vertexElts[numElts].InstanceDataStepRate = 0;                     // --"--
+	vertexElts[numElts].SemanticName = "POSITION";   // Semantic in HLSL (what is this data for)
+	vertexElts[numElts].SemanticIndex = 0;           // Index to add to semantic (a count for this kind of data, when using multiple of the same type, e.g. TEXCOORD0, TEXCOORD1)
+	vertexElts[numElts].Format = DXGI_FORMAT_R32G32B32_FLOAT; // Type of data - this one will be a float3 in the shader. Most data communicated as though it were colours
+	vertexElts[numElts].AlignedByteOffset = offset;  // Offset of element from start of vertex data (e.g. if we have position (float3), uv (float2) then normal, the normal's offset is 5 floats = 5*4 = 20)
+	vertexElts[numElts].InputSlot = 0;               // For when using multiple vertex buffers (e.g. instancing - an advanced topic)
+	vertexElts[numElts].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA; // Use this value for most cases (only changed for instancing)
+	vertexElts[numElts].InstanceDataStepRate = 0;                     // --"--
 	offset += 12;
 	++numElts;
 
 	// Repeat for each kind of vertex data
 	if (subMesh.hasSkinningData) // If sub-mesh contains skinning data
 	{
-		subMeshDX->vertexElts[numElts].SemanticName = "BLENDWEIGHT";
-		subMeshDX->vertexElts[numElts].SemanticIndex = 0;
-		subMeshDX->vertexElts[numElts].Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-		subMeshDX->vertexElts[numElts].AlignedByteOffset = offset;
-		subMeshDX->vertexElts[numElts].InputSlot = 0;
-		subMeshDX->vertexElts[numElts].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-		subMeshDX->vertexElts[numElts].InstanceDataStepRate = 0;
+		vertexElts[numElts].SemanticName = "BLENDWEIGHT";
+		vertexElts[numElts].SemanticIndex = 0;
+		vertexElts[numElts].Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+		vertexElts[numElts].AlignedByteOffset = offset;
+		vertexElts[numElts].InputSlot = 0;
+		vertexElts[numElts].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
+		vertexElts[numElts].InstanceDataStepRate = 0;
 		offset += 16;
 		++numElts;
-		subMeshDX->vertexElts[numElts].SemanticName = "BLENDINDICES";
-		subMeshDX->vertexElts[numElts].SemanticIndex = 0;
-		subMeshDX->vertexElts[numElts].Format = DXGI_FORMAT_R8G8B8A8_UINT;
-		subMeshDX->vertexElts[numElts].AlignedByteOffset = offset;
-		subMeshDX->vertexElts[numElts].InputSlot = 0;
-		subMeshDX->vertexElts[numElts].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-		subMeshDX->vertexElts[numElts].InstanceDataStepRate = 0;
+		vertexElts[numElts].SemanticName = "BLENDINDICES";
+		vertexElts[numElts].SemanticIndex = 0;
+		vertexElts[numElts].Format = DXGI_FORMAT_R8G8B8A8_UINT;
+		vertexElts[numElts].AlignedByteOffset = offset;
+		vertexElts[numElts].InputSlot = 0;
+		vertexElts[numElts].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
+		vertexElts[numElts].InstanceDataStepRate = 0;
 		offset += 4;
 		++numElts;
 	}
 	if (subMesh.hasNormals)
 	{
-		subMeshDX->vertexElts[numElts].SemanticName = "NORMAL";
-		subMeshDX->vertexElts[numElts].SemanticIndex = 0;
-		subMeshDX->vertexElts[numElts].Format = DXGI_FORMAT_R32G32B32_FLOAT;
-		subMeshDX->vertexElts[numElts].AlignedByteOffset = offset;
-		subMeshDX->vertexElts[numElts].InputSlot = 0;
-		subMeshDX->vertexElts[numElts].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-		subMeshDX->vertexElts[numElts].InstanceDataStepRate = 0;
+		vertexElts[numElts].SemanticName = "NORMAL";
+		vertexElts[numElts].SemanticIndex = 0;
+		vertexElts[numElts].Format = DXGI_FORMAT_R32G32B32_FLOAT;
+		vertexElts[numElts].AlignedByteOffset = offset;
+		vertexElts[numElts].InputSlot = 0;
+		vertexElts[numElts].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
+		vertexElts[numElts].InstanceDataStepRate = 0;
 		offset += 12;
 		++numElts;
 	}
 	if (subMesh.hasTangents)
 	{
-		subMeshDX->vertexElts[numElts].SemanticName = "TANGENT";
-		subMeshDX->vertexElts[numElts].SemanticIndex = 0;
-		subMeshDX->vertexElts[numElts].Format = DXGI_FORMAT_R32G32B32_FLOAT;
-		subMeshDX->vertexElts[numElts].AlignedByteOffset = offset;
-		subMeshDX->vertexElts[numElts].InputSlot = 0;
-		subMeshDX->vertexElts[numElts].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-		subMeshDX->vertexElts[numElts].InstanceDataStepRate = 0;
+		vertexElts[numElts].SemanticName = "TANGENT";
+		vertexElts[numElts].SemanticIndex = 0;
+		vertexElts[numElts].Format = DXGI_FORMAT_R32G32B32_FLOAT;
+		vertexElts[numElts].AlignedByteOffset = offset;
+		vertexElts[numElts].InputSlot = 0;
+		vertexElts[numElts].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
+		vertexElts[numElts].InstanceDataStepRate = 0;
 		offset += 12;
 		++numElts;
 	}
 	if (subMesh.hasTextureCoords)
 	{
-		subMeshDX->vertexElts[numElts].SemanticName = "TEXCOORD";
-		subMeshDX->vertexElts[numElts].SemanticIndex = 0;
-		subMeshDX->vertexElts[numElts].Format = DXGI_FORMAT_R32G32_FLOAT;
-		subMeshDX->vertexElts[numElts].AlignedByteOffset = offset;
-		subMeshDX->vertexElts[numElts].InputSlot = 0;
-		subMeshDX->vertexElts[numElts].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-		subMeshDX->vertexElts[numElts].InstanceDataStepRate = 0;
+		vertexElts[numElts].SemanticName = "TEXCOORD";
+		vertexElts[numElts].SemanticIndex = 0;
+		vertexElts[numElts].Format = DXGI_FORMAT_R32G32_FLOAT;
+		vertexElts[numElts].AlignedByteOffset = offset;
+		vertexElts[numElts].InputSlot = 0;
+		vertexElts[numElts].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
+		vertexElts[numElts].InstanceDataStepRate = 0;
 		offset += 8;
 		++numElts;
 	}
 	if (subMesh.hasVertexColours)
 	{
-		subMeshDX->vertexElts[numElts].SemanticName = "COLOR";
-		subMeshDX->vertexElts[numElts].SemanticIndex = 0;
-		subMeshDX->vertexElts[numElts].Format = DXGI_FORMAT_R8G8B8A8_UNORM; // A RGBA colour with 1 byte (0-255) per component
-		subMeshDX->vertexElts[numElts].AlignedByteOffset = offset;
-		subMeshDX->vertexElts[numElts].InputSlot = 0;
-		subMeshDX->vertexElts[numElts].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-		subMeshDX->vertexElts[numElts].InstanceDataStepRate = 0;
-		offset += 4;
+		vertexElts[numElts].SemanticName = "COLOR";
+		vertexElts[numElts].SemanticIndex = 0;
+		vertexElts[numElts].Format = DXGI_FORMAT_R32G32B32A32_FLOAT; // The importer stores colours as four floats
+		vertexElts[numElts].AlignedByteOffset = offset;
+		vertexElts[numElts].InputSlot = 0;
+		vertexElts[numElts].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
+		vertexElts[numElts].InstanceDataStepRate = 0;
+		offset += 16;
 		++numElts;
 	}
-	subMeshDX->vertexSize = offset;
-
-	// Given the vertex element list, pass it to DirectX to create a vertex layout. We also need to pass an example of a technique that will
-	// render this model. We will only be able to render this model with techniques that have the same vertex input as the example we use here
-	D3DX11_PASS_DESC PassDesc;
-	shaderCode->GetPassByIndex( 0 )->GetDesc( &PassDesc );
-	g_pd3dDevice->CreateInputLayout( subMeshDX->vertexElts, numElts, PassDesc.pIAInputSignature, PassDesc.IAInputSignatureSize, &subMeshDX->vertexLayout );
-
-
-	// Create the vertex buffer and fill it with the sub-mesh vertex data
-	D3D11_BUFFER_DESC bufferDesc;
-	bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	bufferDesc.Usage = D3D11_USAGE_DEFAULT; // Not a dynamic buffer
-	bufferDesc.ByteWidth = subMeshDX->numVertices * subMeshDX->vertexSize; // Buffer size
-	bufferDesc.CPUAccessFlags = 0;   // Indicates that CPU won't access this buffer at all after creation
-	bufferDesc.MiscFlags = 0;
-	D3D11_SUBRESOURCE_DATA initData; // Initial data
-	initData.pSysMem = subMesh.vertices;   
-	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, &initData, &subMeshDX->vertexBuffer )))
+	// Register the element list as a vertex format - a level only has a few distinct formats, each sub-mesh just keeps the ID.
+	// The input layout for the format is shared through the layout cache. Fetch it now with an example of a technique that will
+	// render this model, so it is created at load time rather than mid-frame. We will only be able to render this model with
+	// techniques that have the same vertex input as the example we use here
+	subMeshDX->vertexFormat = VertexFormatRegister( vertexElts, numElts, offset );
+	if (m_SeparatePositions && !subMesh.hasSkinningData)
+	{
+		// Same elements with the position moved to a stream of its own, the vertex data is split by the geometry pool
+		subMeshDX->vertexFormat = VertexFormatSeparatePositions( subMeshDX->vertexFormat );
+	}
+	if (!InputLayouts.Layout( subMeshDX->vertexFormat, shaderCode ))
 	{
 		return false;
 	}
 
-
-	// Create the index buffer - assuming 2-byte (WORD) index data
-	bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-	bufferDesc.Usage = D3D11_USAGE_DEFAULT;
-	bufferDesc.ByteWidth = subMeshDX->numIndices * sizeof(WORD);
-	bufferDesc.CPUAccessFlags = 0;
-	bufferDesc.MiscFlags = 0;
-	initData.pSysMem = subMesh.faces;   
-	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, &initData, &subMeshDX->indexBuffer )))
+	// Copy the vertex and index data into the geometry pool - assuming 2-byte (WORD) index data. Sub-meshes share buffers with
+	// others that have the same vertex format
+	subMeshDX->geometry = GeometryPool.Add( subMeshDX->vertexFormat, subMesh.vertices, subMeshDX->numVertices,
+	                                        reinterpret_cast<const WORD*>(subMesh.faces), subMeshDX->numIndices );
+	if (subMeshDX->geometry == kNoGeometry)
 	{
 		return false;
 	}
 
+	// Skinned sub-meshes also get a dynamic vertex buffer of their own, rewritten by Skin each frame. The vertices in the
+	// pool are the bind pose, drawn until Skin is first called
+	if (subMesh.hasSkinningData)
+	{
+		D3D11_BUFFER_DESC bufferDesc;
+		bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+		bufferDesc.ByteWidth = subMesh.numVertices * subMesh.vertexSize;
+		bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		bufferDesc.MiscFlags = 0;
+		bufferDesc.StructureByteStride = 0;
+		if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, NULL, &subMeshDX->skinnedVertices ) ))
+		{
+			subMeshDX->skinnedVertices = 0;
+			GeometryPool.Remove( subMeshDX->geometry );
+			subMeshDX->geometry = kNoGeometry;
+			return false;
+		}
+	}
 	return true;
 }
 
@@ -465,11 +593,19 @@ bool CMesh::CreateMaterialDX
 	                                        material.specularColour.b, material.specularColour.a );
 	materialDX->specularPower = material.specularPower;
 
-	// Load material textures
+	// Load material textures, each on its own until BuildTextureArrays
 	materialDX->numTextures = material.numTextures;
+	materialDX->diffuseSlice = -1;
 	for (TUInt32 texture = 0; texture < material.numTextures; ++texture)
 	{
 		string fullFileName = material.textureFileNames[texture];
+		materialDX->textureFileNames[texture] = fullFileName;
+		TUInt32 options = (texture == 0) ? m_TextureOptions : (m_TextureOptions & kTextureGenerateMips);
+		if (options != 0)
+		{
+			materialDX->textures[texture] = LoadProcessedTexture( g_pd3dDevice, fullFileName, options );
+			if (materialDX->textures[texture]) continue;
+		}
 		if (FAILED( D3DX11CreateShaderResourceViewFromFile( g_pd3dDevice, CA2CT(fullFileName.c_str()), NULL, NULL, &materialDX->textures[texture], NULL ) ))
 		{
 			string errorMsg = "Error loading texture " + fullFileName;
@@ -485,6 +621,8 @@ bool CMesh::CreateMaterialDX
 // Rejects mesh if no sub-meshes or any empty sub-meshes
 bool CMesh::PreProcess()
 {
+	PROFILE_FUNCTION();
+
 	// Ensure at least one non-empty sub-mesh
 	if (m_NumSubMeshes == 0 || m_SubMeshes[0].numVertices == 0)
 	{
@@ -492,9 +630,8 @@ bool CMesh::PreProcess()
 	}
 
 	// Set initial bounds from first vertex
-	// Assuming first three floats are the vertex coord x,y & z. Would be better to support
-	// a flexible data type system like DirectX vertex declarations (D3DVERTEXELEMENT9)
-	TFloat32* pVertexCoord = reinterpret_cast<TFloat32*>(m_SubMeshes[0].vertices);
+	TUInt32 stride;
+	const TFloat32* pVertexCoord = GetPositions( 0, &stride );
 	m_MinBounds.x = m_MaxBounds.x = *pVertexCoord++;
 	m_MinBounds.y = m_MaxBounds.y = *pVertexCoord++;
 	m_MinBounds.z = m_MaxBounds.z = *pVertexCoord;
@@ -510,11 +647,11 @@ bool CMesh::PreProcess()
 		}
 
 		// Go through all vertices
-		TUInt8* pVertex = m_SubMeshes[subMesh].vertices;
+		const TUInt8* pVertex = reinterpret_cast<const TUInt8*>(GetPositions( subMesh, &stride ));
 		for (TUInt32 vert = 0; vert < m_SubMeshes[subMesh].numVertices; ++vert)
 		{
 			// Get vertex coord as vector
-			pVertexCoord = reinterpret_cast<TFloat32*>(pVertex); // Assume float x,y,z coord again
+			pVertexCoord = reinterpret_cast<const TFloat32*>(pVertex);
 			CVector3 vertex;
 			vertex.x = *pVertexCoord++;
 			vertex.y = *pVertexCoord++;
@@ -556,54 +693,761 @@ bool CMesh::PreProcess()
 				m_BoundingRadius = length;
 			}
 
-			// Step to next vertex (flexible vertex size)
-			pVertex += m_SubMeshes[subMesh].vertexSize;
+			// Step to next vertex (flexible vertex size, or packed positions)
+			pVertex += stride;
+		}
+	}
+
+	return true;
+}
+
+
+// Add the memory used by the mesh to the memory accounting, or remove it with a sign of -1
+void CMesh::AccountMemory( long long sign )
+{
+	MemoryAccountAdd( kMemoryMeshNodes, m_FileName, sign * static_cast<long long>(m_NumNodes * sizeof(SMeshNode) + m_Hierarchy.GetMemoryBytes() +
+	                                                                               m_NodeMatrices.capacity() * sizeof(CMatrix4x4)) );
+	MemoryAccountAdd( kMemoryMeshMaterials, m_FileName, sign * static_cast<long long>(m_NumMaterials * sizeof(SMeshMaterialDX)) );
+
+	long long geometryBytes = m_NumSubMeshes * (sizeof(SSubMesh) + sizeof(SSubMeshDX)) + m_Positions.capacity() * sizeof(CVector3) +
+	                          m_BonePalette.capacity() * sizeof(CMatrix4x4);
+	for (TUInt32 animation = 0; animation < m_Animations.size(); ++animation)
+	{
+		geometryBytes += m_Animations[animation].GetMemoryBytes();
+	}
+	long long vertexBufferBytes = 0;
+	long long indexBufferBytes = 0;
+	for (TUInt32 subMesh = 0; subMesh < m_NumSubMeshes; ++subMesh)
+	{
+		geometryBytes += m_SubMeshes[subMesh].numVertices * m_SubMeshes[subMesh].vertexSize +
+		                 m_SubMeshes[subMesh].numFaces * sizeof(SMeshFace);
+		if (m_SubMeshesDX[subMesh].skinnedVertices) vertexBufferBytes += m_SubMeshesDX[subMesh].numVertices * m_SubMeshes[subMesh].vertexSize;
+		if (m_SubMeshesDX[subMesh].geometry == kNoGeometry) continue; // In a static batch
+		vertexBufferBytes += m_SubMeshesDX[subMesh].numVertices * m_SubMeshes[subMesh].vertexSize;
+		indexBufferBytes += m_SubMeshesDX[subMesh].numIndices * sizeof(WORD);
+	}
+	geometryBytes += m_Batches.size() * sizeof(SStaticBatch);
+	for (TUInt32 batch = 0; batch < m_Batches.size(); ++batch)
+	{
+		const SVertexFormat& format = VertexFormatDesc( m_Batches[batch].vertexFormat );
+		vertexBufferBytes += m_Batches[batch].numVertices * (format.vertexSize + format.attributeSize);
+		indexBufferBytes += m_Batches[batch].numIndices * sizeof(WORD);
+	}
+	MemoryAccountAdd( kMemoryMeshGeometry, m_FileName, sign * geometryBytes );
+	MemoryAccountAdd( kMemoryVertexBuffers, m_FileName, sign * vertexBufferBytes );
+	MemoryAccountAdd( kMemoryIndexBuffers, m_FileName, sign * indexBufferBytes );
+
+	// Textures are accounted by file name, a texture used by several materials is loaded (and counted) for each. Texture
+	// arrays are shared by the materials with a slice in them, and counted once under the mesh's name
+	vector<ID3D11ShaderResourceView*> textureArrays;
+	for (TUInt32 material = 0; material < m_NumMaterials; ++material)
+	{
+		for (TUInt32 texture = 0; texture < m_Materials[material].numTextures; ++texture)
+		{
+			ID3D11ShaderResourceView* view = m_Materials[material].textures[texture];
+			string name = m_Materials[material].textureFileNames[texture];
+			if (texture == 0 && m_Materials[material].diffuseSlice >= 0)
+			{
+				if (find( textureArrays.begin(), textureArrays.end(), view ) != textureArrays.end()) continue;
+				textureArrays.push_back( view );
+				name = m_FileName + " texture arrays";
+			}
+
+			ID3D11Resource* resource;
+			view->GetResource( &resource );
+			MemoryAccountAdd( kMemoryTextures, name, sign * static_cast<long long>(TextureMemoryBytes( resource )) );
+			resource->Release();
+		}
+	}
+}
+
+
+// Size of a texture in GPU memory (bytes, all mip levels and array slices), calculated from its description
+size_t TextureMemoryBytes( ID3D11Resource* resource )
+{
+	D3D11_RESOURCE_DIMENSION dimension;
+	resource->GetType( &dimension );
+	if (dimension != D3D11_RESOURCE_DIMENSION_TEXTURE2D)
+	{
+		return 0;
+	}
+	D3D11_TEXTURE2D_DESC desc;
+	static_cast<ID3D11Texture2D*>(resource)->GetDesc( &desc );
+
+	// Bits per pixel, block compressed formats are stored in 4x4 blocks
+	size_t bitsPerPixel = 32;
+	bool blockCompressed = false;
+	switch (desc.Format)
+	{
+		case DXGI_FORMAT_BC1_TYPELESS: case DXGI_FORMAT_BC1_UNORM: case DXGI_FORMAT_BC1_UNORM_SRGB:
+		case DXGI_FORMAT_BC4_TYPELESS: case DXGI_FORMAT_BC4_UNORM: case DXGI_FORMAT_BC4_SNORM:
+			bitsPerPixel = 4; blockCompressed = true; break;
+		case DXGI_FORMAT_BC2_TYPELESS: case DXGI_FORMAT_BC2_UNORM: case DXGI_FORMAT_BC2_UNORM_SRGB:
+		case DXGI_FORMAT_BC3_TYPELESS: case DXGI_FORMAT_BC3_UNORM: case DXGI_FORMAT_BC3_UNORM_SRGB:
+		case DXGI_FORMAT_BC5_TYPELESS: case DXGI_FORMAT_BC5_UNORM: case DXGI_FORMAT_BC5_SNORM:
+		case DXGI_FORMAT_BC6H_TYPELESS: case DXGI_FORMAT_BC6H_UF16: case DXGI_FORMAT_BC6H_SF16:
+		case DXGI_FORMAT_BC7_TYPELESS: case DXGI_FORMAT_BC7_UNORM: case DXGI_FORMAT_BC7_UNORM_SRGB:
+			bitsPerPixel = 8; blockCompressed = true; break;
+		case DXGI_FORMAT_R32G32B32A32_TYPELESS: case DXGI_FORMAT_R32G32B32A32_FLOAT:
+			bitsPerPixel = 128; break;
+		case DXGI_FORMAT_R32G32B32_TYPELESS: case DXGI_FORMAT_R32G32B32_FLOAT:
+			bitsPerPixel = 96; break;
+		case DXGI_FORMAT_R16G16B16A16_TYPELESS: case DXGI_FORMAT_R16G16B16A16_FLOAT: case DXGI_FORMAT_R16G16B16A16_UNORM:
+		case DXGI_FORMAT_R32G32_TYPELESS: case DXGI_FORMAT_R32G32_FLOAT:
+			bitsPerPixel = 64; break;
+		case DXGI_FORMAT_R8G8_TYPELESS: case DXGI_FORMAT_R8G8_UNORM: case DXGI_FORMAT_R16_TYPELESS: case DXGI_FORMAT_R16_FLOAT:
+		case DXGI_FORMAT_R16_UNORM: case DXGI_FORMAT_D16_UNORM: case DXGI_FORMAT_B5G6R5_UNORM: case DXGI_FORMAT_B5G5R5A1_UNORM:
+			bitsPerPixel = 16; break;
+		case DXGI_FORMAT_R8_TYPELESS: case DXGI_FORMAT_R8_UNORM: case DXGI_FORMAT_A8_UNORM:
+			bitsPerPixel = 8; break;
+		default: // Most other formats are 32-bit (RGBA8, BGRA8, R32, R10G10B10A2, D24S8...)
+			break;
+	}
+
+	size_t bytes = 0;
+	for (UINT mip = 0; mip < desc.MipLevels; ++mip)
+	{
+		size_t width = max( desc.Width >> mip, 1u );
+		size_t height = max( desc.Height >> mip, 1u );
+		if (blockCompressed)
+		{
+			width = (width + 3) & ~3;
+			height = (height + 3) & ~3;
+		}
+		bytes += width * height * bitsPerPixel / 8;
+	}
+	return bytes * desc.ArraySize;
+}
+
+// Give every vertex a colour, returns false for meshes with skinning or already batched, or if the geometry pool is out
+// of memory
+bool CMesh::SetVertexColours( const CVector4* colours, ID3DX11EffectTechnique* shaderCode )
+{
+	if (!m_HasGeometry || !m_Batches.empty() || !m_BonePalette.empty())
+	{
+		return false;
+	}
+	PROFILE_FUNCTION();
+
+	// New vertices for each sub-mesh with the colour last, where the importer puts it, and their GPU geometry. The mesh is
+	// only changed once all of them are made
+	vector<SSubMesh> subMeshes( m_NumSubMeshes );
+	vector<SSubMeshDX> subMeshesDX( m_NumSubMeshes );
+	for (TUInt32 subMesh = 0; subMesh < m_NumSubMeshes; ++subMesh)
+	{
+		const SSubMesh& oldSubMesh = m_SubMeshes[subMesh];
+		TUInt32 keptSize = oldSubMesh.vertexSize - (oldSubMesh.hasVertexColours ? sizeof(CVector4) : 0);
+		SSubMesh& newSubMesh = subMeshes[subMesh];
+		newSubMesh = oldSubMesh;
+		newSubMesh.hasVertexColours = true;
+		newSubMesh.vertexSize = keptSize + sizeof(CVector4);
+		newSubMesh.vertices = new TUInt8[newSubMesh.numVertices * newSubMesh.vertexSize];
+		for (TUInt32 vert = 0; vert < newSubMesh.numVertices; ++vert)
+		{
+			TUInt8* vertex = newSubMesh.vertices + vert * newSubMesh.vertexSize;
+			memcpy( vertex, oldSubMesh.vertices + vert * oldSubMesh.vertexSize, keptSize );
+			*reinterpret_cast<CVector4*>(vertex + keptSize) = *colours++;
+		}
+
+		if (!CreateSubMeshDX( newSubMesh, &subMeshesDX[subMesh], shaderCode ))
+		{
+			for (TUInt32 created = 0; created < subMesh; ++created)
+			{
+				GeometryPool.Remove( subMeshesDX[created].geometry );
+				delete[] subMeshes[created].vertices;
+			}
+			delete[] newSubMesh.vertices;
+			return false;
+		}
+		subMeshesDX[subMesh].firstPosition = m_SubMeshesDX[subMesh].firstPosition;
+	}
+
+	// Switch the sub-meshes over to their new vertices, releasing the old
+	AccountMemory( -1 );
+	for (TUInt32 subMesh = 0; subMesh < m_NumSubMeshes; ++subMesh)
+	{
+		GeometryPool.Remove( m_SubMeshesDX[subMesh].geometry );
+		delete[] m_SubMeshes[subMesh].vertices;
+		m_SubMeshes[subMesh] = subMeshes[subMesh];
+		m_SubMeshesDX[subMesh] = subMeshesDX[subMesh];
+	}
+	AccountMemory( 1 );
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Static batching
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Sub-meshes that can go in the same static batch share a material, vertex format and grid cell
+	struct SBatchKey
+	{
+		TUInt32       material;
+		TVertexFormat vertexFormat;
+		int           cell[3];
+
+		bool operator<( const SBatchKey& other ) const
+		{
+			if (material != other.material) return material < other.material;
+			if (vertexFormat != other.vertexFormat) return vertexFormat < other.vertexFormat;
+			for (int i = 0; i < 3; ++i)
+			{
+				if (cell[i] != other.cell[i]) return cell[i] < other.cell[i];
+			}
+			return false;
+		}
+	};
+
+	// Indices are 16-bit, so a batch holds at most this many vertices
+	const TUInt32 kMaxBatchVertices = 65536;
+
+	// Centre of the world space bounds of a sub-mesh
+	CVector3 WorldCentre( const SSubMesh& subMesh, const CMatrix4x4& worldMatrix )
+	{
+		const TUInt8* vertex = subMesh.vertices;
+		CVector3 minBounds = worldMatrix.TransformPoint( *reinterpret_cast<const CVector3*>(vertex) );
+		CVector3 maxBounds = minBounds;
+		for (TUInt32 vert = 1; vert < subMesh.numVertices; ++vert)
+		{
+			vertex += subMesh.vertexSize;
+			CVector3 position = worldMatrix.TransformPoint( *reinterpret_cast<const CVector3*>(vertex) );
+			minBounds = CVector3( Min( minBounds.x, position.x ), Min( minBounds.y, position.y ), Min( minBounds.z, position.z ) );
+			maxBounds = CVector3( Max( maxBounds.x, position.x ), Max( maxBounds.y, position.y ), Max( maxBounds.z, position.z ) );
+		}
+		return (minBounds + maxBounds) * 0.5f;
+	}
+
+	// Transform the vertices of a sub-mesh to world space and add them and its faces to a batch being built
+	void AppendToBatch( const SSubMesh& subMesh, const CMatrix4x4& worldMatrix, CMesh::SStaticBatch* batch,
+	                    vector<TUInt8>* vertices, vector<WORD>* indices )
+	{
+		// Normals transform by the inverse transpose so they stay perpendicular to the surface under non-uniform scaling
+		CMatrix4x4 normalMatrix = Transpose( InverseAffine( worldMatrix ) );
+
+		// Offsets of the normal and tangent (position is first, and skinned sub-meshes are not batched)
+		TUInt32 normalOffset = 12;
+		TUInt32 tangentOffset = normalOffset + (subMesh.hasNormals ? 12 : 0);
+
+		TUInt32 baseVertex = static_cast<TUInt32>(vertices->size() / subMesh.vertexSize);
+		vertices->insert( vertices->end(), subMesh.vertices, subMesh.vertices + subMesh.numVertices * subMesh.vertexSize );
+		TUInt8* vertex = &(*vertices)[baseVertex * subMesh.vertexSize];
+		for (TUInt32 vert = 0; vert < subMesh.numVertices; ++vert)
+		{
+			CVector3* position = reinterpret_cast<CVector3*>(vertex);
+			*position = worldMatrix.TransformPoint( *position );
+			if (baseVertex == 0 && vert == 0)
+			{
+				batch->minBounds = batch->maxBounds = *position;
+			}
+			else
+			{
+				batch->minBounds = CVector3( Min( batch->minBounds.x, position->x ), Min( batch->minBounds.y, position->y ), Min( batch->minBounds.z, position->z ) );
+				batch->maxBounds = CVector3( Max( batch->maxBounds.x, position->x ), Max( batch->maxBounds.y, position->y ), Max( batch->maxBounds.z, position->z ) );
+			}
+			if (subMesh.hasNormals)
+			{
+				CVector3* normal = reinterpret_cast<CVector3*>(vertex + normalOffset);
+				*normal = Normalise( normalMatrix.TransformVector( *normal ) );
+			}
+			if (subMesh.hasTangents)
+			{
+				CVector3* tangent = reinterpret_cast<CVector3*>(vertex + tangentOffset);
+				*tangent = Normalise( worldMatrix.TransformVector( *tangent ) );
+			}
+			vertex += subMesh.vertexSize;
+		}
+
+		// A mirroring transform reverses the winding of the faces, swap two corners to restore it
+		CVector3 xAxis( worldMatrix.e00, worldMatrix.e01, worldMatrix.e02 );
+		CVector3 yAxis( worldMatrix.e10, worldMatrix.e11, worldMatrix.e12 );
+		CVector3 zAxis( worldMatrix.e20, worldMatrix.e21, worldMatrix.e22 );
+		bool mirrored = Dot( Cross( xAxis, yAxis ), zAxis ) < 0.0f;
+		for (TUInt32 face = 0; face < subMesh.numFaces; ++face)
+		{
+			const SMeshFace& meshFace = subMesh.faces[face];
+			indices->push_back( static_cast<WORD>(baseVertex + meshFace.aiVertex[0]) );
+			indices->push_back( static_cast<WORD>(baseVertex + meshFace.aiVertex[mirrored ? 2 : 1]) );
+			indices->push_back( static_cast<WORD>(baseVertex + meshFace.aiVertex[mirrored ? 1 : 2]) );
+		}
+		++batch->numSubMeshes;
+	}
+}
+
+
+// Merge sub-meshes into static batches
+bool CMesh::BuildStaticBatches( TFloat32 maxBatchSize /*= 0.0f*/ )
+{
+	if (!m_HasGeometry || !m_Batches.empty())
+	{
+		return m_HasGeometry; // Nothing to batch or already batched
+	}
+	PROFILE_FUNCTION();
+
+	// Group the sub-meshes that can be batched together. Batches come out sorted by material and format, which also
+	// keeps state changes down when they are rendered
+	map<SBatchKey, vector<TUInt32> > groups;
+	for (TUInt32 subMesh = 0; subMesh < m_NumSubMeshes; ++subMesh)
+	{
+		const SSubMesh& importSubMesh = m_SubMeshes[subMesh];
+		if (importSubMesh.hasSkinningData || m_SubMeshesDX[subMesh].geometry == kNoGeometry) continue;
+
+		SBatchKey key;
+		key.material = importSubMesh.material;
+		key.vertexFormat = m_SubMeshesDX[subMesh].vertexFormat;
+		key.cell[0] = key.cell[1] = key.cell[2] = 0;
+		if (maxBatchSize > 0.0f)
+		{
+			CVector3 centre = WorldCentre( importSubMesh, m_NodeMatrices[importSubMesh.node] );
+			key.cell[0] = static_cast<int>(Floor( centre.x / maxBatchSize ));
+			key.cell[1] = static_cast<int>(Floor( centre.y / maxBatchSize ));
+			key.cell[2] = static_cast<int>(Floor( centre.z / maxBatchSize ));
+		}
+		groups[key].push_back( subMesh );
+	}
+
+	// Build each group into one batch, or more if it has too many vertices for 16-bit indices
+	vector<SStaticBatch> batches;
+	vector<TUInt8> vertices;
+	vector<WORD> indices;
+	for (map<SBatchKey, vector<TUInt32> >::iterator group = groups.begin(); group != groups.end(); ++group)
+	{
+		// Batch vertices are built interleaved, the pool splits them for formats with separate positions
+		const vector<TUInt32>& members = group->second;
+		const SVertexFormat& format = VertexFormatDesc( group->first.vertexFormat );
+		UINT vertexSize = format.vertexSize + format.attributeSize;
+
+		SStaticBatch batch;
+		batch.material = group->first.material;
+		batch.vertexFormat = group->first.vertexFormat;
+		batch.numSubMeshes = 0;
+		for (size_t member = 0; member <= members.size(); ++member)
+		{
+			bool lastMember = (member == members.size());
+			size_t numVertices = vertices.size() / vertexSize;
+			if (batch.numSubMeshes > 0 && (lastMember || numVertices + m_SubMeshes[members[member]].numVertices > kMaxBatchVertices))
+			{
+				batch.numVertices = static_cast<TUInt32>(numVertices);
+				batch.numIndices = static_cast<TUInt32>(indices.size());
+				batch.geometry = GeometryPool.Add( batch.vertexFormat, &vertices[0], batch.numVertices, &indices[0], batch.numIndices );
+				if (batch.geometry == kNoGeometry)
+				{
+					for (size_t added = 0; added < batches.size(); ++added)
+					{
+						GeometryPool.Remove( batches[added].geometry );
+					}
+					return false;
+				}
+				batches.push_back( batch );
+				batch.numSubMeshes = 0;
+				vertices.clear();
+				indices.clear();
+			}
+			if (lastMember) break;
+
+			const SSubMesh& importSubMesh = m_SubMeshes[members[member]];
+			AppendToBatch( importSubMesh, m_NodeMatrices[importSubMesh.node], &batch, &vertices, &indices );
+		}
+	}
+
+	// Switch the batched sub-meshes over to their batches, releasing their own geometry
+	AccountMemory( -1 );
+	for (map<SBatchKey, vector<TUInt32> >::iterator group = groups.begin(); group != groups.end(); ++group)
+	{
+		for (size_t member = 0; member < group->second.size(); ++member)
+		{
+			SSubMeshDX& subMeshDX = m_SubMeshesDX[group->second[member]];
+			GeometryPool.Remove( subMeshDX.geometry );
+			subMeshDX.geometry = kNoGeometry;
+		}
+	}
+	m_Batches.swap( batches );
+	AccountMemory( 1 );
+	return true;
+}
+
+// Draw calls made by each pass of Render
+TUInt32 CMesh::GetNumDraws()
+{
+	TUInt32 numDraws = GetNumStaticBatches();
+	for (TUInt32 subMesh = 0; subMesh < m_NumSubMeshes; ++subMesh)
+	{
+		if (m_SubMeshesDX[subMesh].geometry != kNoGeometry) ++numDraws;
+	}
+	return numDraws;
+}
+
+
+// Share diffuse maps between materials as texture arrays, returns false if a texture can't be read or an array created
+bool CMesh::BuildTextureArrays()
+{
+	if (!m_HasGeometry) return false;
+	PROFILE_FUNCTION();
+
+	// Diffuse maps not already in an array, processed as they were loaded. Textures that aren't read here (JPEGs with no
+	// processing) or are in formats the builder doesn't handle are left out
+	CTextureArrayBuilder builder;
+	for (TUInt32 material = 0; material < m_NumMaterials; ++material)
+	{
+		const SMeshMaterialDX& materialDX = m_Materials[material];
+		if (materialDX.numTextures == 0 || materialDX.diffuseSlice >= 0) continue;
+
+		const string& fileName = materialDX.textureFileNames[0];
+		if (builder.FindTexture( fileName ) != kNoTextureArray) continue;
+		STextureImage image;
+		if (ReadProcessedTexture( fileName, m_TextureOptions, &image ) || ReadTextureImage( fileName, &image ))
+		{
+			builder.Add( fileName, image );
+		}
+	}
+	builder.Build();
+	if (builder.GetNumArrays() == 0)
+	{
+		return true;
+	}
+
+	// Create all the arrays before changing any material
+	vector<ID3D11ShaderResourceView*> arrays( builder.GetNumArrays() );
+	for (TUInt32 array = 0; array < arrays.size(); ++array)
+	{
+		arrays[array] = CreateTextureView( g_pd3dDevice, builder.GetArray( array ), true );
+		if (!arrays[array])
+		{
+			for (TUInt32 created = 0; created < array; ++created) arrays[created]->Release();
+			return false;
 		}
 	}
 
+	// Each material takes a reference to its array in place of its own texture, which is released
+	AccountMemory( -1 );
+	for (TUInt32 material = 0; material < m_NumMaterials; ++material)
+	{
+		SMeshMaterialDX& materialDX = m_Materials[material];
+		if (materialDX.numTextures == 0 || materialDX.diffuseSlice >= 0) continue;
+
+		TUInt32 texture = builder.FindTexture( materialDX.textureFileNames[0] );
+		if (texture == kNoTextureArray || builder.GetSlot( texture ).array == kNoTextureArray) continue;
+
+		const STextureArraySlot& slot = builder.GetSlot( texture );
+		materialDX.textures[0]->Release();
+		materialDX.textures[0] = arrays[slot.array];
+		materialDX.textures[0]->AddRef();
+		materialDX.diffuseSlice = static_cast<TInt32>(slot.slice);
+	}
+	for (TUInt32 array = 0; array < arrays.size(); ++array)
+	{
+		arrays[array]->Release();
+	}
+	m_NumTextureArrays += builder.GetNumArrays();
+	AccountMemory( 1 );
 	return true;
 }
 
+// Diffuse map changes between the draws of one Render
+TUInt32 CMesh::GetNumTextureChanges( bool separateTextures /*= false*/ )
+{
+	// Materials with the same diffuse map share the index of the first of them. Maps loaded on their own are the same
+	// if their file is, maps in an array if their array is
+	vector<TUInt32> diffuseMaps( m_NumMaterials );
+	for (TUInt32 material = 0; material < m_NumMaterials; ++material)
+	{
+		const SMeshMaterialDX& materialDX = m_Materials[material];
+		diffuseMaps[material] = material;
+		for (TUInt32 other = 0; other < material && materialDX.numTextures > 0; ++other)
+		{
+			const SMeshMaterialDX& otherDX = m_Materials[other];
+			if (otherDX.numTextures == 0) continue;
+
+			bool inArrays = !separateTextures && materialDX.diffuseSlice >= 0;
+			if (inArrays ? otherDX.textures[0] == materialDX.textures[0] :
+			               otherDX.textureFileNames[0] == materialDX.textureFileNames[0])
+			{
+				diffuseMaps[material] = diffuseMaps[other];
+				break;
+			}
+		}
+	}
+
+	// Material of each draw in the order Render makes them - static batches, then the sub-meshes not in a batch
+	vector<TUInt32> drawMaterials;
+	for (TUInt32 batch = 0; batch < m_Batches.size(); ++batch)
+	{
+		drawMaterials.push_back( m_Batches[batch].material );
+	}
+	for (TUInt32 subMesh = 0; subMesh < m_NumSubMeshes; ++subMesh)
+	{
+		if (m_SubMeshesDX[subMesh].geometry != kNoGeometry) drawMaterials.push_back( m_SubMeshesDX[subMesh].material );
+	}
+
+	// Materials without textures leave the last one set
+	TUInt32 changes = 0;
+	TUInt32 bound = ~0u;
+	for (TUInt32 draw = 0; draw < drawMaterials.size(); ++draw)
+	{
+		TUInt32 material = drawMaterials[draw];
+		if (m_Materials[material].numTextures > 0 && diffuseMaps[material] != bound)
+		{
+			bound = diffuseMaps[material];
+			++changes;
+		}
+	}
+	return changes;
+}
+
+
+//-----------------------------------------------------------------------------
+// Skinning
+//-----------------------------------------------------------------------------
+
+// Skin the skinned sub-meshes into their dynamic vertex buffers
+void CMesh::Skin( const CMatrix4x4* nodeMatrices /*= 0*/ )
+{
+	if (m_BonePalette.empty()) return;
+	PROFILE_FUNCTION();
+
+	SkinBuildModelPalette( m_Nodes, m_NumNodes, nodeMatrices ? nodeMatrices : &m_NodeMatrices[0], &m_BonePalette[0] );
+	for (TUInt32 subMesh = 0; subMesh < m_NumSubMeshes; ++subMesh)
+	{
+		SSubMeshDX& subMeshDX = m_SubMeshesDX[subMesh];
+		SSkinVertexLayout layout;
+		if (!subMeshDX.skinnedVertices || !SkinVertexLayout( m_SubMeshes[subMesh], &layout )) continue;
+
+		D3D11_MAPPED_SUBRESOURCE mappedData;
+		if (FAILED( g_pd3dContext->Map( subMeshDX.skinnedVertices, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedData ) )) continue;
+		SkinVerticesParallel( layout, m_SubMeshes[subMesh].vertices, static_cast<TUInt8*>(mappedData.pData), subMeshDX.numVertices, &m_BonePalette[0] );
+		g_pd3dContext->Unmap( subMeshDX.skinnedVertices, 0 );
+		FrameStatsAdd( kCounterBufferDiscards );
+		FrameStatsAdd( kCounterVertexBufferBytes, subMeshDX.numVertices * layout.vertexSize );
+	}
+	m_Skinned = true;
+}
+
 
 //-----------------------------------------------------------------------------
 // Rendering
 //-----------------------------------------------------------------------------
 
 // Render the model
-void CMesh::Render(	ID3DX11EffectTechnique* technique )
+void CMesh::Render(	ID3DX11EffectTechnique* technique, const CMatrix4x4* nodeMatrices, const CMatrix4x4* worldMatrix )
 {
 	if (!m_HasGeometry) return;
+	PROFILE_FUNCTION();
+
+	// Buffers and layout bound so far in this call. Other rendering binds its own buffers in between meshes, so binding starts afresh for each
+	SBoundGeometry bound = { 0, 0, 0, kNoVertexFormat };
+
+	// Render static batches, already transformed by the node matrices
+	for (TUInt32 batch = 0; batch < m_Batches.size(); ++batch)
+	{
+		const SStaticBatch& staticBatch = m_Batches[batch];
+		RenderGeometry( technique, worldMatrix ? *worldMatrix : CMatrix4x4::kIdentity, staticBatch.material, staticBatch.vertexFormat,
+		                GeometryPool.Range( staticBatch.geometry ), &bound );
+		FrameStatsAdd( kCounterSubMeshesDrawn, staticBatch.numSubMeshes );
+	}
 
-	// Render each sub-mesh
+	// Render each sub-mesh not in a batch. Skinned vertices are already in model space
 	for (TUInt32 subMesh = 0; subMesh < m_NumSubMeshes; ++subMesh)
 	{
-		// Get a reference to the submesh and its material to reduce code clutter
 		SSubMeshDX& subMeshDX = m_SubMeshesDX[subMesh];
-		SMeshMaterialDX& material = m_Materials[subMeshDX.material];
+		if (subMeshDX.geometry == kNoGeometry) continue;
 
-		// Set up shader variables based on material, assuming standard names
-		Effect->GetVariableByName("WorldMatrix")->AsMatrix()->SetMatrix( &m_Nodes[subMeshDX.node].positionMatrix.e00 );
-		Effect->GetVariableByName("DiffuseColour")->SetRawValue( material.diffuseColour, 0, 12 );
-		Effect->GetVariableByName("SpecularColour")->SetRawValue( material.specularColour, 0, 12 );
-		Effect->GetVariableByName("SpecularPower")->AsScalar()->SetFloat( material.specularPower );
-		if (material.numTextures > 0) Effect->GetVariableByName("DiffuseMap")->AsShaderResource()->SetResource( material.textures[0] );
-		if (material.numTextures > 1) Effect->GetVariableByName("NormalMap" )->AsShaderResource()->SetResource( material.textures[1] );
+		const CMatrix4x4& nodeMatrix = DrawSkinned( subMesh ) ? CMatrix4x4::kIdentity :
+		                               nodeMatrices ? nodeMatrices[subMeshDX.node] : m_NodeMatrices[subMeshDX.node];
+		RenderGeometry( technique, worldMatrix ? nodeMatrix * *worldMatrix : nodeMatrix, subMeshDX.material, subMeshDX.vertexFormat,
+		                SubMeshGeometry( subMesh ), &bound );
+		FrameStatsAdd( kCounterSubMeshesDrawn );
+	}
+}
 
-		// Select vertex and index buffer for sub-mesh - assuming all geometry data is triangle lists
-		UINT offset = 0;
-		g_pd3dContext->IASetVertexBuffers( 0, 1, &subMeshDX.vertexBuffer, &subMeshDX.vertexSize, &offset );
-		g_pd3dContext->IASetInputLayout(subMeshDX.vertexLayout );
-		g_pd3dContext->IASetIndexBuffer(subMeshDX.indexBuffer, DXGI_FORMAT_R16_UINT, 0 );
-		g_pd3dContext->IASetPrimitiveTopology( D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
-
-		// Render the sub-mesh. Geometry buffers and shader variables, just select the technique for this method and draw.
-		D3DX11_TECHNIQUE_DESC techDesc;
-		technique->GetDesc( &techDesc );
+// Render the model's positions only
+void CMesh::RenderPositions( ID3DX11EffectTechnique* technique, const CMatrix4x4* nodeMatrices, const CMatrix4x4* worldMatrix )
+{
+	if (!m_HasGeometry) return;
+	PROFILE_FUNCTION();
+
+	D3DX11_TECHNIQUE_DESC techDesc;
+	technique->GetDesc( &techDesc );
+	ID3DX11EffectMatrixVariable* worldMatrixVar = Effect->GetVariableByName("WorldMatrix")->AsMatrix();
+	SBoundGeometry bound = { 0, 0, 0, kNoVertexFormat };
+	TUInt32 numBatches = static_cast<TUInt32>(m_Batches.size());
+	for (TUInt32 draw = 0; draw < numBatches + m_NumSubMeshes; ++draw)
+	{
+		// Static batches first, then each sub-mesh not in a batch
+		TVertexFormat vertexFormat;
+		SGeometryRange geometry;
+		CMatrix4x4 matrix = worldMatrix ? *worldMatrix : CMatrix4x4::kIdentity;
+		if (draw < numBatches)
+		{
+			vertexFormat = m_Batches[draw].vertexFormat;
+			geometry = GeometryPool.Range( m_Batches[draw].geometry );
+		}
+		else
+		{
+			TUInt32 subMesh = draw - numBatches;
+			const SSubMeshDX& subMeshDX = m_SubMeshesDX[subMesh];
+			if (subMeshDX.geometry == kNoGeometry) continue;
+			vertexFormat = subMeshDX.vertexFormat;
+			geometry = SubMeshGeometry( subMesh );
+			if (!DrawSkinned( subMesh ))
+			{
+				const CMatrix4x4& nodeMatrix = nodeMatrices ? nodeMatrices[subMeshDX.node] : m_NodeMatrices[subMeshDX.node];
+				matrix = worldMatrix ? nodeMatrix * *worldMatrix : nodeMatrix;
+			}
+		}
+
+		worldMatrixVar->SetMatrix( &matrix.e00 );
+		BindGeometry( technique, vertexFormat, geometry, &bound, true );
+		for (UINT p = 0; p < techDesc.Passes; ++p)
+		{
+			technique->GetPassByIndex( p )->Apply( 0, g_pd3dContext );
+			g_pd3dContext->DrawIndexed( geometry.numIndices, geometry.startIndex, geometry.baseVertex );
+		}
+		FrameStatsAdd( kCounterDrawCalls, techDesc.Passes );
+		FrameStatsAdd( kCounterTriangles, techDesc.Passes * (geometry.numIndices / 3) );
+	}
+}
+
+// Render many copies of the model with hardware instancing
+void CMesh::RenderInstanced( ID3DX11EffectTechnique* technique, TVertexFormat instanceFormat, UINT startInstance, UINT numInstances )
+{
+	if (!m_HasGeometry || numInstances == 0) return;
+	PROFILE_FUNCTION();
+
+	// The vertex format of each piece of geometry is extended with the instance data, the combined formats are cached
+	SBoundGeometry bound = { 0, 0, 0, kNoVertexFormat };
+	for (TUInt32 batch = 0; batch < m_Batches.size(); ++batch)
+	{
+		const SStaticBatch& staticBatch = m_Batches[batch];
+		RenderGeometry( technique, CMatrix4x4::kIdentity, staticBatch.material, VertexFormatCombine( staticBatch.vertexFormat, instanceFormat ),
+		                GeometryPool.Range( staticBatch.geometry ), &bound, startInstance, numInstances );
+		FrameStatsAdd( kCounterSubMeshesDrawn, staticBatch.numSubMeshes * numInstances );
+	}
+	for (TUInt32 subMesh = 0; subMesh < m_NumSubMeshes; ++subMesh)
+	{
+		SSubMeshDX& subMeshDX = m_SubMeshesDX[subMesh];
+		if (subMeshDX.geometry == kNoGeometry) continue;
+
+		const CMatrix4x4& nodeMatrix = DrawSkinned( subMesh ) ? CMatrix4x4::kIdentity : m_NodeMatrices[subMeshDX.node];
+		RenderGeometry( technique, nodeMatrix, subMeshDX.material, VertexFormatCombine( subMeshDX.vertexFormat, instanceFormat ),
+		                SubMeshGeometry( subMesh ), &bound, startInstance, numInstances );
+		FrameStatsAdd( kCounterSubMeshesDrawn, numInstances );
+	}
+}
+
+// Render some geometry with a material, for Render and RenderInstanced
+void CMesh::RenderGeometry( ID3DX11EffectTechnique* technique, const CMatrix4x4& worldMatrix, TUInt32 materialIndex,
+                            TVertexFormat vertexFormat, const SGeometryRange& geometry, SBoundGeometry* bound,
+                            UINT startInstance /*= 0*/, UINT numInstances /*= 0*/ )
+{
+	// Set up shader variables based on material, assuming standard names
+	SMeshMaterialDX& material = m_Materials[materialIndex];
+	Effect->GetVariableByName("WorldMatrix")->AsMatrix()->SetMatrix( &worldMatrix.e00 );
+	Effect->GetVariableByName("DiffuseColour")->SetRawValue( material.diffuseColour, 0, 12 );
+	Effect->GetVariableByName("SpecularColour")->SetRawValue( material.specularColour, 0, 12 );
+	Effect->GetVariableByName("SpecularPower")->AsScalar()->SetFloat( material.specularPower );
+	if (material.numTextures > 0)
+	{
+		// A diffuse map in a texture array is selected by its slice, the shader samples DiffuseMap for a negative slice
+		if (material.diffuseSlice >= 0) Effect->GetVariableByName("DiffuseMapArray")->AsShaderResource()->SetResource( material.textures[0] );
+		else                            Effect->GetVariableByName("DiffuseMap"     )->AsShaderResource()->SetResource( material.textures[0] );
+		Effect->GetVariableByName("DiffuseSlice")->AsScalar()->SetFloat( static_cast<float>(material.diffuseSlice) );
+		if (material.textures[0] != bound->diffuseMap)
+		{
+			bound->diffuseMap = material.textures[0];
+			FrameStatsAdd( kCounterMaterialTextures );
+		}
+	}
+	if (material.numTextures > 1)
+	{
+		Effect->GetVariableByName("NormalMap")->AsShaderResource()->SetResource( material.textures[1] );
+		if (material.textures[1] != bound->normalMap)
+		{
+			bound->normalMap = material.textures[1];
+			FrameStatsAdd( kCounterMaterialTextures );
+		}
+	}
+
+	BindGeometry( technique, vertexFormat, geometry, bound, false );
+
+	// Render the geometry. Geometry buffers and shader variables, just select the technique for this method and draw.
+	D3DX11_TECHNIQUE_DESC techDesc;
+	technique->GetDesc( &techDesc );
+	if (numInstances > 0)
+	{
+		for( UINT p = 0; p < techDesc.Passes; ++p )
+		{
+			technique->GetPassByIndex( p )->Apply( 0, g_pd3dContext );
+			g_pd3dContext->DrawIndexedInstanced( geometry.numIndices, numInstances, geometry.startIndex, geometry.baseVertex, startInstance );
+		}
+		g_pd3dContext->DrawIndexedInstanced( geometry.numIndices, numInstances, geometry.startIndex, geometry.baseVertex, startInstance );
+	}
+	else
+	{
 		for( UINT p = 0; p < techDesc.Passes; ++p )
 		{
 			technique->GetPassByIndex( p )->Apply( 0, g_pd3dContext );
-			g_pd3dContext->DrawIndexed( subMeshDX.numIndices, 0, 0 );
+			g_pd3dContext->DrawIndexed( geometry.numIndices, geometry.startIndex, geometry.baseVertex );
 		}
-		g_pd3dContext->DrawIndexed( subMeshDX.numIndices, 0, 0 );
+		g_pd3dContext->DrawIndexed( geometry.numIndices, geometry.startIndex, geometry.baseVertex );
+		numInstances = 1;
+	}
+
+	FrameStatsAdd( kCounterDrawCalls, techDesc.Passes + 1 );
+	FrameStatsAdd( kCounterTriangles, (techDesc.Passes + 1) * numInstances * (geometry.numIndices / 3) );
+}
+
+
+// Bind the buffers and input layout for some geometry where they differ from those already bound
+void CMesh::BindGeometry( ID3DX11EffectTechnique* technique, TVertexFormat vertexFormat, const SGeometryRange& geometry,
+                          SBoundGeometry* bound, bool positionsOnly )
+{
+	// Select vertex and index buffer - assuming all geometry data is triangle lists. Geometry mostly shares buffers in the
+	// geometry pool, so they are only bound when they change
+	if (geometry.vertexBuffer != bound->vertexBuffer)
+	{
+		UINT offset = 0;
+		g_pd3dContext->IASetVertexBuffers( 0, 1, &geometry.vertexBuffer, &geometry.vertexSize, &offset );
+		bound->vertexBuffer = geometry.vertexBuffer;
+		FrameStatsAdd( kCounterBufferBinds );
+	}
+	if (!positionsOnly && geometry.attributeBuffer && geometry.attributeBuffer != bound->attributeBuffer)
+	{
+		// Attributes are in step with the positions, at the same vertex offsets
+		UINT offset = 0;
+		g_pd3dContext->IASetVertexBuffers( 1, 1, &geometry.attributeBuffer, &geometry.attributeSize, &offset );
+		bound->attributeBuffer = geometry.attributeBuffer;
+		FrameStatsAdd( kCounterBufferBinds );
+	}
+	if (geometry.indexBuffer != bound->indexBuffer)
+	{
+		g_pd3dContext->IASetIndexBuffer( geometry.indexBuffer, DXGI_FORMAT_R16_UINT, 0 );
+		bound->indexBuffer = geometry.indexBuffer;
+		FrameStatsAdd( kCounterBufferBinds );
+	}
+	if (positionsOnly) vertexFormat = VertexFormatPositionsOnly( vertexFormat );
+	if (vertexFormat != bound->vertexFormat)
+	{
+		g_pd3dContext->IASetInputLayout( InputLayouts.Layout( vertexFormat, technique ) );
+		bound->vertexFormat = vertexFormat;
+		FrameStatsAdd( kCounterInputLayoutBinds );
+	}
+	g_pd3dContext->IASetPrimitiveTopology( D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
+}
+
+// Geometry to draw for a sub-mesh not in a static batch
+SGeometryRange CMesh::SubMeshGeometry( TUInt32 subMesh )
+{
+	SGeometryRange geometry = GeometryPool.Range( m_SubMeshesDX[subMesh].geometry );
+	if (DrawSkinned( subMesh ))
+	{
+		// Skinned vertices start at the beginning of their own buffer, the pool's indices are relative to the first vertex
+		geometry.vertexBuffer = m_SubMeshesDX[subMesh].skinnedVertices;
+		geometry.vertexSize = m_SubMeshes[subMesh].vertexSize;
+		geometry.attributeBuffer = 0;
+		geometry.attributeSize = 0;
+		geometry.baseVertex = 0;
 	}
+	return geometry;
 }
@@ -7,13 +7,19 @@
 #pragma once
 
 #include <string>
+#include <vector>
 using namespace std;
 
 #include "Defines.h"
 #include "CVector3.h"
+#include "CVector4.h"
 #include "CMatrix4x4.h"
 #include "MeshData.h"
+#include "Animation.h"
+#include "Hierarchy.h"
 #include "Camera.h"
+#include "GeometryPool.h"
+#include "VertexFormat.h"
 using namespace gen;
 
 // Mesh class
@@ -85,6 +91,11 @@ public:
 	// there are no more vertices to enumerate
 	bool GetVertex( CVector3* pVertex );
 
+	// Vertex positions of a sub-mesh (x,y,z floats), in model space relative to the sub-mesh's node. Meshes
+	// loaded with separate positions return a tightly packed copy (stride 12), others the interleaved import
+	// data (stride of the whole vertex). The stride in bytes is returned in pStride
+	const TFloat32* GetPositions( TUInt32 subMesh, TUInt32* pStride );
+
 
 	/////////////////////////////////////
 	// Hierarchy access
@@ -94,30 +105,166 @@ public:
 		return m_NumNodes;
 	}
 
-	//const 
-	SMeshNode& GetNode( TUInt32 node )
+	// Node in the hierarchy, positionMatrix is its current matrix relative to its parent
+	const SMeshNode& GetNode( TUInt32 node )
 	{
 		return m_Nodes[node];
 	}
 
-	CMatrix4x4& Matrix()
+	// Set the matrix of a node relative to its parent. Nodes below it move with it once UpdateNodeMatrices is called
+	void SetNodeMatrix( TUInt32 node, const CMatrix4x4& matrix );
+
+	// Combine the node matrices with their parents' to give each node's matrix in model space (see Hierarchy.h). Only
+	// nodes set since the last call and those below them are recomputed. Called by Load, call again after setting
+	// node matrices and before taking GetNodeMatrix or rendering with the mesh's own node matrices
+	void UpdateNodeMatrices();
+
+	// Model space matrix of a node as of the last UpdateNodeMatrices - the matrix Render places its sub-meshes with
+	const CMatrix4x4& GetNodeMatrix( TUInt32 node )
 	{
-		return m_Nodes[0].positionMatrix;
+		return m_NodeMatrices[node];
 	}
 
 
 	/////////////////////////////////////
 	// Creation
 
-	// Load the mesh from an X-File
-	bool Load( const string& fileName, ID3DX11EffectTechnique* shaderCode, bool needTangents = false );
+	// Load the mesh from an X-File. With separatePositions, vertex positions are kept in a stream of their
+	// own on the GPU (see VertexFormatSeparatePositions) and in a packed array on the CPU, so position-only
+	// passes (RenderPositions, bounds and other CPU geometry work) do not read the other vertex data. Skinned
+	// sub-meshes keep their GPU vertices interleaved, they are drawn from the vertices written by Skin. Texture
+	// options (kTextureCompress, kTextureGenerateMips) process textures on the CPU as they load, see
+	// ReadProcessedTexture - only diffuse maps are compressed. Textures with nothing to do are loaded as they are
+	bool Load( const string& fileName, ID3DX11EffectTechnique* shaderCode, bool needTangents = false,
+	           bool separatePositions = false, TUInt32 textureOptions = 0 );
+
+	// File the mesh was loaded from
+	const string& GetFileName()
+	{
+		return m_FileName;
+	}
+
+	// Give every vertex a colour, e.g. lighting baked into it (see LightBaking.h), replacing any colours it has. There is
+	// a colour for each vertex of each sub-mesh in turn, in the order they were loaded. Colours are added to the end of
+	// the vertex as a float4 COLOR, and the GPU vertices recreated - shaderCode is an example technique as for Load, which
+	// should read the colours. Call after Load and before BuildStaticBatches. Returns false for meshes with skinning or
+	// already batched, or if the geometry pool is out of memory, the mesh is then left as it was
+	bool SetVertexColours( const CVector4* colours, ID3DX11EffectTechnique* shaderCode );
+
+	// Merge sub-meshes into static batches. Sub-meshes sharing a material and vertex format are transformed into world
+	// space by their node matrices and concatenated into a single vertex and index range, drawn with one call. Call after
+	// Load once the nodes are in place (and updated), and only for meshes whose nodes never move - node matrices passed to Render are
+	// not used for batched sub-meshes. maxBatchSize limits the spatial size of a batch (world units, 0 for no limit) so
+	// batches stay small enough to cull: sub-meshes are grouped by the grid cell of this size that their centre lies in.
+	// Skinned sub-meshes are not batched. Returns false if the geometry pool is out of memory, the mesh is then left as
+	// it was
+	bool BuildStaticBatches( TFloat32 maxBatchSize = 0.0f );
+
+	// Share diffuse maps between materials as texture arrays (see TextureArrays.h). The materials' DDS diffuse maps with
+	// the same format, size and mips are copied into an array each, and each of those materials then uses the array
+	// with the slice of its own map, so draws with different materials in the same array don't change texture. Other
+	// textures are left as they are. Call after Load. Returns false if a texture can't be read or an array created, the
+	// mesh is then left as it was
+	bool BuildTextureArrays();
+
+	// Texture arrays made by BuildTextureArrays
+	TUInt32 GetNumTextureArrays()
+	{
+		return m_NumTextureArrays;
+	}
+
+	// Diffuse map changes between the draws of one Render, the first draw included - counting a texture array as one
+	// texture, or with separateTextures as if each material's diffuse map were still a texture of its own (as loaded)
+	TUInt32 GetNumTextureChanges( bool separateTextures = false );
+
+
+	/////////////////////////////////////
+	// Static batches
+
+	// Sub-meshes merged by BuildStaticBatches
+	struct SStaticBatch
+	{
+		TUInt32         material;
+		TVertexFormat   vertexFormat;
+		TGeometryHandle geometry;
+		TUInt32         numSubMeshes; // Merged into this batch
+		TUInt32         numVertices;
+		TUInt32         numIndices;
+		CVector3        minBounds;    // World space
+		CVector3        maxBounds;
+	};
+
+	TUInt32 GetNumStaticBatches()
+	{
+		return static_cast<TUInt32>(m_Batches.size());
+	}
+
+	const SStaticBatch& GetStaticBatch( TUInt32 batch )
+	{
+		return m_Batches[batch];
+	}
+
+	TUInt32 GetNumSubMeshes()
+	{
+		return m_NumSubMeshes;
+	}
+
+	// Draw calls made by each pass of Render - one for each static batch and each sub-mesh not in a batch
+	TUInt32 GetNumDraws();
+
+
+	/////////////////////////////////////
+	// Skinning
+
+	// Does the mesh have sub-meshes with skinning data (bone weights and indices in each vertex)
+	bool HasSkinning()
+	{
+		return !m_BonePalette.empty();
+	}
+
+	// Skin the skinned sub-meshes on the CPU (see Skinning.h) into a dynamic vertex buffer for each, spread over the
+	// job system. From then on Render, RenderPositions and RenderInstanced draw those sub-meshes from the skinned
+	// vertices, which are already in model space, so only the world matrix places them. Node matrices are in model
+	// space, as GetNodeMatrix, and pose the bones - pass 0 for the mesh's own. Call once per frame before rendering,
+	// from the rendering thread (maps buffers with g_pd3dContext)
+	void Skin( const CMatrix4x4* nodeMatrices = 0 );
+
+
+	/////////////////////////////////////
+	// Animation
+
+	// Animations imported with the mesh, compressed (see Animation.h). Sample one into a transform for each node,
+	// set their matrices (CQuatTransform::GetMatrix) with SetNodeMatrix and update the node matrices to pose the mesh
+	TUInt32 GetNumAnimations()
+	{
+		return static_cast<TUInt32>(m_Animations.size());
+	}
+
+	const CAnimationClip& GetAnimation( TUInt32 animation )
+	{
+		return m_Animations[animation];
+	}
 
 
 	/////////////////////////////////////
 	// Rendering
 
-	// Render the model from the given camera
-	void Render( ID3DX11EffectTechnique* technique );
+	// Render the model from the given camera. Node matrices are in model space, as GetNodeMatrix, and can be
+	// supplied from elsewhere (e.g. a copy taken for another thread to render), otherwise the mesh's own are
+	// used. A world matrix places the whole mesh, e.g. for each instance of a shared mesh (see MeshInstances.h).
+	// The node matrices (and static batches) are then relative to it
+	void Render( ID3DX11EffectTechnique* technique, const CMatrix4x4* nodeMatrices = 0, const CMatrix4x4* worldMatrix = 0 );
+
+	// Render the model's positions only, e.g. for a depth pre-pass, with a technique whose vertex shader takes
+	// only a POSITION. No material is set. For meshes loaded with separate positions only the position stream
+	// is read. Node and world matrices are used as for Render
+	void RenderPositions( ID3DX11EffectTechnique* technique, const CMatrix4x4* nodeMatrices = 0, const CMatrix4x4* worldMatrix = 0 );
+
+	// Render many copies of the model with one draw call per static batch and sub-mesh (hardware instancing). The
+	// per-instance data must already be bound to vertex buffer slot 2, laid out as described by instanceFormat (in
+	// slot 2, per-instance). The technique's vertex shader takes the instance world matrix from it and combines it
+	// with the node matrix, which is set as the WorldMatrix. Instances use the mesh's own node matrices
+	void RenderInstanced( ID3DX11EffectTechnique* technique, TVertexFormat instanceFormat, UINT startInstance, UINT numInstances );
 
 
 /*-----------------------------------------------------------------------------------------
@@ -129,26 +276,30 @@ private:
 	// Types
 
 	// The DirectX form of a sub-mesh. Stores controlling node and material used. The vertex/index data is
-	// stored in seperate vertex and index buffers for each mesh. This is sub-optimal - it/ would be better
-	// to share buffers between different meshes where possible, but this would make the code much more complex
+	// stored in the geometry pool, in buffers shared with all other sub-meshes of the same vertex format
 	struct SSubMeshDX
 	{
 		TUInt32                  node;     // Node controlling this sub-mesh 
 		TUInt32                  material; // Index of material used by this sub-mesh
 
-		// Vertex data for the sub-mesh stored in a vertex buffer and the number of vertices in the buffer
-		ID3D11Buffer*            vertexBuffer;
+		// Vertex and index data for the sub-mesh in the geometry pool (kNoGeometry once merged into a static
+		// batch), and the number of vertices
+		TGeometryHandle          geometry;
 		TUInt32                  numVertices;
 
-		// Description of the elements in a single vertex (position, normal, UVs etc.)
-		static const int         MAX_VERTEX_ELTS = 64;
-		D3D11_INPUT_ELEMENT_DESC vertexElts[MAX_VERTEX_ELTS];
-		ID3D11InputLayout*       vertexLayout; // Layout of a vertex (derived from above array)
-		unsigned int             vertexSize;   // Size of vertex calculated from contained elements
+		// Elements in a single vertex (position, normal, UVs etc.) and the vertex size, see VertexFormat.h. The input
+		// layout is shared by all sub-meshes of the same format through the layout cache
+		TVertexFormat            vertexFormat;
 
-		// Index data for the sub-mesh stored in a index buffer and the number of indices in the buffer
-		ID3D11Buffer*            indexBuffer;
+		// Number of indices in the sub-mesh's index data
 		TUInt32                  numIndices;
+
+		// Index of the sub-mesh's first position in m_Positions (meshes with separate positions only)
+		TUInt32                  firstPosition;
+
+		// Dynamic buffer the sub-mesh's vertices are skinned into by Skin, in the same format (skinned sub-meshes
+		// only, otherwise null). Indices still come from the geometry pool
+		ID3D11Buffer*            skinnedVertices;
 	};
 
 
@@ -161,6 +312,10 @@ private:
 
 		TUInt32       numTextures;
 		ID3D11ShaderResourceView* textures[kiMaxTextures];
+		string        textureFileNames[kiMaxTextures]; // Kept for memory accounting
+
+		// Slice of the diffuse map when textures[0] is a texture array shared with other materials, -1 otherwise
+		TInt32        diffuseSlice;
 	};
 
 
@@ -189,6 +344,43 @@ private:
 	// Pre-processing after loading
 	bool PreProcess();
 
+	// Add the memory used by the mesh to the memory accounting (see MemoryAccounting.h), or remove
+	// it with a sign of -1 when it is released
+	void AccountMemory( long long sign );
+
+	// Buffers and layout bound so far in a call to Render, so they are only bound again when they change, and the
+	// material textures last set, to count how often they change
+	struct SBoundGeometry
+	{
+		ID3D11Buffer* vertexBuffer;
+		ID3D11Buffer* attributeBuffer;
+		ID3D11Buffer* indexBuffer;
+		TVertexFormat vertexFormat;
+		ID3D11ShaderResourceView* diffuseMap;
+		ID3D11ShaderResourceView* normalMap;
+	};
+
+	// Bind the buffers and input layout for some geometry where they differ from those already bound. With
+	// positionsOnly the attribute stream is not bound and the layout reads only slot 0
+	void BindGeometry( ID3DX11EffectTechnique* technique, TVertexFormat vertexFormat, const SGeometryRange& geometry,
+	                   SBoundGeometry* bound, bool positionsOnly );
+
+	// Render some geometry with a material, for Render and RenderInstanced. Draws the given number of instances
+	// when it is not 0
+	void RenderGeometry( ID3DX11EffectTechnique* technique, const CMatrix4x4& worldMatrix, TUInt32 materialIndex,
+	                     TVertexFormat vertexFormat, const SGeometryRange& geometry, SBoundGeometry* bound,
+	                     UINT startInstance = 0, UINT numInstances = 0 );
+
+	// Geometry to draw for a sub-mesh not in a static batch - its range in the geometry pool, or its skinned vertices
+	// once Skin has been called
+	SGeometryRange SubMeshGeometry( TUInt32 subMesh );
+
+	// Is a sub-mesh drawn from its skinned vertices, which are in model space rather than relative to its node
+	bool DrawSkinned( TUInt32 subMesh )
+	{
+		return m_Skinned && m_SubMeshesDX[subMesh].skinnedVertices;
+	}
+
 
 	/*---------------------------------------------------------------------------------------------
 		Data
@@ -197,19 +389,46 @@ private:
 	// Does this mesh have any geometry to render
 	bool             m_HasGeometry;
 
+	// File the mesh was loaded from, names it in memory reports
+	string           m_FileName;
+
 	// Hierarchy for mesh - stored as a depth-first list of nodes, see SMeshNode defn in MeshData.h
 	TUInt32          m_NumNodes;
 	SMeshNode*       m_Nodes;        // Dynamically allocated array
 
+	// Node matrices combined down the hierarchy, and a model space copy of each node's for rendering
+	CNodeHierarchy     m_Hierarchy;
+	vector<CMatrix4x4> m_NodeMatrices;
+
 	// Sub-meshes for mesh - each uses a single material
 	TUInt32          m_NumSubMeshes;
 	SSubMesh*        m_SubMeshes;    // Original sub-mesh data (dynamically allocated array)
 	SSubMeshDX*      m_SubMeshesDX;  // DirectX sub-mesh data (vertex / index buffers)
 
+	// Positions in a separate stream, and a packed copy of all sub-meshes' positions (see Load)
+	bool             m_SeparatePositions;
+	vector<CVector3> m_Positions;
+
+	// Processing of textures as they load, see Load
+	TUInt32          m_TextureOptions;
+
+	// Static batches built from the sub-meshes, see BuildStaticBatches
+	vector<SStaticBatch> m_Batches;
+
+	// Bone palette of meshes with skinned sub-meshes, one matrix for each node, and whether Skin has been called
+	vector<CMatrix4x4> m_BonePalette;
+	bool             m_Skinned;
+
+	// Compressed animations of the nodes
+	vector<CAnimationClip> m_Animations;
+
 	// Materials used in mesh
 	TUInt32          m_NumMaterials;
 	SMeshMaterialDX* m_Materials;    // Dynamically allocated array
 
+	// Texture arrays the materials' diffuse maps were grouped into, see BuildTextureArrays
+	TUInt32          m_NumTextureArrays;
+
 	// Mesh bounding volume - minimum and maximum x,y & z values stored in two vectors
 	CVector3         m_MinBounds;
 	CVector3         m_MaxBounds;
@@ -224,3 +443,8 @@ private:
 	TUInt32          m_EnumVert;     // Current vertices (within above mesh) being enumerated
 };
 
+
+// Size of a texture in GPU memory (bytes, all mip levels and array slices), calculated from its
+// description. Returns 0 for resources other than 2D textures
+size_t TextureMemoryBytes( ID3D11Resource* resource );
+
@@ -0,0 +1,429 @@
+/*******************************************
+	MeshInstances.cpp
+
+	Lightweight placements of shared meshes
+********************************************/
+
+#include <algorithm>
+using namespace std;
+
+#include "MeshInstances.h"
+#include "Profiler.h"
+#include "FrameStats.h"
+#include "MemoryAccounting.h"
+
+
+//-----------------------------------------------------------------------------
+// Instances
+//-----------------------------------------------------------------------------
+
+// Place a mesh with a world matrix
+TMeshInstance CMeshInstanceStore::Add( CMesh* mesh, const CMatrix4x4& worldMatrix, TUInt32 flags /*= 0*/ )
+{
+	TUInt32 slot = NumInstances();
+	TMeshInstance instance;
+	if (!m_FreeHandles.empty())
+	{
+		instance = m_FreeHandles.back();
+		m_FreeHandles.pop_back();
+		m_HandleSlots[instance] = slot;
+	}
+	else
+	{
+		instance = static_cast<TMeshInstance>(m_HandleSlots.size());
+		m_HandleSlots.push_back( slot );
+	}
+
+	m_Meshes.push_back( mesh );
+	m_WorldMatrices.push_back( worldMatrix );
+	m_Bounds.push_back( CVector4() );
+	m_Flags.push_back( flags );
+	m_Colours.push_back( CVector3( 1.0f, 1.0f, 1.0f ) );
+	m_NodeOverrides.push_back( kNoOverrides );
+	m_SlotHandles.push_back( instance );
+	m_Visible.reserve( m_Meshes.size() ); // So rendering doesn't allocate
+	UpdateBounds( slot );
+	if (!m_UploadRing && g_pd3dDevice) ReserveInstanceBuffer( NumInstances() ); // Nor create buffers
+
+	AccountMemory();
+	return instance;
+}
+
+// Remove an instance
+void CMeshInstanceStore::Remove( TMeshInstance instance )
+{
+	TUInt32 slot = m_HandleSlots[instance];
+	FreeNodeOverrides( slot );
+
+	// Move the last instance into the gap
+	TUInt32 last = NumInstances() - 1;
+	if (slot != last)
+	{
+		m_Meshes[slot] = m_Meshes[last];
+		m_WorldMatrices[slot] = m_WorldMatrices[last];
+		m_Bounds[slot] = m_Bounds[last];
+		m_Flags[slot] = m_Flags[last];
+		m_Colours[slot] = m_Colours[last];
+		m_NodeOverrides[slot] = m_NodeOverrides[last];
+		m_SlotHandles[slot] = m_SlotHandles[last];
+		m_HandleSlots[m_SlotHandles[slot]] = slot;
+	}
+	m_Meshes.pop_back();
+	m_WorldMatrices.pop_back();
+	m_Bounds.pop_back();
+	m_Flags.pop_back();
+	m_Colours.pop_back();
+	m_NodeOverrides.pop_back();
+	m_SlotHandles.pop_back();
+
+	m_FreeHandles.push_back( instance );
+	AccountMemory();
+}
+
+// Remove all instances
+void CMeshInstanceStore::Clear()
+{
+	m_Meshes.clear();
+	m_WorldMatrices.clear();
+	m_Bounds.clear();
+	m_Flags.clear();
+	m_Colours.clear();
+	m_NodeOverrides.clear();
+	m_SlotHandles.clear();
+	m_HandleSlots.clear();
+	m_FreeHandles.clear();
+	m_NodeMatrices.clear();
+	m_FreeNodeBlocks.clear();
+	m_Visible.clear();
+	MemoryAccountRelease( kMemoryMeshNodes, m_Name );
+
+	if (m_InstanceBuffer)
+	{
+		m_InstanceBuffer->Release();
+		m_InstanceBuffer = 0;
+		m_InstanceCapacity = 0;
+		MemoryAccountRelease( kMemoryVertexBuffers, m_Name );
+	}
+}
+
+
+// Move an instance
+void CMeshInstanceStore::SetWorldMatrix( TMeshInstance instance, const CMatrix4x4& worldMatrix )
+{
+	TUInt32 slot = m_HandleSlots[instance];
+	m_WorldMatrices[slot] = worldMatrix;
+	UpdateBounds( slot );
+}
+
+// Override the matrix of a node for this instance only
+void CMeshInstanceStore::SetNodeMatrix( TMeshInstance instance, TUInt32 node, const CMatrix4x4& matrix )
+{
+	TUInt32 slot = m_HandleSlots[instance];
+	if (m_NodeOverrides[slot] == kNoOverrides)
+	{
+		// Copy the mesh's node matrices into a free block if there is one of the right size, or a new one
+		CMesh* mesh = m_Meshes[slot];
+		TUInt32 numNodes = mesh->GetNumNodes();
+		TUInt32 offset;
+		multimap<TUInt32, TUInt32>::iterator freeBlock = m_FreeNodeBlocks.find( numNodes );
+		if (freeBlock != m_FreeNodeBlocks.end())
+		{
+			offset = freeBlock->second;
+			m_FreeNodeBlocks.erase( freeBlock );
+		}
+		else
+		{
+			offset = static_cast<TUInt32>(m_NodeMatrices.size());
+			m_NodeMatrices.resize( offset + numNodes );
+		}
+		for (TUInt32 n = 0; n < numNodes; ++n)
+		{
+			m_NodeMatrices[offset + n] = mesh->GetNodeMatrix( n );
+		}
+		m_NodeOverrides[slot] = offset;
+		AccountMemory();
+	}
+	m_NodeMatrices[m_NodeOverrides[slot] + node] = matrix;
+}
+
+// Go back to the mesh's node matrices
+void CMeshInstanceStore::ClearNodeOverrides( TMeshInstance instance )
+{
+	FreeNodeOverrides( m_HandleSlots[instance] );
+}
+
+
+//-----------------------------------------------------------------------------
+// Rendering
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Orders visible instances by mesh, with instances that have node overrides after the others of the same mesh
+	struct SInstanceOrder
+	{
+		const vector<CMesh*>*  meshes;
+		const vector<TUInt32>* nodeOverrides;
+		TUInt32                noOverrides;
+
+		bool operator()( TUInt32 a, TUInt32 b ) const
+		{
+			if ((*meshes)[a] != (*meshes)[b]) return (*meshes)[a] < (*meshes)[b];
+			bool aOverrides = ((*nodeOverrides)[a] != noOverrides);
+			bool bOverrides = ((*nodeOverrides)[b] != noOverrides);
+			if (aOverrides != bOverrides) return bOverrides;
+			return a < b;
+		}
+	};
+
+	// Instance data format, registered on first use
+	TVertexFormat InstanceFormat()
+	{
+		static TVertexFormat format = kNoVertexFormat;
+		if (format == kNoVertexFormat)
+		{
+			D3D11_INPUT_ELEMENT_DESC elements[] =
+			{
+				{ "WORLD", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 2,  0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+				{ "WORLD", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 2, 16, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+				{ "WORLD", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 2, 32, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+				{ "WORLD", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, 2, 48, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+				{ "COLOR", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 2, 64, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+			};
+			format = VertexFormatRegister( elements, sizeof(elements) / sizeof(elements[0]), sizeof(SInstanceData) );
+		}
+		return format;
+	}
+}
+
+// Render every visible instance
+void CMeshInstanceStore::Render( ID3DX11EffectTechnique* technique, ID3DX11EffectTechnique* instancedTechnique,
+                                 const CMatrix4x4& viewProjMatrix )
+{
+	PROFILE_FUNCTION();
+
+	// Frustum planes from the view-projection matrix (row vectors, so planes come from its columns). A point p
+	// is inside when dot(plane.xyz, p) + plane.w >= 0 for all six. Normalised so the sphere test can use distances
+	const CMatrix4x4& m = viewProjMatrix;
+	CVector4 planes[6] =
+	{
+		CVector4( m.e03 + m.e00, m.e13 + m.e10, m.e23 + m.e20, m.e33 + m.e30 ), // Left
+		CVector4( m.e03 - m.e00, m.e13 - m.e10, m.e23 - m.e20, m.e33 - m.e30 ), // Right
+		CVector4( m.e03 + m.e01, m.e13 + m.e11, m.e23 + m.e21, m.e33 + m.e31 ), // Bottom
+		CVector4( m.e03 - m.e01, m.e13 - m.e11, m.e23 - m.e21, m.e33 - m.e31 ), // Top
+		CVector4( m.e02,         m.e12,         m.e22,         m.e32         ), // Near (z >= 0 in DirectX)
+		CVector4( m.e03 - m.e02, m.e13 - m.e12, m.e23 - m.e22, m.e33 - m.e32 ), // Far
+	};
+	for (int p = 0; p < 6; ++p)
+	{
+		TFloat32 length = Sqrt( planes[p].x * planes[p].x + planes[p].y * planes[p].y + planes[p].z * planes[p].z );
+		if (length > 0.0f) planes[p] = planes[p] * (1.0f / length);
+	}
+
+	m_Visible.clear();
+	TUInt32 numInstances = NumInstances();
+	for (TUInt32 slot = 0; slot < numInstances; ++slot)
+	{
+		TUInt32 flags = m_Flags[slot];
+		if (flags & kInstanceHidden) continue;
+
+		if (!(flags & kInstanceNoCull))
+		{
+			const CVector4& sphere = m_Bounds[slot];
+			int p = 0;
+			while (p < 6 && planes[p].x * sphere.x + planes[p].y * sphere.y + planes[p].z * sphere.z + planes[p].w >= -sphere.w) ++p;
+			if (p < 6)
+			{
+				FrameStatsAdd( kCounterSubMeshesCulled, m_Meshes[slot]->GetNumSubMeshes() );
+				continue;
+			}
+		}
+
+		m_Visible.push_back( slot );
+	}
+
+	if (instancedTechnique)
+	{
+		RenderInstanced( instancedTechnique );
+	}
+
+	// Draw the rest one at a time, with the instance colour set for each
+	if (m_Visible.empty()) return;
+	ID3DX11EffectVariable* colourVar = Effect->GetVariableByName( "InstanceColour" );
+	for (TUInt32 i = 0; i < m_Visible.size(); ++i)
+	{
+		TUInt32 slot = m_Visible[i];
+		colourVar->SetRawValue( &m_Colours[slot], 0, 12 );
+		const CMatrix4x4* nodeMatrices = (m_NodeOverrides[slot] == kNoOverrides) ? 0 : &m_NodeMatrices[m_NodeOverrides[slot]];
+		m_Meshes[slot]->Render( technique, nodeMatrices, &m_WorldMatrices[slot] );
+	}
+	CVector3 white( 1.0f, 1.0f, 1.0f );
+	colourVar->SetRawValue( &white, 0, 12 );
+}
+
+// Draw the visible instances that can be instanced and remove them from m_Visible
+void CMeshInstanceStore::RenderInstanced( ID3DX11EffectTechnique* instancedTechnique )
+{
+	PROFILE_FUNCTION();
+
+	// Group the instances of each mesh together
+	SInstanceOrder order = { &m_Meshes, &m_NodeOverrides, kNoOverrides };
+	sort( m_Visible.begin(), m_Visible.end(), order );
+	TUInt32 numVisible = static_cast<TUInt32>(m_Visible.size());
+
+	// Count the instances in groups large enough to instance
+	TUInt32 numInstanced = 0;
+	for (TUInt32 first = 0, end; first < numVisible; first = end)
+	{
+		end = GroupEnd( first );
+		if (end - first >= kMinInstanced) numInstanced += end - first;
+	}
+	if (numInstanced == 0) return;
+
+	// Gather the data of those instances into the upload ring if there is one, otherwise the store's own instance buffer
+	ID3D11Buffer* buffer;
+	UINT offset = 0;
+	SInstanceData* instanceData;
+	if (m_UploadRing)
+	{
+		buffer = m_UploadRing->Buffer();
+		instanceData = static_cast<SInstanceData*>(m_UploadRing->Map( numInstanced * sizeof(SInstanceData), 16, &offset ));
+		if (!instanceData) return;
+	}
+	else
+	{
+		if (!ReserveInstanceBuffer( numInstanced )) return;
+		buffer = m_InstanceBuffer;
+		D3D11_MAPPED_SUBRESOURCE mappedData;
+		if (FAILED( g_pd3dContext->Map( m_InstanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedData ) )) return;
+		instanceData = static_cast<SInstanceData*>(mappedData.pData);
+		FrameStatsAdd( kCounterBufferDiscards );
+	}
+	for (TUInt32 first = 0, end; first < numVisible; first = end)
+	{
+		end = GroupEnd( first );
+		if (end - first < kMinInstanced) continue;
+		for (TUInt32 i = first; i < end; ++i)
+		{
+			TUInt32 slot = m_Visible[i];
+			const CVector3& colour = m_Colours[slot];
+			instanceData->worldMatrix = m_WorldMatrices[slot];
+			instanceData->colour = CVector4( colour.x, colour.y, colour.z, 1.0f );
+			++instanceData;
+		}
+	}
+	if (m_UploadRing) m_UploadRing->Unmap();
+	else              g_pd3dContext->Unmap( m_InstanceBuffer, 0 );
+	FrameStatsAdd( kCounterVertexBufferBytes, numInstanced * sizeof(SInstanceData) );
+
+	// Draw each group, and move the instances left over to the front of m_Visible (never past the group being read)
+	UINT stride = sizeof(SInstanceData);
+	g_pd3dContext->IASetVertexBuffers( 2, 1, &buffer, &stride, &offset );
+	FrameStatsAdd( kCounterBufferBinds );
+	TUInt32 numLeft = 0;
+	UINT startInstance = 0;
+	for (TUInt32 first = 0, end; first < numVisible; first = end)
+	{
+		end = GroupEnd( first );
+		if (end - first >= kMinInstanced)
+		{
+			m_Meshes[m_Visible[first]]->RenderInstanced( instancedTechnique, InstanceFormat(), startInstance, end - first );
+			startInstance += end - first;
+		}
+		else
+		{
+			for (TUInt32 i = first; i < end; ++i) m_Visible[numLeft++] = m_Visible[i];
+		}
+	}
+	m_Visible.resize( numLeft );
+}
+
+
+// CPU memory used by the store
+size_t CMeshInstanceStore::MemoryBytes() const
+{
+	return m_Meshes.capacity() * sizeof(CMesh*) + m_WorldMatrices.capacity() * sizeof(CMatrix4x4) +
+	       m_Bounds.capacity() * sizeof(CVector4) + m_Flags.capacity() * sizeof(TUInt32) +
+	       m_Colours.capacity() * sizeof(CVector3) + m_Visible.capacity() * sizeof(TUInt32) +
+	       m_NodeOverrides.capacity() * sizeof(TUInt32) + m_SlotHandles.capacity() * sizeof(TMeshInstance) +
+	       m_HandleSlots.capacity() * sizeof(TUInt32) + m_FreeHandles.capacity() * sizeof(TMeshInstance) +
+	       m_NodeMatrices.capacity() * sizeof(CMatrix4x4);
+}
+
+
+//-----------------------------------------------------------------------------
+// Support functions
+//-----------------------------------------------------------------------------
+
+// Recalculate the world space bounding sphere of the instance in a slot. The mesh's bounding radius is from its
+// origin, so the sphere is centred on the instance's position and scaled by its largest axis scale
+void CMeshInstanceStore::UpdateBounds( TUInt32 slot )
+{
+	const CMatrix4x4& worldMatrix = m_WorldMatrices[slot];
+	CVector3 scale = worldMatrix.GetScale();
+	TFloat32 maxScale = Max( scale.x, Max( scale.y, scale.z ) );
+	CVector3 position = worldMatrix.GetPosition();
+	m_Bounds[slot] = CVector4( position.x, position.y, position.z, m_Meshes[slot]->BoundingRadius() * maxScale );
+}
+
+// End of the group of visible instances (in m_Visible, sorted) starting at the given index - the instances of the
+// same mesh that either all have node overrides or all don't. Instances with overrides are not instanced
+TUInt32 CMeshInstanceStore::GroupEnd( TUInt32 first ) const
+{
+	TUInt32 numVisible = static_cast<TUInt32>(m_Visible.size());
+	CMesh* mesh = m_Meshes[m_Visible[first]];
+	bool overrides = (m_NodeOverrides[m_Visible[first]] != kNoOverrides);
+	if (overrides) return first + 1;
+
+	TUInt32 end = first + 1;
+	while (end < numVisible && m_Meshes[m_Visible[end]] == mesh && m_NodeOverrides[m_Visible[end]] == kNoOverrides) ++end;
+	return end;
+}
+
+// Make the instance buffer big enough for the given number of instances
+bool CMeshInstanceStore::ReserveInstanceBuffer( TUInt32 numInstances )
+{
+	if (numInstances <= m_InstanceCapacity) return true;
+
+	// Grow to fit every instance in the store, and at least double, so adding instances one at a time only
+	// recreates the buffer a few times
+	TUInt32 capacity = Max( Max( numInstances, NumInstances() ), m_InstanceCapacity * 2 );
+	if (m_InstanceBuffer)
+	{
+		m_InstanceBuffer->Release();
+		m_InstanceBuffer = 0;
+		m_InstanceCapacity = 0;
+		MemoryAccountRelease( kMemoryVertexBuffers, m_Name );
+	}
+	D3D11_BUFFER_DESC bufferDesc;
+	bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+	bufferDesc.ByteWidth = capacity * sizeof(SInstanceData);
+	bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	bufferDesc.MiscFlags = 0;
+	bufferDesc.StructureByteStride = 0;
+	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, NULL, &m_InstanceBuffer ) ))
+	{
+		m_InstanceBuffer = 0;
+		return false;
+	}
+	m_InstanceCapacity = capacity;
+	MemoryAccountAdd( kMemoryVertexBuffers, m_Name, bufferDesc.ByteWidth );
+	return true;
+}
+
+// Release the node overrides of the instance in a slot
+void CMeshInstanceStore::FreeNodeOverrides( TUInt32 slot )
+{
+	if (m_NodeOverrides[slot] == kNoOverrides) return;
+
+	m_FreeNodeBlocks.insert( make_pair( m_Meshes[slot]->GetNumNodes(), m_NodeOverrides[slot] ) );
+	m_NodeOverrides[slot] = kNoOverrides;
+}
+
+// Update the memory accounting for the store's arrays
+void CMeshInstanceStore::AccountMemory()
+{
+	MemoryAccountRelease( kMemoryMeshNodes, m_Name );
+	MemoryAccountAdd( kMemoryMeshNodes, m_Name, static_cast<long long>(MemoryBytes()) );
+}
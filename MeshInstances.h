@@ -0,0 +1,202 @@
+/*******************************************
+	MeshInstances.h
+
+	Lightweight placements of shared meshes.
+	A mesh (CMesh) is loaded once and holds the
+	geometry, materials and default node
+	matrices, each instance holds only a world
+	transform, node overrides and flags
+********************************************/
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "Mesh.h"
+#include "UploadRing.h"
+#include "CVector4.h"
+
+
+// Identifies an instance in a store
+typedef TUInt32 TMeshInstance;
+const TMeshInstance kNoMeshInstance = ~0u;
+
+// Instance flags
+enum EMeshInstanceFlags
+{
+	kInstanceHidden = 1, // Not rendered
+	kInstanceNoCull = 2, // Always rendered, e.g. if node overrides move it beyond its mesh's bounding radius
+};
+
+// Per-instance data for hardware instancing, read by the instanced techniques in Deferred.fx from vertex
+// buffer slot 2 (WORLD0-3 and COLOR1), after the position and attribute streams of the mesh
+struct SInstanceData
+{
+	CMatrix4x4 worldMatrix;
+	CVector4   colour;     // Multiplies the diffuse material, w unused
+};
+
+
+// Instances of any number of meshes. The data each frame touches is kept in parallel arrays (structure of
+// arrays), packed together with no gaps, so culling and submission walk it in order. Removing an instance
+// moves the last one into its place, so handles are mapped to array slots. Memory grows with the number of
+// placements only by the size of a transform and a few words, geometry is only held once by the mesh.
+// Instances keep pointers to their meshes, which must outlive them. Renders with g_pd3dContext, and must not
+// be changed while another thread is rendering it.
+// Visible instances of the same mesh can be drawn with hardware instancing: their world matrices and colours
+// are gathered into a per-frame instance buffer and each sub-mesh (or static batch) is drawn once for all of
+// them, rather than once per instance
+class CMeshInstanceStore
+{
+public:
+	CMeshInstanceStore( const string& name )
+		: m_Name( name ), m_UploadRing( 0 ), m_InstanceBuffer( 0 ), m_InstanceCapacity( 0 )
+	{
+	}
+
+	~CMeshInstanceStore()
+	{
+		Clear();
+	}
+
+
+	/////////////////////////////////////
+	// Instances
+
+	// Place a mesh with a world matrix, returns a handle to the new instance. Stores without an upload ring grow
+	// their instance buffer here, so rendering doesn't have to
+	TMeshInstance Add( CMesh* mesh, const CMatrix4x4& worldMatrix, TUInt32 flags = 0 );
+
+	// Remove an instance, its handle may be reused by a later Add
+	void Remove( TMeshInstance instance );
+
+	// Remove all instances
+	void Clear();
+
+	TUInt32 NumInstances() const
+	{
+		return static_cast<TUInt32>(m_Meshes.size());
+	}
+
+	CMesh* Mesh( TMeshInstance instance ) const
+	{
+		return m_Meshes[m_HandleSlots[instance]];
+	}
+
+	const CMatrix4x4& WorldMatrix( TMeshInstance instance ) const
+	{
+		return m_WorldMatrices[m_HandleSlots[instance]];
+	}
+	void SetWorldMatrix( TMeshInstance instance, const CMatrix4x4& worldMatrix );
+
+	TUInt32 Flags( TMeshInstance instance ) const
+	{
+		return m_Flags[m_HandleSlots[instance]];
+	}
+	void SetFlags( TMeshInstance instance, TUInt32 flags )
+	{
+		m_Flags[m_HandleSlots[instance]] = flags;
+	}
+
+	// Colour multiplying the diffuse material of the instance, white by default
+	const CVector3& Colour( TMeshInstance instance ) const
+	{
+		return m_Colours[m_HandleSlots[instance]];
+	}
+	void SetColour( TMeshInstance instance, const CVector3& colour )
+	{
+		m_Colours[m_HandleSlots[instance]] = colour;
+	}
+
+	// Override the matrix of a node for this instance only (in model space, relative to the instance's world matrix,
+	// like CMesh::GetNodeMatrix - nodes below it are not moved). The first override copies all the mesh's node matrices
+	// for the instance, other instances are unaffected. Sub-meshes merged into static batches (see
+	// CMesh::BuildStaticBatches) ignore node matrices, so overrides only affect meshes that are not batched
+	void SetNodeMatrix( TMeshInstance instance, TUInt32 node, const CMatrix4x4& matrix );
+
+	// Go back to the mesh's node matrices
+	void ClearNodeOverrides( TMeshInstance instance );
+
+
+	/////////////////////////////////////
+	// Rendering
+
+	// Render every instance not hidden whose bounding sphere is inside the view frustum of the given view-
+	// projection matrix. If an instanced technique is given (one taking SInstanceData in slot 2, such as
+	// GBufferInstanced) visible instances of a mesh are drawn together with it when there are at least
+	// kMinInstanced of them. Instances with node overrides are always drawn one at a time
+	void Render( ID3DX11EffectTechnique* technique, ID3DX11EffectTechnique* instancedTechnique, const CMatrix4x4& viewProjMatrix );
+
+	// Fewest visible instances of a mesh drawn with hardware instancing
+	static const TUInt32 kMinInstanced = 2;
+
+	// Write instance data into a shared upload ring (see UploadRing.h) rather than the store's own buffer.
+	// The ring must outlive the store, and needs the immediate context, so leave it unset for stores
+	// rendered with a deferred context
+	void SetUploadRing( CUploadRing* uploadRing )
+	{
+		m_UploadRing = uploadRing;
+	}
+
+	// CPU memory used by the store (bytes, array capacities)
+	size_t MemoryBytes() const;
+
+private:
+	// Disallow use of copy constructor and assignment operator (private and not defined)
+	CMeshInstanceStore( const CMeshInstanceStore& );
+	CMeshInstanceStore& operator=( const CMeshInstanceStore& );
+
+	static const TUInt32 kNoOverrides = ~0u;
+
+	// Recalculate the world space bounding sphere of the instance in a slot
+	void UpdateBounds( TUInt32 slot );
+
+	// Release the node overrides of the instance in a slot
+	void FreeNodeOverrides( TUInt32 slot );
+
+	// Draw the visible instances that can be instanced (groups of kMinInstanced or more of the same mesh
+	// without node overrides), and remove them from m_Visible
+	void RenderInstanced( ID3DX11EffectTechnique* instancedTechnique );
+
+	// End of the group of visible instances starting at the given index in m_Visible (after sorting)
+	TUInt32 GroupEnd( TUInt32 first ) const;
+
+	// Make the instance buffer big enough for the given number of instances, returns false on failure. Called as
+	// instances are added, rendering only checks it is big enough
+	bool ReserveInstanceBuffer( TUInt32 numInstances );
+
+	// Update the memory accounting for the store's arrays
+	void AccountMemory();
+
+	string m_Name; // Names the store in memory reports
+
+	// Instance data by slot, all the same length
+	vector<CMesh*>        m_Meshes;
+	vector<CMatrix4x4>    m_WorldMatrices;
+	vector<CVector4>      m_Bounds;        // World space bounding sphere, centre in xyz and radius in w
+	vector<TUInt32>       m_Flags;
+	vector<CVector3>      m_Colours;
+	vector<TUInt32>       m_NodeOverrides; // Offset of the instance's node matrices in m_NodeMatrices, or kNoOverrides
+	vector<TMeshInstance> m_SlotHandles;   // Handle of the instance in each slot
+
+	// Slot of each handle, and handles removed to be reused
+	vector<TUInt32>       m_HandleSlots;
+	vector<TMeshInstance> m_FreeHandles;
+
+	// Node matrices of instances with overrides, a full set for each such instance, and blocks of matrices freed
+	// when overrides are cleared (by number of matrices) to be reused
+	vector<CMatrix4x4>          m_NodeMatrices;
+	multimap<TUInt32, TUInt32>  m_FreeNodeBlocks;
+
+	// Slots of the instances visible in the current Render call. Capacity is kept between frames
+	vector<TUInt32>       m_Visible;
+
+	// Dynamic vertex buffer of SInstanceData, rewritten by each Render call that uses instancing, unless
+	// there is an upload ring
+	CUploadRing*          m_UploadRing;
+	ID3D11Buffer*         m_InstanceBuffer;
+	TUInt32               m_InstanceCapacity; // In instances
+};
@@ -0,0 +1,530 @@
+/*******************************************
+	MipGeneration.cpp
+
+	CPU mip chain generation
+********************************************/
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <emmintrin.h>
+using namespace std;
+
+#include "MipGeneration.h"
+#include "BlockCompression.h"
+#include "JobSystem.h"
+
+
+//-----------------------------------------------------------------------------
+// Filters and colour conversion
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Weights of the pixels of the mip above contributing to each pixel of a mip, along one axis. Pixel x of a mip is
+	// centred between pixels 2x and 2x+1 above, taps start at pixel 2x + first
+	struct SMipKernel
+	{
+		int   first;
+		int   numTaps;
+		float weights[8];
+	};
+
+	// Modified Bessel function of the first kind, order 0, for the Kaiser window
+	float BesselI0( float x )
+	{
+		float sum = 1.0f, term = 1.0f;
+		for (int k = 1; k < 20; ++k)
+		{
+			term *= (x * 0.5f / k) * (x * 0.5f / k);
+			sum += term;
+		}
+		return sum;
+	}
+
+	void MakeMipKernel( EMipFilter filter, SMipKernel* pKernel )
+	{
+		if (filter == kMipBox)
+		{
+			pKernel->first = 0;
+			pKernel->numTaps = 2;
+			pKernel->weights[0] = pKernel->weights[1] = 0.5f;
+			return;
+		}
+
+		// Sinc with its zeros at whole pixels of the mip, windowed to two of them either side (alpha 4)
+		const float kPi = 3.14159265f;
+		const float kAlpha = 4.0f;
+		const float kRadius = 2.0f;
+		pKernel->first = -3;
+		pKernel->numTaps = 8;
+		float total = 0.0f;
+		for (int tap = 0; tap < 8; ++tap)
+		{
+			float t = (tap - 3.5f) * 0.5f; // Distance from the centre in pixels of the mip
+			float sinc = sinf( kPi * t ) / (kPi * t);
+			float window = BesselI0( kAlpha * sqrtf( 1.0f - (t / kRadius) * (t / kRadius) ) ) / BesselI0( kAlpha );
+			pKernel->weights[tap] = sinc * window;
+			total += pKernel->weights[tap];
+		}
+		for (int tap = 0; tap < 8; ++tap) pKernel->weights[tap] /= total;
+	}
+
+	// Conversions between 8-bit values and floats from 0 to 1, through sRGB for colour in linear light. Linear values are
+	// encoded through a table of 65536 steps, finer than an 8-bit step of sRGB even near black
+	struct SColourTables
+	{
+		float  toUnit[256];
+		float  toLinear[256];
+		TUInt8 fromLinear[65536];
+
+		SColourTables()
+		{
+			for (int value = 0; value < 256; ++value)
+			{
+				float unit = value / 255.0f;
+				toUnit[value] = unit;
+				toLinear[value] = (unit <= 0.04045f) ? unit / 12.92f : powf( (unit + 0.055f) / 1.055f, 2.4f );
+			}
+			for (int step = 0; step < 65536; ++step)
+			{
+				float linear = step / 65535.0f;
+				float unit = (linear <= 0.0031308f) ? linear * 12.92f : 1.055f * powf( linear, 1.0f / 2.4f ) - 0.055f;
+				fromLinear[step] = static_cast<TUInt8>(unit * 255.0f + 0.5f);
+			}
+		}
+	};
+
+	const SColourTables& ColourTables()
+	{
+		static SColourTables tables;
+		return tables;
+	}
+
+	// Value of a channel of a pixel of the mip above: full precision values, or the 8-bit top mip converted through tables
+	inline float ChannelValue( const float* row, int x, int channel, const float*, const float* )
+	{
+		return row[x * 4 + channel];
+	}
+
+	inline float ChannelValue( const TUInt8* row, int x, int channel, const float* colourTable, const float* alphaTable )
+	{
+		return ((channel == 3) ? alphaTable : colourTable)[row[x * 4 + channel]];
+	}
+
+	inline __m128 PixelValues( const float* row, int x, const float*, const float* )
+	{
+		return _mm_loadu_ps( row + x * 4 );
+	}
+
+	inline __m128 PixelValues( const TUInt8* row, int x, const float* colourTable, const float* alphaTable )
+	{
+		const TUInt8* pixel = row + x * 4;
+		return _mm_setr_ps( colourTable[pixel[0]], colourTable[pixel[1]], colourTable[pixel[2]], alphaTable[pixel[3]] );
+	}
+
+	// Scale for alpha in a mip so the given fraction of its pixels is above the reference, the alpha test value. The
+	// threshold is put halfway between the lowest alpha that should pass and the highest that shouldn't
+	float AlphaCoverageScale( const float* values, TUInt32 numPixels, float coverage, float reference )
+	{
+		TUInt32 covered = static_cast<TUInt32>(coverage * numPixels + 0.5f);
+		if (covered == 0)
+		{
+			return 1.0f;
+		}
+		vector<float> alphas( numPixels );
+		for (TUInt32 pixel = 0; pixel < numPixels; ++pixel) alphas[pixel] = values[pixel * 4 + 3];
+		nth_element( alphas.begin(), alphas.begin() + (covered - 1), alphas.end(), greater<float>() );
+		float lowestCovered = alphas[covered - 1];
+		float highestUncovered = (covered < numPixels) ? *max_element( alphas.begin() + covered, alphas.end() ) : 0.0f;
+		float threshold = (lowestCovered + highestUncovered) * 0.5f;
+		return (threshold > 0.0f) ? reference / threshold : 1.0f;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Scalar kernels
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Filter a row of the mip above horizontally, to the width of the next mip. Taps beyond the edges repeat the edge pixels
+	template <class TPixel>
+	void FilterRowScalar( const TPixel* row, TUInt32 sourceWidth, float* out, TUInt32 destWidth, const SMipKernel& kernel,
+	                      const float* colourTable, const float* alphaTable )
+	{
+		int lastX = static_cast<int>(sourceWidth) - 1;
+		for (int x = 0; x < static_cast<int>(destWidth); ++x)
+		{
+			int firstX = 2 * x + kernel.first;
+			int sourceX[8];
+			for (int tap = 0; tap < kernel.numTaps; ++tap) sourceX[tap] = min( max( firstX + tap, 0 ), lastX );
+			for (int channel = 0; channel < 4; ++channel)
+			{
+				float sum = ChannelValue( row, sourceX[0], channel, colourTable, alphaTable ) * kernel.weights[0];
+				for (int tap = 1; tap < kernel.numTaps; ++tap)
+				{
+					sum = sum + ChannelValue( row, sourceX[tap], channel, colourTable, alphaTable ) * kernel.weights[tap];
+				}
+				out[x * 4 + channel] = sum;
+			}
+		}
+	}
+
+	// Filter horizontally filtered rows vertically, giving a row of the next mip
+	void FilterColumnScalar( const float* const* rows, float* out, TUInt32 width, const SMipKernel& kernel )
+	{
+		for (size_t i = 0; i < static_cast<size_t>(width) * 4; ++i)
+		{
+			float sum = rows[0][i] * kernel.weights[0];
+			for (int tap = 1; tap < kernel.numTaps; ++tap) sum = sum + rows[tap][i] * kernel.weights[tap];
+			out[i] = sum;
+		}
+	}
+
+	// Rows [begin, end) of a filtered mip to 8 bits, alpha scaled
+	void EncodeRowsScalar( const float* values, TUInt8* pixels, TUInt32 width, bool linearColour, float alphaScale, int begin, int end )
+	{
+		const TUInt8* fromLinear = ColourTables().fromLinear;
+		float colourSteps = linearColour ? 65535.0f : 255.0f;
+		for (size_t i = static_cast<size_t>(begin) * width * 4; i < static_cast<size_t>(end) * width * 4; i += 4)
+		{
+			for (int channel = 0; channel < 4; ++channel)
+			{
+				float value = values[i + channel] * ((channel == 3) ? alphaScale : 1.0f);
+				value = min( max( value, 0.0f ), 1.0f );
+				int step = static_cast<int>(value * ((channel == 3) ? 255.0f : colourSteps) + 0.5f);
+				pixels[i + channel] = static_cast<TUInt8>((channel < 3 && linearColour) ? fromLinear[step] : step);
+			}
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// SSE kernels
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// The four channels of a pixel in one register. Taps are only clamped to the edges for pixels near them
+	template <class TPixel>
+	void FilterRowSSE( const TPixel* row, TUInt32 sourceWidth, float* out, TUInt32 destWidth, const SMipKernel& kernel,
+	                   const float* colourTable, const float* alphaTable )
+	{
+		__m128 weights[8];
+		for (int tap = 0; tap < kernel.numTaps; ++tap) weights[tap] = _mm_set1_ps( kernel.weights[tap] );
+
+		int lastX = static_cast<int>(sourceWidth) - 1;
+		for (int x = 0; x < static_cast<int>(destWidth); ++x)
+		{
+			int firstX = 2 * x + kernel.first;
+			__m128 sum;
+			if (firstX >= 0 && firstX + kernel.numTaps - 1 <= lastX)
+			{
+				sum = _mm_mul_ps( PixelValues( row, firstX, colourTable, alphaTable ), weights[0] );
+				for (int tap = 1; tap < kernel.numTaps; ++tap)
+				{
+					sum = _mm_add_ps( sum, _mm_mul_ps( PixelValues( row, firstX + tap, colourTable, alphaTable ), weights[tap] ) );
+				}
+			}
+			else
+			{
+				sum = _mm_mul_ps( PixelValues( row, min( max( firstX, 0 ), lastX ), colourTable, alphaTable ), weights[0] );
+				for (int tap = 1; tap < kernel.numTaps; ++tap)
+				{
+					int sourceX = min( max( firstX + tap, 0 ), lastX );
+					sum = _mm_add_ps( sum, _mm_mul_ps( PixelValues( row, sourceX, colourTable, alphaTable ), weights[tap] ) );
+				}
+			}
+			_mm_storeu_ps( out + x * 4, sum );
+		}
+	}
+
+	// Rows are RGBA interleaved, so four values at a time is one pixel at a time
+	void FilterColumnSSE( const float* const* rows, float* out, TUInt32 width, const SMipKernel& kernel )
+	{
+		__m128 weights[8];
+		for (int tap = 0; tap < kernel.numTaps; ++tap) weights[tap] = _mm_set1_ps( kernel.weights[tap] );
+
+		for (size_t i = 0; i < static_cast<size_t>(width) * 4; i += 4)
+		{
+			__m128 sum = _mm_mul_ps( _mm_loadu_ps( rows[0] + i ), weights[0] );
+			for (int tap = 1; tap < kernel.numTaps; ++tap)
+			{
+				sum = _mm_add_ps( sum, _mm_mul_ps( _mm_loadu_ps( rows[tap] + i ), weights[tap] ) );
+			}
+			_mm_storeu_ps( out + i, sum );
+		}
+	}
+
+	// Scale, clamp and convert a pixel at a time, then look up the colour in the sRGB table
+	void EncodeRowsSSE( const float* values, TUInt8* pixels, TUInt32 width, bool linearColour, float alphaScale, int begin, int end )
+	{
+		const TUInt8* fromLinear = ColourTables().fromLinear;
+		float colourSteps = linearColour ? 65535.0f : 255.0f;
+		const __m128 scale = _mm_setr_ps( 1.0f, 1.0f, 1.0f, alphaScale );
+		const __m128 steps = _mm_setr_ps( colourSteps, colourSteps, colourSteps, 255.0f );
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps( 1.0f ), half = _mm_set1_ps( 0.5f );
+		for (size_t i = static_cast<size_t>(begin) * width * 4; i < static_cast<size_t>(end) * width * 4; i += 4)
+		{
+			__m128 value = _mm_min_ps( _mm_max_ps( _mm_mul_ps( _mm_loadu_ps( values + i ), scale ), zero ), one );
+			TUInt32 step[4];
+			_mm_storeu_si128( reinterpret_cast<__m128i*>(step), _mm_cvttps_epi32( _mm_add_ps( _mm_mul_ps( value, steps ), half ) ) );
+			if (linearColour)
+			{
+				pixels[i]     = fromLinear[step[0]];
+				pixels[i + 1] = fromLinear[step[1]];
+				pixels[i + 2] = fromLinear[step[2]];
+			}
+			else
+			{
+				pixels[i]     = static_cast<TUInt8>(step[0]);
+				pixels[i + 1] = static_cast<TUInt8>(step[1]);
+				pixels[i + 2] = static_cast<TUInt8>(step[2]);
+			}
+			pixels[i + 3] = static_cast<TUInt8>(step[3]);
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Mip generation
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Call function( begin, end ) over the rows [0, numRows), spread over the job system if parallel
+	template <class TFunc>
+	void ForRows( TUInt32 numRows, bool parallel, const TFunc& function )
+	{
+		if (parallel) ParallelFor( 0, static_cast<int>(numRows), kMipRowsPerJob, function, "GenerateMips" );
+		else          function( 0, static_cast<int>(numRows) );
+	}
+
+	// Filter rows [begin, end) of the next mip from the mip above. Rows of the mip above filtered horizontally are kept in a
+	// ring of one per tap, rows needed for a row of the next mip being consecutive, so each is filtered once per call
+	template <class TPixel>
+	void FilterMipRows( const TPixel* source, TUInt32 sourceWidth, TUInt32 sourceHeight, float* dest, TUInt32 destWidth,
+	                    const SMipKernel& kernel, const float* colourTable, const float* alphaTable, bool sse, int begin, int end )
+	{
+		size_t rowValues = static_cast<size_t>(destWidth) * 4;
+		vector<float> ring( rowValues * kernel.numTaps );
+		int ringRows[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+		int lastY = static_cast<int>(sourceHeight) - 1;
+		for (int y = begin; y < end; ++y)
+		{
+			const float* rows[8];
+			for (int tap = 0; tap < kernel.numTaps; ++tap)
+			{
+				int sourceY = min( max( 2 * y + kernel.first + tap, 0 ), lastY );
+				int slot = sourceY % kernel.numTaps;
+				float* filtered = &ring[slot * rowValues];
+				if (ringRows[slot] != sourceY)
+				{
+					const TPixel* row = source + static_cast<size_t>(sourceY) * sourceWidth * 4;
+					if (sse) FilterRowSSE( row, sourceWidth, filtered, destWidth, kernel, colourTable, alphaTable );
+					else     FilterRowScalar( row, sourceWidth, filtered, destWidth, kernel, colourTable, alphaTable );
+					ringRows[slot] = sourceY;
+				}
+				rows[tap] = filtered;
+			}
+			if (sse) FilterColumnSSE( rows, dest + y * rowValues, destWidth, kernel );
+			else     FilterColumnScalar( rows, dest + y * rowValues, destWidth, kernel );
+		}
+	}
+
+	bool ContainsAny( const string& name, const char* const* words, int numWords )
+	{
+		for (int word = 0; word < numWords; ++word)
+		{
+			if (name.find( words[word] ) != string::npos) return true;
+		}
+		return false;
+	}
+}
+
+// Settings for a texture file, by its name
+SMipSettings MipSettingsForFile( const string& fileName )
+{
+	static const char* const kNormalMapWords[] = { "normal" };
+	static const char* const kFoliageWords[] = { "tree", "plant", "fence" };
+
+	string name = fileName;
+	transform( name.begin(), name.end(), name.begin(), ::tolower );
+	SMipSettings settings;
+	settings.filter = kMipKaiser;
+	settings.linearColour = !ContainsAny( name, kNormalMapWords, 1 );
+	settings.alphaCoverage = ContainsAny( name, kFoliageWords, 3 ) ? 0.5f : 0.0f;
+	return settings;
+}
+
+// Number of mips in a full chain down to 1x1
+TUInt32 FullMipLevels( TUInt32 width, TUInt32 height )
+{
+	TUInt32 levels = 1;
+	for (TUInt32 size = max( width, height ); size > 1; size >>= 1) ++levels;
+	return levels;
+}
+
+// Generate a full mip chain for each slice of an R8G8B8A8 image from its top mip
+bool GenerateMips( const STextureImage& source, STextureImage* pMipped, const SMipSettings& settings,
+                   EMipMethod method /*= kMipSSE*/, bool parallel /*= true*/ )
+{
+	if ((source.format != DXGI_FORMAT_R8G8B8A8_UNORM && source.format != DXGI_FORMAT_R8G8B8A8_UNORM_SRGB) ||
+	    source.width == 0 || source.height == 0 || source.data.size() < static_cast<size_t>(TextureSliceBytes( source )) * source.arraySize)
+	{
+		return false;
+	}
+
+	STextureImage mipped;
+	mipped.format = source.format;
+	mipped.width = source.width;
+	mipped.height = source.height;
+	mipped.mipLevels = FullMipLevels( source.width, source.height );
+	mipped.arraySize = source.arraySize;
+	mipped.data.resize( static_cast<size_t>(TextureSliceBytes( mipped )) * mipped.arraySize );
+
+	SMipKernel kernel;
+	MakeMipKernel( settings.filter, &kernel );
+	const SMipKernel* pKernel = &kernel;
+	bool linearColour = settings.linearColour;
+	bool sse = (method == kMipSSE);
+
+	// Each mip is filtered from the full precision values of the mip above, horizontally then vertically. The top mip is
+	// converted from 8 bits as it is filtered
+	const SColourTables& tables = ColourTables();
+	const float* colourTable = linearColour ? tables.toLinear : tables.toUnit;
+	const float* alphaTable = tables.toUnit;
+	vector<float> above, mip;
+	TUInt8* dest = &mipped.data[0];
+	for (TUInt32 slice = 0; slice < source.arraySize; ++slice)
+	{
+		TUInt32 width = source.width, height = source.height;
+		const TUInt8* top = &source.data[static_cast<size_t>(TextureSliceBytes( source )) * slice];
+		memcpy( dest, top, static_cast<size_t>(width) * height * 4 );
+		dest += static_cast<size_t>(width) * height * 4;
+		float coverage = (settings.alphaCoverage > 0.0f) ? MipAlphaCoverage( source, slice, 0, settings.alphaCoverage ) : 0.0f;
+
+		for (TUInt32 level = 1; level < mipped.mipLevels; ++level)
+		{
+			TUInt32 mipWidth = max( width >> 1, 1u ), mipHeight = max( height >> 1, 1u );
+			mip.resize( static_cast<size_t>(mipWidth) * mipHeight * 4 );
+			const float* aboveValues = (level > 1) ? &above[0] : 0;
+			float* mipValues = &mip[0];
+			ForRows( mipHeight, parallel, [top, aboveValues, width, height, mipValues, mipWidth, pKernel, colourTable, alphaTable, sse]( int begin, int end )
+			{
+				if (aboveValues) FilterMipRows( aboveValues, width, height, mipValues, mipWidth, *pKernel, colourTable, alphaTable, sse, begin, end );
+				else             FilterMipRows( top, width, height, mipValues, mipWidth, *pKernel, colourTable, alphaTable, sse, begin, end );
+			} );
+
+			float alphaScale = (coverage > 0.0f) ? AlphaCoverageScale( mipValues, mipWidth * mipHeight, coverage, settings.alphaCoverage ) : 1.0f;
+			ForRows( mipHeight, parallel, [mipValues, dest, mipWidth, linearColour, alphaScale, sse]( int begin, int end )
+			{
+				if (sse) EncodeRowsSSE( mipValues, dest, mipWidth, linearColour, alphaScale, begin, end );
+				else     EncodeRowsScalar( mipValues, dest, mipWidth, linearColour, alphaScale, begin, end );
+			} );
+
+			dest += static_cast<size_t>(mipWidth) * mipHeight * 4;
+			above.swap( mip );
+			width = mipWidth;
+			height = mipHeight;
+		}
+	}
+
+	pMipped->format = mipped.format;
+	pMipped->width = mipped.width;
+	pMipped->height = mipped.height;
+	pMipped->mipLevels = mipped.mipLevels;
+	pMipped->arraySize = mipped.arraySize;
+	pMipped->data.swap( mipped.data );
+	return true;
+}
+
+// Fraction of the pixels of one mip of an R8G8B8A8 image with alpha above a value
+float MipAlphaCoverage( const STextureImage& image, TUInt32 slice, TUInt32 mip, float alphaReference )
+{
+	size_t offset = static_cast<size_t>(TextureSliceBytes( image )) * slice;
+	for (TUInt32 level = 0; level < mip; ++level)
+	{
+		offset += TextureSurfaceBytes( image.format, max( image.width >> level, 1u ), max( image.height >> level, 1u ) );
+	}
+	TUInt32 numPixels = max( image.width >> mip, 1u ) * max( image.height >> mip, 1u );
+	TUInt32 covered = 0;
+	for (TUInt32 pixel = 0; pixel < numPixels; ++pixel)
+	{
+		if (image.data[offset + pixel * 4 + 3] > alphaReference * 255.0f) ++covered;
+	}
+	return static_cast<float>(covered) / numPixels;
+}
+
+
+//-----------------------------------------------------------------------------
+// Loading
+//-----------------------------------------------------------------------------
+
+// Read a texture file and process it: mips generated, then compressed
+bool ReadProcessedTexture( const string& fileName, TUInt32 options, STextureImage* pImage )
+{
+	if (options == 0)
+	{
+		return false;
+	}
+
+	// Block compressed files are only decoded to give them mips
+	STextureImage file, image;
+	bool fileCompressed = false;
+	if (!ReadImageRGBA( fileName, &image ))
+	{
+		if ((options & kTextureGenerateMips) == 0 || !ReadTextureImage( fileName, &file ) || !DecompressTextureImage( file, &image ))
+		{
+			return false;
+		}
+		fileCompressed = true;
+	}
+	bool generateMips = (options & kTextureGenerateMips) != 0 && image.mipLevels == 1 && FullMipLevels( image.width, image.height ) > 1;
+	if (generateMips)
+	{
+		STextureImage mipped;
+		if (!GenerateMips( image, &mipped, MipSettingsForFile( fileName ) )) return false;
+		swap( image, mipped );
+	}
+	else if (fileCompressed || (options & kTextureCompress) == 0)
+	{
+		return false; // Nothing to do
+	}
+
+	// Compressed files go back to their own format, keeping their own top mip rather than a second encoding of it
+	DXGI_FORMAT format = fileCompressed ? file.format : ChooseBlockFormat( image );
+	if ((fileCompressed || (options & kTextureCompress) != 0) && image.width % 4 == 0 && image.height % 4 == 0)
+	{
+		STextureImage compressed;
+		if (!CompressTextureImage( image, format, &compressed )) return false;
+		if (fileCompressed)
+		{
+			size_t topBytes = TextureSurfaceBytes( format, image.width, image.height );
+			for (TUInt32 slice = 0; slice < image.arraySize; ++slice)
+			{
+				memcpy( &compressed.data[TextureSliceBytes( compressed ) * slice], &file.data[topBytes * slice], topBytes );
+			}
+		}
+		swap( image, compressed );
+	}
+
+	swap( *pImage, image );
+	return true;
+}
+
+// Create a texture from a processed file
+ID3D11ShaderResourceView* LoadProcessedTexture( ID3D11Device* device, const string& fileName, TUInt32 options )
+{
+	STextureImage image;
+	if (!ReadProcessedTexture( fileName, options, &image ))
+	{
+		return 0;
+	}
+	return CreateTextureView( device, image, false );
+}
@@ -0,0 +1,85 @@
+/*******************************************
+	MipGeneration.h
+
+	CPU mip chain generation for 8-bit RGBA
+	images that arrive without mips (JPEGs,
+	PNGs and single mip DDS files). Colour is
+	filtered in linear light with a box or
+	Kaiser-windowed sinc filter, and alpha
+	can be rescaled in each mip to keep the
+	coverage of alpha tested foliage. Rows of
+	each mip are filtered with SSE, spread
+	over the job system
+********************************************/
+
+#pragma once
+
+#include <string>
+using namespace std;
+
+#include "Defines.h"
+#include "TextureArrays.h"
+
+
+//-----------------------------------------------------------------------------
+// Mip generation
+//-----------------------------------------------------------------------------
+
+// Filters for each mip from the one above it
+enum EMipFilter
+{
+	kMipBox,    // Average of 2x2 pixels
+	kMipKaiser, // Kaiser-windowed sinc over 8x8 pixels, sharper with less aliasing
+};
+
+// How mips are filtered. Both give the same results
+enum EMipMethod
+{
+	kMipScalar, // One channel at a time, the reference for the SSE version
+	kMipSSE,    // The four channels of a pixel at a time with SSE
+};
+
+// Settings for generating mips of an image
+struct SMipSettings
+{
+	EMipFilter filter;
+	bool       linearColour;  // Colour is sRGB encoded, filter it in linear light (alpha is always filtered as it is)
+	float      alphaCoverage; // Keep the fraction of pixels with alpha above this value in every mip as it is in the top mip, for
+	                          // alpha tested textures (0 for off)
+};
+
+// Settings for a texture file: Kaiser filter in linear light, except for normal maps (names containing "normal") which are
+// filtered as they are. Foliage (names containing "tree", "plant" or "fence") keeps its coverage at alpha 0.5
+SMipSettings MipSettingsForFile( const string& fileName );
+
+// Number of mips in a full chain down to 1x1
+TUInt32 FullMipLevels( TUInt32 width, TUInt32 height );
+
+// Rows of pixels given to each job by GenerateMips
+const TUInt32 kMipRowsPerJob = 16;
+
+// Generate a full mip chain for each slice of an R8G8B8A8 image from its top mip, each mip filtered from the mip above it
+// at full precision. Mips of odd sizes drop the last row or column of the mip above. With parallel, rows of each mip are
+// spread over the job system, returning once all are done. Returns false if the image is not R8G8B8A8
+bool GenerateMips( const STextureImage& source, STextureImage* pMipped, const SMipSettings& settings,
+                   EMipMethod method = kMipSSE, bool parallel = true );
+
+// Fraction of the pixels of one mip of an R8G8B8A8 image with alpha above a value
+float MipAlphaCoverage( const STextureImage& image, TUInt32 slice, TUInt32 mip, float alphaReference );
+
+
+//-----------------------------------------------------------------------------
+// Loading
+//-----------------------------------------------------------------------------
+
+// Processing of texture files by ReadProcessedTexture, combined as bits
+const TUInt32 kTextureCompress     = 1; // Block compress uncompressed images, BC1 or BC3 (see ChooseBlockFormat)
+const TUInt32 kTextureGenerateMips = 2; // Generate mips for images with only one (see MipSettingsForFile)
+
+// Read a texture file and process it: mips generated, then compressed. Block compressed files without mips are decoded,
+// given mips and compressed again in their own format. Images not a multiple of 4 in size are not compressed. Returns false
+// if the file can't be read or there is nothing to do for it - load it as usual then
+bool ReadProcessedTexture( const string& fileName, TUInt32 options, STextureImage* pImage );
+
+// Create a texture from a file processed by ReadProcessedTexture. Returns 0 if there was nothing to do or on failure
+ID3D11ShaderResourceView* LoadProcessedTexture( ID3D11Device* device, const string& fileName, TUInt32 options );
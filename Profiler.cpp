@@ -0,0 +1,223 @@
+/*******************************************
+	Profiler.cpp
+
+	Hierarchical CPU frame profiler
+********************************************/
+
+#include <cstdio>
+#include <vector>
+#include <mutex>
+using namespace std;
+
+#include "Profiler.h"
+
+
+//-----------------------------------------------------------------------------
+// Profiler data
+//-----------------------------------------------------------------------------
+
+atomic<bool> g_ProfilerActive( false );
+
+namespace
+{
+	// An event collected from a thread buffer, tagged with the thread it came from
+	struct SCapturedEvent
+	{
+		SProfileEvent event;
+		unsigned int  thread;
+	};
+
+	// All thread buffers ever created. Buffers are never released while the program runs (until
+	// ProfilerShutdown), so threads that exit do not leave dangling pointers
+	mutex                         BuffersMutex;
+	vector<CProfileThreadBuffer*> ThreadBuffers;
+
+	// Buffer for the calling thread, registered on first use
+	thread_local CProfileThreadBuffer* ThreadBuffer = 0;
+
+	// Current capture
+	vector<SCapturedEvent> CaptureEvents;
+	string                 CaptureFileName;
+	unsigned int           CaptureFramesLeft = 0;
+	TClockTicks            CaptureStart = 0;
+	unsigned int           CaptureDroppedStart = 0;
+
+
+	// Total events dropped across all threads, BuffersMutex must be held
+	unsigned int TotalDropped()
+	{
+		unsigned int dropped = 0;
+		for (size_t b = 0; b < ThreadBuffers.size(); ++b)
+		{
+			dropped += ThreadBuffers[b]->Dropped();
+		}
+		return dropped;
+	}
+
+	// Move all pending events from thread buffers into the capture (or discard them)
+	void CollectEvents( bool keep )
+	{
+		lock_guard<mutex> lock( BuffersMutex );
+		SCapturedEvent captured;
+		for (size_t b = 0; b < ThreadBuffers.size(); ++b)
+		{
+			captured.thread = ThreadBuffers[b]->ThreadIndex();
+			while (ThreadBuffers[b]->Pop( &captured.event ))
+			{
+				if (keep) CaptureEvents.push_back( captured );
+			}
+		}
+	}
+
+	// Write a string as a JSON string literal (names are usually literals, but be safe)
+	void WriteJSONString( FILE* file, const char* text )
+	{
+		fputc( '"', file );
+		for (; *text; ++text)
+		{
+			if (*text == '"' || *text == '\\') fputc( '\\', file );
+			if (static_cast<unsigned char>(*text) >= 0x20) fputc( *text, file );
+		}
+		fputc( '"', file );
+	}
+
+	// Write the current capture to a file in Chrome trace event format. Each scope becomes a
+	// "complete" event (ph:X), the viewer reconstructs the nesting from the timestamps
+	bool ExportChromeTrace( const string& fileName )
+	{
+		FILE* file = fopen( fileName.c_str(), "w" );
+		if (!file)
+		{
+			return false;
+		}
+
+		fprintf( file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+
+		// Thread names first, as metadata events
+		bool first = true;
+		{
+			lock_guard<mutex> lock( BuffersMutex );
+			for (size_t b = 0; b < ThreadBuffers.size(); ++b)
+			{
+				if (ThreadBuffers[b]->m_Name.empty()) continue;
+				fprintf( file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+				         first ? "" : ",\n", ThreadBuffers[b]->ThreadIndex() );
+				WriteJSONString( file, ThreadBuffers[b]->m_Name.c_str() );
+				fprintf( file, "}}" );
+				first = false;
+			}
+		}
+
+		for (size_t e = 0; e < CaptureEvents.size(); ++e)
+		{
+			const SProfileEvent& event = CaptureEvents[e].event;
+			fprintf( file, "%s{\"name\":", first ? "" : ",\n" );
+			WriteJSONString( file, event.name );
+			fprintf( file, ",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"depth\":%u}}",
+			         CaptureEvents[e].thread, ClockTicksToMicroseconds( event.start - CaptureStart ),
+			         ClockTicksToMicroseconds( event.end - event.start ), event.depth );
+			first = false;
+		}
+
+		unsigned int dropped;
+		{
+			lock_guard<mutex> lock( BuffersMutex );
+			dropped = TotalDropped() - CaptureDroppedStart;
+		}
+		fprintf( file, "\n],\"otherData\":{\"droppedEvents\":%u}}\n", dropped );
+
+		bool success = (ferror( file ) == 0);
+		fclose( file );
+		return success;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Thread buffers
+//-----------------------------------------------------------------------------
+
+// Get the event buffer for the calling thread, creating and registering it on first use
+CProfileThreadBuffer* ProfilerThreadBuffer()
+{
+	if (!ThreadBuffer)
+	{
+		lock_guard<mutex> lock( BuffersMutex );
+		ThreadBuffer = new CProfileThreadBuffer( static_cast<unsigned int>(ThreadBuffers.size()) );
+		ThreadBuffers.push_back( ThreadBuffer );
+	}
+	return ThreadBuffer;
+}
+
+// Name the calling thread in captures (e.g. "Main", "Worker 3")
+void ProfilerSetThreadName( const char* name )
+{
+	CProfileThreadBuffer* buffer = ProfilerThreadBuffer();
+	lock_guard<mutex> lock( BuffersMutex );
+	buffer->m_Name = name;
+}
+
+
+//-----------------------------------------------------------------------------
+// Capture control
+//-----------------------------------------------------------------------------
+
+// Start capturing events for the given number of frames. The capture is written to the given
+// file as Chrome trace JSON when complete. Ignored if a capture is already running
+void ProfilerBeginCapture( unsigned int numFrames, const string& fileName )
+{
+	if (ProfilerIsCapturing() || numFrames == 0) return;
+
+	// Throw away anything left over from scopes that were still open when the last capture ended
+	CollectEvents( false );
+
+	CaptureEvents.clear();
+	CaptureEvents.reserve( 4096 );
+	CaptureFileName = fileName;
+	CaptureFramesLeft = numFrames;
+	{
+		lock_guard<mutex> lock( BuffersMutex );
+		CaptureDroppedStart = TotalDropped();
+	}
+	CaptureStart = ClockTicks();
+	g_ProfilerActive.store( true, memory_order_relaxed );
+}
+
+// Is a capture currently running
+bool ProfilerIsCapturing()
+{
+	return CaptureFramesLeft > 0;
+}
+
+// Call once at the end of every frame from the main thread. Collects events from all threads and
+// finishes the capture once enough frames have been seen
+void ProfilerEndFrame()
+{
+	if (!ProfilerIsCapturing()) return;
+
+	// Empty the thread buffers every frame so they only need to hold a single frame of events
+	CollectEvents( true );
+
+	if (--CaptureFramesLeft == 0)
+	{
+		g_ProfilerActive.store( false, memory_order_relaxed );
+		ExportChromeTrace( CaptureFileName );
+		CaptureEvents.clear();
+	}
+}
+
+// Release all profiler memory. No profiling markers may be active on any thread
+void ProfilerShutdown()
+{
+	g_ProfilerActive.store( false, memory_order_relaxed );
+	CaptureFramesLeft = 0;
+	CaptureEvents.clear();
+
+	lock_guard<mutex> lock( BuffersMutex );
+	for (size_t b = 0; b < ThreadBuffers.size(); ++b)
+	{
+		delete ThreadBuffers[b];
+	}
+	ThreadBuffers.clear();
+	ThreadBuffer = 0; // Only clears the calling thread's pointer, other threads must have finished
+}
@@ -0,0 +1,185 @@
+/*******************************************
+	Profiler.h
+
+	Hierarchical CPU frame profiler. Code is
+	marked up with scoped markers, captures
+	are exported as Chrome trace JSON (open in
+	chrome://tracing or ui.perfetto.dev)
+********************************************/
+
+#pragma once
+
+#include <atomic>
+#include <string>
+using namespace std;
+
+#include "Clock.h"
+
+
+//-----------------------------------------------------------------------------
+// Profiling markers
+//-----------------------------------------------------------------------------
+
+// Mark the remainder of the current block as a named profiling scope. Scopes nest, and the name
+// must be a string literal (only the pointer is stored). Define NO_PROFILER to compile them out
+#ifndef NO_PROFILER
+	#define PROFILE_CONCAT_INNER( a, b ) a##b
+	#define PROFILE_CONCAT( a, b ) PROFILE_CONCAT_INNER( a, b )
+	#define PROFILE_SCOPE( name ) CProfileScope PROFILE_CONCAT( profileScope, __LINE__ )( name )
+	#define PROFILE_FUNCTION() PROFILE_SCOPE( __FUNCTION__ )
+#else
+	#define PROFILE_SCOPE( name )
+	#define PROFILE_FUNCTION()
+#endif
+
+
+//-----------------------------------------------------------------------------
+// Types
+//-----------------------------------------------------------------------------
+
+// A single completed profiling scope
+struct SProfileEvent
+{
+	const char*  name;
+	TClockTicks  start;
+	TClockTicks  end;
+	unsigned int depth; // Nesting depth within its thread, 0 = outermost
+};
+
+
+// Fixed size ring buffer of events owned by a single thread. Only the owning thread pushes events
+// and only the capture code (main thread) pops them, so no locks are needed - the head and tail
+// are each written by one side only
+class CProfileThreadBuffer
+{
+public:
+	static const unsigned int kCapacity = 1 << 14; // Must be a power of two
+
+	CProfileThreadBuffer( unsigned int threadIndex ) : m_Depth( 0 ), m_ThreadIndex( threadIndex ),
+	                                                    m_Head( 0 ), m_Tail( 0 ), m_Dropped( 0 ) {}
+
+	// Add a completed event, called by the owning thread only. If the consumer has fallen behind
+	// the event is dropped (and counted) rather than blocking the thread being profiled
+	void Push( const SProfileEvent& event )
+	{
+		unsigned int head = m_Head.load( memory_order_relaxed );
+		if (head - m_Tail.load( memory_order_acquire ) >= kCapacity)
+		{
+			m_Dropped.fetch_add( 1, memory_order_relaxed );
+			return;
+		}
+		m_Events[head & (kCapacity - 1)] = event;
+		m_Head.store( head + 1, memory_order_release );
+	}
+
+	// Remove the oldest event, called by the consumer only. Returns false if the buffer is empty
+	bool Pop( SProfileEvent* pEvent )
+	{
+		unsigned int tail = m_Tail.load( memory_order_relaxed );
+		if (tail == m_Head.load( memory_order_acquire ))
+		{
+			return false;
+		}
+		*pEvent = m_Events[tail & (kCapacity - 1)];
+		m_Tail.store( tail + 1, memory_order_release );
+		return true;
+	}
+
+	unsigned int Dropped() const
+	{
+		return m_Dropped.load( memory_order_relaxed );
+	}
+
+	unsigned int ThreadIndex() const
+	{
+		return m_ThreadIndex;
+	}
+
+	// Thread name shown in the trace, set with ProfilerSetThreadName
+	string m_Name;
+
+	// Current nesting depth, only used by the owning thread
+	unsigned int m_Depth;
+
+private:
+	unsigned int m_ThreadIndex;
+
+	SProfileEvent m_Events[kCapacity];
+
+	// Keep producer and consumer positions on separate cache lines (padding rather than alignas,
+	// as buffers are heap allocated and Visual Studio 2017 does not align over-aligned new)
+	atomic<unsigned int> m_Head;
+	char                 m_Pad[64];
+	atomic<unsigned int> m_Tail;
+	atomic<unsigned int> m_Dropped;
+};
+
+
+//-----------------------------------------------------------------------------
+// Profiler state and scope class
+//-----------------------------------------------------------------------------
+
+// True while a capture is in progress. Markers do nothing more than test this when not capturing
+extern atomic<bool> g_ProfilerActive;
+
+// Get the event buffer for the calling thread, creating and registering it on first use
+CProfileThreadBuffer* ProfilerThreadBuffer();
+
+
+// Scoped marker, records an event covering its own lifetime. Use through PROFILE_SCOPE
+class CProfileScope
+{
+public:
+	CProfileScope( const char* name )
+	{
+		m_Buffer = g_ProfilerActive.load( memory_order_relaxed ) ? ProfilerThreadBuffer() : 0;
+		if (m_Buffer)
+		{
+			m_Event.name = name;
+			m_Event.depth = m_Buffer->m_Depth++;
+			m_Event.start = ClockTicks();
+		}
+	}
+
+	~CProfileScope()
+	{
+		// Scopes opened during a capture are always closed, even if the capture has since ended,
+		// so the nesting depth stays balanced
+		if (m_Buffer)
+		{
+			m_Event.end = ClockTicks();
+			--m_Buffer->m_Depth;
+			m_Buffer->Push( m_Event );
+		}
+	}
+
+private:
+	// Disallow use of copy constructor and assignment operator (private and not defined)
+	CProfileScope( const CProfileScope& );
+	CProfileScope& operator=( const CProfileScope& );
+
+	CProfileThreadBuffer* m_Buffer;
+	SProfileEvent         m_Event;
+};
+
+
+//-----------------------------------------------------------------------------
+// Capture control
+//-----------------------------------------------------------------------------
+
+// Name the calling thread in captures (e.g. "Main", "Worker 3")
+void ProfilerSetThreadName( const char* name );
+
+// Start capturing events for the given number of frames. The capture is written to the given
+// file as Chrome trace JSON when complete. Ignored if a capture is already running
+void ProfilerBeginCapture( unsigned int numFrames, const string& fileName );
+
+// Is a capture currently running
+bool ProfilerIsCapturing();
+
+// Call once at the end of every frame from the main thread. Collects events from all threads and
+// finishes the capture once enough frames have been seen
+void ProfilerEndFrame();
+
+// Release all profiler memory. No profiling markers may be active on any thread
+void ProfilerShutdown();
@@ -0,0 +1,124 @@
+/*******************************************
+	RangeAllocator.cpp
+
+	Free-list range allocator
+********************************************/
+
+#include <cassert>
+using namespace std;
+
+#include "RangeAllocator.h"
+
+
+// Forget all allocations and start again with a single free range of the given size
+void CRangeAllocator::Reset( unsigned int size )
+{
+	m_Size = size;
+	m_UsedSize = 0;
+	m_Free.clear();
+	m_Used.clear();
+	if (size > 0) m_Free[0] = size;
+}
+
+// Allocate a range, returns its offset or kInvalidOffset if there is no free range big enough
+unsigned int CRangeAllocator::Allocate( unsigned int size )
+{
+	if (size == 0) return kInvalidOffset;
+
+	// Best fit - the smallest free range that is big enough, the lowest offset if there are several
+	map<unsigned int, unsigned int>::iterator best = m_Free.end();
+	for (map<unsigned int, unsigned int>::iterator free = m_Free.begin(); free != m_Free.end(); ++free)
+	{
+		if (free->second >= size && (best == m_Free.end() || free->second < best->second))
+		{
+			best = free;
+			if (free->second == size) break; // Can't do better
+		}
+	}
+	if (best == m_Free.end()) return kInvalidOffset;
+
+	// Take the start of the free range, anything left stays free
+	unsigned int offset = best->first;
+	unsigned int remaining = best->second - size;
+	m_Free.erase( best );
+	if (remaining > 0) m_Free[offset + size] = remaining;
+
+	m_Used[offset] = size;
+	m_UsedSize += size;
+	return offset;
+}
+
+// Free a range previously allocated at the given offset
+void CRangeAllocator::Free( unsigned int offset )
+{
+	map<unsigned int, unsigned int>::iterator used = m_Used.find( offset );
+	assert( used != m_Used.end() && "Freeing a range that was not allocated" );
+	if (used == m_Used.end()) return;
+
+	unsigned int size = used->second;
+	m_UsedSize -= size;
+	m_Used.erase( used );
+
+	// Merge with the free ranges either side if they touch
+	map<unsigned int, unsigned int>::iterator next = m_Free.lower_bound( offset );
+	if (next != m_Free.end() && offset + size == next->first)
+	{
+		size += next->second;
+		next = m_Free.erase( next );
+	}
+	if (next != m_Free.begin())
+	{
+		map<unsigned int, unsigned int>::iterator prev = next;
+		--prev;
+		if (prev->first + prev->second == offset)
+		{
+			prev->second += size;
+			return;
+		}
+	}
+	m_Free[offset] = size;
+}
+
+
+// Slide every live range down to remove the gaps between them
+void CRangeAllocator::Compact( vector<SMove>* pMoves )
+{
+	pMoves->clear();
+
+	map<unsigned int, unsigned int> compacted;
+	unsigned int end = 0;
+	for (map<unsigned int, unsigned int>::iterator used = m_Used.begin(); used != m_Used.end(); ++used)
+	{
+		if (used->first != end)
+		{
+			SMove move = { used->first, end, used->second };
+			pMoves->push_back( move );
+		}
+		compacted[end] = used->second;
+		end += used->second;
+	}
+
+	m_Used.swap( compacted );
+	m_Free.clear();
+	if (end < m_Size) m_Free[end] = m_Size - end;
+}
+
+
+// Size of the largest free range
+unsigned int CRangeAllocator::LargestFreeRange() const
+{
+	unsigned int largest = 0;
+	for (map<unsigned int, unsigned int>::const_iterator free = m_Free.begin(); free != m_Free.end(); ++free)
+	{
+		if (free->second > largest) largest = free->second;
+	}
+	return largest;
+}
+
+// Proportion of the free space not in the largest free range
+float CRangeAllocator::Fragmentation() const
+{
+	unsigned int freeSize = FreeSize();
+	if (freeSize == 0) return 0.0f;
+	return 1.0f - static_cast<float>(LargestFreeRange()) / freeSize;
+}
@@ -0,0 +1,90 @@
+/*******************************************
+	RangeAllocator.h
+
+	Free-list allocator of ranges within a
+	fixed-size block (e.g. a GPU buffer),
+	with compaction. Only manages offsets,
+	never touches the memory itself
+********************************************/
+
+#pragma once
+
+#include <map>
+#include <vector>
+using namespace std;
+
+
+// Allocates ranges of units (bytes, vertices, indices...) from a block of fixed size. Free ranges
+// are kept sorted by offset and merged with their neighbours when freed, allocation takes the
+// smallest free range that fits (best fit). Allocation and freeing cost O(free ranges), fine for
+// loading but not meant for every frame. Not thread-safe
+class CRangeAllocator
+{
+public:
+	static const unsigned int kInvalidOffset = ~0u;
+
+	CRangeAllocator( unsigned int size = 0 )
+	{
+		Reset( size );
+	}
+
+	// Forget all allocations and start again with a single free range of the given size
+	void Reset( unsigned int size );
+
+	// Allocate a range, returns its offset or kInvalidOffset if there is no free range big enough
+	unsigned int Allocate( unsigned int size );
+
+	// Free a range previously allocated at the given offset
+	void Free( unsigned int offset );
+
+
+	// A live range moved by Compact
+	struct SMove
+	{
+		unsigned int from;
+		unsigned int to;
+		unsigned int size;
+	};
+
+	// Slide every live range down to remove the gaps between them, leaving one free range at the
+	// end. The moves needed are returned in increasing offset order, a move never overlaps a
+	// range that is moved later, so they can be copied in order even within the same block
+	void Compact( vector<SMove>* pMoves );
+
+
+	/////////////////////////////////////
+	// Statistics
+
+	unsigned int Size() const
+	{
+		return m_Size;
+	}
+	unsigned int UsedSize() const
+	{
+		return m_UsedSize;
+	}
+	unsigned int FreeSize() const
+	{
+		return m_Size - m_UsedSize;
+	}
+	unsigned int NumAllocations() const
+	{
+		return static_cast<unsigned int>(m_Used.size());
+	}
+	unsigned int NumFreeRanges() const
+	{
+		return static_cast<unsigned int>(m_Free.size());
+	}
+
+	unsigned int LargestFreeRange() const;
+
+	// Proportion of the free space not in the largest free range, 0 when all free space is in one
+	// range, approaching 1 when it is scattered in many small ones
+	float Fragmentation() const;
+
+private:
+	unsigned int                    m_Size;
+	unsigned int                    m_UsedSize;
+	map<unsigned int, unsigned int> m_Free; // Offset to size of each free range
+	map<unsigned int, unsigned int> m_Used; // Offset to size of each allocated range
+};
@@ -0,0 +1,97 @@
+/*******************************************
+	RingAllocator.cpp
+
+	Ring allocator of per-frame data
+********************************************/
+
+#include "RingAllocator.h"
+
+
+// Forget all allocations and frames
+void CRingAllocator::Reset( unsigned int size )
+{
+	m_Size = size;
+	m_Head = 0;
+	m_Tail = 0;
+	m_UsedSize = 0;
+	m_FrameSize = 0;
+	m_FirstFrame = 0;
+	m_NumFrames = 0;
+}
+
+// Allocate a range at the given alignment
+unsigned int CRingAllocator::Allocate( unsigned int size, unsigned int alignment, bool* pWrapped /*= 0*/ )
+{
+	if (pWrapped) *pWrapped = false;
+	if (size == 0 || size > m_Size) return kInvalidOffset;
+
+	// Start from the beginning whenever the ring is empty, so it wraps less often
+	if (m_UsedSize == 0)
+	{
+		m_Head = m_Tail = 0;
+	}
+
+	unsigned int offset = (m_Head + alignment - 1) & ~(alignment - 1);
+	bool wrapped = false;
+	if (m_Head > m_Tail || m_UsedSize == 0)
+	{
+		// Used space is in one piece in the middle, free space is after the head and before the tail
+		if (offset > m_Size || size > m_Size - offset)
+		{
+			if (size > m_Tail) return kInvalidOffset;
+			offset = 0;
+			wrapped = true;
+		}
+	}
+	else
+	{
+		// Used space wraps round the end (or the ring is full), free space is between the head and the tail
+		if (offset > m_Tail || size > m_Tail - offset) return kInvalidOffset;
+	}
+
+	// Padding and space skipped at the end count as used until the frame is retired
+	unsigned int used = wrapped ? (m_Size - m_Head) + size : (offset - m_Head) + size;
+	m_Head = offset + size;
+	m_UsedSize += used;
+	m_FrameSize += used;
+	if (pWrapped) *pWrapped = wrapped;
+	return offset;
+}
+
+
+// End the frame in progress
+void CRingAllocator::EndFrame( unsigned long long frame )
+{
+	if (m_FrameSize == 0) return; // Nothing to wait for
+
+	if (m_NumFrames == kMaxFrames)
+	{
+		// Merge into the newest frame, which is now retired when this one is
+		SFrame& newest = m_Frames[(m_FirstFrame + m_NumFrames - 1) % kMaxFrames];
+		newest.frame = frame;
+		newest.end = m_Head;
+		newest.size += m_FrameSize;
+	}
+	else
+	{
+		SFrame& ended = m_Frames[(m_FirstFrame + m_NumFrames) % kMaxFrames];
+		ended.frame = frame;
+		ended.end = m_Head;
+		ended.size = m_FrameSize;
+		++m_NumFrames;
+	}
+	m_FrameSize = 0;
+}
+
+// Release the space of every ended frame up to and including the given one
+void CRingAllocator::Retire( unsigned long long completedFrame )
+{
+	while (m_NumFrames > 0 && m_Frames[m_FirstFrame].frame <= completedFrame)
+	{
+		const SFrame& oldest = m_Frames[m_FirstFrame];
+		m_Tail = oldest.end;
+		m_UsedSize -= oldest.size;
+		m_FirstFrame = (m_FirstFrame + 1) % kMaxFrames;
+		--m_NumFrames;
+	}
+}
@@ -0,0 +1,98 @@
+/*******************************************
+	RingAllocator.h
+
+	Ring allocator of per-frame data within a
+	fixed-size block (e.g. a dynamic GPU
+	buffer), with space reused once the frame
+	that used it has been retired. Only
+	manages offsets, never touches the memory
+********************************************/
+
+#pragma once
+
+
+// Allocates ranges from a block used as a ring: each allocation follows the last, wrapping round
+// to the start when the end is reached. Allocations belong to the frame in progress, EndFrame closes
+// the frame and Retire releases every frame up to one the consumer has finished with (e.g. once a
+// GPU fence for the frame has passed), so space is only reused once nothing reads it. Allocation
+// and retiring cost O(1), no memory is allocated. Not thread-safe
+class CRingAllocator
+{
+public:
+	static const unsigned int kInvalidOffset = ~0u;
+
+	// Frames tracked separately. If more are in flight the newest are merged, so they are retired
+	// together when the last of them is
+	static const unsigned int kMaxFrames = 8;
+
+	CRingAllocator( unsigned int size = 0 )
+	{
+		Reset( size );
+	}
+
+	// Forget all allocations and frames, and start again with the whole block free
+	void Reset( unsigned int size );
+
+	// Allocate a range at the given alignment (a power of 2). Returns its offset or kInvalidOffset
+	// if the space is still in use by frames not yet retired. Sets *pWrapped if the range wrapped
+	// round to the start of the block
+	unsigned int Allocate( unsigned int size, unsigned int alignment, bool* pWrapped = 0 );
+
+	// End the frame in progress, everything allocated since the last EndFrame belongs to it. Frame
+	// numbers must increase
+	void EndFrame( unsigned long long frame );
+
+	// Release the space of every ended frame up to and including the given one
+	void Retire( unsigned long long completedFrame );
+
+
+	/////////////////////////////////////
+	// Statistics
+
+	unsigned int Size() const
+	{
+		return m_Size;
+	}
+
+	// Space in use, including padding for alignment and space skipped at the end when wrapping
+	unsigned int UsedSize() const
+	{
+		return m_UsedSize;
+	}
+	unsigned int FreeSize() const
+	{
+		return m_Size - m_UsedSize;
+	}
+
+	// Space used by the frame in progress
+	unsigned int FrameSize() const
+	{
+		return m_FrameSize;
+	}
+
+	// Ended frames not yet retired (after merging)
+	unsigned int NumFramesInFlight() const
+	{
+		return m_NumFrames;
+	}
+
+private:
+	// An ended frame, with the position the frame ended at and the space it used
+	struct SFrame
+	{
+		unsigned long long frame;
+		unsigned int       end;
+		unsigned int       size;
+	};
+
+	unsigned int m_Size;
+	unsigned int m_Head;      // Next allocation starts here (after alignment)
+	unsigned int m_Tail;      // Start of the oldest frame not retired
+	unsigned int m_UsedSize;
+	unsigned int m_FrameSize;
+
+	// Ended frames not retired, oldest first, in a ring of their own
+	SFrame       m_Frames[kMaxFrames];
+	unsigned int m_FirstFrame;
+	unsigned int m_NumFrames;
+};
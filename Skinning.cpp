@@ -0,0 +1,230 @@
+/*******************************************
+	Skinning.cpp
+
+	CPU linear blend skinning
+********************************************/
+
+#include <cmath>
+#include <cstring>
+#include <xmmintrin.h>
+using namespace std;
+
+#include "Skinning.h"
+#include "Hierarchy.h"
+#include "JobSystem.h"
+
+
+//-----------------------------------------------------------------------------
+// Vertex layout
+//-----------------------------------------------------------------------------
+
+// Layout of a sub-mesh's vertices, returns false if the sub-mesh has no skinning data
+bool SkinVertexLayout( const SSubMesh& subMesh, SSkinVertexLayout* pLayout )
+{
+	if (!subMesh.hasSkinningData)
+	{
+		return false;
+	}
+
+	// Weights and indices come straight after the position, normal and tangent after them
+	TUInt32 offset = 3 * sizeof(TFloat32);
+	pLayout->vertexSize = subMesh.vertexSize;
+	pLayout->weightsOffset = offset;
+	offset += 4 * sizeof(TFloat32);
+	pLayout->indicesOffset = offset;
+	offset += sizeof(TUInt32);
+	pLayout->normalOffset = SSkinVertexLayout::kNone;
+	if (subMesh.hasNormals)
+	{
+		pLayout->normalOffset = offset;
+		offset += 3 * sizeof(TFloat32);
+	}
+	pLayout->tangentOffset = subMesh.hasTangents ? offset : SSkinVertexLayout::kNone;
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Bone palette
+//-----------------------------------------------------------------------------
+
+// Build the bone palette of a mesh. The palette first holds each node's model space matrix, which its children
+// build on, then each is combined with the node's inverse bind pose
+void SkinBuildPalette( const SMeshNode* nodes, TUInt32 numNodes, const CMatrix4x4* nodeMatrices, CMatrix4x4* pPalette )
+{
+	ConcatenateNodeMatrices( nodes, numNodes, nodeMatrices, pPalette );
+	SkinBuildModelPalette( nodes, numNodes, pPalette, pPalette );
+}
+
+// Build the bone palette from model space node matrices
+void SkinBuildModelPalette( const SMeshNode* nodes, TUInt32 numNodes, const CMatrix4x4* modelMatrices, CMatrix4x4* pPalette )
+{
+	for (TUInt32 node = 0; node < numNodes; ++node)
+	{
+		pPalette[node] = nodes[node].invMeshOffset * modelMatrices[node];
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Skinning
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Scalar linear blend skinning, the reference version. The blended matrix is only the top three rows and
+	// three columns plus the translation row - palette matrices are affine
+	void SkinVerticesScalar( const SSkinVertexLayout& layout, const TUInt8* source, TUInt8* dest, TUInt32 numVertices,
+	                         const CMatrix4x4* palette )
+	{
+		for (TUInt32 vert = 0; vert < numVertices; ++vert)
+		{
+			const TFloat32* weights = reinterpret_cast<const TFloat32*>(source + layout.weightsOffset);
+			const TUInt8* indices = source + layout.indicesOffset;
+
+			TFloat32 blended[4][3] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+			for (int influence = 0; influence < 4; ++influence)
+			{
+				const TFloat32* matrix = &palette[indices[influence]].e00;
+				for (int row = 0; row < 4; ++row)
+				{
+					for (int col = 0; col < 3; ++col)
+					{
+						blended[row][col] += weights[influence] * matrix[row * 4 + col];
+					}
+				}
+			}
+
+			memcpy( dest, source, layout.vertexSize );
+
+			const TFloat32* position = reinterpret_cast<const TFloat32*>(source);
+			TFloat32* skinned = reinterpret_cast<TFloat32*>(dest);
+			for (int col = 0; col < 3; ++col)
+			{
+				skinned[col] = position[0] * blended[0][col] + position[1] * blended[1][col] + position[2] * blended[2][col] + blended[3][col];
+			}
+
+			// Normals and tangents have no translation, and are renormalised as the blend of several rotations shortens them
+			TUInt32 directionOffsets[2] = { layout.normalOffset, layout.tangentOffset };
+			for (int d = 0; d < 2; ++d)
+			{
+				if (directionOffsets[d] == SSkinVertexLayout::kNone) continue;
+				const TFloat32* direction = reinterpret_cast<const TFloat32*>(source + directionOffsets[d]);
+				TFloat32* skinnedDirection = reinterpret_cast<TFloat32*>(dest + directionOffsets[d]);
+				TFloat32 result[3];
+				for (int col = 0; col < 3; ++col)
+				{
+					result[col] = direction[0] * blended[0][col] + direction[1] * blended[1][col] + direction[2] * blended[2][col];
+				}
+				TFloat32 lengthSq = result[0] * result[0] + result[1] * result[1] + result[2] * result[2];
+				TFloat32 scale = (lengthSq > 0.0f) ? 1.0f / sqrtf( lengthSq ) : 0.0f;
+				for (int col = 0; col < 3; ++col)
+				{
+					skinnedDirection[col] = result[col] * scale;
+				}
+			}
+
+			source += layout.vertexSize;
+			dest += layout.vertexSize;
+		}
+	}
+
+
+	// Store the x, y and z of an SSE register, leaving the float after them alone
+	inline void StoreXYZ( TFloat32* dest, __m128 v )
+	{
+		_mm_storel_pi( reinterpret_cast<__m64*>(dest), v );
+		_mm_store_ss( dest + 2, _mm_movehl_ps( v, v ) );
+	}
+
+	// Transform a direction by the top three blended rows and renormalise it
+	inline __m128 SkinDirection( const TFloat32* direction, __m128 row0, __m128 row1, __m128 row2 )
+	{
+		__m128 result = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_set1_ps( direction[0] ), row0 ),
+		                                        _mm_mul_ps( _mm_set1_ps( direction[1] ), row1 ) ),
+		                                        _mm_mul_ps( _mm_set1_ps( direction[2] ), row2 ) );
+		__m128 squared = _mm_mul_ps( result, result );
+		__m128 lengthSq = _mm_add_ss( _mm_add_ss( squared, _mm_shuffle_ps( squared, squared, _MM_SHUFFLE(1, 1, 1, 1) ) ),
+		                              _mm_shuffle_ps( squared, squared, _MM_SHUFFLE(2, 2, 2, 2) ) );
+		if (_mm_cvtss_f32( lengthSq ) <= 0.0f)
+		{
+			return _mm_setzero_ps();
+		}
+		__m128 length = _mm_sqrt_ss( lengthSq );
+		return _mm_div_ps( result, _mm_shuffle_ps( length, length, _MM_SHUFFLE(0, 0, 0, 0) ) );
+	}
+
+	// SSE linear blend skinning. Each row of the four palette matrices is loaded whole, weighted and summed, so
+	// blending takes 16 multiplies rather than 48. The fourth column (0 for affine matrices) rides along unused.
+	// Palette matrices need not be 16-byte aligned
+	void SkinVerticesSSE( const SSkinVertexLayout& layout, const TUInt8* source, TUInt8* dest, TUInt32 numVertices,
+	                      const CMatrix4x4* palette )
+	{
+		for (TUInt32 vert = 0; vert < numVertices; ++vert)
+		{
+			const TFloat32* weights = reinterpret_cast<const TFloat32*>(source + layout.weightsOffset);
+			const TUInt8* indices = source + layout.indicesOffset;
+			const TFloat32* m0 = &palette[indices[0]].e00;
+			const TFloat32* m1 = &palette[indices[1]].e00;
+			const TFloat32* m2 = &palette[indices[2]].e00;
+			const TFloat32* m3 = &palette[indices[3]].e00;
+			__m128 w0 = _mm_set1_ps( weights[0] );
+			__m128 w1 = _mm_set1_ps( weights[1] );
+			__m128 w2 = _mm_set1_ps( weights[2] );
+			__m128 w3 = _mm_set1_ps( weights[3] );
+
+			__m128 rows[4];
+			for (int row = 0; row < 4; ++row)
+			{
+				rows[row] = _mm_add_ps( _mm_add_ps( _mm_mul_ps( w0, _mm_loadu_ps( m0 + row * 4 ) ), _mm_mul_ps( w1, _mm_loadu_ps( m1 + row * 4 ) ) ),
+				                        _mm_add_ps( _mm_mul_ps( w2, _mm_loadu_ps( m2 + row * 4 ) ), _mm_mul_ps( w3, _mm_loadu_ps( m3 + row * 4 ) ) ) );
+			}
+
+			memcpy( dest, source, layout.vertexSize );
+
+			const TFloat32* position = reinterpret_cast<const TFloat32*>(source);
+			__m128 skinned = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_set1_ps( position[0] ), rows[0] ),
+			                                         _mm_mul_ps( _mm_set1_ps( position[1] ), rows[1] ) ),
+			                             _mm_add_ps( _mm_mul_ps( _mm_set1_ps( position[2] ), rows[2] ), rows[3] ) );
+			StoreXYZ( reinterpret_cast<TFloat32*>(dest), skinned );
+			if (layout.normalOffset != SSkinVertexLayout::kNone)
+			{
+				const TFloat32* normal = reinterpret_cast<const TFloat32*>(source + layout.normalOffset);
+				StoreXYZ( reinterpret_cast<TFloat32*>(dest + layout.normalOffset), SkinDirection( normal, rows[0], rows[1], rows[2] ) );
+			}
+			if (layout.tangentOffset != SSkinVertexLayout::kNone)
+			{
+				const TFloat32* tangent = reinterpret_cast<const TFloat32*>(source + layout.tangentOffset);
+				StoreXYZ( reinterpret_cast<TFloat32*>(dest + layout.tangentOffset), SkinDirection( tangent, rows[0], rows[1], rows[2] ) );
+			}
+
+			source += layout.vertexSize;
+			dest += layout.vertexSize;
+		}
+	}
+}
+
+// Skin vertices from source to dest
+void SkinVertices( const SSkinVertexLayout& layout, const TUInt8* source, TUInt8* dest, TUInt32 numVertices,
+                   const CMatrix4x4* palette, ESkinMethod method /*= kSkinSSE*/ )
+{
+	if (method == kSkinScalar)
+	{
+		SkinVerticesScalar( layout, source, dest, numVertices, palette );
+	}
+	else
+	{
+		SkinVerticesSSE( layout, source, dest, numVertices, palette );
+	}
+}
+
+// The same, in batches across the job system
+void SkinVerticesParallel( const SSkinVertexLayout& layout, const TUInt8* source, TUInt8* dest, TUInt32 numVertices,
+                           const CMatrix4x4* palette, ESkinMethod method /*= kSkinSSE*/ )
+{
+	ParallelFor( 0, static_cast<int>(numVertices), kSkinBatchVertices, [&layout, source, dest, palette, method]( int begin, int end )
+	{
+		TUInt32 offset = begin * layout.vertexSize;
+		SkinVertices( layout, source + offset, dest + offset, end - begin, palette, method );
+	}, "Skinning" );
+}
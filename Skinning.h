@@ -0,0 +1,82 @@
+/*******************************************
+	Skinning.h
+
+	CPU linear blend skinning. A bone palette
+	is built from a mesh's node matrices, then
+	the positions, normals and tangents of
+	skinned vertices are transformed by up to
+	four weighted bones each, in batches spread
+	over the job system
+********************************************/
+
+#pragma once
+
+#include "Defines.h"
+#include "CMatrix4x4.h"
+#include "MeshData.h"
+using namespace gen;
+
+
+//-----------------------------------------------------------------------------
+// Vertex layout
+//-----------------------------------------------------------------------------
+
+// Where the skinning data of a vertex lies, in bytes from its start. Vertices are as the importer writes them
+// (see CImportXFile::GetSubMesh): position, four float weights (sorted largest first, summing to 1), four byte
+// bone indices, then the normal and tangent if present, then any other data
+struct SSkinVertexLayout
+{
+	static const TUInt32 kNone = ~0u;
+
+	TUInt32 vertexSize;
+	TUInt32 weightsOffset;
+	TUInt32 indicesOffset;
+	TUInt32 normalOffset;  // kNone if there are no normals
+	TUInt32 tangentOffset; // kNone if there are no tangents
+};
+
+// Layout of a sub-mesh's vertices, returns false if the sub-mesh has no skinning data
+bool SkinVertexLayout( const SSubMesh& subMesh, SSkinVertexLayout* pLayout );
+
+
+//-----------------------------------------------------------------------------
+// Bone palette
+//-----------------------------------------------------------------------------
+
+// Build the bone palette of a mesh, one matrix for each node (bone indices in the vertices are node indices).
+// Node matrices are relative to their parent, as positionMatrix in SMeshNode - pass 0 to use the nodes' own.
+// Each is combined with its parents' to give the node's matrix in model space, and the palette matrix is the
+// node's invMeshOffset (bind pose model space to bone space) followed by that. The palette must have room for
+// numNodes matrices
+void SkinBuildPalette( const SMeshNode* nodes, TUInt32 numNodes, const CMatrix4x4* nodeMatrices, CMatrix4x4* pPalette );
+
+// The same from node matrices already combined with their parents' (in model space, as CNodeHierarchy gives). The
+// model matrices and palette may be the same array
+void SkinBuildModelPalette( const SMeshNode* nodes, TUInt32 numNodes, const CMatrix4x4* modelMatrices, CMatrix4x4* pPalette );
+
+
+//-----------------------------------------------------------------------------
+// Skinning
+//-----------------------------------------------------------------------------
+
+// How the vertices are transformed. Both blend the palette matrices of a vertex's bones by its weights and
+// transform by the result, normals and tangents are then renormalised
+enum ESkinMethod
+{
+	kSkinScalar, // One float at a time, the reference for the SSE version
+	kSkinSSE,    // Each matrix row blended four floats at a time with SSE
+};
+
+// Skin vertices from source to dest, both with the given layout. Every byte of each dest vertex is written
+// and none are read, so dest can be a mapped dynamic buffer. Position, normal and tangent are transformed,
+// the rest of the vertex is copied. Vertices must not overlap
+void SkinVertices( const SSkinVertexLayout& layout, const TUInt8* source, TUInt8* dest, TUInt32 numVertices,
+                   const CMatrix4x4* palette, ESkinMethod method = kSkinSSE );
+
+// Vertices given to each job by SkinVerticesParallel, a few tens of microseconds of work
+const TUInt32 kSkinBatchVertices = 1024;
+
+// The same, split into batches of kSkinBatchVertices run across the job system, returning once all are
+// done. Without the job system (or from a thread outside it) the batches run on the calling thread
+void SkinVerticesParallel( const SSkinVertexLayout& layout, const TUInt8* source, TUInt8* dest, TUInt32 numVertices,
+                           const CMatrix4x4* palette, ESkinMethod method = kSkinSSE );
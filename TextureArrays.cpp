@@ -0,0 +1,654 @@
+/*******************************************
+	TextureArrays.cpp
+
+	DDS images and texture arrays built from
+	them
+********************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+using namespace std;
+
+#include "TextureArrays.h"
+#include "CImportXFile.h"
+using namespace gen;
+
+
+//-----------------------------------------------------------------------------
+// Images
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Bytes in a 4x4 block of the block compressed formats handled, 0 for others
+	TUInt32 FormatBlockBytes( DXGI_FORMAT format )
+	{
+		switch (format)
+		{
+			case DXGI_FORMAT_BC1_UNORM: case DXGI_FORMAT_BC1_UNORM_SRGB:
+			case DXGI_FORMAT_BC4_UNORM: case DXGI_FORMAT_BC4_SNORM:
+				return 8;
+			case DXGI_FORMAT_BC2_UNORM: case DXGI_FORMAT_BC2_UNORM_SRGB:
+			case DXGI_FORMAT_BC3_UNORM: case DXGI_FORMAT_BC3_UNORM_SRGB:
+			case DXGI_FORMAT_BC5_UNORM: case DXGI_FORMAT_BC5_SNORM:
+				return 16;
+			default:
+				return 0;
+		}
+	}
+
+	// Bytes per pixel of the uncompressed formats handled, 0 for others
+	TUInt32 FormatPixelBytes( DXGI_FORMAT format )
+	{
+		switch (format)
+		{
+			case DXGI_FORMAT_R8G8B8A8_UNORM: case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+			case DXGI_FORMAT_B8G8R8A8_UNORM: case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+			case DXGI_FORMAT_B8G8R8X8_UNORM: case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+				return 4;
+			default:
+				return 0;
+		}
+	}
+
+	// Name of a format handled, for reports
+	const char* FormatName( DXGI_FORMAT format )
+	{
+		switch (format)
+		{
+			case DXGI_FORMAT_BC1_UNORM:           return "BC1";
+			case DXGI_FORMAT_BC1_UNORM_SRGB:      return "BC1_SRGB";
+			case DXGI_FORMAT_BC2_UNORM:           return "BC2";
+			case DXGI_FORMAT_BC2_UNORM_SRGB:      return "BC2_SRGB";
+			case DXGI_FORMAT_BC3_UNORM:           return "BC3";
+			case DXGI_FORMAT_BC3_UNORM_SRGB:      return "BC3_SRGB";
+			case DXGI_FORMAT_BC4_UNORM:           return "BC4";
+			case DXGI_FORMAT_BC4_SNORM:           return "BC4_SNORM";
+			case DXGI_FORMAT_BC5_UNORM:           return "BC5";
+			case DXGI_FORMAT_BC5_SNORM:           return "BC5_SNORM";
+			case DXGI_FORMAT_R8G8B8A8_UNORM:      return "RGBA8";
+			case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB: return "RGBA8_SRGB";
+			case DXGI_FORMAT_B8G8R8A8_UNORM:      return "BGRA8";
+			case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB: return "BGRA8_SRGB";
+			case DXGI_FORMAT_B8G8R8X8_UNORM:      return "BGRX8";
+			case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB: return "BGRX8_SRGB";
+			default:                              return "unknown";
+		}
+	}
+}
+
+// Bytes in one mip of the given size, 0 if the format is not one handled here
+TUInt32 TextureSurfaceBytes( DXGI_FORMAT format, TUInt32 width, TUInt32 height )
+{
+	if (FormatBlockBytes( format ) > 0)
+	{
+		return TextureRowBytes( format, width ) * max( (height + 3) / 4, 1u );
+	}
+	return TextureRowBytes( format, width ) * height;
+}
+
+// Bytes in one row of a mip, of 4x4 blocks for block compressed formats
+TUInt32 TextureRowBytes( DXGI_FORMAT format, TUInt32 width )
+{
+	TUInt32 blockBytes = FormatBlockBytes( format );
+	if (blockBytes > 0)
+	{
+		return max( (width + 3) / 4, 1u ) * blockBytes;
+	}
+	return width * FormatPixelBytes( format );
+}
+
+// Bytes in one slice of an image, all its mips
+TUInt32 TextureSliceBytes( const STextureImage& image )
+{
+	TUInt32 bytes = 0;
+	for (TUInt32 mip = 0; mip < image.mipLevels; ++mip)
+	{
+		bytes += TextureSurfaceBytes( image.format, max( image.width >> mip, 1u ), max( image.height >> mip, 1u ) );
+	}
+	return bytes;
+}
+
+
+//-----------------------------------------------------------------------------
+// DDS files
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// File layout: the magic number, the header, the DX10 header if the pixel format's four CC is "DX10", then the data
+	struct SDDSPixelFormat
+	{
+		TUInt32 size;
+		TUInt32 flags;
+		TUInt32 fourCC;
+		TUInt32 rgbBitCount;
+		TUInt32 rMask, gMask, bMask, aMask;
+	};
+
+	struct SDDSHeader
+	{
+		TUInt32         size;
+		TUInt32         flags;
+		TUInt32         height;
+		TUInt32         width;
+		TUInt32         pitchOrLinearSize;
+		TUInt32         depth;
+		TUInt32         mipMapCount;
+		TUInt32         reserved1[11];
+		SDDSPixelFormat pixelFormat;
+		TUInt32         caps, caps2, caps3, caps4;
+		TUInt32         reserved2;
+	};
+
+	struct SDDSHeaderDX10
+	{
+		TUInt32 dxgiFormat;
+		TUInt32 resourceDimension;
+		TUInt32 miscFlag;
+		TUInt32 arraySize;
+		TUInt32 miscFlags2;
+	};
+
+	TUInt32 MakeFourCC( char a, char b, char c, char d )
+	{
+		return static_cast<TUInt32>(static_cast<TUInt8>(a)) | (static_cast<TUInt32>(static_cast<TUInt8>(b)) << 8) |
+		       (static_cast<TUInt32>(static_cast<TUInt8>(c)) << 16) | (static_cast<TUInt32>(static_cast<TUInt8>(d)) << 24);
+	}
+
+	const TUInt32 kDDSMagic = 0x20534444; // "DDS "
+
+	// Header flags
+	const TUInt32 kDDSDCaps        = 0x1;
+	const TUInt32 kDDSDHeight      = 0x2;
+	const TUInt32 kDDSDWidth       = 0x4;
+	const TUInt32 kDDSDPixelFormat = 0x1000;
+	const TUInt32 kDDSDMipMapCount = 0x20000;
+	const TUInt32 kDDSDLinearSize  = 0x80000;
+
+	// Pixel format flags
+	const TUInt32 kDDPFAlphaPixels = 0x1;
+	const TUInt32 kDDPFFourCC      = 0x4;
+	const TUInt32 kDDPFRGB         = 0x40;
+
+	// Caps
+	const TUInt32 kDDSCapsComplex  = 0x8;
+	const TUInt32 kDDSCapsTexture  = 0x1000;
+	const TUInt32 kDDSCapsMipMap   = 0x400000;
+	const TUInt32 kDDSCaps2CubeMap = 0x200;
+	const TUInt32 kDDSCaps2Volume  = 0x200000;
+
+	// DX10 header values
+	const TUInt32 kDX10Texture2D   = 3; // D3D10_RESOURCE_DIMENSION_TEXTURE2D
+	const TUInt32 kDX10MiscCube    = 4; // D3D10_RESOURCE_MISC_TEXTURECUBE
+
+	// Format of a legacy pixel format, DXGI_FORMAT_UNKNOWN for those not handled
+	DXGI_FORMAT LegacyFormat( const SDDSPixelFormat& pixelFormat )
+	{
+		if (pixelFormat.flags & kDDPFFourCC)
+		{
+			TUInt32 fourCC = pixelFormat.fourCC;
+			if (fourCC == MakeFourCC( 'D', 'X', 'T', '1' ))                                                 return DXGI_FORMAT_BC1_UNORM;
+			if (fourCC == MakeFourCC( 'D', 'X', 'T', '2' ) || fourCC == MakeFourCC( 'D', 'X', 'T', '3' )) return DXGI_FORMAT_BC2_UNORM;
+			if (fourCC == MakeFourCC( 'D', 'X', 'T', '4' ) || fourCC == MakeFourCC( 'D', 'X', 'T', '5' )) return DXGI_FORMAT_BC3_UNORM;
+			if (fourCC == MakeFourCC( 'A', 'T', 'I', '1' ) || fourCC == MakeFourCC( 'B', 'C', '4', 'U' )) return DXGI_FORMAT_BC4_UNORM;
+			if (fourCC == MakeFourCC( 'A', 'T', 'I', '2' ) || fourCC == MakeFourCC( 'B', 'C', '5', 'U' )) return DXGI_FORMAT_BC5_UNORM;
+			return DXGI_FORMAT_UNKNOWN;
+		}
+		if ((pixelFormat.flags & kDDPFRGB) && pixelFormat.rgbBitCount == 32)
+		{
+			bool alpha = (pixelFormat.flags & kDDPFAlphaPixels) != 0;
+			if (pixelFormat.rMask == 0xff && pixelFormat.gMask == 0xff00 && pixelFormat.bMask == 0xff0000)
+			{
+				return DXGI_FORMAT_R8G8B8A8_UNORM; // No RGBX format, alpha is left as it is
+			}
+			if (pixelFormat.rMask == 0xff0000 && pixelFormat.gMask == 0xff00 && pixelFormat.bMask == 0xff)
+			{
+				return alpha ? DXGI_FORMAT_B8G8R8A8_UNORM : DXGI_FORMAT_B8G8R8X8_UNORM;
+			}
+		}
+		return DXGI_FORMAT_UNKNOWN;
+	}
+}
+
+// Read a DDS file from memory. Returns false for anything but 2D textures and arrays in the formats handled
+bool TextureImageFromDDS( const TUInt8* file, size_t fileSize, STextureImage* pImage )
+{
+	TUInt32 magic;
+	SDDSHeader header;
+	if (fileSize < sizeof(magic) + sizeof(header)) return false;
+	memcpy( &magic, file, sizeof(magic) );
+	memcpy( &header, file + sizeof(magic), sizeof(header) );
+	if (magic != kDDSMagic || header.size != sizeof(SDDSHeader) || header.pixelFormat.size != sizeof(SDDSPixelFormat))
+	{
+		return false;
+	}
+	if ((header.caps2 & (kDDSCaps2CubeMap | kDDSCaps2Volume)) != 0)
+	{
+		return false;
+	}
+	size_t offset = sizeof(magic) + sizeof(header);
+
+	STextureImage image;
+	image.width = header.width;
+	image.height = header.height;
+	image.mipLevels = (header.flags & kDDSDMipMapCount) ? max( header.mipMapCount, 1u ) : 1;
+	image.arraySize = 1;
+	if ((header.pixelFormat.flags & kDDPFFourCC) && header.pixelFormat.fourCC == MakeFourCC( 'D', 'X', '1', '0' ))
+	{
+		SDDSHeaderDX10 headerDX10;
+		if (fileSize < offset + sizeof(headerDX10)) return false;
+		memcpy( &headerDX10, file + offset, sizeof(headerDX10) );
+		offset += sizeof(headerDX10);
+		if (headerDX10.resourceDimension != kDX10Texture2D || (headerDX10.miscFlag & kDX10MiscCube) != 0)
+		{
+			return false;
+		}
+		image.format = static_cast<DXGI_FORMAT>(headerDX10.dxgiFormat);
+		image.arraySize = max( headerDX10.arraySize, 1u );
+	}
+	else
+	{
+		image.format = LegacyFormat( header.pixelFormat );
+	}
+	if (image.width == 0 || image.height == 0 || TextureSurfaceBytes( image.format, image.width, image.height ) == 0)
+	{
+		return false;
+	}
+
+	size_t dataBytes = static_cast<size_t>(TextureSliceBytes( image )) * image.arraySize;
+	if (fileSize < offset + dataBytes) return false;
+	image.data.assign( file + offset, file + offset + dataBytes );
+	pImage->format = image.format;
+	pImage->width = image.width;
+	pImage->height = image.height;
+	pImage->mipLevels = image.mipLevels;
+	pImage->arraySize = image.arraySize;
+	pImage->data.swap( image.data );
+	return true;
+}
+
+// Write an image as a DDS file in memory, always with a DX10 header so arrays are kept
+void TextureImageToDDS( const STextureImage& image, vector<TUInt8>* pFile )
+{
+	SDDSHeader header;
+	memset( &header, 0, sizeof(header) );
+	header.size = sizeof(SDDSHeader);
+	header.flags = kDDSDCaps | kDDSDHeight | kDDSDWidth | kDDSDPixelFormat | kDDSDMipMapCount | kDDSDLinearSize;
+	header.height = image.height;
+	header.width = image.width;
+	header.pitchOrLinearSize = TextureSurfaceBytes( image.format, image.width, image.height );
+	header.mipMapCount = image.mipLevels;
+	header.pixelFormat.size = sizeof(SDDSPixelFormat);
+	header.pixelFormat.flags = kDDPFFourCC;
+	header.pixelFormat.fourCC = MakeFourCC( 'D', 'X', '1', '0' );
+	header.caps = kDDSCapsTexture;
+	if (image.mipLevels > 1) header.caps |= kDDSCapsMipMap | kDDSCapsComplex;
+	if (image.arraySize > 1) header.caps |= kDDSCapsComplex;
+
+	SDDSHeaderDX10 headerDX10;
+	headerDX10.dxgiFormat = static_cast<TUInt32>(image.format);
+	headerDX10.resourceDimension = kDX10Texture2D;
+	headerDX10.miscFlag = 0;
+	headerDX10.arraySize = image.arraySize;
+	headerDX10.miscFlags2 = 0;
+
+	size_t dataBytes = static_cast<size_t>(TextureSliceBytes( image )) * image.arraySize;
+	pFile->resize( sizeof(kDDSMagic) + sizeof(header) + sizeof(headerDX10) + dataBytes );
+	TUInt8* out = &(*pFile)[0];
+	memcpy( out, &kDDSMagic, sizeof(kDDSMagic) );               out += sizeof(kDDSMagic);
+	memcpy( out, &header, sizeof(header) );                     out += sizeof(header);
+	memcpy( out, &headerDX10, sizeof(headerDX10) );             out += sizeof(headerDX10);
+	if (dataBytes > 0) memcpy( out, &image.data[0], dataBytes );
+}
+
+// Read a DDS file into an image
+bool ReadTextureImage( const string& fileName, STextureImage* pImage )
+{
+	FILE* file = fopen( fileName.c_str(), "rb" );
+	if (!file)
+	{
+		return false;
+	}
+	vector<TUInt8> contents;
+	TUInt8 buffer[64 * 1024];
+	size_t read;
+	while ((read = fread( buffer, 1, sizeof(buffer), file )) > 0)
+	{
+		contents.insert( contents.end(), buffer, buffer + read );
+	}
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success && !contents.empty() && TextureImageFromDDS( &contents[0], contents.size(), pImage );
+}
+
+// Write an image to a DDS file
+bool WriteTextureImage( const string& fileName, const STextureImage& image )
+{
+	vector<TUInt8> contents;
+	TextureImageToDDS( image, &contents );
+
+	FILE* file = fopen( fileName.c_str(), "wb" );
+	if (!file)
+	{
+		return false;
+	}
+	fwrite( &contents[0], 1, contents.size(), file );
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success;
+}
+
+
+//-----------------------------------------------------------------------------
+// Array builder
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Most slices in a texture array (D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION)
+	const TUInt32 kMaxArraySlices = 2048;
+
+	// Can a texture go in an array - a single texture in a format handled, with all its data
+	bool CanGroup( const STextureImage& image )
+	{
+		return image.arraySize == 1 && TextureSurfaceBytes( image.format, image.width, image.height ) > 0 &&
+		       image.data.size() >= TextureSliceBytes( image );
+	}
+
+	// Can two textures share an array
+	bool SameLayout( const STextureImage& a, const STextureImage& b )
+	{
+		return a.format == b.format && a.width == b.width && a.height == b.height && a.mipLevels == b.mipLevels;
+	}
+}
+
+// Add a texture, returns its index. A texture already added under the same name is not added again
+TUInt32 CTextureArrayBuilder::Add( const string& name, const STextureImage& image )
+{
+	TUInt32 existing = FindTexture( name );
+	if (existing != kNoTextureArray)
+	{
+		return existing;
+	}
+
+	STexture texture;
+	texture.name = name;
+	texture.image = image;
+	texture.slot.array = kNoTextureArray;
+	texture.slot.slice = 0;
+	m_Textures.push_back( texture );
+	return static_cast<TUInt32>(m_Textures.size() - 1);
+}
+
+// Index of a texture by name, kNoTextureArray if it hasn't been added
+TUInt32 CTextureArrayBuilder::FindTexture( const string& name ) const
+{
+	for (TUInt32 texture = 0; texture < m_Textures.size(); ++texture)
+	{
+		if (m_Textures[texture].name == name) return texture;
+	}
+	return kNoTextureArray;
+}
+
+// Group the textures with the same format, size and number of mips into arrays
+void CTextureArrayBuilder::Build( TUInt32 minSlices /*= 2*/ )
+{
+	m_Arrays.clear();
+	m_ArrayTextures.clear();
+	for (TUInt32 texture = 0; texture < m_Textures.size(); ++texture)
+	{
+		m_Textures[texture].slot.array = kNoTextureArray;
+		m_Textures[texture].slot.slice = 0;
+	}
+
+	// Each texture not yet grouped starts a group of the textures after it with the same layout. A texture in a group
+	// too small for an array is not looked at again
+	vector<bool> grouped( m_Textures.size(), false );
+	for (TUInt32 first = 0; first < m_Textures.size(); ++first)
+	{
+		const STextureImage& image = m_Textures[first].image;
+		if (grouped[first] || !CanGroup( image )) continue;
+
+		vector<TUInt32> group;
+		for (TUInt32 texture = first; texture < m_Textures.size() && group.size() < kMaxArraySlices; ++texture)
+		{
+			if (!grouped[texture] && CanGroup( m_Textures[texture].image ) && SameLayout( image, m_Textures[texture].image ))
+			{
+				group.push_back( texture );
+				grouped[texture] = true;
+			}
+		}
+		if (group.size() < max( minSlices, 1u )) continue;
+
+		// Each slice is a straight copy of a texture's data - all its mips, block compressed data block for block
+		TUInt32 sliceBytes = TextureSliceBytes( image );
+		TUInt32 array = static_cast<TUInt32>(m_Arrays.size());
+		m_Arrays.push_back( STextureImage() );
+		STextureImage& arrayImage = m_Arrays.back();
+		arrayImage.format = image.format;
+		arrayImage.width = image.width;
+		arrayImage.height = image.height;
+		arrayImage.mipLevels = image.mipLevels;
+		arrayImage.arraySize = static_cast<TUInt32>(group.size());
+		arrayImage.data.resize( static_cast<size_t>(sliceBytes) * group.size() );
+		for (TUInt32 slice = 0; slice < group.size(); ++slice)
+		{
+			STexture& texture = m_Textures[group[slice]];
+			memcpy( &arrayImage.data[static_cast<size_t>(sliceBytes) * slice], &texture.image.data[0], sliceBytes );
+			texture.slot.array = array;
+			texture.slot.slice = slice;
+		}
+		m_ArrayTextures.push_back( group );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Devices
+//-----------------------------------------------------------------------------
+
+// Create an immutable texture from an image and a view of it. Returns 0 on failure
+ID3D11ShaderResourceView* CreateTextureView( ID3D11Device* device, const STextureImage& image, bool asArray )
+{
+	TUInt32 arraySize = asArray ? image.arraySize : 1;
+	TUInt32 sliceBytes = TextureSliceBytes( image );
+	if (sliceBytes == 0 || image.data.size() < static_cast<size_t>(sliceBytes) * arraySize)
+	{
+		return 0;
+	}
+
+	D3D11_TEXTURE2D_DESC textureDesc;
+	textureDesc.Width = image.width;
+	textureDesc.Height = image.height;
+	textureDesc.MipLevels = image.mipLevels;
+	textureDesc.ArraySize = arraySize;
+	textureDesc.Format = image.format;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.SampleDesc.Quality = 0;
+	textureDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	textureDesc.CPUAccessFlags = 0;
+	textureDesc.MiscFlags = 0;
+
+	// Initial data for each mip of each slice, in subresource order - the order they are stored in
+	vector<D3D11_SUBRESOURCE_DATA> initialData( arraySize * image.mipLevels );
+	const TUInt8* source = &image.data[0];
+	for (TUInt32 slice = 0; slice < arraySize; ++slice)
+	{
+		for (TUInt32 mip = 0; mip < image.mipLevels; ++mip)
+		{
+			TUInt32 width = max( image.width >> mip, 1u );
+			TUInt32 height = max( image.height >> mip, 1u );
+			D3D11_SUBRESOURCE_DATA& data = initialData[slice * image.mipLevels + mip];
+			data.pSysMem = source;
+			data.SysMemPitch = TextureRowBytes( image.format, width );
+			data.SysMemSlicePitch = TextureSurfaceBytes( image.format, width, height );
+			source += data.SysMemSlicePitch;
+		}
+	}
+
+	ID3D11Texture2D* texture;
+	if (FAILED( device->CreateTexture2D( &textureDesc, &initialData[0], &texture ) ))
+	{
+		return 0;
+	}
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc;
+	viewDesc.Format = image.format;
+	if (asArray)
+	{
+		viewDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+		viewDesc.Texture2DArray.MostDetailedMip = 0;
+		viewDesc.Texture2DArray.MipLevels = image.mipLevels;
+		viewDesc.Texture2DArray.FirstArraySlice = 0;
+		viewDesc.Texture2DArray.ArraySize = arraySize;
+	}
+	else
+	{
+		viewDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		viewDesc.Texture2D.MostDetailedMip = 0;
+		viewDesc.Texture2D.MipLevels = image.mipLevels;
+	}
+	ID3D11ShaderResourceView* view;
+	HRESULT result = device->CreateShaderResourceView( texture, &viewDesc, &view );
+	texture->Release(); // The view holds a reference
+	return SUCCEEDED( result ) ? view : 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Offline build
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// Texture changes drawing a list of textures in order, the first draw included. Draws with no texture ("") don't
+	// change what is bound
+	TUInt32 CountTextureChanges( const vector<string>& drawTextures )
+	{
+		TUInt32 changes = 0;
+		string bound;
+		for (TUInt32 draw = 0; draw < drawTextures.size(); ++draw)
+		{
+			if (!drawTextures[draw].empty() && drawTextures[draw] != bound)
+			{
+				bound = drawTextures[draw];
+				++changes;
+			}
+		}
+		return changes;
+	}
+
+	// Number of different textures in a list
+	TUInt32 CountTextures( vector<string> textures )
+	{
+		sort( textures.begin(), textures.end() );
+		textures.erase( unique( textures.begin(), textures.end() ), textures.end() );
+		textures.erase( remove( textures.begin(), textures.end(), string() ), textures.end() );
+		return static_cast<TUInt32>(textures.size());
+	}
+
+	// File an array is written to
+	string ArrayFileName( const string& meshFileName, TUInt32 array )
+	{
+		ostringstream name;
+		name << meshFileName << ".array" << array << ".dds";
+		return name.str();
+	}
+}
+
+// Build arrays from the diffuse maps of the materials in an X-file and write them with a report
+bool BuildTextureArrayFiles( const string& meshFileName, const string& reportFileName )
+{
+	CImportXFile importFile;
+	if (!importFile.IsXFile( meshFileName ) || importFile.ImportFile( meshFileName ) != kSuccess)
+	{
+		return false;
+	}
+
+	// Diffuse map of each material. Those that can't be read as DDS (e.g. JPEGs) are left out of the arrays
+	CTextureArrayBuilder builder;
+	vector<string> materialTextures( importFile.GetNumMaterials() );
+	for (TUInt32 material = 0; material < materialTextures.size(); ++material)
+	{
+		SMeshMaterial importMaterial;
+		importFile.GetMaterial( material, &importMaterial );
+		if (importMaterial.numTextures == 0) continue;
+
+		materialTextures[material] = importMaterial.textureFileNames[0];
+		STextureImage image;
+		if (ReadTextureImage( materialTextures[material], &image ))
+		{
+			builder.Add( materialTextures[material], image );
+		}
+	}
+	builder.Build();
+
+	// Texture each draw uses, separately then with arrays. Sub-meshes are drawn in order, as CMesh::Render draws those not
+	// in static batches
+	vector<string> drawsSeparate, drawsArrays;
+	for (TUInt32 subMesh = 0; subMesh < importFile.GetNumSubMeshes(); ++subMesh)
+	{
+		SSubMesh importSubMesh;
+		if (importFile.GetSubMesh( subMesh, &importSubMesh ) != kSuccess) return false;
+		delete[] importSubMesh.vertices; // Only the material is needed
+		delete[] importSubMesh.faces;
+
+		string texture = materialTextures[importSubMesh.material];
+		drawsSeparate.push_back( texture );
+		TUInt32 index = builder.FindTexture( texture );
+		if (index != kNoTextureArray && builder.GetSlot( index ).array != kNoTextureArray)
+		{
+			texture = ArrayFileName( meshFileName, builder.GetSlot( index ).array );
+		}
+		drawsArrays.push_back( texture );
+	}
+
+	for (TUInt32 array = 0; array < builder.GetNumArrays(); ++array)
+	{
+		if (!WriteTextureImage( ArrayFileName( meshFileName, array ), builder.GetArray( array ) )) return false;
+	}
+
+	FILE* file = fopen( reportFileName.c_str(), "w" );
+	if (!file)
+	{
+		return false;
+	}
+	fprintf( file, "mesh,draws,textures_separate,textures_arrays,arrays,texture_changes_separate,texture_changes_arrays\n" );
+	fprintf( file, "%s,%u,%u,%u,%u,%u,%u\n", meshFileName.c_str(), static_cast<TUInt32>(drawsSeparate.size()),
+	         CountTextures( drawsSeparate ), CountTextures( drawsArrays ), builder.GetNumArrays(),
+	         CountTextureChanges( drawsSeparate ), CountTextureChanges( drawsArrays ) );
+
+	fprintf( file, "\narray,file,format,width,height,mips,slices,bytes\n" );
+	for (TUInt32 array = 0; array < builder.GetNumArrays(); ++array)
+	{
+		const STextureImage& image = builder.GetArray( array );
+		fprintf( file, "%u,%s,%s,%u,%u,%u,%u,%u\n", array, ArrayFileName( meshFileName, array ).c_str(), FormatName( image.format ),
+		         image.width, image.height, image.mipLevels, image.arraySize, static_cast<TUInt32>(image.data.size()) );
+	}
+
+	// Where each texture went, the slice a material using it selects
+	fprintf( file, "\ntexture,format,width,height,array,slice\n" );
+	for (TUInt32 texture = 0; texture < builder.GetNumTextures(); ++texture)
+	{
+		const STextureImage& image = builder.GetTexture( texture );
+		const STextureArraySlot& slot = builder.GetSlot( texture );
+		if (slot.array != kNoTextureArray)
+		{
+			fprintf( file, "%s,%s,%u,%u,%u,%u\n", builder.GetTextureName( texture ).c_str(), FormatName( image.format ),
+			         image.width, image.height, slot.array, slot.slice );
+		}
+		else
+		{
+			fprintf( file, "%s,%s,%u,%u,none,\n", builder.GetTextureName( texture ).c_str(), FormatName( image.format ),
+			         image.width, image.height );
+		}
+	}
+
+	bool success = (ferror( file ) == 0);
+	fclose( file );
+	return success;
+}
@@ -0,0 +1,166 @@
+/*******************************************
+	TextureArrays.h
+
+	Texture arrays built from many small
+	textures. Textures of the same format,
+	size and number of mips are grouped and
+	their data copied slice by slice into one
+	array - block compressed data is copied
+	block for block, never re-encoded - so
+	materials using any of them share a single
+	texture and select theirs by slice
+********************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "Defines.h"
+#include "GenDefines.h"
+using namespace gen;
+
+
+//-----------------------------------------------------------------------------
+// Images
+//-----------------------------------------------------------------------------
+
+// A 2D texture or texture array in memory, as stored in a DDS file: each slice in turn with all of its
+// mips, largest first, and the rows of each mip (rows of 4x4 blocks for block compressed formats) packed
+struct STextureImage
+{
+	DXGI_FORMAT     format;
+	TUInt32         width;
+	TUInt32         height;
+	TUInt32         mipLevels;
+	TUInt32         arraySize;
+	vector<TUInt8>  data;
+};
+
+// Bytes in one mip of the given size, 0 if the format is not one handled here (BC1-5 and 32-bit RGBA/BGRA)
+TUInt32 TextureSurfaceBytes( DXGI_FORMAT format, TUInt32 width, TUInt32 height );
+
+// Bytes in one row of a mip, of 4x4 blocks for block compressed formats
+TUInt32 TextureRowBytes( DXGI_FORMAT format, TUInt32 width );
+
+// Bytes in one slice of an image, all its mips
+TUInt32 TextureSliceBytes( const STextureImage& image );
+
+
+//-----------------------------------------------------------------------------
+// DDS files
+//-----------------------------------------------------------------------------
+
+// Read a DDS file from memory. Legacy headers (DXT1-5, ATI1/2 and 32-bit RGB masks) and DX10 headers (2D textures
+// and arrays) are understood. Returns false for anything else - cube maps, volumes and other formats
+bool TextureImageFromDDS( const TUInt8* file, size_t fileSize, STextureImage* pImage );
+
+// Write an image as a DDS file in memory, always with a DX10 header so arrays are kept
+void TextureImageToDDS( const STextureImage& image, vector<TUInt8>* pFile );
+
+// The same to and from files on disk. Return false on a file error or an image that can't be read
+bool ReadTextureImage( const string& fileName, STextureImage* pImage );
+bool WriteTextureImage( const string& fileName, const STextureImage& image );
+
+
+//-----------------------------------------------------------------------------
+// Array builder
+//-----------------------------------------------------------------------------
+
+// Where a texture ended up, array is kNoTextureArray if it was left on its own
+const TUInt32 kNoTextureArray = ~0u;
+struct STextureArraySlot
+{
+	TUInt32 array;
+	TUInt32 slice;
+};
+
+// Groups textures into arrays. Add the textures, Build, then take the arrays and the slot each texture was put in
+class CTextureArrayBuilder
+{
+public:
+	// Add a texture, returns its index. A texture already added under the same name is not added again, the index
+	// of the first is returned
+	TUInt32 Add( const string& name, const STextureImage& image );
+
+	// Group the textures with the same format, size and number of mips into arrays, each slice a copy of a texture's
+	// data in the order they were added. Groups of fewer than minSlices textures, arrays and formats not handled by
+	// TextureSurfaceBytes are left as they are. Replaces the arrays of any previous Build
+	void Build( TUInt32 minSlices = 2 );
+
+
+	/////////////////////////////////////
+	// Data access
+
+	TUInt32 GetNumTextures() const
+	{
+		return static_cast<TUInt32>(m_Textures.size());
+	}
+
+	const string& GetTextureName( TUInt32 texture ) const
+	{
+		return m_Textures[texture].name;
+	}
+
+	const STextureImage& GetTexture( TUInt32 texture ) const
+	{
+		return m_Textures[texture].image;
+	}
+
+	// Index of a texture by name, kNoTextureArray if it hasn't been added
+	TUInt32 FindTexture( const string& name ) const;
+
+	TUInt32 GetNumArrays() const
+	{
+		return static_cast<TUInt32>(m_Arrays.size());
+	}
+
+	const STextureImage& GetArray( TUInt32 array ) const
+	{
+		return m_Arrays[array];
+	}
+
+	// Texture in each slice of an array
+	const vector<TUInt32>& GetArrayTextures( TUInt32 array ) const
+	{
+		return m_ArrayTextures[array];
+	}
+
+	// Array and slice a texture was copied into by the last Build
+	const STextureArraySlot& GetSlot( TUInt32 texture ) const
+	{
+		return m_Textures[texture].slot;
+	}
+
+private:
+	struct STexture
+	{
+		string            name;
+		STextureImage     image;
+		STextureArraySlot slot;
+	};
+
+	vector<STexture>         m_Textures;
+	vector<STextureImage>    m_Arrays;
+	vector<vector<TUInt32> > m_ArrayTextures;
+};
+
+
+//-----------------------------------------------------------------------------
+// Devices
+//-----------------------------------------------------------------------------
+
+// Create an immutable texture from an image and a view of it, a Texture2DArray view for arrays (even of one slice)
+// if asArray is set, otherwise a Texture2D view of the first slice. Returns 0 on failure
+ID3D11ShaderResourceView* CreateTextureView( ID3D11Device* device, const STextureImage& image, bool asArray );
+
+
+//-----------------------------------------------------------------------------
+// Offline build
+//-----------------------------------------------------------------------------
+
+// Build arrays from the diffuse maps of the materials in an X-file, writing each as a DDS file named after the mesh
+// (e.g. level2.x.array0.dds), and write a CSV report of the slot of each texture, the arrays, and the texture changes
+// drawing the sub-meshes in order with separate textures and with arrays. Returns false on a file error
+bool BuildTextureArrayFiles( const string& meshFileName, const string& reportFileName );
@@ -0,0 +1,167 @@
+/*******************************************
+	UploadRing.cpp
+
+	Fenced ring buffer for per-frame uploads
+********************************************/
+
+#include "UploadRing.h"
+#include "FrameStats.h"
+#include "MemoryAccounting.h"
+
+
+//-----------------------------------------------------------------------------
+// Setup
+//-----------------------------------------------------------------------------
+
+// Create the buffer and fences
+bool CUploadRing::Init( UINT size, UINT bindFlags )
+{
+	Release();
+
+	D3D11_BUFFER_DESC bufferDesc;
+	bufferDesc.BindFlags = bindFlags;
+	bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+	bufferDesc.ByteWidth = size;
+	bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	bufferDesc.MiscFlags = 0;
+	bufferDesc.StructureByteStride = 0;
+	if (FAILED( g_pd3dDevice->CreateBuffer( &bufferDesc, NULL, &m_Buffer ) ))
+	{
+		m_Buffer = 0;
+		return false;
+	}
+	MemoryAccountAdd( kMemoryVertexBuffers, m_Name, size );
+
+	D3D11_QUERY_DESC queryDesc;
+	queryDesc.Query = D3D11_QUERY_EVENT;
+	queryDesc.MiscFlags = 0;
+	for (unsigned int f = 0; f < kMaxFramesInFlight; ++f)
+	{
+		if (FAILED( g_pd3dDevice->CreateQuery( &queryDesc, &m_Fences[f] ) ))
+		{
+			m_Fences[f] = 0;
+			Release();
+			return false;
+		}
+	}
+
+	m_Ring.Reset( size );
+	m_Frame = 0;
+	m_FirstPending = 0;
+	m_NumPending = 0;
+	m_NeedsDiscard = true;
+	return true;
+}
+
+// Release the buffer and fences
+void CUploadRing::Release()
+{
+	if (m_Buffer)
+	{
+		m_Buffer->Release();
+		m_Buffer = 0;
+		MemoryAccountRelease( kMemoryVertexBuffers, m_Name );
+	}
+	for (unsigned int f = 0; f < kMaxFramesInFlight; ++f)
+	{
+		if (m_Fences[f]) m_Fences[f]->Release();
+		m_Fences[f] = 0;
+	}
+	m_Ring.Reset( 0 );
+	m_NumPending = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Frames
+//-----------------------------------------------------------------------------
+
+// Retire the frames the GPU has finished with
+void CUploadRing::BeginFrame()
+{
+	while (m_NumPending > 0 && RetireOldest( false ));
+}
+
+// Fence the frame
+void CUploadRing::EndFrame()
+{
+	if (!m_Buffer) return;
+
+	// Too far ahead of the GPU - wait for the oldest frame so its fence can be reused
+	if (m_NumPending == kMaxFramesInFlight && !RetireOldest( true ))
+	{
+		// The fence failed (e.g. device removed), start again with a discard
+		m_Ring.Reset( m_Ring.Size() );
+		m_NumPending = 0;
+		m_NeedsDiscard = true;
+	}
+
+	unsigned int fence = (m_FirstPending + m_NumPending) % kMaxFramesInFlight;
+	g_pd3dContext->End( m_Fences[fence] );
+	m_FenceFrames[fence] = m_Frame;
+	++m_NumPending;
+	m_Ring.EndFrame( m_Frame );
+	++m_Frame;
+}
+
+// Retire the oldest pending frame if the GPU has finished it
+bool CUploadRing::RetireOldest( bool wait )
+{
+	ID3D11Query* fence = m_Fences[m_FirstPending];
+	BOOL done = FALSE;
+	HRESULT result;
+	while ((result = g_pd3dContext->GetData( fence, &done, sizeof(done), wait ? 0 : D3D11_ASYNC_GETDATA_DONOTFLUSH )) == S_FALSE && wait);
+	if (result != S_OK || !done) return false;
+
+	m_Ring.Retire( m_FenceFrames[m_FirstPending] );
+	m_FirstPending = (m_FirstPending + 1) % kMaxFramesInFlight;
+	--m_NumPending;
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Uploads
+//-----------------------------------------------------------------------------
+
+// Map space for some data
+void* CUploadRing::Map( UINT size, UINT alignment, UINT* pOffset )
+{
+	if (!m_Buffer) return 0;
+
+	// Could never fit - fail before touching the ring, resetting it would forget the frames still in flight
+	if (size > m_Ring.Size()) return 0;
+
+	D3D11_MAP mapType = D3D11_MAP_WRITE_NO_OVERWRITE;
+	UINT offset = m_Ring.Allocate( size, alignment );
+	if (offset == CRingAllocator::kInvalidOffset || m_NeedsDiscard)
+	{
+		// The space is still in use by the GPU (or this is the first upload) - discard. Draws already
+		// submitted keep the old contents, so the whole ring is free
+		m_Ring.Reset( m_Ring.Size() );
+		offset = m_Ring.Allocate( size, alignment );
+		if (offset == CRingAllocator::kInvalidOffset)
+		{
+			// Too large once aligned. The reset dropped the fences, so the next upload must discard
+			m_NeedsDiscard = true;
+			return 0;
+		}
+		mapType = D3D11_MAP_WRITE_DISCARD;
+		m_NeedsDiscard = false;
+		FrameStatsAdd( kCounterBufferDiscards );
+	}
+
+	D3D11_MAPPED_SUBRESOURCE mappedData;
+	if (FAILED( g_pd3dContext->Map( m_Buffer, 0, mapType, 0, &mappedData ) ))
+	{
+		m_NeedsDiscard = true;
+		return 0;
+	}
+	*pOffset = offset;
+	return static_cast<char*>(mappedData.pData) + offset;
+}
+
+void CUploadRing::Unmap()
+{
+	g_pd3dContext->Unmap( m_Buffer, 0 );
+}
@@ -0,0 +1,106 @@
+/*******************************************
+	UploadRing.h
+
+	Per-frame dynamic data (lights, instance
+	data) written into one large dynamic
+	buffer, sub-allocated as a ring and
+	fenced by frame
+********************************************/
+
+#pragma once
+
+#include <string>
+using namespace std;
+
+#include "Defines.h"
+#include "RingAllocator.h"
+
+
+// A dynamic buffer shared by all the data uploaded each frame. Each upload takes the next range in
+// the ring and maps it with WRITE_NO_OVERWRITE, so the driver doesn't rename the buffer for every
+// small upload. Frames are fenced with event queries, space is reused once the GPU has finished
+// the frame that used it. WRITE_DISCARD is only used on the first upload and when the ring wraps
+// round into space still in use, the driver then gives the buffer fresh memory and every range is
+// free again. Uses g_pd3dContext, which must be the immediate context (deferred contexts can only
+// map with WRITE_DISCARD). Use from the rendering thread only
+class CUploadRing
+{
+public:
+	// Frames the CPU may be ahead of the GPU. EndFrame waits for the GPU beyond this
+	static const unsigned int kMaxFramesInFlight = 3;
+
+	CUploadRing( const string& name )
+		: m_Name( name ), m_Buffer( 0 ), m_Frame( 0 ), m_FirstPending( 0 ), m_NumPending( 0 ), m_NeedsDiscard( true )
+	{
+		for (unsigned int f = 0; f < kMaxFramesInFlight; ++f) m_Fences[f] = 0;
+	}
+
+	~CUploadRing()
+	{
+		Release();
+	}
+
+	// Create the buffer and fences, bind flags as in D3D11_BUFFER_DESC (e.g. D3D11_BIND_VERTEX_BUFFER).
+	// Returns false on failure
+	bool Init( UINT size, UINT bindFlags );
+
+	// Release the buffer and fences
+	void Release();
+
+
+	/////////////////////////////////////
+	// Frames
+
+	// Call at the start of each frame's rendering, retires the frames the GPU has finished with
+	void BeginFrame();
+
+	// Call after the frame's last draw using the ring, before Present. Fences the frame
+	void EndFrame();
+
+
+	/////////////////////////////////////
+	// Uploads
+
+	// Map space for some data at the given alignment (a power of 2). Returns a pointer to write the
+	// data to and the offset of the data in the buffer, or 0 if the data is larger than the ring.
+	// Call Unmap before drawing
+	void* Map( UINT size, UINT alignment, UINT* pOffset );
+	void Unmap();
+
+	ID3D11Buffer* Buffer() const
+	{
+		return m_Buffer;
+	}
+
+	UINT Size() const
+	{
+		return m_Ring.Size();
+	}
+
+	// Space used by frames in flight and the frame in progress
+	UINT UsedSize() const
+	{
+		return m_Ring.UsedSize();
+	}
+
+private:
+	// Disallow use of copy constructor and assignment operator (private and not defined)
+	CUploadRing( const CUploadRing& );
+	CUploadRing& operator=( const CUploadRing& );
+
+	// Retire the oldest pending frame if the GPU has finished it (or wait for it to), returns true if it was retired
+	bool RetireOldest( bool wait );
+
+	string             m_Name; // Names the buffer in memory reports
+	ID3D11Buffer*      m_Buffer;
+	CRingAllocator     m_Ring;
+	unsigned long long m_Frame; // Frame in progress
+
+	// Event queries of frames the GPU may not have finished, oldest first in a ring
+	ID3D11Query*       m_Fences[kMaxFramesInFlight];
+	unsigned long long m_FenceFrames[kMaxFramesInFlight];
+	unsigned int       m_FirstPending;
+	unsigned int       m_NumPending;
+
+	bool               m_NeedsDiscard; // Until the first upload
+};
@@ -0,0 +1,283 @@
+/*******************************************
+	VertexFormat.cpp
+
+	Vertex format registry and input layout
+	cache
+********************************************/
+
+#include <set>
+#include <cstring>
+using namespace std;
+
+#include "VertexFormat.h"
+#include "MemoryTracking.h"
+
+
+//-----------------------------------------------------------------------------
+// Hashing
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	// FNV-1a, continuing from a previous hash
+	const unsigned int kHashStart = 2166136261u;
+
+	unsigned int Hash( const void* data, size_t size, unsigned int hash = kHashStart )
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash = (hash ^ bytes[i]) * 16777619u;
+		}
+		return hash;
+	}
+
+	// Elements are compared by contents, semantic names included
+	bool SameElement( const D3D11_INPUT_ELEMENT_DESC& a, const D3D11_INPUT_ELEMENT_DESC& b )
+	{
+		return strcmp( a.SemanticName, b.SemanticName ) == 0 && a.SemanticIndex == b.SemanticIndex &&
+		       a.Format == b.Format && a.InputSlot == b.InputSlot && a.AlignedByteOffset == b.AlignedByteOffset &&
+		       a.InputSlotClass == b.InputSlotClass && a.InstanceDataStepRate == b.InstanceDataStepRate;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Vertex formats
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	vector<SVertexFormat> Formats;
+	set<string>           SemanticNames; // Element semantic names point into this
+
+	// Formats registered by VertexFormatCombine, by the pair of formats combined
+	map<pair<TVertexFormat, TVertexFormat>, TVertexFormat> Combined;
+
+	// Formats registered by VertexFormatSeparatePositions and VertexFormatPositionsOnly, by the original format
+	map<TVertexFormat, TVertexFormat> SeparatePositions;
+	map<TVertexFormat, TVertexFormat> PositionsOnly;
+}
+
+// Register a vertex format and return its ID
+TVertexFormat VertexFormatRegister( const D3D11_INPUT_ELEMENT_DESC* elements, UINT numElements, UINT vertexSize,
+                                    UINT attributeSize /*= 0*/ )
+{
+	if (numElements > SVertexFormat::kMaxElements)
+	{
+		return kNoVertexFormat;
+	}
+
+	unsigned int hash = Hash( &vertexSize, sizeof(vertexSize) );
+	hash = Hash( &attributeSize, sizeof(attributeSize), hash );
+	for (UINT e = 0; e < numElements; ++e)
+	{
+		const D3D11_INPUT_ELEMENT_DESC& element = elements[e];
+		hash = Hash( element.SemanticName, strlen( element.SemanticName ), hash );
+		hash = Hash( &element.SemanticIndex, sizeof(element.SemanticIndex), hash );
+		hash = Hash( &element.Format, sizeof(element.Format), hash );
+		hash = Hash( &element.InputSlot, sizeof(element.InputSlot), hash );
+		hash = Hash( &element.AlignedByteOffset, sizeof(element.AlignedByteOffset), hash );
+		hash = Hash( &element.InputSlotClass, sizeof(element.InputSlotClass), hash );
+		hash = Hash( &element.InstanceDataStepRate, sizeof(element.InstanceDataStepRate), hash );
+	}
+
+	// Look for the same format, there are only ever a few
+	for (size_t f = 0; f < Formats.size(); ++f)
+	{
+		const SVertexFormat& format = Formats[f];
+		if (format.hash != hash || format.numElements != numElements || format.vertexSize != vertexSize ||
+		    format.attributeSize != attributeSize) continue;
+
+		UINT e = 0;
+		while (e < numElements && SameElement( format.elements[e], elements[e] )) ++e;
+		if (e == numElements) return static_cast<TVertexFormat>(f);
+	}
+
+	// New format
+	if (Formats.size() >= kNoVertexFormat)
+	{
+		return kNoVertexFormat;
+	}
+	SVertexFormat format;
+	format.numElements = numElements;
+	format.vertexSize = vertexSize;
+	format.attributeSize = attributeSize;
+	format.hash = hash;
+	for (UINT e = 0; e < numElements; ++e)
+	{
+		format.elements[e] = elements[e];
+		format.elements[e].SemanticName = SemanticNames.insert( elements[e].SemanticName ).first->c_str();
+	}
+	Formats.push_back( format );
+	return static_cast<TVertexFormat>(Formats.size() - 1);
+}
+
+// Description of a registered format
+const SVertexFormat& VertexFormatDesc( TVertexFormat format )
+{
+	return Formats[format];
+}
+
+// Number of distinct formats registered
+unsigned int VertexFormatCount()
+{
+	return static_cast<unsigned int>(Formats.size());
+}
+
+// Register the format made of the elements of one format followed by those of another
+TVertexFormat VertexFormatCombine( TVertexFormat format, TVertexFormat extra )
+{
+	if (format == kNoVertexFormat || extra == kNoVertexFormat)
+	{
+		return kNoVertexFormat;
+	}
+
+	pair<TVertexFormat, TVertexFormat> key( format, extra );
+	map<pair<TVertexFormat, TVertexFormat>, TVertexFormat>::iterator found = Combined.find( key );
+	if (found != Combined.end())
+	{
+		return found->second;
+	}
+
+	// First use of this pair, normally at load time but allow for it mid-frame
+	CMemoryAllowAllocationsScope allowAllocations;
+	const SVertexFormat& first = Formats[format];
+	const SVertexFormat& second = Formats[extra];
+	if (first.numElements + second.numElements > SVertexFormat::kMaxElements)
+	{
+		return kNoVertexFormat;
+	}
+	D3D11_INPUT_ELEMENT_DESC elements[SVertexFormat::kMaxElements];
+	for (UINT e = 0; e < first.numElements; ++e) elements[e] = first.elements[e];
+	for (UINT e = 0; e < second.numElements; ++e) elements[first.numElements + e] = second.elements[e];
+	TVertexFormat combined = VertexFormatRegister( elements, first.numElements + second.numElements, first.vertexSize, first.attributeSize );
+	Combined[key] = combined;
+	return combined;
+}
+
+// Register the same elements with the position in a stream of its own
+TVertexFormat VertexFormatSeparatePositions( TVertexFormat format )
+{
+	if (format == kNoVertexFormat)
+	{
+		return kNoVertexFormat;
+	}
+	map<TVertexFormat, TVertexFormat>::iterator found = SeparatePositions.find( format );
+	if (found != SeparatePositions.end())
+	{
+		return found->second;
+	}
+
+	CMemoryAllowAllocationsScope allowAllocations;
+	const SVertexFormat& formatDesc = Formats[format];
+	const D3D11_INPUT_ELEMENT_DESC& position = formatDesc.elements[0];
+	TVertexFormat separate = kNoVertexFormat;
+	if (formatDesc.numElements > 0 && formatDesc.attributeSize == 0 && strcmp( position.SemanticName, "POSITION" ) == 0 &&
+	    position.Format == DXGI_FORMAT_R32G32B32_FLOAT && position.AlignedByteOffset == 0 && position.InputSlot == 0)
+	{
+		const UINT kPositionSize = 12;
+		D3D11_INPUT_ELEMENT_DESC elements[SVertexFormat::kMaxElements];
+		for (UINT e = 0; e < formatDesc.numElements; ++e)
+		{
+			elements[e] = formatDesc.elements[e];
+			if (e > 0 && elements[e].InputSlot == 0)
+			{
+				elements[e].InputSlot = 1;
+				elements[e].AlignedByteOffset -= kPositionSize;
+			}
+		}
+		UINT attributeSize = formatDesc.vertexSize - kPositionSize;
+		separate = (attributeSize == 0) ? format : VertexFormatRegister( elements, formatDesc.numElements, kPositionSize, attributeSize );
+	}
+	SeparatePositions[format] = separate;
+	return separate;
+}
+
+// Register a format with just the slot 0 elements of another
+TVertexFormat VertexFormatPositionsOnly( TVertexFormat format )
+{
+	if (format == kNoVertexFormat)
+	{
+		return kNoVertexFormat;
+	}
+	map<TVertexFormat, TVertexFormat>::iterator found = PositionsOnly.find( format );
+	if (found != PositionsOnly.end())
+	{
+		return found->second;
+	}
+
+	CMemoryAllowAllocationsScope allowAllocations;
+	const SVertexFormat& formatDesc = Formats[format];
+	D3D11_INPUT_ELEMENT_DESC elements[SVertexFormat::kMaxElements];
+	UINT numElements = 0;
+	for (UINT e = 0; e < formatDesc.numElements; ++e)
+	{
+		if (formatDesc.elements[e].InputSlot == 0) elements[numElements++] = formatDesc.elements[e];
+	}
+	TVertexFormat positions = VertexFormatRegister( elements, numElements, formatDesc.vertexSize );
+	PositionsOnly[format] = positions;
+	return positions;
+}
+
+
+//-----------------------------------------------------------------------------
+// Input layout cache
+//-----------------------------------------------------------------------------
+
+// Cache used for all rendering
+CInputLayoutCache InputLayouts;
+
+
+// Layout for a format and the input signature of a technique's first pass
+ID3D11InputLayout* CInputLayoutCache::Layout( TVertexFormat format, ID3DX11EffectTechnique* technique )
+{
+	D3DX11_PASS_DESC passDesc;
+	technique->GetPassByIndex( 0 )->GetDesc( &passDesc );
+	return Layout( format, passDesc.pIAInputSignature, passDesc.IAInputSignatureSize );
+}
+
+// Layout for a format and a vertex shader input signature
+ID3D11InputLayout* CInputLayoutCache::Layout( TVertexFormat format, const void* signature, SIZE_T signatureSize )
+{
+	if (format == kNoVertexFormat || !signature)
+	{
+		return 0;
+	}
+
+	TLayoutKey key( format, Hash( signature, signatureSize ) );
+	pair<multimap<TLayoutKey, SLayout>::iterator, multimap<TLayoutKey, SLayout>::iterator> found = m_Layouts.equal_range( key );
+	for (multimap<TLayoutKey, SLayout>::iterator layout = found.first; layout != found.second; ++layout)
+	{
+		const vector<unsigned char>& cached = layout->second.signature;
+		if (cached.size() == signatureSize && memcmp( &cached[0], signature, signatureSize ) == 0)
+		{
+			return layout->second.layout;
+		}
+	}
+
+	// First use of this pair - create the layout. Happens at load time in practice, but allow for it
+	// mid-frame
+	CMemoryAllowAllocationsScope allowAllocations;
+	const SVertexFormat& formatDesc = Formats[format];
+	SLayout layout;
+	if (FAILED( g_pd3dDevice->CreateInputLayout( formatDesc.elements, formatDesc.numElements, signature, signatureSize, &layout.layout ) ))
+	{
+		return 0;
+	}
+	const unsigned char* signatureBytes = static_cast<const unsigned char*>(signature);
+	layout.signature.assign( signatureBytes, signatureBytes + signatureSize );
+	m_Layouts.insert( make_pair( key, layout ) );
+	return layout.layout;
+}
+
+
+// Release all layouts
+void CInputLayoutCache::Release()
+{
+	for (multimap<TLayoutKey, SLayout>::iterator layout = m_Layouts.begin(); layout != m_Layouts.end(); ++layout)
+	{
+		layout->second.layout->Release();
+	}
+	m_Layouts.clear();
+}
@@ -0,0 +1,123 @@
+/*******************************************
+	VertexFormat.h
+
+	Vertex formats registered once and
+	referred to by a small ID, and a cache of
+	input layouts shared by everything with
+	the same format and shader input
+********************************************/
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "Defines.h"
+
+
+//-----------------------------------------------------------------------------
+// Vertex formats
+//-----------------------------------------------------------------------------
+
+// Identifies a registered vertex format
+typedef unsigned short TVertexFormat;
+const TVertexFormat kNoVertexFormat = 0xffff;
+
+// Description of the elements in a single vertex (position, normal, UVs etc.)
+struct SVertexFormat
+{
+	static const int kMaxElements = 16;
+
+	UINT                     numElements;
+	D3D11_INPUT_ELEMENT_DESC elements[kMaxElements];
+	UINT                     vertexSize;    // Bytes per vertex in slot 0
+	UINT                     attributeSize; // Bytes per vertex in slot 1 if positions are a separate stream, otherwise 0
+	unsigned int             hash;          // Of the element contents (semantic names by value, not pointer)
+};
+
+// Register a vertex format and return its ID. A format the same as one already registered gets
+// the same ID, so IDs can be compared to see if two meshes share a format. Semantic names are
+// copied, the element array need not outlive the call. Returns kNoVertexFormat if there are too
+// many elements. Formats with separate position and attribute streams (see
+// VertexFormatSeparatePositions) also give the attribute size
+TVertexFormat VertexFormatRegister( const D3D11_INPUT_ELEMENT_DESC* elements, UINT numElements, UINT vertexSize,
+                                    UINT attributeSize = 0 );
+
+// Description of a registered format
+const SVertexFormat& VertexFormatDesc( TVertexFormat format );
+
+// Number of distinct formats registered
+unsigned int VertexFormatCount();
+
+// Register the format made of the elements of one format followed by those of another, e.g. vertex data
+// in slots 0 and 1 with per-instance data in slot 2 for hardware instancing. The vertex size is the first
+// format's. Combinations are cached, so this is cheap to call per draw. Returns kNoVertexFormat if
+// there are too many elements
+TVertexFormat VertexFormatCombine( TVertexFormat format, TVertexFormat extra );
+
+// Register the same elements with the position in a tightly packed stream of its own (slot 0) and
+// the other elements moved to slot 1, in the same order. Passes that only need positions (depth
+// passes, CPU geometry work) then read 12 bytes per vertex rather than the whole vertex. The
+// position must be the first element, a float3 at offset 0. Vertex data for the new format is still
+// given interleaved, position first, and split into the streams by the geometry pool. Cached like
+// VertexFormatCombine. Returns kNoVertexFormat if the format does not start with a position
+TVertexFormat VertexFormatSeparatePositions( TVertexFormat format );
+
+// Register a format with just the slot 0 elements of another - the position stream of a format
+// with separate positions. Layouts for position-only shaders made from it read only that stream
+TVertexFormat VertexFormatPositionsOnly( TVertexFormat format );
+
+
+//-----------------------------------------------------------------------------
+// Input layout cache
+//-----------------------------------------------------------------------------
+
+// Input layouts for each pair of vertex format and shader input signature, created the first time
+// the pair is used and shared from then on. Techniques whose vertex shaders take the same input
+// share layouts even if they are different shaders, since the signature is compared by contents.
+// Lookup hashes the signature, so fetch a layout once per draw batch rather than once per draw.
+// Not thread-safe, use from the thread that creates resources
+class CInputLayoutCache
+{
+public:
+	CInputLayoutCache() {}
+	~CInputLayoutCache()
+	{
+		Release();
+	}
+
+	// Layout for a format and the input signature of a technique's first pass. Returns 0 if the
+	// layout cannot be created (the format does not provide what the shader needs)
+	ID3D11InputLayout* Layout( TVertexFormat format, ID3DX11EffectTechnique* technique );
+	ID3D11InputLayout* Layout( TVertexFormat format, const void* signature, SIZE_T signatureSize );
+
+	// Release all layouts, pointers returned earlier become invalid
+	void Release();
+
+	// Number of layouts created
+	unsigned int NumLayouts() const
+	{
+		return static_cast<unsigned int>(m_Layouts.size());
+	}
+
+private:
+	// Disallow use of copy constructor and assignment operator (private and not defined)
+	CInputLayoutCache( const CInputLayoutCache& );
+	CInputLayoutCache& operator=( const CInputLayoutCache& );
+
+	// A layout with the signature it was created for, kept to rule out hash collisions
+	struct SLayout
+	{
+		vector<unsigned char> signature;
+		ID3D11InputLayout*    layout;
+	};
+
+	// Keyed by format and signature hash
+	typedef pair<TVertexFormat, unsigned int> TLayoutKey;
+	multimap<TLayoutKey, SLayout> m_Layouts;
+};
+
+// Cache used for all rendering
+extern CInputLayoutCache InputLayouts;